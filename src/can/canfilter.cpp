@@ -0,0 +1,181 @@
+#include "can/canfilter.h"
+
+#define STANDARD_ID_BITS 11
+#define EXTENDED_ID_BITS 29
+
+using openxc::can::filter::AcceptanceFilterRange;
+using openxc::can::filter::AcceptanceFilterMask;
+
+/* Private: Copy the IDs of a bus's acceptance filters in one format into an
+ * array, sorted in ascending order.
+ *
+ * Returns the number of IDs copied.
+ */
+static int collectFilterIds(CanBus* bus, CanMessageFormat format,
+        uint32_t ids[]) {
+    int count = 0;
+    AcceptanceFilterListEntry* entry;
+    LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
+        if(entry->format != format || count >= MAX_ACCEPTANCE_FILTERS) {
+            continue;
+        }
+
+        // The list is short and unsorted, so an insertion sort is plenty
+        int i = count++;
+        for(; i > 0 && ids[i - 1] > entry->filter; --i) {
+            ids[i] = ids[i - 1];
+        }
+        ids[i] = entry->filter;
+    }
+    return count;
+}
+
+/* Private: Append the runs of consecutive IDs in a sorted array to an array of
+ * ranges.
+ *
+ * Returns the new number of ranges.
+ */
+static int appendRuns(const uint32_t ids[], int idCount,
+        CanMessageFormat format, AcceptanceFilterRange ranges[],
+        int rangeCount) {
+    for(int i = 0; i < idCount; i++) {
+        if(i > 0 && ids[i] <= ranges[rangeCount - 1].upper + 1) {
+            ranges[rangeCount - 1].upper = ids[i];
+        } else {
+            ranges[rangeCount].lower = ids[i];
+            ranges[rangeCount].upper = ids[i];
+            ranges[rangeCount].format = format;
+            ++rangeCount;
+        }
+    }
+    return rangeCount;
+}
+
+/* Private: Return the number of groups a sorted array of IDs falls into when
+ * the given number of low bits of each ID are ignored.
+ */
+static int countMaskGroups(const uint32_t ids[], int idCount, int ignoredBits) {
+    int groupCount = 0;
+    for(int i = 0; i < idCount; i++) {
+        if(i == 0 || (ids[i] >> ignoredBits) != (ids[i - 1] >> ignoredBits)) {
+            ++groupCount;
+        }
+    }
+    return groupCount;
+}
+
+/* Private: Append the value and mask pairs for a sorted array of IDs, grouped
+ * by ignoring the given number of low bits of each ID.
+ *
+ * Returns the new number of pairs.
+ */
+static int appendMaskGroups(const uint32_t ids[], int idCount, int ignoredBits,
+        CanMessageFormat format, AcceptanceFilterMask masks[], int maskCount) {
+    uint32_t fullMask = openxc::can::filter::fullFilterMask(format);
+    uint32_t groupMask = fullMask & ~((1u << ignoredBits) - 1);
+    int i = 0;
+    while(i < idCount) {
+        int groupEnd = i + 1;
+        while(groupEnd < idCount &&
+                (ids[groupEnd] >> ignoredBits) == (ids[i] >> ignoredBits)) {
+            ++groupEnd;
+        }
+
+        AcceptanceFilterMask* mask = &masks[maskCount++];
+        mask->format = format;
+        if(groupEnd - i == 1) {
+            mask->value = ids[i];
+            mask->mask = fullMask;
+        } else {
+            mask->value = ids[i] & groupMask;
+            mask->mask = groupMask;
+        }
+        i = groupEnd;
+    }
+    return maskCount;
+}
+
+uint32_t openxc::can::filter::fullFilterMask(CanMessageFormat format) {
+    return format == CanMessageFormat::STANDARD ?
+            (1u << STANDARD_ID_BITS) - 1 : (1u << EXTENDED_ID_BITS) - 1;
+}
+
+int openxc::can::filter::compileRanges(CanBus* bus,
+        AcceptanceFilterRange ranges[], int maxRangeCount) {
+    static uint32_t ids[MAX_ACCEPTANCE_FILTERS];
+    static AcceptanceFilterRange compiled[MAX_ACCEPTANCE_FILTERS * 2];
+
+    int rangeCount = appendRuns(ids,
+            collectFilterIds(bus, CanMessageFormat::STANDARD, ids),
+            CanMessageFormat::STANDARD, compiled, 0);
+    rangeCount = appendRuns(ids,
+            collectFilterIds(bus, CanMessageFormat::EXTENDED, ids),
+            CanMessageFormat::EXTENDED, compiled, rangeCount);
+
+    while(rangeCount > maxRangeCount) {
+        int closest = -1;
+        uint32_t smallestGap = 0;
+        for(int i = 0; i < rangeCount - 1; i++) {
+            if(compiled[i].format != compiled[i + 1].format) {
+                continue;
+            }
+
+            uint32_t gap = compiled[i + 1].lower - compiled[i].upper;
+            if(closest == -1 || gap < smallestGap) {
+                closest = i;
+                smallestGap = gap;
+            }
+        }
+
+        if(closest == -1) {
+            return -1;
+        }
+
+        compiled[closest].upper = compiled[closest + 1].upper;
+        for(int i = closest + 1; i < rangeCount - 1; i++) {
+            compiled[i] = compiled[i + 1];
+        }
+        --rangeCount;
+    }
+
+    memcpy(ranges, compiled, sizeof(AcceptanceFilterRange) * rangeCount);
+    return rangeCount;
+}
+
+int openxc::can::filter::compileMasks(CanBus* bus, AcceptanceFilterMask masks[],
+        int maxMaskCount) {
+    static uint32_t standardIds[MAX_ACCEPTANCE_FILTERS];
+    static uint32_t extendedIds[MAX_ACCEPTANCE_FILTERS];
+
+    int standardCount = collectFilterIds(bus, CanMessageFormat::STANDARD,
+            standardIds);
+    int extendedCount = collectFilterIds(bus, CanMessageFormat::EXTENDED,
+            extendedIds);
+
+    // Ignore more low bits of whichever format has the most groups, so the
+    // coarser grouping goes where it saves the most entries.
+    int standardBits = 0, extendedBits = 0;
+    int standardGroups = countMaskGroups(standardIds, standardCount, 0);
+    int extendedGroups = countMaskGroups(extendedIds, extendedCount, 0);
+    while(standardGroups + extendedGroups > maxMaskCount) {
+        bool canGrowStandard = standardGroups > 1 &&
+                standardBits < STANDARD_ID_BITS;
+        bool canGrowExtended = extendedGroups > 1 &&
+                extendedBits < EXTENDED_ID_BITS;
+        if(canGrowStandard && (!canGrowExtended ||
+                    standardGroups >= extendedGroups)) {
+            standardGroups = countMaskGroups(standardIds, standardCount,
+                    ++standardBits);
+        } else if(canGrowExtended) {
+            extendedGroups = countMaskGroups(extendedIds, extendedCount,
+                    ++extendedBits);
+        } else {
+            return -1;
+        }
+    }
+
+    int maskCount = appendMaskGroups(standardIds, standardCount, standardBits,
+            CanMessageFormat::STANDARD, masks, 0);
+    return appendMaskGroups(extendedIds, extendedCount, extendedBits,
+            CanMessageFormat::EXTENDED, masks, maskCount);
+}
@@ -0,0 +1,89 @@
+#ifndef _CANFILTER_H_
+#define _CANFILTER_H_
+
+#include "can/canutil.h"
+
+namespace openxc {
+namespace can {
+namespace filter {
+
+/* Public: A contiguous, inclusive range of CAN message IDs to accept, fit for
+ * an explicit (when lower == upper) or group entry in a hardware acceptance
+ * filter table.
+ *
+ * lower - the lowest message ID in the range.
+ * upper - the highest message ID in the range.
+ * format - the format of all IDs in the range.
+ */
+struct AcceptanceFilterRange {
+    uint32_t lower;
+    uint32_t upper;
+    CanMessageFormat format;
+};
+
+/* Public: A value and mask pair to accept CAN message IDs, fit for a filter
+ * and mask register pair in a CAN controller. An ID matches if
+ * (id & mask) == (value & mask).
+ *
+ * value - the ID to match against.
+ * mask - the bits of the ID that must match value. When this is the full
+ *      mask for the format (see fullFilterMask), only one ID matches.
+ * format - the format of the IDs to match.
+ */
+struct AcceptanceFilterMask {
+    uint32_t value;
+    uint32_t mask;
+    CanMessageFormat format;
+};
+
+/* Public: Return the mask that matches every bit of a message ID in the given
+ * format, i.e. 0x7ff for standard and 0x1fffffff for extended IDs.
+ */
+uint32_t fullFilterMask(CanMessageFormat format);
+
+/* Public: Compile the acceptance filters of a CAN bus into the fewest ranges of
+ * message IDs that will fit in a hardware acceptance filter table.
+ *
+ * Consecutive IDs of the same format are always combined into a single range.
+ * If there are still more than maxRangeCount ranges, the two neighbouring
+ * ranges with the smallest gap between them are merged until they fit. The
+ * merged ranges will also accept the IDs in those gaps, so the software
+ * acceptance filter (see shouldAcceptMessage) must drop the false accepts.
+ *
+ * bus - The CanBus whose acceptanceFilters list should be compiled.
+ * ranges - An output array for the compiled ranges, sorted by format and then
+ *      by ID.
+ * maxRangeCount - The number of ranges available in the ranges array, i.e.
+ *      the number of entries available in the hardware table for this bus.
+ *
+ * Returns the number of ranges written to the array, or -1 if the filters
+ * could not be compiled to fit (e.g. maxRangeCount is 1 but the bus has both
+ * standard and extended filters).
+ */
+int compileRanges(CanBus* bus, AcceptanceFilterRange ranges[],
+        int maxRangeCount);
+
+/* Public: Compile the acceptance filters of a CAN bus into the fewest value
+ * and mask pairs that will fit in a CAN controller's filter registers.
+ *
+ * Filters are grouped by ignoring an increasing number of the least
+ * significant bits of their IDs until the groups fit in maxMaskCount. A group
+ * with a single ID is given the full mask, so it matches only that ID, and all
+ * larger groups of the same format share one mask - so at most 2 masks are
+ * needed per format. Like compileRanges, the software acceptance filter must
+ * drop the false accepts of the larger groups.
+ *
+ * bus - The CanBus whose acceptanceFilters list should be compiled.
+ * masks - An output array for the compiled value and mask pairs.
+ * maxMaskCount - The number of pairs available in the masks array.
+ *
+ * Returns the number of pairs written to the array, or -1 if the filters could
+ * not be compiled to fit.
+ */
+int compileMasks(CanBus* bus, AcceptanceFilterMask masks[], int maxMaskCount);
+
+} // namespace filter
+} // namespace can
+} // namespace openxc
+
+#endif // _CANFILTER_H_
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <canutil/read.h>
+#include <bitfield/bitfield.h>
 #include <pb_encode.h>
 #include "can/canread.h"
 #include "config.h"
@@ -11,6 +12,7 @@ using openxc::pipeline::MessageClass;
 using openxc::pipeline::Pipeline;
 using openxc::config::getConfiguration;
 using openxc::pipeline::publish;
+using openxc::can::read::MessageDecoder;
 
 namespace pipeline = openxc::pipeline;
 namespace time = openxc::util::time;
@@ -22,6 +24,17 @@ float openxc::can::read::parseSignalBitfield(CanSignal* signal,
             signal->offset);
 }
 
+uint64_t openxc::can::read::parseSignalBitfieldRaw(const CanSignal* signal,
+        const CanMessage* message) {
+    return get_bitfield(message->data, CAN_MESSAGE_SIZE,
+            signal->bitPosition, signal->bitSize);
+}
+
+float openxc::can::read::scaleSignalValue(const CanSignal* signal,
+        uint64_t rawValue) {
+    return rawValue * signal->factor + signal->offset;
+}
+
 openxc_DynamicField openxc::can::read::noopDecoder(CanSignal* signal,
         CanSignal* signals, int signalCount, Pipeline* pipeline, float value,
         bool* send) {
@@ -69,6 +82,23 @@ static void buildBaseSimpleVehicleMessage(openxc_VehicleMessage* message,
     strcpy(message->simple_message.name, name);
 }
 
+/* Private: Publish the decoded value of a signal, letting the pipeline check
+ * the interfaces' subscriptions by the signal's index rather than its name.
+ */
+static void publishSignalValue(CanSignal* signal, openxc_DynamicField* value,
+        CanSignal* signals, int signalCount, Pipeline* pipeline) {
+    openxc_VehicleMessage message = {0};
+    buildBaseSimpleVehicleMessage(&message, signal->genericName);
+    message.simple_message.has_value = true;
+    message.simple_message.value = *value;
+
+    int signalIndex = -1;
+    if(signals != NULL && signal >= signals && signal < signals + signalCount) {
+        signalIndex = signal - signals;
+    }
+    pipeline::publishSignal(&message, signalIndex, pipeline);
+}
+
 void openxc::can::read::publishVehicleMessage(const char* name,
         openxc_DynamicField* value, openxc_DynamicField* event,
         openxc::pipeline::Pipeline* pipeline) {
@@ -172,34 +202,260 @@ void openxc::can::read::passthroughMessage(CanBus* bus, CanMessage* message,
     }
 }
 
+/* Private: Read a CAN message payload as a big-endian 64-bit integer, so bit 0
+ * of the signal bit numbering is its most significant bit.
+ */
+static uint64_t payloadBits(const uint8_t data[]) {
+    uint64_t bits = 0;
+    for(int i = 0; i < CAN_MESSAGE_SIZE; i++) {
+        bits = (bits << 8) | data[i];
+    }
+    return bits;
+}
+
+/* Private: Return the bits of a signal in a payload read with payloadBits,
+ * calculating them the first time.
+ */
+static uint64_t signalBitMask(CanSignal* signal) {
+    if(signal->bitMask == 0) {
+        int endBit = signal->bitPosition + signal->bitSize;
+        if(signal->bitSize == 0 || endBit > CAN_MESSAGE_SIZE * 8) {
+            // Not a valid bitfield - always treat it as changed
+            signal->bitMask = ~0ULL;
+        } else {
+            uint64_t fieldMask = signal->bitSize == 64 ?
+                    ~0ULL : (1ULL << signal->bitSize) - 1;
+            signal->bitMask = fieldMask << (CAN_MESSAGE_SIZE * 8 - endBit);
+        }
+    }
+    return signal->bitMask;
+}
+
+/* Private: Returns true if the signal has been received before and none of its
+ * bits have changed in this message, according to the changes tracked for its
+ * message definition.
+ */
+static bool signalUnchanged(CanSignal* signal, const CanMessage* message) {
+    CanMessageDefinition* definition = signal->message;
+    return signal->received && definition != NULL &&
+            definition->changesTracked &&
+            !memcmp(definition->decodedValue, message->data,
+                CAN_MESSAGE_SIZE) &&
+            (definition->changedBits & signalBitMask(signal)) == 0;
+}
+
+void openxc::can::read::trackMessageChanges(CanMessageDefinition* definition,
+        const CanMessage* message) {
+    if(definition->changesTracked) {
+        definition->changedBits = payloadBits(definition->decodedValue) ^
+                payloadBits(message->data);
+    } else {
+        definition->changedBits = ~0ULL;
+    }
+    memcpy(definition->decodedValue, message->data, CAN_MESSAGE_SIZE);
+    definition->changesTracked = true;
+}
+
 void openxc::can::read::translateSignal(CanSignal* signal,
         const CanMessage* message,
         CanSignal* signals, int signalCount,
         openxc::pipeline::Pipeline* pipeline) {
+#ifdef __INTEGER_SIGNAL_DECODING__
+    translateSignalRaw(signal, message, signals, signalCount, pipeline);
+#else
     if(signal == NULL || message == NULL) {
         return;
     }
 
-    float value = parseSignalBitfield(signal, message);
+    bool unchanged = signalUnchanged(signal, message);
+    float value = unchanged ? signal->lastValue :
+            parseSignalBitfield(signal, message);
 
     bool send = true;
+    if(unchanged && signal->decoder == NULL) {
+        // The default decoder has no side effects, so there's no need to call
+        // it for the same value unless it's going to be sent again.
+        if(shouldSend(signal, value)) {
+            openxc_DynamicField decodedValue = payload::wrapNumber(value);
+            publishSignalValue(signal, &decodedValue, signals, signalCount,
+                    pipeline);
+        }
+        return;
+    }
+
     // Must call the decoders every time, regardless of if we are going to
     // decide to send the signal or not.
     openxc_DynamicField decodedValue = openxc::can::read::decodeSignal(signal,
             value, signals, signalCount, &send);
     if(send && shouldSend(signal, value)) {
-        openxc::can::read::publishVehicleMessage(signal->genericName, &decodedValue, pipeline);
+        publishSignalValue(signal, &decodedValue, signals, signalCount,
+                pipeline);
     }
     signal->received = true;
     signal->lastValue = value;
+#endif
 }
 
-bool openxc::can::read::shouldSend(CanSignal* signal, float value) {
+#ifdef __RAW_SIGNAL_DECODING__
+void openxc::can::read::translateSignalRaw(CanSignal* signal,
+        const CanMessage* message,
+        CanSignal* signals, int signalCount,
+        openxc::pipeline::Pipeline* pipeline) {
+    if(signal == NULL || message == NULL) {
+        return;
+    }
+
+    bool unchanged = signalUnchanged(signal, message);
+    uint64_t rawValue = unchanged ? signal->lastRawValue :
+            parseSignalBitfieldRaw(signal, message);
+    // Scaling is the only floating point math left, so only do it when the
+    // value has actually changed.
+    float value = signal->received && rawValue == signal->lastRawValue ?
+            signal->lastValue : scaleSignalValue(signal, rawValue);
+
+    bool send = true;
+    openxc_DynamicField decodedValue = {0};
+    if(signal->decoder != NULL) {
+        // Must call custom decoders every time, regardless of if we are going
+        // to decide to send the signal or not.
+        decodedValue = decodeSignal(signal, value, signals, signalCount, &send);
+    }
+
+    if(send && shouldSendRaw(signal, rawValue)) {
+        if(signal->decoder == NULL) {
+            decodedValue = payload::wrapNumber(value);
+        }
+        publishSignalValue(signal, &decodedValue, signals, signalCount,
+                pipeline);
+    }
+    signal->received = true;
+    signal->lastValue = value;
+    signal->lastRawValue = rawValue;
+}
+#endif
+
+/* Private: Order a decoder table row against a message key, by bus address,
+ * then format and then ID.
+ *
+ * Returns a negative number if the row sorts before the key, 0 if it matches
+ * and a positive number if it sorts after.
+ */
+static int compareDecoder(const MessageDecoder* decoder, uint8_t busAddress,
+        CanMessageFormat format, uint32_t id) {
+    if(decoder->busAddress != busAddress) {
+        return decoder->busAddress < busAddress ? -1 : 1;
+    } else if(decoder->format != format) {
+        return (int)decoder->format < (int)format ? -1 : 1;
+    } else if(decoder->id != id) {
+        return decoder->id < id ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Private: Binary search a sorted decoder table for the first row that doesn't
+ * sort before a message key.
+ *
+ * Returns the index of the row, or decoderCount if there isn't one.
+ */
+static int lowerBoundDecoder(const MessageDecoder decoders[],
+        int decoderCount, uint8_t busAddress, CanMessageFormat format,
+        uint32_t id) {
+    int lower = 0, upper = decoderCount;
+    while(lower < upper) {
+        int middle = lower + (upper - lower) / 2;
+        if(compareDecoder(&decoders[middle], busAddress, format, id) < 0) {
+            lower = middle + 1;
+        } else {
+            upper = middle;
+        }
+    }
+    return lower;
+}
+
+int openxc::can::read::buildMessageDecoders(CanSignal* signals,
+        int signalCount, MessageDecoder decoders[], int maxDecoderCount) {
+    int decoderCount = 0;
+    int current = -1;
+    for(int i = 0; i < signalCount; i++) {
+        CanMessageDefinition* definition = signals[i].message;
+        if(definition == NULL || definition->bus == NULL) {
+            continue;
+        }
+
+        if(current != -1 && signals[i - 1].message == definition) {
+            // Generated signals are grouped by message, so this is the common
+            // case - one row covers all of them.
+            ++decoders[current].signalCount;
+            continue;
+        }
+
+        if(decoderCount >= maxDecoderCount) {
+            return -1;
+        }
+
+        // Insert after any existing rows for the same message, so their
+        // signals are still translated in the order they were defined.
+        current = decoderCount++;
+        for(; current > 0 && compareDecoder(&decoders[current - 1],
+                    definition->bus->address, definition->format,
+                    definition->id) > 0; --current) {
+            decoders[current] = decoders[current - 1];
+        }
+        decoders[current] = {0};
+        decoders[current].busAddress = definition->bus->address;
+        decoders[current].id = definition->id;
+        decoders[current].format = definition->format;
+        decoders[current].signalIndex = i;
+        decoders[current].signalCount = 1;
+    }
+    return decoderCount;
+}
+
+MessageDecoder* openxc::can::read::lookupMessageDecoder(
+        MessageDecoder decoders[], int decoderCount, CanBus* bus, uint32_t id,
+        CanMessageFormat format) {
+    int row = lowerBoundDecoder(decoders, decoderCount, bus->address, format,
+            id);
+    if(row < decoderCount &&
+            compareDecoder(&decoders[row], bus->address, format, id) == 0) {
+        return &decoders[row];
+    }
+    return NULL;
+}
+
+bool openxc::can::read::dispatchMessage(const MessageDecoder decoders[],
+        int decoderCount, CanBus* bus, CanMessage* message, CanSignal* signals,
+        int signalCount, Pipeline* pipeline) {
+    bool found = false;
+    for(int row = lowerBoundDecoder(decoders, decoderCount, bus->address,
+                message->format, message->id);
+            row < decoderCount && compareDecoder(&decoders[row], bus->address,
+                message->format, message->id) == 0;
+            row++) {
+        const MessageDecoder* decoder = &decoders[row];
+        int signalEnd = decoder->signalIndex + decoder->signalCount;
+        for(int i = decoder->signalIndex; i < signalEnd && i < signalCount;
+                i++) {
+            translateSignal(&signals[i], message, signals, signalCount,
+                    pipeline);
+        }
+
+        if(decoder->handler != NULL) {
+            decoder->handler(message, signals, signalCount, pipeline);
+        }
+        found = true;
+    }
+    return found;
+}
+
+/* Private: Decide if a signal should be published, given whether its value has
+ * changed since it was last received.
+ */
+static bool shouldSendChange(CanSignal* signal, bool changed) {
     bool send = true;
     if(time::conditionalTick(&signal->frequencyClock) ||
-            (value != signal->lastValue && signal->forceSendChanged)) {
-        if(signal->received && !signal->sendSame
-                && value == signal->lastValue) {
+            (changed && signal->forceSendChanged)) {
+        if(signal->received && !signal->sendSame && !changed) {
             send = false;
         }
     } else {
@@ -208,6 +464,16 @@ bool openxc::can::read::shouldSend(CanSignal* signal, float value) {
     return send;
 }
 
+bool openxc::can::read::shouldSend(CanSignal* signal, float value) {
+    return shouldSendChange(signal, value != signal->lastValue);
+}
+
+#ifdef __RAW_SIGNAL_DECODING__
+bool openxc::can::read::shouldSendRaw(CanSignal* signal, uint64_t rawValue) {
+    return shouldSendChange(signal, rawValue != signal->lastRawValue);
+}
+#endif
+
 openxc_DynamicField openxc::can::read::decodeSignal(CanSignal* signal,
         float value, CanSignal* signals, int signalCount, bool* send) {
     SignalDecoder decoder = signal->decoder == NULL ?
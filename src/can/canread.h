@@ -5,10 +5,105 @@
 #include "pipeline.h"
 #include "openxc.pb.h"
 
+#ifndef MAX_MESSAGE_DECODERS
+// The maximum number of rows in a table-driven message decoder - at least one
+// per CAN message with signals in the active message set.
+#define MAX_MESSAGE_DECODERS 128
+#endif
+
 namespace openxc {
 namespace can {
 namespace read {
 
+/* Public: The type signature of a custom handler for a CAN message, called
+ * after all of the message's signals have been translated.
+ *
+ * message - The received CAN message.
+ * signals - The list of all signals.
+ * signalCount - The length of the signals array.
+ * pipeline - The pipeline that wraps the output devices.
+ */
+typedef void (*MessageHandler)(CanMessage* message, CanSignal* signals,
+        int signalCount, openxc::pipeline::Pipeline* pipeline);
+
+/* Public: One row of a table-driven CAN message decoder, mapping a message on
+ * a bus to the range of its signals in the signals array.
+ *
+ * A table of these sorted by bus address, format and ID (see
+ * buildMessageDecoders) replaces the nested switches of a generated
+ * openxc::signals::decodeCanMessage.
+ *
+ * busAddress - The address of the bus the message is received on.
+ * id - The ID of the message.
+ * format - The format of the message's ID.
+ * signalIndex - The index of the message's first signal in the signals array.
+ * signalCount - The number of consecutive signals from signalIndex to
+ *      translate.
+ * handler - An optional custom handler for the message, or NULL.
+ */
+struct MessageDecoder {
+    uint8_t busAddress;
+    uint32_t id;
+    CanMessageFormat format;
+    uint16_t signalIndex;
+    uint16_t signalCount;
+    MessageHandler handler;
+};
+typedef struct MessageDecoder MessageDecoder;
+
+/* Public: Build a decoder table from an array of signals, one row for each run
+ * of consecutive signals from the same CAN message, sorted for
+ * dispatchMessage.
+ *
+ * The table only refers to signals by their index, so it can be rebuilt at
+ * runtime when the active message set changes without any generated code.
+ * Rows have no handler - add them with lookupMessageDecoder afterwards.
+ *
+ * signals - The list of all signals.
+ * signalCount - The length of the signals array.
+ * decoders - An output array for the table.
+ * maxDecoderCount - The number of rows available in the decoders array.
+ *
+ * Returns the number of rows written to the table, or -1 if it didn't fit.
+ */
+int buildMessageDecoders(CanSignal* signals, int signalCount,
+        MessageDecoder decoders[], int maxDecoderCount);
+
+/* Public: Find the first row of a sorted decoder table for a CAN message.
+ *
+ * decoders - The decoder table, sorted by buildMessageDecoders.
+ * decoderCount - The length of the decoders array.
+ * bus - The bus the message is received on.
+ * id - The ID of the message.
+ * format - The format of the message's ID.
+ *
+ * Returns a pointer to the row, or NULL if the message isn't in the table.
+ */
+MessageDecoder* lookupMessageDecoder(MessageDecoder decoders[],
+        int decoderCount, CanBus* bus, uint32_t id, CanMessageFormat format);
+
+/* Public: Decode a received CAN message with a decoder table - a binary search
+ * for the message's rows, then translateSignal for each signal in their ranges
+ * and a call to their custom handlers.
+ *
+ * This is a generic, data-driven alternative to a generated
+ * openxc::signals::decodeCanMessage with a cost that only grows with the log
+ * of the number of messages.
+ *
+ * decoders - The decoder table, sorted by buildMessageDecoders.
+ * decoderCount - The length of the decoders array.
+ * bus - The bus the message was received on.
+ * message - The received message.
+ * signals - The list of all signals the table was built from.
+ * signalCount - The length of the signals array.
+ * pipeline - The pipeline to publish the signals' values.
+ *
+ * Returns true if the message was in the table.
+ */
+bool dispatchMessage(const MessageDecoder decoders[], int decoderCount,
+        CanBus* bus, CanMessage* message, CanSignal* signals, int signalCount,
+        openxc::pipeline::Pipeline* pipeline);
+
 /* Public: Parse a signal from a CAN message, apply any required transforations
  *      to get a human readable value and public the result to the pipeline.
  *
@@ -30,6 +125,40 @@ void translateSignal(CanSignal* signal,
         const CanMessage* message, CanSignal* signals, int signalCount,
         openxc::pipeline::Pipeline* pipeline);
 
+/* Public: Record which bits of a message definition's payload changed in a
+ *      newly received CAN message, before decoding its signals.
+ *
+ * translateSignal() and translateSignalRaw() skip parsing signals whose bits
+ * haven't changed, and reuse their last value instead. The sendSame and
+ * frequency settings of each signal still apply. This relies on every signal
+ * in the message being translated for every received message, like the
+ * generated decodeCanMessage does.
+ *
+ * definition - The definition of the received message.
+ * message - The received message, which is about to be decoded.
+ */
+void trackMessageChanges(CanMessageDefinition* definition,
+        const CanMessage* message);
+
+#ifdef __RAW_SIGNAL_DECODING__
+/* Public: Parse a signal from a CAN message and publish it like
+ *      translateSignal(), but keep the value as a raw integer until it's
+ *      needed.
+ *
+ * Change detection and the sendSame and forceSendChanged checks compare the raw
+ * bitfields, and the factor and offset are only applied when the raw value
+ * changes, so signals that repeat the same value don't need any floating point
+ * math. Unless the signal has a custom decoder, the value isn't decoded unless
+ * it's going to be published. This is what translateSignal() uses when the
+ * firmware is compiled with INTEGER_SIGNAL_DECODING=1.
+ *
+ * The arguments are the same as translateSignal().
+ */
+void translateSignalRaw(CanSignal* signal,
+        const CanMessage* message, CanSignal* signals, int signalCount,
+        openxc::pipeline::Pipeline* pipeline);
+#endif
+
 /* Public: Publish a CAN message to the pipeline without any parsing or
  * processing - just encapsulate it in a VehicleMessage.
  *
@@ -199,6 +328,24 @@ openxc_DynamicField noopDecoder(CanSignal* signal, CanSignal* signals,
  */
 float parseSignalBitfield(CanSignal* signal, const CanMessage* message);
 
+/* Public: Parse the signal's bitfield from the given message without applying
+ * the signal's factor or offset.
+ *
+ * signal - The signal to parse from the message.
+ * message - The message to parse the signal from.
+ *
+ * Returns the unscaled integer value of the signal's bitfield.
+ */
+uint64_t parseSignalBitfieldRaw(const CanSignal* signal,
+        const CanMessage* message);
+
+/* Public: Apply a signal's factor and offset to a raw value parsed with
+ * parseSignalBitfieldRaw().
+ *
+ * Returns the same value parseSignalBitfield() would have for the message.
+ */
+float scaleSignalValue(const CanSignal* signal, uint64_t rawValue);
+
 /* Public: Parse a signal from a CAN message and apply any required
  * transforations to get a human readable value.
  *
@@ -241,6 +388,15 @@ openxc_DynamicField decodeSignal(CanSignal* signal, float value,
  */
 bool shouldSend(CanSignal* signal, float value);
 
+#ifdef __RAW_SIGNAL_DECODING__
+/* Public: The same as shouldSend(), but compares the raw bitfield value of the
+ * signal with its lastRawValue instead of the scaled value.
+ *
+ * Returns true of the value should be published.
+ */
+bool shouldSendRaw(CanSignal* signal, uint64_t rawValue);
+#endif
+
 } // namespace read
 } // namespace can
 } // namespace openxc
@@ -1,3 +1,4 @@
+#include <math.h>
 #include "can/canutil.h"
 #include "can/canwrite.h"
 #include "util/log.h"
@@ -6,6 +7,11 @@
 #define BUS_STATS_LOG_FREQUENCY_S 15
 #define CAN_MESSAGE_TOTAL_BIT_SIZE 128
 
+// The most decimal places calculated for a signal from its factor and offset
+#ifndef MAX_SIGNAL_PRECISION
+#define MAX_SIGNAL_PRECISION 6
+#endif
+
 namespace time = openxc::util::time;
 namespace statistics = openxc::util::statistics;
 namespace config = openxc::config;
@@ -19,6 +25,8 @@ void openxc::can::initializeCommon(CanBus* bus) {
     debug("Initializing CAN node %d...", bus->address);
     QUEUE_INIT(CanMessage, &bus->receiveQueue);
     QUEUE_INIT(CanMessage, &bus->sendQueue);
+    memset(&bus->receiveQueueMetrics, 0, sizeof(bus->receiveQueueMetrics));
+    memset(&bus->sendQueueMetrics, 0, sizeof(bus->sendQueueMetrics));
 
     LIST_INIT(&bus->acceptanceFilters);
     LIST_INIT(&bus->freeAcceptanceFilters);
@@ -26,6 +34,10 @@ void openxc::can::initializeCommon(CanBus* bus) {
         LIST_INSERT_HEAD(&bus->freeAcceptanceFilters,
                 &bus->acceptanceFilterEntries[i], entries);
     }
+    memset(bus->standardFilters, 0, sizeof(bus->standardFilters));
+    memset(bus->extendedFilters, 0xff, sizeof(bus->extendedFilters));
+    bus->extendedFilterCount = 0;
+    bus->acceptanceFiltersChanged = false;
 
     bus->writeHandler = openxc::can::write::sendMessage;
     bus->lastMessageReceived = 0;
@@ -35,6 +47,10 @@ void openxc::can::initializeCommon(CanBus* bus) {
         LIST_INSERT_HEAD(&bus->freeMessageDefinitions,
                 &bus->definitionEntries[i], entries);
     }
+    bus->indexedMessages = NULL;
+    bus->indexedMessageCount = 0;
+    bus->messageIndexComplete = true;
+    memset(bus->messageIndex, 0xff, sizeof(bus->messageIndex));
 
     statistics::initialize(&bus->totalMessageStats);
     statistics::initialize(&bus->droppedMessageStats);
@@ -42,6 +58,9 @@ void openxc::can::initializeCommon(CanBus* bus) {
     statistics::initialize(&bus->receivedDataStats);
     statistics::initialize(&bus->sendQueueStats);
     statistics::initialize(&bus->receiveQueueStats);
+    statistics::initialize(&bus->receiveBatchStats);
+    statistics::initialize(&bus->receiveQueueLatency);
+    statistics::initialize(&bus->processLatency);
 }
 
 void openxc::can::destroy(CanBus* bus) {
@@ -94,6 +113,33 @@ const CanSignalState* openxc::can::lookupSignalState(int value,
     }
 }
 
+/* Private: Return the number of decimal places needed to write a number
+ * exactly, to within float rounding, up to MAX_SIGNAL_PRECISION.
+ */
+static int decimalPlaces(float value) {
+    float scaled = fabs(value);
+    int places = 0;
+    while(places < MAX_SIGNAL_PRECISION &&
+            fabs(scaled - floor(scaled + 0.5)) > 1e-6 * MAX(scaled, 1)) {
+        scaled *= 10;
+        ++places;
+    }
+    return places;
+}
+
+int openxc::can::signalPrecision(CanSignal* signal) {
+    if(signal->decoder != NULL) {
+        return -1;
+    }
+
+    if(signal->precision == 0) {
+        int places = MAX(decimalPlaces(signal->factor),
+                decimalPlaces(signal->offset));
+        signal->precision = places > 0 ? places : -1;
+    }
+    return signal->precision > 0 ? signal->precision : 0;
+}
+
 static bool signalComparator(void* name, int index, void* signals) {
     return !strcmp((const char*)name, ((CanSignal*)signals)[index].genericName);
 }
@@ -154,27 +200,202 @@ static CanMessageDefinition* lookupMessage(CanBus* bus, uint32_t id,
         CanMessageDefinition* messages, int messageCount) {
     CanMessageDefinition* message = NULL;
     for(int i = 0; i < messageCount; i++) {
-        if(messages[i].bus == bus && messages[i].id == id) {
+        if(messages[i].bus == bus && messages[i].id == id &&
+                messages[i].format == format) {
             message = &messages[i];
         }
     }
     return message;
 }
 
+static CanMessageDefinition* lookupDynamicMessage(CanBus* bus, uint32_t id,
+        CanMessageFormat format) {
+    CanMessageDefinitionListEntry* entry;
+    LIST_FOREACH(entry, &bus->dynamicMessages, entries) {
+        if(entry->definition.id == id && entry->definition.format == format) {
+            return &entry->definition;
+        }
+    }
+    return NULL;
+}
+
+#define MESSAGE_INDEX_EMPTY CAN_MESSAGE_INDEX_EMPTY
+#define MESSAGE_INDEX_DYNAMIC_FLAG CAN_MESSAGE_INDEX_DYNAMIC_FLAG
+#define MESSAGE_INDEX_MASK (CAN_MESSAGE_INDEX_SIZE - 1)
+
+/* Private: Hash a CAN message ID for an open-addressed table.
+ *
+ * The ID bits are mixed so that extended IDs that differ only in their upper
+ * bytes (e.g. J1939 PGNs from the same source address) are spread out.
+ */
+static uint32_t hashCanId(uint32_t id) {
+    uint32_t hash = (id ^ (id >> 16)) * 0x45d9f3b;
+    return hash ^ (hash >> 16);
+}
+
+/* Private: Return the preferred slot in a bus's message index for a message.
+ */
+static int messageIndexSlot(uint32_t id, CanMessageFormat format) {
+    return hashCanId(id ^ ((uint32_t)format << 31)) & MESSAGE_INDEX_MASK;
+}
+
+/* Private: Return the message definition referred to by an entry in a bus's
+ * message index.
+ */
+static CanMessageDefinition* indexedDefinition(CanBus* bus,
+        CanMessageIndexEntry entry) {
+    if(entry & MESSAGE_INDEX_DYNAMIC_FLAG) {
+        return &bus->definitionEntries[
+                entry & ~MESSAGE_INDEX_DYNAMIC_FLAG].definition;
+    }
+    return &bus->indexedMessages[entry];
+}
+
+/* Private: Find the slot holding a message in a bus's index.
+ *
+ * Returns the slot, or -1 if the message isn't in the index.
+ */
+static int findIndexedMessage(CanBus* bus, uint32_t id,
+        CanMessageFormat format) {
+    int slot = messageIndexSlot(id, format);
+    for(int probes = 0; probes < CAN_MESSAGE_INDEX_SIZE; probes++) {
+        CanMessageIndexEntry entry = bus->messageIndex[slot];
+        if(entry == MESSAGE_INDEX_EMPTY) {
+            break;
+        }
+
+        CanMessageDefinition* candidate = indexedDefinition(bus, entry);
+        if(candidate->id == id && candidate->format == format) {
+            return slot;
+        }
+        slot = (slot + 1) & MESSAGE_INDEX_MASK;
+    }
+    return -1;
+}
+
+/* Private: Add an entry to a bus's message index.
+ *
+ * If a message with the same ID and format is already in the index, it's
+ * replaced if 'replace' is true, otherwise the index is left as it was.
+ *
+ * Returns false if the index is full.
+ */
+static bool addToMessageIndex(CanBus* bus, CanMessageIndexEntry entry,
+        bool replace) {
+    CanMessageDefinition* definition = indexedDefinition(bus, entry);
+    int slot = messageIndexSlot(definition->id, definition->format);
+    for(int probes = 0; probes < CAN_MESSAGE_INDEX_SIZE; probes++) {
+        CanMessageIndexEntry existing = bus->messageIndex[slot];
+        if(existing == MESSAGE_INDEX_EMPTY) {
+            bus->messageIndex[slot] = entry;
+            return true;
+        }
+
+        CanMessageDefinition* candidate = indexedDefinition(bus, existing);
+        if(candidate->id == definition->id &&
+                candidate->format == definition->format) {
+            if(replace) {
+                bus->messageIndex[slot] = entry;
+            }
+            return true;
+        }
+        slot = (slot + 1) & MESSAGE_INDEX_MASK;
+    }
+    bus->messageIndexComplete = false;
+    return false;
+}
+
+/* Private: Remove the entry in a slot of a bus's message index.
+ *
+ * The following entries in the same probe sequence are shifted back to fill the
+ * gap, so lookups never have to skip over deleted slots.
+ */
+static void removeFromMessageIndex(CanBus* bus, int slot) {
+    int next = (slot + 1) & MESSAGE_INDEX_MASK;
+    while(bus->messageIndex[next] != MESSAGE_INDEX_EMPTY) {
+        CanMessageDefinition* candidate = indexedDefinition(bus,
+                bus->messageIndex[next]);
+        int home = messageIndexSlot(candidate->id, candidate->format);
+        if(((next - home) & MESSAGE_INDEX_MASK) >=
+                ((next - slot) & MESSAGE_INDEX_MASK)) {
+            bus->messageIndex[slot] = bus->messageIndex[next];
+            slot = next;
+        }
+        next = (next + 1) & MESSAGE_INDEX_MASK;
+    }
+    bus->messageIndex[slot] = MESSAGE_INDEX_EMPTY;
+}
+
+/* Private: Rebuild a bus's message index from an array of predefined messages
+ * and the bus's current dynamic messages.
+ *
+ * If there are duplicate predefined messages, the last one wins to match
+ * lookupMessage, and predefined messages take precedence over dynamic.
+ *
+ * Returns false if the index can't hold every message on the bus.
+ */
+static bool buildMessageIndex(CanBus* bus,
+        CanMessageDefinition* predefinedMessages, int predefinedMessageCount) {
+    memset(bus->messageIndex, 0xff, sizeof(bus->messageIndex));
+    bus->indexedMessages = predefinedMessages;
+    bus->indexedMessageCount = predefinedMessageCount;
+    bus->messageIndexComplete = predefinedMessageCount <
+            MESSAGE_INDEX_DYNAMIC_FLAG;
+
+    for(int i = 0; i < predefinedMessageCount && bus->messageIndexComplete;
+            i++) {
+        if(predefinedMessages[i].bus == bus) {
+            addToMessageIndex(bus, i, true);
+        }
+    }
+
+    CanMessageDefinitionListEntry* entry;
+    LIST_FOREACH(entry, &bus->dynamicMessages, entries) {
+        addToMessageIndex(bus, MESSAGE_INDEX_DYNAMIC_FLAG |
+                (entry - bus->definitionEntries), false);
+    }
+    return bus->messageIndexComplete;
+}
+
+bool openxc::can::indexMessageDefinitions(CanBus* bus,
+        CanMessageDefinition* predefinedMessages, int predefinedMessageCount) {
+    if(!buildMessageIndex(bus, predefinedMessages, predefinedMessageCount)) {
+        debug("ERROR: %d messages don't fit in the message index of bus %d, "
+                "rebuild with CAN_MESSAGE_COUNT=%d - lookups will be slow",
+                predefinedMessageCount, bus->address,
+                predefinedMessageCount);
+        return false;
+    }
+    return true;
+}
+
 CanMessageDefinition* openxc::can::lookupMessageDefinition(CanBus* bus,
         uint32_t id, CanMessageFormat format,
         CanMessageDefinition* predefinedMessages,
         int predefinedMessageCount) {
-    CanMessageDefinition* message = lookupMessage(bus, id, format,
-            predefinedMessages, predefinedMessageCount);
-    if(message == NULL) {
-        CanMessageDefinitionListEntry* entry;
-        LIST_FOREACH(entry, &bus->dynamicMessages, entries) {
-            if(entry->definition.id == id) {
-                message = &entry->definition;
-                break;
+    if(predefinedMessages != NULL &&
+            (predefinedMessages != bus->indexedMessages ||
+                predefinedMessageCount != bus->indexedMessageCount)) {
+        indexMessageDefinitions(bus, predefinedMessages,
+                predefinedMessageCount);
+    }
+
+    CanMessageDefinition* message = NULL;
+    if(bus->messageIndexComplete) {
+        int slot = findIndexedMessage(bus, id, format);
+        if(slot != -1) {
+            CanMessageIndexEntry entry = bus->messageIndex[slot];
+            if(predefinedMessages != NULL ||
+                    (entry & MESSAGE_INDEX_DYNAMIC_FLAG)) {
+                message = indexedDefinition(bus, entry);
             }
         }
+    } else {
+        message = lookupMessage(bus, id, format, predefinedMessages,
+                predefinedMessageCount);
+        if(message == NULL) {
+            message = lookupDynamicMessage(bus, id, format);
+        }
     }
     return message;
 }
@@ -194,17 +415,23 @@ bool openxc::can::registerMessageDefinition(CanBus* bus, uint32_t id,
         CanMessageFormat format,
         CanMessageDefinition* predefinedMessages, int predefinedMessageCount) {
     CanMessageDefinition* message = lookupMessageDefinition(
-            bus, id, format, NULL, 0);
+            bus, id, format, predefinedMessages, predefinedMessageCount);
     if(message == NULL && LIST_FIRST(&bus->freeMessageDefinitions) != NULL) {
         CanMessageDefinitionListEntry* entry = LIST_FIRST(
                 &bus->freeMessageDefinitions);
         LIST_REMOVE(entry, entries);
         entry->definition.bus = bus;
         entry->definition.id = id;
+        entry->definition.format = format;
         entry->definition.frequencyClock = {bus->maxMessageFrequency};
         entry->definition.forceSendChanged = true;
+        entry->definition.changesTracked = false;
 
         LIST_INSERT_HEAD(&bus->dynamicMessages, entry, entries);
+        if(bus->messageIndexComplete) {
+            addToMessageIndex(bus, MESSAGE_INDEX_DYNAMIC_FLAG |
+                    (entry - bus->definitionEntries), false);
+        }
         message = &entry->definition;
     }
     return message != NULL;
@@ -214,15 +441,23 @@ bool openxc::can::unregisterMessageDefinition(CanBus* bus, uint32_t id,
         CanMessageFormat format) {
     CanMessageDefinitionListEntry* entry, *match = NULL;
     LIST_FOREACH(entry, &bus->dynamicMessages, entries) {
-        if(entry->definition.id == id) {
+        if(entry->definition.id == id && entry->definition.format == format) {
             match = entry;
             break;
         }
     }
 
     if(match != NULL) {
-        LIST_REMOVE(entry, entries);
-        LIST_INSERT_HEAD(&bus->freeMessageDefinitions, entry, entries);
+        if(bus->messageIndexComplete) {
+            int slot = findIndexedMessage(bus, id, format);
+            if(slot != -1 && bus->messageIndex[slot] ==
+                    (MESSAGE_INDEX_DYNAMIC_FLAG |
+                        (match - bus->definitionEntries))) {
+                removeFromMessageIndex(bus, slot);
+            }
+        }
+        LIST_REMOVE(match, entries);
+        LIST_INSERT_HEAD(&bus->freeMessageDefinitions, match, entries);
         return true;
     }
     return false;
@@ -238,10 +473,21 @@ bool openxc::can::signalsWritable(CanBus* bus, CanSignal* signals,
     return false;
 }
 
-void openxc::can::logBusStatistics(CanBus* buses, const int busCount) {
-    if(!config::getConfiguration()->calculateMetrics) {
-        return;
+static void logLatency(CanBus* bus, const char* stage,
+        const statistics::Histogram* latency) {
+    if(latency->count > 0) {
+        char buckets[96];
+        statistics::formatBuckets(latency, buckets, sizeof(buckets));
+        debug("CAN%d %s latency max: %luus, buckets from <%dus: %s",
+                bus->address, stage, latency->max, HISTOGRAM_FIRST_BUCKET_US,
+                buckets);
     }
+}
+
+void openxc::can::logBusStatistics(CanBus* buses, const int busCount) {
+    // The statistics are always sampled, so they can be reported by the
+    // metrics command - only the logging costs anything worth turning off
+    bool logging = config::getConfiguration()->calculateMetrics;
 
     static DeltaStatistic totalMessageStats;
     static DeltaStatistic receivedMessageStats;
@@ -279,19 +525,33 @@ void openxc::can::logBusStatistics(CanBus* buses, const int busCount) {
             statistics::update(&bus->receiveQueueStats,
                     QUEUE_LENGTH(CanMessage, &bus->receiveQueue));
 
-            if(bus->totalMessageStats.total > 0) {
+            if(logging && bus->totalMessageStats.total > 0) {
                 debug("CAN%d Rx queue length: %d, avg: %f percent",
                         bus->address,
                         QUEUE_LENGTH(CanMessage, &bus->receiveQueue),
                         statistics::exponentialMovingAverage(
                             &bus->receiveQueueStats) /
-                                QUEUE_MAX_LENGTH(CanMessage) * 100);
+                                effectiveQueueDepth(bus->receiveQueueDepth)
+                                * 100);
                 debug("CAN%d Tx queue length: %d, avg: %f percent",
                         bus->address,
                         QUEUE_LENGTH(CanMessage, &bus->sendQueue),
                         statistics::exponentialMovingAverage(
                             &bus->sendQueueStats) /
-                                QUEUE_MAX_LENGTH(CanMessage) * 100);
+                                effectiveQueueDepth(bus->sendQueueDepth)
+                                * 100);
+                debug("CAN%d Rx queue depth: %d, high-water mark: %d, "
+                        "overflows: %d (first at %lums)", bus->address,
+                        effectiveQueueDepth(bus->receiveQueueDepth),
+                        bus->receiveQueueMetrics.highWaterMark,
+                        bus->receiveQueueMetrics.overflowCount,
+                        bus->receiveQueueMetrics.firstOverflow);
+                debug("CAN%d Tx queue depth: %d, high-water mark: %d, "
+                        "overflows: %d (first at %lums)", bus->address,
+                        effectiveQueueDepth(bus->sendQueueDepth),
+                        bus->sendQueueMetrics.highWaterMark,
+                        bus->sendQueueMetrics.overflowCount,
+                        bus->sendQueueMetrics.firstOverflow);
                 debug("CAN%d msgs Rx: %d (%dKB)",
                         bus->address, bus->receivedMessageStats.total,
                         bus->receivedDataStats.total);
@@ -305,6 +565,12 @@ void openxc::can::logBusStatistics(CanBus* buses, const int busCount) {
                         statistics::exponentialMovingAverage(
                             &bus->receivedDataStats) /
                             BUS_STATS_LOG_FREQUENCY_S);
+                debug("CAN%d Rx batch size avg: %f, max: %d", bus->address,
+                        statistics::exponentialMovingAverage(
+                            &bus->receiveBatchStats),
+                        statistics::maximum(&bus->receiveBatchStats));
+                logLatency(bus, "Rx queue", &bus->receiveQueueLatency);
+                logLatency(bus, "decode", &bus->processLatency);
             }
 
             totalMessages += bus->totalMessageStats.total;
@@ -317,7 +583,7 @@ void openxc::can::logBusStatistics(CanBus* buses, const int busCount) {
         statistics::update(&droppedMessageStats, messagesDropped);
         statistics::update(&receivedDataStats, dataReceived);
 
-        if(totalMessageStats.total > 0) {
+        if(logging && totalMessageStats.total > 0) {
             debug("CAN total msgs Rx: %d (%dKB)",
                     receivedMessageStats.total,
                     receivedDataStats.total);
@@ -335,20 +601,233 @@ void openxc::can::logBusStatistics(CanBus* buses, const int busCount) {
 
         lastTimeLogged = time::systemTimeMs();
 
-        for(int i = 0; i < busCount; i++) {
-            if(QUEUE_LENGTH(CanMessage, &buses[i].receiveQueue) ==
-                    QUEUE_MAX_LENGTH(CanMessage)) {
+        for(int i = 0; logging && i < busCount; i++) {
+            if(QUEUE_LENGTH(CanMessage, &buses[i].receiveQueue) >=
+                    effectiveQueueDepth(buses[i].receiveQueueDepth)) {
                 debug("Dropped CAN messages while running stats on bus %d", i);
             }
         }
     }
 }
 
+#define FILTER_SET_MASK (CAN_EXTENDED_FILTER_SET_SIZE - 1)
+
+static bool usesStandardFilterBitmap(uint32_t id, CanMessageFormat format) {
+    return format == CanMessageFormat::STANDARD && id < CAN_STANDARD_ID_COUNT;
+}
+
+/* Private: Find the slot holding an ID in a bus's extended filter set.
+ *
+ * Returns the slot, or -1 if the ID isn't in the set.
+ */
+static int findExtendedFilter(const CanBus* bus, uint32_t id) {
+    int slot = hashCanId(id) & FILTER_SET_MASK;
+    for(int probes = 0; probes < CAN_EXTENDED_FILTER_SET_SIZE; probes++) {
+        uint32_t entry = bus->extendedFilters[slot];
+        if(entry == id) {
+            return slot;
+        } else if(entry == CAN_EXTENDED_FILTER_EMPTY) {
+            break;
+        }
+        slot = (slot + 1) & FILTER_SET_MASK;
+    }
+    return -1;
+}
+
+/* Private: Add an ID to the software acceptance filter for a bus.
+ *
+ * Returns false if the bus's extended filter set is full.
+ */
+static bool addSoftwareFilter(CanBus* bus, uint32_t id,
+        CanMessageFormat format) {
+    if(usesStandardFilterBitmap(id, format)) {
+        bus->standardFilters[id / 32] |= 1u << (id % 32);
+        return true;
+    }
+
+    if(findExtendedFilter(bus, id) != -1) {
+        return true;
+    }
+
+    int slot = hashCanId(id) & FILTER_SET_MASK;
+    for(int probes = 0; probes < CAN_EXTENDED_FILTER_SET_SIZE; probes++) {
+        uint32_t entry = bus->extendedFilters[slot];
+        if(entry == CAN_EXTENDED_FILTER_EMPTY ||
+                entry == CAN_EXTENDED_FILTER_REMOVED) {
+            bus->extendedFilters[slot] = id;
+            ++bus->extendedFilterCount;
+            return true;
+        }
+        slot = (slot + 1) & FILTER_SET_MASK;
+    }
+    return false;
+}
+
+/* Private: Remove an ID from the software acceptance filter for a bus.
+ */
+static void removeSoftwareFilter(CanBus* bus, uint32_t id,
+        CanMessageFormat format) {
+    if(usesStandardFilterBitmap(id, format)) {
+        bus->standardFilters[id / 32] &= ~(1u << (id % 32));
+        return;
+    }
+
+    int slot = findExtendedFilter(bus, id);
+    if(slot != -1) {
+        bus->extendedFilters[slot] = CAN_EXTENDED_FILTER_REMOVED;
+        --bus->extendedFilterCount;
+    }
+}
+
+/* Private: Clear the removal markers out of a bus's extended filter set, so
+ * filters that come and go don't make every lookup slower over time.
+ *
+ * IDs are first moved back into any marked slots along their probe sequences,
+ * and then no probe sequence runs through the markers that are left, so they
+ * can be emptied. The interrupt handler may be reading the set, so like every
+ * other change it's made one word at a time - an ID is copied to its new slot
+ * before its old one is marked, so it can always be found.
+ */
+static void compactExtendedFilters(CanBus* bus) {
+    bool moved = true;
+    while(moved) {
+        moved = false;
+        for(int slot = 0; slot < CAN_EXTENDED_FILTER_SET_SIZE; slot++) {
+            uint32_t id = bus->extendedFilters[slot];
+            if(id == CAN_EXTENDED_FILTER_EMPTY ||
+                    id == CAN_EXTENDED_FILTER_REMOVED) {
+                continue;
+            }
+
+            for(int probe = hashCanId(id) & FILTER_SET_MASK; probe != slot;
+                    probe = (probe + 1) & FILTER_SET_MASK) {
+                if(bus->extendedFilters[probe] ==
+                        CAN_EXTENDED_FILTER_REMOVED) {
+                    bus->extendedFilters[probe] = id;
+                    bus->extendedFilters[slot] = CAN_EXTENDED_FILTER_REMOVED;
+                    moved = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    for(int slot = 0; slot < CAN_EXTENDED_FILTER_SET_SIZE; slot++) {
+        if(bus->extendedFilters[slot] == CAN_EXTENDED_FILTER_REMOVED) {
+            bus->extendedFilters[slot] = CAN_EXTENDED_FILTER_EMPTY;
+        }
+    }
+}
+
+/* Private: The number of nested beginAcceptanceFilterUpdate() batches that
+ * haven't been committed yet.
+ */
+static int acceptanceFilterBatchDepth = 0;
+
+/* Private: Move any filters on the bus that no longer have any users back to
+ * the free list.
+ */
+static void releaseUnusedFilters(CanBus* bus) {
+    AcceptanceFilterListEntry* entry = LIST_FIRST(&bus->acceptanceFilters);
+    while(entry != NULL) {
+        AcceptanceFilterListEntry* next = LIST_NEXT(entry, entries);
+        if(entry->activeUserCount == 0) {
+            debug("No active users - disabling filter 0x%x on bus %d",
+                    entry->filter, bus->address);
+            removeSoftwareFilter(bus, entry->filter, entry->format);
+            LIST_REMOVE(entry, entries);
+            LIST_INSERT_HEAD(&bus->freeAcceptanceFilters, entry, entries);
+            bus->acceptanceFiltersChanged = true;
+        }
+        entry = next;
+    }
+}
+
+/* Private: Remove the filters that were added to the bus during a batch of
+ * changes, after the AF table couldn't be updated to include them.
+ *
+ * Returns true if any filters were removed.
+ */
+static bool rollBackUncommittedFilters(CanBus* bus) {
+    bool removed = false;
+    AcceptanceFilterListEntry* entry = LIST_FIRST(&bus->acceptanceFilters);
+    while(entry != NULL) {
+        AcceptanceFilterListEntry* next = LIST_NEXT(entry, entries);
+        if(entry->uncommitted) {
+            debug("Unable to update AF table, removing filter for 0x%x on "
+                    "bus %d", entry->filter, bus->address);
+            removeSoftwareFilter(bus, entry->filter, entry->format);
+            LIST_REMOVE(entry, entries);
+            LIST_INSERT_HEAD(&bus->freeAcceptanceFilters, entry, entries);
+            removed = true;
+        }
+        entry = next;
+    }
+    return removed;
+}
+
+/* Private: Update the hardware AF table if the filters on any bus have
+ * changed, unless we're in the middle of a batch of changes.
+ */
+static bool applyAcceptanceFilterChanges(CanBus* buses, const int busCount) {
+    if(acceptanceFilterBatchDepth > 0) {
+        return true;
+    }
+
+    bool changed = false;
+    for(int i = 0; i < busCount; i++) {
+        releaseUnusedFilters(&buses[i]);
+        changed |= buses[i].acceptanceFiltersChanged;
+        buses[i].acceptanceFiltersChanged = false;
+    }
+    bool status = !changed || openxc::can::updateAcceptanceFilterTable(buses,
+            busCount);
+
+    bool rolledBack = false;
+    for(int i = 0; i < busCount; i++) {
+        if(!status) {
+            rolledBack |= rollBackUncommittedFilters(&buses[i]);
+        }
+        AcceptanceFilterListEntry* entry;
+        LIST_FOREACH(entry, &buses[i].acceptanceFilters, entries) {
+            entry->uncommitted = false;
+        }
+    }
+
+    if(rolledBack && !openxc::can::updateAcceptanceFilterTable(buses,
+                busCount)) {
+        debug("Unable to restore AF table after removing new filters");
+    }
+
+    if(changed) {
+        for(int i = 0; i < busCount; i++) {
+            compactExtendedFilters(&buses[i]);
+        }
+    }
+    return status;
+}
+
+void openxc::can::beginAcceptanceFilterUpdate() {
+    ++acceptanceFilterBatchDepth;
+}
+
+bool openxc::can::commitAcceptanceFilterUpdate(CanBus* buses,
+        const int busCount) {
+    if(acceptanceFilterBatchDepth > 0) {
+        --acceptanceFilterBatchDepth;
+    }
+    return applyAcceptanceFilterChanges(buses, busCount);
+}
+
 bool openxc::can::configureDefaultFilters(CanBus* bus,
         const CanMessageDefinition* messages, const int messageCount,
         CanBus* buses, const int busCount) {
     uint8_t filterCount = 0;
     bool status = true;
+    beginAcceptanceFilterUpdate();
+    // Always write the table, even if there are no filters for this bus, so
+    // the AF is bypassed instead of left in whatever state it was.
+    bus->acceptanceFiltersChanged = true;
     if(messageCount > 0) {
         for(int i = 0; i < messageCount; i++) {
             if(messages[i].bus == bus) {
@@ -368,7 +847,7 @@ bool openxc::can::configureDefaultFilters(CanBus* bus,
                     bus->address);
         }
     }
-    status &= updateAcceptanceFilterTable(buses, busCount);
+    status &= commitAcceptanceFilterUpdate(buses, busCount);
     return status;
 }
 
@@ -384,7 +863,7 @@ bool openxc::can::addAcceptanceFilter(CanBus* bus, uint32_t id,
         CanMessageFormat format, CanBus* buses, int busCount) {
     AcceptanceFilterListEntry* entry;
     LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
-        if(entry->filter == id) {
+        if(entry->filter == id && entry->format == format) {
             ++entry->activeUserCount;
             debug("Filter for 0x%x already exists -- bumped user count to %d",
                     id, entry->activeUserCount);
@@ -394,22 +873,38 @@ bool openxc::can::addAcceptanceFilter(CanBus* bus, uint32_t id,
 
     AcceptanceFilterListEntry* availableFilter = popListEntry(
             &bus->freeAcceptanceFilters);
+    if(availableFilter == NULL) {
+        // Filters waiting for the end of a batch to be removed can be
+        // reclaimed early
+        releaseUnusedFilters(bus);
+        availableFilter = popListEntry(&bus->freeAcceptanceFilters);
+    }
+
     if(availableFilter == NULL) {
         debug("All acceptance filter slots already taken, can't add 0x%lx",
                 id);
         return false;
     }
 
+    if(!addSoftwareFilter(bus, id, format)) {
+        debug("Software filter for extended IDs is full, can't add 0x%lx", id);
+        LIST_INSERT_HEAD(&bus->freeAcceptanceFilters, availableFilter, entries);
+        return false;
+    }
+
     availableFilter->filter = id;
     availableFilter->format = format;
     availableFilter->activeUserCount = 1;
+    availableFilter->uncommitted = acceptanceFilterBatchDepth > 0;
     LIST_INSERT_HEAD(&bus->acceptanceFilters, availableFilter, entries);
+    bus->acceptanceFiltersChanged = true;
     debug("Added acceptance filter for 0x%x on bus %d", availableFilter->filter,
             bus->address);
-    bool status = updateAcceptanceFilterTable(buses, busCount);
+    bool status = applyAcceptanceFilterChanges(buses, busCount);
     if(!status) {
         debug("Unable to update AF table after adding filter for 0x%x on bus %d",
                 availableFilter->filter, bus->address);
+        removeSoftwareFilter(bus, id, format);
         LIST_REMOVE(availableFilter, entries);
         LIST_INSERT_HEAD(&bus->freeAcceptanceFilters, availableFilter, entries);
     }
@@ -420,20 +915,17 @@ void openxc::can::removeAcceptanceFilter(CanBus* bus, uint32_t id,
         CanMessageFormat format, CanBus* buses, const int busCount) {
     AcceptanceFilterListEntry* entry;
     LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
-        if(entry->filter == id) {
+        if(entry->filter == id && entry->format == format) {
             break;
         }
     }
 
-    if(entry != NULL) {
+    if(entry != NULL && entry->activeUserCount > 0) {
         --entry->activeUserCount;
         debug("Decremented active user count for filter 0x%x to %d",
                 entry->filter, entry->activeUserCount);
         if(entry->activeUserCount == 0) {
-            debug("No active users - disabling filter");
-            LIST_REMOVE(entry, entries);
-            LIST_INSERT_HEAD(&bus->freeAcceptanceFilters, entry, entries);
-            updateAcceptanceFilterTable(buses, busCount);
+            applyAcceptanceFilterChanges(buses, busCount);
         }
     }
 }
@@ -441,21 +933,59 @@ void openxc::can::removeAcceptanceFilter(CanBus* bus, uint32_t id,
 bool openxc::can::setAcceptanceFilterStatus(CanBus* bus, bool enabled,
         CanBus* buses, const uint busCount) {
     bus->bypassFilters = !enabled;
+    bus->acceptanceFiltersChanged = true;
     debug("CAN AF for bus %d is now %s", bus->address,
             bus->bypassFilters ? "bypassed" : "enabled");
-    return updateAcceptanceFilterTable(buses, busCount);
+    return applyAcceptanceFilterChanges(buses, busCount);
 }
 
-bool openxc::can::shouldAcceptMessage(CanBus* bus, uint32_t messageId) {
+bool openxc::can::shouldAcceptMessage(CanBus* bus, uint32_t messageId,
+        CanMessageFormat format) {
     bool acceptMessage = bus->bypassFilters;
     if(!acceptMessage) {
-        AcceptanceFilterListEntry* entry;
-        LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
-            if(entry->filter == messageId) {
-                acceptMessage = true;
-                break;
-            }
+        if(format == CanMessageFormat::STANDARD) {
+            acceptMessage = messageId < CAN_STANDARD_ID_COUNT &&
+                    (bus->standardFilters[messageId / 32] &
+                        (1u << (messageId % 32)));
+        } else {
+            acceptMessage = findExtendedFilter(bus, messageId) != -1;
         }
     }
     return acceptMessage;
 }
+
+int openxc::can::effectiveQueueDepth(unsigned short depth) {
+    if(depth == 0 || depth > QUEUE_MAX_LENGTH(CanMessage)) {
+        return QUEUE_MAX_LENGTH(CanMessage);
+    }
+    return depth;
+}
+
+bool openxc::can::pushCanMessage(QUEUE_TYPE(CanMessage)* queue,
+        unsigned short depth, CanQueueMetrics* metrics,
+        const CanMessage* message) {
+    bool queued = QUEUE_LENGTH(CanMessage, queue) < effectiveQueueDepth(depth)
+            && QUEUE_PUSH(CanMessage, queue, *message);
+    if(queued) {
+        int length = QUEUE_LENGTH(CanMessage, queue);
+        if(length > metrics->highWaterMark) {
+            metrics->highWaterMark = length;
+        }
+    } else {
+        if(metrics->overflowCount == 0) {
+            metrics->firstOverflow = time::systemTimeMs();
+        }
+        ++metrics->overflowCount;
+    }
+    return queued;
+}
+
+bool openxc::can::enqueueReceivedMessage(CanBus* bus,
+        const CanMessage* message) {
+    bool queued = pushCanMessage(&bus->receiveQueue, bus->receiveQueueDepth,
+            &bus->receiveQueueMetrics, message);
+    if(!queued) {
+        ++bus->messagesDropped;
+    }
+    return queued;
+}
@@ -12,13 +12,88 @@
 #include "cJSON.h"
 #include "openxc.pb.h"
 
-// TODO actual max is 32 but dropped to 24 for memory considerations
-#define MAX_ACCEPTANCE_FILTERS 24
+// The number of acceptance filters each CAN bus can hold. This is independent
+// of the size of the hardware filter table - the filters are compiled into
+// ranges or masks that fit in the hardware (see can/canfilter.h), and the
+// software filter drops any extra messages they let through.
+#ifndef MAX_ACCEPTANCE_FILTERS
+#define MAX_ACCEPTANCE_FILTERS 48
+#endif
 // TODO this takes up a ton of memory
 #define MAX_DYNAMIC_MESSAGE_COUNT 12
 
 #define CAN_MESSAGE_SIZE 8
 
+// The most messages in the active message set, which sizes each CAN bus's
+// message definition index. The default covers large production message sets;
+// a smaller value saves 2 bytes of RAM per bus for each slot of the index
+// dropped.
+#ifndef CAN_MESSAGE_COUNT
+#define CAN_MESSAGE_COUNT 180
+#endif
+
+// The number of slots in each CAN bus's message definition index, a hash table
+// of the predefined and dynamic CanMessageDefinitions on the bus. This must be
+// a power of 2 larger than CAN_MESSAGE_COUNT plus MAX_DYNAMIC_MESSAGE_COUNT.
+// By default it's the next power of 2 that keeps the table at most 3/4 full.
+#ifndef CAN_MESSAGE_INDEX_SIZE
+#if (CAN_MESSAGE_COUNT + MAX_DYNAMIC_MESSAGE_COUNT) * 4 / 3 <= 32
+#define CAN_MESSAGE_INDEX_SIZE 32
+#elif (CAN_MESSAGE_COUNT + MAX_DYNAMIC_MESSAGE_COUNT) * 4 / 3 <= 64
+#define CAN_MESSAGE_INDEX_SIZE 64
+#elif (CAN_MESSAGE_COUNT + MAX_DYNAMIC_MESSAGE_COUNT) * 4 / 3 <= 128
+#define CAN_MESSAGE_INDEX_SIZE 128
+#elif (CAN_MESSAGE_COUNT + MAX_DYNAMIC_MESSAGE_COUNT) * 4 / 3 <= 256
+#define CAN_MESSAGE_INDEX_SIZE 256
+#elif (CAN_MESSAGE_COUNT + MAX_DYNAMIC_MESSAGE_COUNT) * 4 / 3 <= 512
+#define CAN_MESSAGE_INDEX_SIZE 512
+#else
+#define CAN_MESSAGE_INDEX_SIZE 1024
+#endif
+#endif
+
+#if (CAN_MESSAGE_INDEX_SIZE & (CAN_MESSAGE_INDEX_SIZE - 1)) != 0
+#error "CAN_MESSAGE_INDEX_SIZE must be a power of 2"
+#endif
+
+#if CAN_MESSAGE_COUNT + MAX_DYNAMIC_MESSAGE_COUNT >= CAN_MESSAGE_INDEX_SIZE
+#error "CAN_MESSAGE_INDEX_SIZE must be larger than CAN_MESSAGE_COUNT plus the dynamic messages"
+#endif
+
+// A slot in a message definition index - the position of a predefined message
+// in the message set, or of a dynamic message with the dynamic flag set.
+typedef uint16_t CanMessageIndexEntry;
+#define CAN_MESSAGE_INDEX_EMPTY 0xffff
+#define CAN_MESSAGE_INDEX_DYNAMIC_FLAG 0x8000
+
+// Include the integer signal decoder, which needs another 8 bytes of RAM for
+// each signal. Firmware builds only have it with INTEGER_SIGNAL_DECODING=1, but
+// builds for the development computer always do, so the unit tests and
+// benchmarks can compare the two decoders.
+#if defined(__INTEGER_SIGNAL_DECODING__) || \
+        !(defined(__PIC32__) || defined(__LPC17XX__))
+#define __RAW_SIGNAL_DECODING__
+#endif
+
+// The number of possible standard, 11-bit CAN message IDs.
+#define CAN_STANDARD_ID_COUNT 0x800
+
+// The number of slots in each CAN bus's software acceptance filter for
+// extended IDs, an open-addressed hash set. This must be a power of 2 and
+// larger than the number of extended ID filters on any bus.
+#ifndef CAN_EXTENDED_FILTER_SET_SIZE
+#define CAN_EXTENDED_FILTER_SET_SIZE 64
+#endif
+
+#if (CAN_EXTENDED_FILTER_SET_SIZE & (CAN_EXTENDED_FILTER_SET_SIZE - 1)) != 0
+#error "CAN_EXTENDED_FILTER_SET_SIZE must be a power of 2"
+#endif
+
+// Markers for the unused slots in an extended filter set - IDs this high don't
+// fit in the 29 bits of an extended CAN ID.
+#define CAN_EXTENDED_FILTER_EMPTY 0xffffffff
+#define CAN_EXTENDED_FILTER_REMOVED 0xfffffffe
+
 /* Public: The type signature for a CAN signal decoder.
  *
  * A SignalDecoder transforms a raw floating point CAN signal into a number,
@@ -109,6 +184,16 @@ typedef struct CanSignalState CanSignalState;
  * received    - True if this signal has ever been received.
  * lastValue   - The last received value of the signal. If 'received' is false,
  *      this value is undefined.
+ * lastRawValue - The last received value of the signal's bitfield, before
+ *      applying the factor and offset. Only maintained by
+ *      openxc::can::read::translateSignalRaw, and only present in builds that
+ *      have it (see __RAW_SIGNAL_DECODING__).
+ * bitMask     - The bits of the signal in a CAN message's payload, read as a
+ *      big-endian 64-bit integer. Calculated the first time it's needed, 0
+ *      until then.
+ * precision   - The number of decimal places to send the value with in text
+ *      payloads, or -1 to always send a whole number. If 0, it's calculated
+ *      from the factor and offset the first time it's needed.
  */
 struct CanSignal {
     struct CanMessageDefinition* message;
@@ -129,6 +214,11 @@ struct CanSignal {
     SignalEncoder encoder;
     bool received;
     float lastValue;
+#ifdef __RAW_SIGNAL_DECODING__
+    uint64_t lastRawValue;
+#endif
+    uint64_t bitMask;
+    int8_t precision;
 };
 typedef struct CanSignal CanSignal;
 
@@ -147,6 +237,12 @@ typedef struct CanSignal CanSignal;
  * lastValue - The last received value of the message. Defaults to undefined.
  *      This is required for the forceSendChanged functionality, as the stack
  *      needs to compare an incoming CAN message with the previous frame.
+ * changesTracked - True if decodedValue and changedBits have been set by
+ *      openxc::can::read::trackMessageChanges.
+ * decodedValue - The payload of the message currently being decoded.
+ * changedBits - The bits of decodedValue that differ from the payload of the
+ *      message before it, read as a big-endian 64-bit integer. Signals with
+ *      none of their bits in changedBits don't need to be decoded again.
  */
 struct CanMessageDefinition {
     struct CanBus* bus;
@@ -155,6 +251,9 @@ struct CanMessageDefinition {
     openxc::util::time::FrequencyClock frequencyClock;
     bool forceSendChanged;
     uint8_t lastValue[CAN_MESSAGE_SIZE];
+    bool changesTracked;
+    uint8_t decodedValue[CAN_MESSAGE_SIZE];
+    uint64_t changedBits;
 };
 typedef struct CanMessageDefinition CanMessageDefinition;
 
@@ -165,16 +264,47 @@ typedef struct CanMessageDefinition CanMessageDefinition;
  * format - the format of the message's ID.
  * data  - The message's data field.
  * length - the length of the data array (max 8).
+ * timestamped - true if the message was pulled off the bus by the receive
+ *      interrupt, which set receivedUs.
+ * receivedUs - the time (in us) when the receive interrupt pulled the message
+ *      off the bus, if timestamped. This costs 4 bytes for each message the
+ *      receive and send queues of each bus can hold.
  */
 struct CanMessage {
     uint32_t id;
     CanMessageFormat format;
     uint8_t data[CAN_MESSAGE_SIZE];
     uint8_t length;
+    bool timestamped;
+    unsigned long receivedUs;
 };
 typedef struct CanMessage CanMessage;
 
-QUEUE_DECLARE(CanMessage, 8);
+// The capacity of each CAN bus's send and receive queues. The memory for both
+// queues is reserved for every bus, so this is set at build time - use the
+// receiveQueueDepth and sendQueueDepth fields of CanBus to limit an individual
+// bus to fewer messages.
+#ifndef MAX_CAN_QUEUE_LENGTH
+#define MAX_CAN_QUEUE_LENGTH 8
+#endif
+
+QUEUE_DECLARE(CanMessage, MAX_CAN_QUEUE_LENGTH);
+
+/* Public: Occupancy metrics for one of a CanBus's message queues, for sizing
+ * the queues from real traffic.
+ *
+ * highWaterMark - The largest number of messages ever waiting in the queue at
+ *      once.
+ * overflowCount - The number of messages dropped because the queue was full.
+ * firstOverflow - The time (in ms) when a message was first dropped because
+ *      the queue was full. If the queue has never overflowed, it will be 0.
+ */
+struct CanQueueMetrics {
+    unsigned short highWaterMark;
+    unsigned int overflowCount;
+    unsigned long firstOverflow;
+};
+typedef struct CanQueueMetrics CanQueueMetrics;
 
 /* Private: An entry in the list of acceptance filters for each CanBus.
  *
@@ -189,6 +319,8 @@ struct AcceptanceFilterListEntry {
     uint32_t filter;
     uint8_t activeUserCount;
     CanMessageFormat format;
+    // Added inside a batch that hasn't been committed to the AF table yet
+    bool uncommitted;
     LIST_ENTRY(AcceptanceFilterListEntry) entries;
 };
 
@@ -228,17 +360,51 @@ LIST_HEAD(CanMessageDefinitionList, CanMessageDefinitionListEntry);
  *      are no acceptance filters configured.
  * loopback - True if the controller should be configured in loopback mode, so
  *         all sent messages are received immediately on that same controller.
+ * receiveBatchSize - The maximum number of received CAN messages to pull from
+ *      the receive queue and decode each time through the main loop. If 0,
+ *      the queue is drained completely (up to its capacity).
+ * receiveBatchBudgetUs - An optional limit in microseconds on the time spent
+ *      draining the receive queue each time through the main loop. At least
+ *      one message is always decoded if the queue isn't empty. If 0, there is
+ *      no time limit.
+ * receiveQueueDepth - The maximum number of received CAN messages to hold for
+ *      decoding before dropping new ones. If 0 or larger than
+ *      MAX_CAN_QUEUE_LENGTH, the full capacity of the queue is used.
+ * sendQueueDepth - The maximum number of outgoing CAN messages to hold before
+ *      dropping new ones. If 0 or larger than MAX_CAN_QUEUE_LENGTH, the full
+ *      capacity of the queue is used.
  *
  * acceptanceFilters - a list of active acceptance filters for this bus.
  * freeAcceptanceFilters - a list of available slots for acceptance filters.
  * acceptanceFilterEntries - static memory allocated for entires in the
  *      acceptanceFilters and freeAcceptanceFilters list.
+ * standardFilters - a bitmap of the standard IDs in acceptanceFilters, for
+ *      constant time software filtering in the CAN interrupt handler.
+ * extendedFilters - an open-addressed hash set of the IDs in
+ *      acceptanceFilters that don't fit in standardFilters, i.e. extended IDs.
+ *      Removed IDs are replaced with a marker rather than shifting the other
+ *      entries, so every change is a single word write that's safe to make
+ *      while the interrupt handler is reading the set. The markers are cleared
+ *      out whenever the AF table is updated.
+ * extendedFilterCount - the number of IDs in extendedFilters.
+ * acceptanceFiltersChanged - true if acceptanceFilters or bypassFilters has
+ *      changed since the hardware AF table was last updated.
  * dynamicMessages - a list of CAN message IDs ever received on this bus. This
  *      is used for message frequency control and metrics.
  * freeMessageDefinitions - a list of available slots for dynamic message
  *      definitions.
  * definitionEntries - static memory allocated for entires in the
  *      dynamicMessages and freeMessageDefinitions list.
+ * indexedMessages - the array of predefined CAN messages that messageIndex was
+ *      built from, or NULL if it only holds dynamic messages.
+ * indexedMessageCount - the length of the indexedMessages array.
+ * messageIndexComplete - false if messageIndex filled up and is missing
+ *      some of the bus's message definitions, in which case lookups use a
+ *      linear search. indexMessageDefinitions reports this at startup.
+ * messageIndex - an open-addressed hash table of the message definitions on
+ *      this bus, keyed on ID and format. Each slot holds the position of a
+ *      definition in indexedMessages, or of a dynamic definition in
+ *      definitionEntries.
  * writeHandler - a function that actually writes out a CanMessage object to the
  *      CAN interface (implementation is platform specific);
  * lastMessageReceived - the time (in ms) when the last CAN message was
@@ -247,6 +413,17 @@ LIST_HEAD(CanMessageDefinitionList, CanMessageDefinitionListEntry);
  * messagesDropped - A count of the number of CAN messages we knowingly dropped
  * - i.e. we received an interrupt with a new CAN message but the incoming CAN
  *   message queue was full.
+ * receiveBatchStats - The number of messages drained from the receive queue
+ *      in each pass of the main loop that found the queue non-empty. Only
+ *      updated when calculating metrics.
+ * receiveQueueMetrics - The high-water mark and overflows of the receive queue.
+ * sendQueueMetrics - The high-water mark and overflows of the send queue.
+ * receiveQueueLatency - How long (in us) received messages waited in the
+ *      receive queue before the main loop picked them up. Only updated when
+ *      calculating metrics.
+ * processLatency - How long (in us) it took to decode each received message
+ *      and hand its output to the pipeline. Only updated when calculating
+ *      metrics.
  * sendQueue - a queue of CanMessage instances that need to be written to CAN.
  * receiveQueue - a queue of messages received from CAN that have yet to be
  *      translated.
@@ -259,14 +436,26 @@ struct CanBus {
     bool passthroughCanMessages;
     bool bypassFilters;
     bool loopback;
+    unsigned short receiveBatchSize;
+    unsigned int receiveBatchBudgetUs;
+    unsigned short receiveQueueDepth;
+    unsigned short sendQueueDepth;
 
     // Private
     AcceptanceFilterList acceptanceFilters;
     AcceptanceFilterList freeAcceptanceFilters;
     AcceptanceFilterListEntry acceptanceFilterEntries[MAX_ACCEPTANCE_FILTERS];
+    uint32_t standardFilters[CAN_STANDARD_ID_COUNT / 32];
+    uint32_t extendedFilters[CAN_EXTENDED_FILTER_SET_SIZE];
+    uint16_t extendedFilterCount;
+    bool acceptanceFiltersChanged;
     CanMessageDefinitionList dynamicMessages;
     CanMessageDefinitionList freeMessageDefinitions;
     CanMessageDefinitionListEntry definitionEntries[MAX_DYNAMIC_MESSAGE_COUNT];
+    CanMessageDefinition* indexedMessages;
+    int indexedMessageCount;
+    bool messageIndexComplete;
+    CanMessageIndexEntry messageIndex[CAN_MESSAGE_INDEX_SIZE];
     bool (*writeHandler)(const CanBus*, const CanMessage*);
     unsigned long lastMessageReceived;
     unsigned int messagesReceived;
@@ -280,6 +469,11 @@ struct CanBus {
     openxc::util::statistics::DeltaStatistic receivedDataStats;
     openxc::util::statistics::Statistic sendQueueStats;
     openxc::util::statistics::Statistic receiveQueueStats;
+    openxc::util::statistics::Statistic receiveBatchStats;
+    CanQueueMetrics receiveQueueMetrics;
+    CanQueueMetrics sendQueueMetrics;
+    openxc::util::statistics::Histogram receiveQueueLatency;
+    openxc::util::statistics::Histogram processLatency;
 
     QUEUE_TYPE(CanMessage) sendQueue;
     QUEUE_TYPE(CanMessage) receiveQueue;
@@ -389,6 +583,18 @@ void initializeCommon(CanBus* bus);
  */
 bool busActive(CanBus* bus);
 
+/* Public: Return the number of decimal places needed to send a signal's value
+ * without losing any of its resolution - enough for the signal's factor and
+ * offset, up to MAX_SIGNAL_PRECISION. It's stored in the signal's precision
+ * the first time, unless the signal already has one.
+ *
+ * signal - The signal to check.
+ *
+ * Returns the number of decimal places, or -1 if the signal has a custom
+ * decoder, so its value isn't necessarily a multiple of its factor.
+ */
+int signalPrecision(CanSignal* signal);
+
 /* Public: Look up the CanSignal representation of a signal based on its generic
  * name. The signal may or may not be writable - the first result will be
  * returned.
@@ -449,9 +655,28 @@ const CanSignalState* lookupSignalState(const char* name, const CanSignal* signa
  */
 const CanSignalState* lookupSignalState(int value, const CanSignal* signal);
 
+/* Public: Build a bus's message definition index from the predefined messages,
+ * so lookupMessageDefinition takes constant time from the first message. Call
+ * this when initializing the bus.
+ *
+ * bus - The CanBus to index.
+ * predefinedMessages - The list of predefined CAN messages.
+ * predefinedMessageCount - The length of the predefined messages array.
+ *
+ * Returns false, and logs the CAN_MESSAGE_COUNT the message set needs, if the
+ * index is too small to hold all of the messages on the bus.
+ */
+bool indexMessageDefinitions(CanBus* bus,
+        CanMessageDefinition* predefinedMessages, int predefinedMessageCount);
+
 /* Public: Search all predefined and dynamically configured CAN messages for one
  * matching the given ID.
  *
+ * This uses the bus's message index, so it takes constant time regardless of
+ * how many messages are defined. The index is built from the predefined
+ * messages the first time they're searched, and rebuilt if a different array
+ * is passed. If predefinedMessages is NULL, only dynamic messages are matched.
+ *
  * bus - The CanBus to search for the message.
  * id - The ID of the CAN message.
  * format - The format of the ID of the message.
@@ -542,12 +767,19 @@ bool configureDefaultFilters(CanBus* bus, const CanMessageDefinition* messages,
  *
  * Returns true if the filter was added or already existed. Returns false if the
  * filter could not be added because of a CAN controller error or because all
- * available filter slots are taken.
+ * available filter slots are taken. Inside a beginAcceptanceFilterUpdate()
+ * batch, CAN controller errors are instead reported by
+ * commitAcceptanceFilterUpdate().
  */
 bool addAcceptanceFilter(CanBus* bus, uint32_t id, CanMessageFormat format,
         CanBus* buses, const int busCount);
 
 /* Public: Remove a CAN message acceptance filter from the given bus.
+ *
+ * Inside a beginAcceptanceFilterUpdate() batch, a filter with no remaining
+ * users stays in place until the batch is committed - if it's added again in
+ * the meantime, e.g. by the next diagnostic request for the same ID, the
+ * hardware AF table doesn't need to be rewritten at all.
  *
  * bus - The CanBus to remove the filter from.
  * id - The value of the new filter.
@@ -562,6 +794,33 @@ bool addAcceptanceFilter(CanBus* bus, uint32_t id, CanMessageFormat format,
 void removeAcceptanceFilter(CanBus* bus, uint32_t id, CanMessageFormat format,
         CanBus* buses, const int busCount);
 
+/* Public: Start a batch of acceptance filter changes.
+ *
+ * Rewriting the hardware AF table is slow, and it has to be rewritten in full
+ * for every change. Until the matching call to commitAcceptanceFilterUpdate(),
+ * calls to addAcceptanceFilter(), removeAcceptanceFilter() and
+ * setAcceptanceFilterStatus() only change the software filters, and the table
+ * is rewritten once at the end. Batches may be nested - only the outermost
+ * commit updates the table.
+ */
+void beginAcceptanceFilterUpdate();
+
+/* Public: Finish a batch of acceptance filter changes started with
+ * beginAcceptanceFilterUpdate(), and if it was the outermost batch, update the
+ * hardware AF table if the filters on any bus actually changed.
+ *
+ * buses - An array of all active CanBus instances.
+ * busCount - The length of the buses array.
+ *
+ * If the AF table can't be updated, the filters added during the batch are
+ * removed again, as addAcceptanceFilter() does outside of a batch, and the
+ * table is rewritten with the filters that were already there.
+ *
+ * Returns true if the AF table didn't need to be updated yet, or was updated
+ * successfully.
+ */
+bool commitAcceptanceFilterUpdate(CanBus* buses, const int busCount);
+
 /* Private: Apply the CAN acceptance filter configuration from software (on the
  * CanBus struct) to the actual hardware CAN controllers.
  *
@@ -609,7 +868,9 @@ bool setAcceptanceFilterStatus(CanBus* bus, bool enabled,
  */
 bool signalsWritable(CanBus* bus, CanSignal* signals, int signalCount);
 
-/* Public: Log transfer statistics about all active CAN buses to the debug log.
+/* Public: Sample transfer statistics about all active CAN buses and, if
+ * calculateMetrics is set in the configuration, log them to the debug log.
+ * Call this once each pass of the main loop.
  *
  * buses - an array of active CAN buses.
  * busCount - the length of the buses array.
@@ -622,12 +883,57 @@ void logBusStatistics(CanBus* buses, const int busCount);
  * bus has the AF off but we still want to filter on the other, we use this to
  * do software filtering based on the registered CAN messages.
  *
+ * This is called from the CAN interrupt handler, so it takes constant time
+ * regardless of the number of filters - standard IDs are checked in a bitmap
+ * and extended IDs in a small hash set.
+ *
  * bus - The bus the message was received on.
  * messageId - the ID of the message.
+ * format - the format of the message's ID.
  *
  * Returns true if the message should be accepted.
  */
-bool shouldAcceptMessage(CanBus* bus, uint32_t messageId);
+bool shouldAcceptMessage(CanBus* bus, uint32_t messageId,
+        CanMessageFormat format);
+
+/* Public: Return the maximum number of messages to hold in a CAN message
+ * queue, given its configured depth.
+ *
+ * depth - the depth configured for the queue, e.g. a CanBus's
+ *      receiveQueueDepth. If 0 or larger than the capacity of the queue, the
+ *      full capacity is used.
+ */
+int effectiveQueueDepth(unsigned short depth);
+
+/* Public: Add a CAN message to a queue, without exceeding its configured depth,
+ * and record the queue's occupancy.
+ *
+ * This is safe to call from an interrupt handler.
+ *
+ * queue - the queue to add the message to.
+ * depth - the configured depth of the queue (see effectiveQueueDepth).
+ * metrics - the occupancy metrics to update for the queue.
+ * message - the message to add.
+ *
+ * Returns true if the message was queued, or false if the queue was full and
+ * it was dropped.
+ */
+bool pushCanMessage(QUEUE_TYPE(CanMessage)* queue, unsigned short depth,
+        CanQueueMetrics* metrics, const CanMessage* message);
+
+/* Public: Add a message received from a CAN controller to the bus's receive
+ * queue, for decoding in the main loop.
+ *
+ * This is meant to be called from the CAN receive interrupt handler. If the
+ * queue is full, the message is dropped and counted in the bus's
+ * messagesDropped.
+ *
+ * bus - the bus the message was received on.
+ * message - the received message.
+ *
+ * Returns true if the message was queued.
+ */
+bool enqueueReceivedMessage(CanBus* bus, const CanMessage* message);
 
 } // can
 } // openxc
@@ -51,7 +51,11 @@ void openxc::can::write::enqueueMessage(CanBus* bus, CanMessage* message) {
     memcpy(outgoingMessage.data, message->data, CAN_MESSAGE_SIZE);
     outgoingMessage.length = (uint8_t)(message->length == 0 ?
             CAN_MESSAGE_SIZE : message->length);
-    QUEUE_PUSH(CanMessage, &bus->sendQueue, outgoingMessage);
+    if(!can::pushCanMessage(&bus->sendQueue, bus->sendQueueDepth,
+                &bus->sendQueueMetrics, &outgoingMessage)) {
+        debug("Dropped outgoing CAN message with ID 0x%02x -- queue is full",
+                outgoingMessage.id);
+    }
 }
 
 uint64_t openxc::can::write::encodeDynamicField(const CanSignal* signal,
@@ -21,8 +21,18 @@ void openxc::signals::initialize(DiagnosticsManager* diagnosticsManager) { }
 
 void openxc::signals::loop() { }
 
+#ifndef __TABLE_DRIVEN_DECODING__
 void openxc::signals::decodeCanMessage(Pipeline* pipeline, CanBus* bus, CanMessage* message) {
 }
+#endif
+
+const openxc::can::read::MessageDecoder* openxc::signals::getMessageDecoders() {
+    return NULL;
+}
+
+int openxc::signals::getMessageDecoderCount() {
+    return -1;
+}
 
 CanCommand* openxc::signals::getCommands() {
     return NULL;
@@ -19,18 +19,27 @@
 #include "commands/modem_config_command.h"
 #include "commands/rtc_config_command.h"
 #include "commands/sd_mount_status_command.h"
+#include "commands/subscription_command.h"
+#include "commands/metrics_command.h"
 
 
 using openxc::util::log::debug;
 using openxc::config::getConfiguration;
 using openxc::payload::PayloadFormat;
 using openxc::interface::InterfaceType;
+using openxc::payload::SUBSCRIBE_COMMAND_TYPE;
+using openxc::payload::UNSUBSCRIBE_COMMAND_TYPE;
+using openxc::payload::METRICS_COMMAND_TYPE;
 
-static bool handleComplexCommand(openxc_VehicleMessage* message) {
+static bool handleComplexCommand(openxc_VehicleMessage* message,
+        openxc::interface::InterfaceDescriptor* sourceInterfaceDescriptor) {
     bool status = true;
     if(message != NULL && message->has_control_command) {
         openxc_ControlCommand* command = &message->control_command;
-        switch(command->type) {
+        // Switch on the int value to include the command types that are local
+        // to this firmware, which are outside of the openxc_ControlCommand_Type
+        // enum.
+        switch((int)command->type) {
         case openxc_ControlCommand_Type_DIAGNOSTIC:
             status = openxc::commands::handleDiagnosticRequestCommand(command);
             break;
@@ -53,7 +62,8 @@ static bool handleComplexCommand(openxc_VehicleMessage* message) {
             status = openxc::commands::handleFilterBypassCommand(command);
             break;
         case openxc_ControlCommand_Type_PAYLOAD_FORMAT:
-            status = openxc::commands::handlePayloadFormatCommand(command);
+            status = openxc::commands::handlePayloadFormatCommand(command,
+                    sourceInterfaceDescriptor);
             break;
         case openxc_ControlCommand_Type_MODEM_CONFIGURATION:
             status = openxc::commands::handleModemConfigurationCommand(command);
@@ -63,6 +73,15 @@ static bool handleComplexCommand(openxc_VehicleMessage* message) {
         break;
         case openxc_ControlCommand_Type_SD_MOUNT_STATUS:
             status =  openxc::commands::handleSDMountStatusCommand();
+            break;
+        case METRICS_COMMAND_TYPE:
+            status = openxc::commands::handleMetricsCommand();
+            break;
+        case SUBSCRIBE_COMMAND_TYPE:
+        case UNSUBSCRIBE_COMMAND_TYPE:
+            status = openxc::commands::handleSubscriptionCommand(message,
+                    sourceInterfaceDescriptor);
+            break;
         default:
             status = false;
             break;
@@ -78,8 +97,9 @@ size_t openxc::commands::handleIncomingMessage(uint8_t payload[], size_t length,
 
     // TODO Not attempting to deserialize binary messages via UART,
     // see https://github.com/openxc/vi-firmware/issues/313
+    PayloadFormat format = interface::payloadFormat(sourceInterfaceDescriptor);
     if(sourceInterfaceDescriptor->type == InterfaceType::UART &&
-            getConfiguration()->payloadFormat == PayloadFormat::PROTOBUF) {
+            format == PayloadFormat::PROTOBUF) {
         return 0;
     }
 
@@ -87,7 +107,7 @@ size_t openxc::commands::handleIncomingMessage(uint8_t payload[], size_t length,
     // wait for more to come in before trying to parse it
     if(length > 2) {
         if((bytesRead = openxc::payload::deserialize(payload, length,
-                getConfiguration()->payloadFormat, &message)) > 0) {
+                format, &message)) > 0) {
             if(validate(&message)) {
                 switch(message.type) {
                 case openxc_VehicleMessage_Type_CAN:
@@ -97,7 +117,7 @@ size_t openxc::commands::handleIncomingMessage(uint8_t payload[], size_t length,
                     handleSimple(&message);
                     break;
                 case openxc_VehicleMessage_Type_CONTROL_COMMAND:
-                    handleComplexCommand(&message);
+                    handleComplexCommand(&message, sourceInterfaceDescriptor);
                     break;
                 default:
                     debug("Incoming message had unrecognized type: %d", message.type);
@@ -111,7 +131,7 @@ size_t openxc::commands::handleIncomingMessage(uint8_t payload[], size_t length,
             // in a couple or bursts and is passed to this function when
             // incomplete.
             // debug("Unable to deserialize a %s message from the payload",
-                 // getConfiguration()->payloadFormat == PayloadFormat::JSON ?
+                 // format == PayloadFormat::JSON ?
                      // "JSON" : "Protobuf");
         }
     }
@@ -124,7 +144,7 @@ static bool validateControlCommand(openxc_VehicleMessage* message) {
             message->has_control_command &&
             message->control_command.has_type;
     if(valid) {
-        switch(message->control_command.type) {
+        switch((int)message->control_command.type) {
         case openxc_ControlCommand_Type_DIAGNOSTIC:
             valid = openxc::commands::validateDiagnosticRequest(message);
             break;
@@ -144,6 +164,7 @@ static bool validateControlCommand(openxc_VehicleMessage* message) {
         case openxc_ControlCommand_Type_DEVICE_ID:
         case openxc_ControlCommand_Type_PLATFORM:
         case openxc_ControlCommand_Type_SD_MOUNT_STATUS:
+        case METRICS_COMMAND_TYPE:
             valid =  true;
             break;
         case openxc_ControlCommand_Type_MODEM_CONFIGURATION:
@@ -152,6 +173,10 @@ static bool validateControlCommand(openxc_VehicleMessage* message) {
         case openxc_ControlCommand_Type_RTC_CONFIGURATION:
             valid = openxc::commands::validateRTCConfigurationCommand(message);
             break;    
+        case SUBSCRIBE_COMMAND_TYPE:
+        case UNSUBSCRIBE_COMMAND_TYPE:
+            valid = openxc::commands::validateSubscriptionCommand(message);
+            break;
         default:
             valid = false;
             break;
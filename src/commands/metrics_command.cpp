@@ -0,0 +1,105 @@
+#include "metrics_command.h"
+
+#include <sys/param.h>
+
+#include "config.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "signals.h"
+#include "util/statistics.h"
+#include <can/canutil.h>
+
+using openxc::signals::getCanBuses;
+using openxc::signals::getCanBusCount;
+using openxc::config::getConfiguration;
+using openxc::can::effectiveQueueDepth;
+using openxc::interface::InterfaceDescriptor;
+using openxc::interface::InterfaceType;
+using openxc::pipeline::EndpointMetrics;
+using openxc::metrics::MetricsSnapshot;
+using openxc::metrics::BusMetrics;
+using openxc::metrics::InterfaceMetrics;
+using openxc::metrics::QueueMetrics;
+using openxc::util::statistics::Histogram;
+
+namespace statistics = openxc::util::statistics;
+namespace metrics = openxc::metrics;
+
+#define LATENCY_PERCENTILE 99
+
+static void copyQueueMetrics(const CanQueueMetrics* source,
+        unsigned short depth, QueueMetrics* metrics) {
+    metrics->highWaterMark = source->highWaterMark;
+    metrics->depth = effectiveQueueDepth(depth);
+    metrics->overflows = source->overflowCount;
+    metrics->firstOverflowMs = source->firstOverflow;
+}
+
+static void copyBusMetrics(CanBus* bus, BusMetrics* metrics) {
+    metrics->address = bus->address;
+    metrics->received = bus->messagesReceived;
+    metrics->dropped = bus->messagesDropped;
+    copyQueueMetrics(&bus->receiveQueueMetrics, bus->receiveQueueDepth,
+            &metrics->receiveQueue);
+    copyQueueMetrics(&bus->sendQueueMetrics, bus->sendQueueDepth,
+            &metrics->sendQueue);
+    metrics->receiveLatencyUs = statistics::percentileUs(
+            &bus->receiveQueueLatency, LATENCY_PERCENTILE);
+    metrics->receiveLatencyMaxUs = bus->receiveQueueLatency.max;
+    metrics->decodeLatencyUs = statistics::percentileUs(&bus->processLatency,
+            LATENCY_PERCENTILE);
+    metrics->decodeLatencyMaxUs = bus->processLatency.max;
+}
+
+/* Private: Fill in the metrics of an interface.
+ *
+ * Returns false if the interface hasn't had anything to send.
+ */
+static bool copyInterfaceMetrics(InterfaceType type,
+        InterfaceMetrics* metrics) {
+    EndpointMetrics endpoint;
+    if(!openxc::pipeline::endpointMetrics(type, &endpoint)) {
+        return false;
+    }
+
+    InterfaceDescriptor descriptor;
+    descriptor.type = type;
+    metrics->name = openxc::interface::descriptorToString(&descriptor);
+    metrics->sent = endpoint.sent;
+    metrics->dropped = endpoint.dropped;
+    metrics->bytesSent = endpoint.bytesSent;
+    // The maximum is below 0 until the first sample
+    metrics->maxQueueFill = MAX(statistics::maximum(&endpoint.sendQueueFill),
+            0);
+
+    const Histogram* latency = openxc::pipeline::sendLatency(
+            &getConfiguration()->pipeline, type);
+    metrics->latencyUs = latency != NULL ?
+            statistics::percentileUs(latency, LATENCY_PERCENTILE) : 0;
+    metrics->latencyMaxUs = latency != NULL ? latency->max : 0;
+    return true;
+}
+
+bool openxc::commands::handleMetricsCommand() {
+    MetricsSnapshot snapshot = {0};
+    snapshot.busCount = MIN(getCanBusCount(), MAX_METRICS_CAN_BUSES);
+    for(int i = 0; i < snapshot.busCount; i++) {
+        copyBusMetrics(&getCanBuses()[i], &snapshot.buses[i]);
+    }
+
+    for(int i = InterfaceType::USB; i <= InterfaceType::FS &&
+            snapshot.interfaceCount < MAX_METRICS_INTERFACES; i++) {
+        if(copyInterfaceMetrics((InterfaceType) i,
+                    &snapshot.interfaces[snapshot.interfaceCount])) {
+            ++snapshot.interfaceCount;
+        }
+    }
+
+    const metrics::LoopMetrics* loop = metrics::loopMetrics();
+    snapshot.loopPasses = loop->passes;
+    snapshot.loopAverageUs = metrics::averageLoopPassUs();
+    snapshot.loopMaxUs = loop->maxUs;
+
+    openxc::pipeline::publishMetrics(&snapshot, &getConfiguration()->pipeline);
+    return true;
+}
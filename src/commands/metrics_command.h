@@ -0,0 +1,24 @@
+#ifndef __METRICS_COMMAND_H__
+#define __METRICS_COMMAND_H__
+
+namespace openxc {
+namespace commands {
+
+/* Public: Respond with a snapshot of the health metrics of each CAN bus and
+ * output interface, and of the main loop. Unlike the debug log these are
+ * available in every build, and the snapshot is only serialized on request.
+ *
+ * The whole snapshot is sent as one command response, with integer values
+ * only - the message counts and queue state of each CAN bus, the traffic and
+ * send queue fill of each interface that has had anything to send, the 99th
+ * percentile and maximum latency of each stage, and the timing of the main
+ * loop. See payload::json::serializeMetrics for the layout.
+ *
+ * Returns true if the response was sent.
+ */
+bool handleMetricsCommand();
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __METRICS_COMMAND_H__
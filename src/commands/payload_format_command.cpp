@@ -27,7 +27,8 @@ bool openxc::commands::validatePayloadFormatCommand(openxc_VehicleMessage* messa
     return valid;
 }
 
-bool openxc::commands::handlePayloadFormatCommand(openxc_ControlCommand* command) {
+bool openxc::commands::handlePayloadFormatCommand(openxc_ControlCommand* command,
+        openxc::interface::InterfaceDescriptor* sourceInterfaceDescriptor) {
     bool status = false;
     PayloadFormat format;
     if(command->has_payload_format_command) {
@@ -54,8 +55,10 @@ bool openxc::commands::handlePayloadFormatCommand(openxc_ControlCommand* command
 
     if(status) {
         // Don't change format until we've sent the response
-        getConfiguration()->payloadFormat = format;
-        debug("Set message format to %s",
+        sourceInterfaceDescriptor->hasPayloadFormat = true;
+        sourceInterfaceDescriptor->payloadFormat = format;
+        debug("Set message format for %s to %s",
+                interface::descriptorToString(sourceInterfaceDescriptor),
                 format == PayloadFormat::JSON ? "JSON" : "binary" );
     }
 
@@ -0,0 +1,84 @@
+#include "subscription_command.h"
+
+#include "commands/commands.h"
+#include "config.h"
+#include "payload/payload.h"
+#include "pipeline.h"
+#include "signals.h"
+#include "util/log.h"
+#include <can/canutil.h>
+
+using openxc::util::log::debug;
+using openxc::interface::InterfaceType;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
+using openxc::payload::SUBSCRIBE_COMMAND_TYPE;
+using openxc::payload::UNSUBSCRIBE_COMMAND_TYPE;
+
+namespace pipeline = openxc::pipeline;
+
+bool openxc::commands::validateSubscriptionCommand(
+        openxc_VehicleMessage* message) {
+    bool hasSignal = message->has_simple_message &&
+            message->simple_message.has_name;
+    bool hasCanMessage = message->has_can_message &&
+            message->can_message.has_bus && message->can_message.has_id;
+    if(hasSignal && hasCanMessage) {
+        return false;
+    }
+    return hasSignal || hasCanMessage ||
+            message->control_command.type == UNSUBSCRIBE_COMMAND_TYPE;
+}
+
+bool openxc::commands::handleSubscriptionCommand(
+        openxc_VehicleMessage* message,
+        openxc::interface::InterfaceDescriptor* sourceInterfaceDescriptor) {
+    openxc_ControlCommand_Type commandType = message->control_command.type;
+    bool subscribe = commandType == SUBSCRIBE_COMMAND_TYPE;
+    InterfaceType interfaceType = sourceInterfaceDescriptor->type;
+    bool status = false;
+
+    if(message->has_simple_message && message->simple_message.has_name) {
+        const CanSignal* signal = can::lookupSignal(
+                message->simple_message.name, getSignals(), getSignalCount());
+        if(signal != NULL) {
+            int signalIndex = signal - getSignals();
+            if(subscribe) {
+                // Without a frequency, any earlier limit is removed. The limit
+                // is set first so that if the rate limit table is full, the
+                // interface isn't left subscribed at full rate.
+                float frequency = message->simple_message.has_value ?
+                        message->simple_message.value.numeric_value : 0;
+                status = pipeline::setSignalRateLimit(interfaceType,
+                        signalIndex, frequency);
+                if(!status) {
+                    debug("No room to limit the rate of %s, not subscribing",
+                            message->simple_message.name);
+                } else if(!pipeline::subscribeToSignal(interfaceType,
+                            signalIndex)) {
+                    pipeline::setSignalRateLimit(interfaceType, signalIndex, 0);
+                    status = false;
+                }
+            } else {
+                status = pipeline::unsubscribeFromSignal(interfaceType,
+                        signalIndex);
+                pipeline::setSignalRateLimit(interfaceType, signalIndex, 0);
+            }
+        } else {
+            debug("No signal named %s to subscribe to",
+                    message->simple_message.name);
+        }
+    } else if(message->has_can_message) {
+        status = subscribe ?
+                pipeline::subscribeToCanMessage(interfaceType,
+                    message->can_message.bus, message->can_message.id) :
+                pipeline::unsubscribeFromCanMessage(interfaceType,
+                    message->can_message.bus, message->can_message.id);
+    } else if(!subscribe) {
+        pipeline::clearSubscriptions(interfaceType);
+        status = true;
+    }
+
+    sendCommandResponse(commandType, status);
+    return status;
+}
@@ -0,0 +1,36 @@
+#ifndef __SUBSCRIPTION_COMMAND_H__
+#define __SUBSCRIPTION_COMMAND_H__
+
+#include "openxc.pb.h"
+#include "interface/interface.h"
+
+namespace openxc {
+namespace commands {
+
+/* Public: Validate a subscribe or unsubscribe command.
+ *
+ * A subscribe command must name a signal (in the message's simple_message
+ * field) or a raw CAN message by bus and ID (in its can_message field). An
+ * unsubscribe command with neither clears all of the interface's subscriptions.
+ *
+ * Returns true if the command is valid.
+ */
+bool validateSubscriptionCommand(openxc_VehicleMessage* message);
+
+/* Public: Add or remove a subscription for the interface the command was
+ * received on, so it only receives the signals and raw CAN messages it wants.
+ * A signal subscription with a value in the simple_message field also limits
+ * the interface to receiving that many values of the signal per second.
+ *
+ * message - The deserialized subscribe or unsubscribe command.
+ * sourceInterfaceDescriptor - The interface that sent the command.
+ *
+ * Returns true if the subscription was changed.
+ */
+bool handleSubscriptionCommand(openxc_VehicleMessage* message,
+        openxc::interface::InterfaceDescriptor* sourceInterfaceDescriptor);
+
+} // namespace commands
+} // namespace openxc
+
+#endif // __SUBSCRIPTION_COMMAND_H__
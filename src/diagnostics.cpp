@@ -21,6 +21,8 @@ using openxc::util::log::debug;
 using openxc::can::lookupBus;
 using openxc::can::addAcceptanceFilter;
 using openxc::can::removeAcceptanceFilter;
+using openxc::can::beginAcceptanceFilterUpdate;
+using openxc::can::commitAcceptanceFilterUpdate;
 using openxc::can::read::publishNumericalMessage;
 using openxc::pipeline::Pipeline;
 using openxc::signals::getCanBuses;
@@ -62,6 +64,7 @@ static bool requestCompleted(ActiveDiagnosticRequest* request) {
 static void cancelRequest(DiagnosticsManager* manager,
         ActiveDiagnosticRequest* entry) {
     LIST_INSERT_HEAD(&manager->freeRequestEntries, entry, listEntries);
+    beginAcceptanceFilterUpdate();
     if(entry->arbitration_id == OBD2_FUNCTIONAL_BROADCAST_ID) {
         for(uint32_t filter = OBD2_FUNCTIONAL_RESPONSE_START;
                 filter < OBD2_FUNCTIONAL_RESPONSE_START +
@@ -77,6 +80,10 @@ static void cancelRequest(DiagnosticsManager* manager,
                     DIAGNOSTIC_RESPONSE_ARBITRATION_ID_OFFSET,
                 CanMessageFormat::STANDARD, getCanBuses(), getCanBusCount());
     }
+    if(!commitAcceptanceFilterUpdate(getCanBuses(), getCanBusCount())) {
+        debug("Unable to update AF table after removing filters for 0x%x",
+                entry->arbitration_id);
+    }
 }
 
 static void cleanupRequest(DiagnosticsManager* manager,
@@ -229,7 +236,7 @@ static void sendRequest(DiagnosticsManager* manager, CanBus* bus,
             debug("Fatal error sending diagnostic request");
         } else {
             request->timeoutClock = {0};
-            request->timeoutClock.frequency = 10;
+            time::setFrequency(&request->timeoutClock, 10);
             time::tick(&request->timeoutClock);
             request->inFlight = true;
         }
@@ -405,6 +412,7 @@ static ActiveDiagnosticRequest* getFreeEntry(DiagnosticsManager* manager) {
 static bool updateRequiredAcceptanceFilters(CanBus* bus,
         DiagnosticRequest* request) {
     bool filterStatus = true;
+    beginAcceptanceFilterUpdate();
     if(request->arbitration_id == OBD2_FUNCTIONAL_BROADCAST_ID) {
         for(uint32_t filter = OBD2_FUNCTIONAL_RESPONSE_START;
                 filter < OBD2_FUNCTIONAL_RESPONSE_START +
@@ -421,6 +429,8 @@ static bool updateRequiredAcceptanceFilters(CanBus* bus,
                 CanMessageFormat::STANDARD,
                 getCanBuses(), getCanBusCount());
     }
+    filterStatus = commitAcceptanceFilterUpdate(getCanBuses(),
+            getCanBusCount()) && filterStatus;
 
     if(!filterStatus) {
         debug("Couldn't add filter 0x%x to bus %d", request->arbitration_id,
@@ -449,10 +459,11 @@ static void updateDiagnosticRequestEntry(ActiveDiagnosticRequest* entry,
     entry->callback = callback;
     entry->recurring = frequencyHz != 0;
     entry->frequencyClock = {0};
-    entry->frequencyClock.frequency = entry->recurring ? frequencyHz : 0;
+    time::setFrequency(&entry->frequencyClock,
+            entry->recurring ? frequencyHz : 0);
     // time out after 100ms
     entry->timeoutClock = {0};
-    entry->timeoutClock.frequency = 10;
+    time::setFrequency(&entry->timeoutClock, 10);
     entry->inFlight = false;
 }
 
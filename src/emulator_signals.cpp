@@ -46,8 +46,18 @@ const int MAX_COMMAND_COUNT = 1;
 CanCommand COMMANDS[][MAX_COMMAND_COUNT] = {
 };
 
+#ifdef __TABLE_DRIVEN_DECODING__
+const openxc::can::read::MessageDecoder* openxc::signals::getMessageDecoders() {
+    return NULL;
+}
+
+int openxc::signals::getMessageDecoderCount() {
+    return 0;
+}
+#else
 void openxc::signals::decodeCanMessage(Pipeline* pipeline, CanBus* bus, CanMessage* message) {
 }
+#endif
 
 
 CanCommand* openxc::signals::getCommands() {
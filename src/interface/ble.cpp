@@ -11,8 +11,10 @@ void openxc::interface::ble::initializeCommon(BleDevice* device) {
     if(device != NULL) {
         debug("Initializing Bluetooth Low Energy common...");
         QUEUE_INIT(uint8_t,(QUEUE_TYPE(uint8_t)* ) &device->receiveQueue);//messages received over BLE characteristic write
-        QUEUE_INIT(uint8_t,(QUEUE_TYPE(uint8_t)* ) &device->sendQueue);
+        openxc::util::messagepool::initializeQueue(&device->sendQueue);
         device->descriptor.type = InterfaceType::BLE;
+        device->descriptor.backpressurePolicy = BackpressurePolicy::DROP_OLDEST;
+        device->descriptor.maxBytesPerSecond = BLE_MAX_BYTES_PER_SECOND;
     }
 }
 
@@ -4,7 +4,19 @@
 #include <stdlib.h>
 #include "interface/interface.h"
 #include "util/bytebuffer.h"
+#include "util/messagepool.h"
 
+// The most data to queue for BLE per second, or 0 for no limit - the link
+// saturates at a few KB/s, past which messages only pile up in the queue.
+#ifndef BLE_MAX_BYTES_PER_SECOND
+#define BLE_MAX_BYTES_PER_SECOND 0
+#endif
+
+// How long to hold back less than a full notification of data, waiting for
+// more messages to fill it.
+#ifndef BLE_COALESCE_MAX_LATENCY_MS
+#define BLE_COALESCE_MAX_LATENCY_MS 1000
+#endif
 
 namespace openxc {
 namespace interface {
@@ -14,7 +26,7 @@ namespace ble {
  * output.
  *
  * descriptor - A general descriptor for this interface.
- * sendQueue - A queue of bytes that need to be sent out over an IP network.
+ * sendQueue - A queue of messages that need to be sent out over BLE.
  * receiveQueue - A queue of bytes that have been received via an IP network but
  *      not yet processed.
  */
@@ -47,7 +59,7 @@ typedef enum {
 typedef struct {
     InterfaceDescriptor descriptor;
     BleSettings         blesettings;
-    QUEUE_TYPE(uint8_t) sendQueue;
+    openxc::util::messagepool::MessageQueue sendQueue;
     QUEUE_TYPE(uint8_t) receiveQueue;
     bool configured;
     BleStatus status;
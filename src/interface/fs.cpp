@@ -8,7 +8,8 @@ using openxc::util::log::debug;
 void openxc::interface::fs::initializeCommon(FsDevice* device) {
     if(device != NULL) {
         device->descriptor.type = InterfaceType::FS;
-        QUEUE_INIT(uint8_t,(QUEUE_TYPE(uint8_t)* ) &device->sendQueue);
+        device->descriptor.backpressurePolicy = BackpressurePolicy::DROP_OLDEST;
+        openxc::util::messagepool::initializeQueue(&device->sendQueue);
     }
 }
 
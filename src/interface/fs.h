@@ -3,7 +3,8 @@
 
 #include <stdlib.h>
 #include "interface/interface.h"
-#include "util/bytebuffer.h" //to do remove this and add custom type to have 512 size
+#include "util/bytebuffer.h"
+#include "util/messagepool.h" //to do remove this and add custom type to have 512 size
 #include "platform_profile.h"
 
 
@@ -23,7 +24,7 @@ namespace fs {
 typedef struct {
     InterfaceDescriptor descriptor;
     //since our write speeds are much higher to the SD card we are excluding the queue here
-    QUEUE_TYPE(uint8_t) sendQueue;
+    openxc::util::messagepool::MessageQueue sendQueue;
     uint8_t buffer[FS_BUF_SZ];
     bool configured;
 } FsDevice;
@@ -25,6 +25,14 @@ const char* openxc::interface::descriptorToString(InterfaceDescriptor* descripto
     return "Unknown";
 }
 
+openxc::payload::PayloadFormat openxc::interface::payloadFormat(
+        InterfaceDescriptor* descriptor) {
+    if(descriptor != NULL && descriptor->hasPayloadFormat) {
+        return descriptor->payloadFormat;
+    }
+    return getConfiguration()->payloadFormat;
+}
+
 bool openxc::interface::anyConnected() {
     return  openxc::interface::uart::connected   (&getConfiguration()->uart   ) ||
             openxc::interface::usb::connected    (&getConfiguration()->usb    ) ||
@@ -1,6 +1,7 @@
 #ifndef __INTERFACE_H__
 #define __INTERFACE_H__
 #include "platform_profile.h"
+#include "payload/payload.h"
 namespace openxc {
 namespace interface {
 
@@ -13,19 +14,58 @@ typedef enum {
     FS = 5,
 } InterfaceType;
 
+/* Public: What the pipeline does with a new message when an interface's send
+ * queue is full.
+ *
+ * DROP_NEWEST - Drop the new message.
+ * DROP_OLDEST - Drop the oldest queued messages until the new one fits. Only
+ *      for interfaces whose send queue is read from the main loop, never from
+ *      an interrupt handler.
+ * BOUNDED_WAIT - Process only this interface's send queue until the new message
+ *      fits, then drop the new message if it still doesn't. All of the waits
+ *      in a pass of the main loop share backpressureWaitUs, and after one
+ *      runs out, new messages are dropped without waiting until the next pass.
+ */
+typedef enum {
+    DROP_NEWEST,
+    DROP_OLDEST,
+    BOUNDED_WAIT,
+} BackpressurePolicy;
+
 /* Public:
  *
  * type - The type of this interface, one of InterfaceType.
  * allowRawWrites - if raw CAN messages writes are enabled for a bus and this is
  *      true, accept raw write requests from the USB interface.
+ * backpressurePolicy - How to handle a full send queue, one of
+ *      BackpressurePolicy.
+ * backpressureWaitUs - For the BOUNDED_WAIT policy, the longest time in
+ *      microseconds to wait for room in the send queue in each pass of the
+ *      main loop.
+ * maxBytesPerSecond - The most data to queue for this interface per second,
+ *      averaged over a second, or 0 for no limit. Messages over the limit are
+ *      dropped, except replies to commands and diagnostic requests.
+ * hasPayloadFormat - If true, this interface sends and receives messages in
+ *      its own payloadFormat instead of the configured default.
+ * payloadFormat - The payload format for this interface, if hasPayloadFormat.
  */
 typedef struct {
     bool allowRawWrites;
     InterfaceType type;
+    BackpressurePolicy backpressurePolicy;
+    unsigned long backpressureWaitUs;
+    unsigned long maxBytesPerSecond;
+    bool hasPayloadFormat;
+    openxc::payload::PayloadFormat payloadFormat;
 } InterfaceDescriptor;
 
 const char* descriptorToString(InterfaceDescriptor* descriptor);
 
+/* Public: Return the payload format to use for messages sent and received on
+ * an interface - its own if it has one, otherwise the configured default.
+ */
+openxc::payload::PayloadFormat payloadFormat(InterfaceDescriptor* descriptor);
+
 /* Public: Return true if any of the output interfaces is connected.
  */
 bool anyConnected();
@@ -11,8 +11,9 @@ void openxc::interface::network::initializeCommon(NetworkDevice* device) {
     if(device != NULL) {
         debug("Initializing Network...");
         QUEUE_INIT(uint8_t, &device->receiveQueue);
-        QUEUE_INIT(uint8_t, &device->sendQueue);
+        openxc::util::messagepool::initializeQueue(&device->sendQueue);
         device->descriptor.type = InterfaceType::NETWORK;
+        device->descriptor.backpressurePolicy = BackpressurePolicy::DROP_OLDEST;
     }
 }
 
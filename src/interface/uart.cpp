@@ -13,9 +13,12 @@ void openxc::interface::uart::initializeCommon(UartDevice* device) {
     if(device != NULL) {
         debug("Initializing UART.....");
         QUEUE_INIT(uint8_t, &device->receiveQueue);
-        QUEUE_INIT(uint8_t, &device->sendQueue);
+        openxc::util::messagepool::initializeQueue(&device->sendQueue);
 
         device->descriptor.type = InterfaceType::UART;
+        // The LPC17xx sends from the UART interrupt handler, so the pipeline
+        // can't remove old messages from under it.
+        device->descriptor.backpressurePolicy = BackpressurePolicy::DROP_NEWEST;
     }
 }
 
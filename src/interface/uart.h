@@ -5,6 +5,7 @@
 
 #include "interface.h"
 #include "util/bytebuffer.h"
+#include "util/messagepool.h"
 
 #define MAX_DEVICE_ID_LENGTH 17
 
@@ -21,7 +22,7 @@ extern const int BAUD_RATE;
  * descriptor - A general descriptor for this interface.
  * baudRate - the desired baud rate for the interface.
  *
- * sendQueue - A queue of bytes that need to be sent out over UART.
+ * sendQueue - A queue of messages that need to be sent out over UART.
  * receiveQueue - A queue of bytes that have been received via UART but not yet
  *      processed.
  * controller - A pointer to the hardware UART device to use for OpenXC messages.
@@ -33,7 +34,7 @@ typedef struct {
     int baudRate;
 
     // device to host
-    QUEUE_TYPE(uint8_t) sendQueue;
+    openxc::util::messagepool::MessageQueue sendQueue;
     // host to device
     QUEUE_TYPE(uint8_t) receiveQueue;
     void* controller;
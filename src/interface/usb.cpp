@@ -9,10 +9,16 @@ using openxc::util::log::debug;
 void openxc::interface::usb::initializeCommon(UsbDevice* usbDevice) {
     debug("Initializing USB.....");
     for(int i = 0; i < ENDPOINT_COUNT; i++) {
-        QUEUE_INIT(uint8_t, &usbDevice->endpoints[i].queue);
+        openxc::util::messagepool::initializeQueue(
+                &usbDevice->endpoints[i].sendQueue);
+        openxc::util::coalesce::initialize(&usbDevice->endpoints[i].coalescer,
+                MAX_USB_PACKET_SIZE_BYTES, USB_COALESCE_MAX_LATENCY_MS);
     }
+    QUEUE_INIT(uint8_t, &usbDevice->receiveQueue);
     usbDevice->configured = false;
     usbDevice->descriptor.type = InterfaceType::USB;
+    usbDevice->descriptor.backpressurePolicy = BackpressurePolicy::BOUNDED_WAIT;
+    usbDevice->descriptor.backpressureWaitUs = USB_BACKPRESSURE_WAIT_US;
 }
 
 void openxc::interface::usb::deinitializeCommon(UsbDevice* usbDevice) {
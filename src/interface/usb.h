@@ -11,11 +11,25 @@
 #include "interface.h"
 #include "usb_config.h"
 #include "util/bytebuffer.h"
+#include "util/messagepool.h"
+#include "util/coalesce.h"
 
 #define USB_BUFFER_SIZE 64
 #define USB_SEND_BUFFER_SIZE 512
 #define MAX_USB_PACKET_SIZE_BYTES USB_BUFFER_SIZE
 
+// How long to wait for the host to read from a full USB send queue in each pass
+// of the main loop before dropping messages - a couple of USB frames.
+#ifndef USB_BACKPRESSURE_WAIT_US
+#define USB_BACKPRESSURE_WAIT_US 2000
+#endif
+
+// How long to hold back less than a full USB packet of data, waiting for more
+// messages to fill it, or 0 to always send right away.
+#ifndef USB_COALESCE_MAX_LATENCY_MS
+#define USB_COALESCE_MAX_LATENCY_MS 5
+#endif
+
 namespace openxc {
 namespace interface {
 namespace usb {
@@ -30,14 +44,16 @@ typedef enum {
  * address - the physical endpoint number.
  * size - the packet size for the endpoint, e.g. 512.
  * direction - the direction of the endpoint, IN or OUT.
- * queue - A queue of bytes from or for IN or OUT requests, depending on the
- *      direction.
+ * sendQueue - A queue of messages waiting for IN requests. Unused for OUT
+ *      endpoints, which share the device's receiveQueue.
+ * coalescer - Groups the bytes in sendQueue into full packets.
  */
 typedef struct {
     uint8_t address;
     uint8_t size;
     UsbEndpointDirection direction;
-    QUEUE_TYPE(uint8_t) queue;
+    openxc::util::messagepool::MessageQueue sendQueue;
+    openxc::util::coalesce::Coalescer coalescer;
     // This buffer MUST be non-local, so it doesn't get invalidated when it
     // falls off the stack
     uint8_t sendBuffer[USB_SEND_BUFFER_SIZE];
@@ -52,6 +68,8 @@ typedef struct {
  *
  * descriptor - A general descriptor for this interface.
  * endpoints - An array of addresses for the endpoints to use.
+ * receiveQueue - A queue of bytes received from the host on the OUT endpoint
+ *      but not yet processed.
  * configured - A flag that indicates if the USB interface has been configured
  *      by a host. Once true, this will not be set to false until the board is
  *      reset.
@@ -63,6 +81,7 @@ typedef struct {
     // TODO what if we had two UsbEndpoint types, one for in and one for out?
     // how would we index into the array?
     UsbEndpoint endpoints[ENDPOINT_COUNT];
+    QUEUE_TYPE(uint8_t) receiveQueue;
     bool configured;
 #ifdef __PIC32__
     USBDevice device;
@@ -0,0 +1,51 @@
+#include "metrics.h"
+
+using openxc::metrics::LoopMetrics;
+using openxc::metrics::BusMetrics;
+using openxc::metrics::InterfaceMetrics;
+
+static LoopMetrics loop;
+
+void openxc::metrics::recordLoopPass(unsigned long elapsedUs) {
+    ++loop.passes;
+    loop.totalUs += elapsedUs;
+    if(elapsedUs > loop.maxUs) {
+        loop.maxUs = elapsedUs;
+    }
+}
+
+const LoopMetrics* openxc::metrics::loopMetrics() {
+    return &loop;
+}
+
+unsigned long openxc::metrics::averageLoopPassUs() {
+    return loop.passes > 0 ? loop.totalUs / loop.passes : 0;
+}
+
+void openxc::metrics::busMetricsRow(const BusMetrics* bus, uint32_t row[]) {
+    row[0] = bus->address;
+    row[1] = bus->received;
+    row[2] = bus->dropped;
+    row[3] = bus->receiveQueue.highWaterMark;
+    row[4] = bus->receiveQueue.depth;
+    row[5] = bus->receiveQueue.overflows;
+    row[6] = bus->receiveQueue.firstOverflowMs;
+    row[7] = bus->sendQueue.highWaterMark;
+    row[8] = bus->sendQueue.depth;
+    row[9] = bus->sendQueue.overflows;
+    row[10] = bus->sendQueue.firstOverflowMs;
+    row[11] = bus->receiveLatencyUs;
+    row[12] = bus->receiveLatencyMaxUs;
+    row[13] = bus->decodeLatencyUs;
+    row[14] = bus->decodeLatencyMaxUs;
+}
+
+void openxc::metrics::interfaceMetricsRow(const InterfaceMetrics* interface,
+        uint32_t row[]) {
+    row[0] = interface->sent;
+    row[1] = interface->dropped;
+    row[2] = interface->bytesSent;
+    row[3] = interface->maxQueueFill;
+    row[4] = interface->latencyUs;
+    row[5] = interface->latencyMaxUs;
+}
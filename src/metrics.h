@@ -0,0 +1,158 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+
+namespace openxc {
+namespace metrics {
+
+/* Public: Timing of the passes through the main loop since startup, kept with
+ * integer math only so it's cheap enough to update on every pass.
+ *
+ * passes - The number of passes recorded.
+ * totalUs - The total time (in us) of all of the passes.
+ * maxUs - The longest single pass.
+ */
+typedef struct {
+    uint32_t passes;
+    uint64_t totalUs;
+    uint32_t maxUs;
+} LoopMetrics;
+
+#ifndef MAX_METRICS_CAN_BUSES
+#define MAX_METRICS_CAN_BUSES 2
+#endif
+
+// One for each interface::InterfaceType
+#define MAX_METRICS_INTERFACES 6
+
+/* Public: The state of one of a CAN bus's message queues.
+ *
+ * highWaterMark - The most messages ever waiting in the queue at once.
+ * depth - The number of messages the queue is allowed to hold.
+ * overflows - The number of messages dropped because the queue was full.
+ * firstOverflowMs - When a message was first dropped, or 0 if none have been.
+ */
+typedef struct {
+    uint16_t highWaterMark;
+    uint16_t depth;
+    uint32_t overflows;
+    uint32_t firstOverflowMs;
+} QueueMetrics;
+
+/* Public: The health of one CAN bus.
+ *
+ * address - The address of the bus.
+ * received - The number of CAN messages received.
+ * dropped - The number of CAN messages knowingly dropped.
+ * receiveQueue - The state of the receive queue.
+ * sendQueue - The state of the send queue.
+ * receiveLatencyUs - The 99th percentile of the time (in us) messages wait in
+ *      the receive queue.
+ * receiveLatencyMaxUs - The longest a message has waited in the receive queue.
+ * decodeLatencyUs - The 99th percentile of the time (in us) spent decoding a
+ *      message and queueing the results.
+ * decodeLatencyMaxUs - The longest a message has taken to decode.
+ */
+typedef struct {
+    uint8_t address;
+    uint32_t received;
+    uint32_t dropped;
+    QueueMetrics receiveQueue;
+    QueueMetrics sendQueue;
+    uint32_t receiveLatencyUs;
+    uint32_t receiveLatencyMaxUs;
+    uint32_t decodeLatencyUs;
+    uint32_t decodeLatencyMaxUs;
+} BusMetrics;
+
+/* Public: The health of one output interface.
+ *
+ * name - The name of the interface, e.g. "usb".
+ * sent - The number of messages queued to send.
+ * dropped - The number of messages dropped because the send queue was full.
+ * bytesSent - The total length of the messages queued to send.
+ * maxQueueFill - The most bytes seen waiting in the send queue, sampled every
+ *      few seconds.
+ * latencyUs - The 99th percentile of the time (in us) from receiving the data
+ *      until it left the interface.
+ * latencyMaxUs - The longest time from receiving data until it was sent.
+ */
+typedef struct {
+    const char* name;
+    uint32_t sent;
+    uint32_t dropped;
+    uint32_t bytesSent;
+    uint32_t maxQueueFill;
+    uint32_t latencyUs;
+    uint32_t latencyMaxUs;
+} InterfaceMetrics;
+
+/* Public: A snapshot of the health metrics of the whole device, with integer
+ * values only so it can be serialized without any floating point math.
+ *
+ * buses - The metrics of each CAN bus.
+ * busCount - The number of entries used in buses.
+ * interfaces - The metrics of each interface that has had anything to send.
+ * interfaceCount - The number of entries used in interfaces.
+ * loopPasses - The number of passes through the main loop.
+ * loopAverageUs - The average time (in us) of a pass through the main loop.
+ * loopMaxUs - The longest single pass through the main loop.
+ */
+typedef struct {
+    BusMetrics buses[MAX_METRICS_CAN_BUSES];
+    int busCount;
+    InterfaceMetrics interfaces[MAX_METRICS_INTERFACES];
+    int interfaceCount;
+    uint32_t loopPasses;
+    uint32_t loopAverageUs;
+    uint32_t loopMaxUs;
+} MetricsSnapshot;
+
+#define BUS_METRICS_ROW_LENGTH 15
+#define INTERFACE_METRICS_ROW_LENGTH 6
+
+/* Public: Record how long one pass through the main loop took.
+ *
+ * elapsedUs - The time in microseconds from the start to the end of the pass.
+ */
+void recordLoopPass(unsigned long elapsedUs);
+
+/* Public: Return the timing of the main loop so far.
+ */
+const LoopMetrics* loopMetrics();
+
+/* Public: Return the average time (in us) of a pass through the main loop, or
+ * 0 if none have been recorded.
+ */
+unsigned long averageLoopPassUs();
+
+/* Public: Flatten the metrics of a CAN bus into the order they're reported in
+ * a metrics command response:
+ *
+ *      address, received, dropped,
+ *      rx high-water mark, rx depth, rx overflows, rx first overflow (ms),
+ *      tx high-water mark, tx depth, tx overflows, tx first overflow (ms),
+ *      rx latency p99 (us), rx latency max (us),
+ *      decode latency p99 (us), decode latency max (us)
+ *
+ * Keeping the order here means every payload format reports the same layout.
+ *
+ * row - An output parameter, BUS_METRICS_ROW_LENGTH values long.
+ */
+void busMetricsRow(const BusMetrics* bus, uint32_t row[]);
+
+/* Public: Flatten the metrics of an interface into the order they're reported
+ * in a metrics command response, after the interface's name:
+ *
+ *      sent, dropped, bytes sent, max send queue fill (bytes),
+ *      latency p99 (us), latency max (us)
+ *
+ * row - An output parameter, INTERFACE_METRICS_ROW_LENGTH values long.
+ */
+void interfaceMetricsRow(const InterfaceMetrics* interface, uint32_t row[]);
+
+} // namespace metrics
+} // namespace openxc
+
+#endif // _METRICS_H_
@@ -151,7 +151,7 @@ void openxc::diagnostics::obd2::loop(DiagnosticsManager* manager) {
             // active we want to keep querying for igntion. If we de-init
             // diagnosicts here we risk getting stuck awake, but not querying
             // for any diagnostics messages.
-            IGNITION_STATUS_TIMER.frequency = .1;
+            time::setFrequency(&IGNITION_STATUS_TIMER, .1);
             ignitionCheckCount = 0;
             pidSupportQueried = false;
         } else {
@@ -164,7 +164,7 @@ void openxc::diagnostics::obd2::loop(DiagnosticsManager* manager) {
             ++ignitionCheckCount;
         }
     } else if(ENGINE_STARTED || VEHICLE_IN_MOTION) {
-        IGNITION_STATUS_TIMER.frequency = .5;
+        time::setFrequency(&IGNITION_STATUS_TIMER, .5);
         ignitionCheckCount = 0;
         getConfiguration()->desiredRunLevel = RunLevel::ALL_IO;
         if(getConfiguration()->recurringObd2Requests && !pidSupportQueried) {
@@ -1,15 +1,33 @@
 #include "payload.h"
 
-#include <cJSON.h>
 #include <stdlib.h>
 #include <sys/param.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <ctype.h>
 
 #include "json.h"
 #include "util/strutil.h"
 #include "util/log.h"
 #include "config.h"
 
+// The most values, including object keys, in a JSON message that can be parsed
+#ifndef MAX_JSON_TOKENS
+#define MAX_JSON_TOKENS 64
+#endif
+
+// The decimal places written for numbers that don't come from a signal with a
+// known precision
+#ifndef JSON_NUMBER_PRECISION
+#define JSON_NUMBER_PRECISION 6
+#endif
+
+// The most decimal places written for any number
+#define MAX_JSON_NUMBER_PRECISION 9
+
 namespace payload = openxc::payload;
 
 using openxc::util::log::debug;
@@ -25,6 +43,13 @@ const char openxc::payload::json::PREDEFINED_OBD2_REQUESTS_COMMAND_NAME[] = "pre
 const char openxc::payload::json::MODEM_CONFIGURATION_COMMAND_NAME[] = "modem_configuration";
 const char openxc::payload::json::RTC_CONFIGURATION_COMMAND_NAME[] = "rtc_configuration";
 const char openxc::payload::json::SD_MOUNT_STATUS_COMMAND_NAME[] = "sd_mount_status";
+const char openxc::payload::json::SUBSCRIBE_COMMAND_NAME[] = "subscribe";
+const char openxc::payload::json::UNSUBSCRIBE_COMMAND_NAME[] = "unsubscribe";
+const char openxc::payload::json::METRICS_COMMAND_NAME[] = "metrics";
+
+const char openxc::payload::json::METRICS_CAN_FIELD_NAME[] = "can";
+const char openxc::payload::json::METRICS_INTERFACES_FIELD_NAME[] = "out";
+const char openxc::payload::json::METRICS_LOOP_FIELD_NAME[] = "loop";
 
 const char openxc::payload::json::PAYLOAD_FORMAT_JSON_NAME[] = "json";
 const char openxc::payload::json::PAYLOAD_FORMAT_PROTOBUF_NAME[] = "protobuf";
@@ -52,49 +77,261 @@ const char openxc::payload::json::DIAGNOSTIC_NRC_FIELD_NAME[] = "negative_respon
 const char openxc::payload::json::DIAGNOSTIC_PAYLOAD_FIELD_NAME[] = "payload";
 const char openxc::payload::json::DIAGNOSTIC_VALUE_FIELD_NAME[] = "value";
 
-static bool serializeDiagnostic(openxc_VehicleMessage* message, cJSON* root) {
-    cJSON_AddNumberToObject(root, payload::json::BUS_FIELD_NAME,
+/* Private: A position in the caller's buffer for writing JSON directly,
+ * without building a cJSON tree on the heap first.
+ *
+ * Output that doesn't fit in the buffer is dropped but still counted, so the
+ * result is truncated exactly like the copy of a printed cJSON tree was.
+ *
+ * buffer - The caller's buffer.
+ * length - The length of the buffer.
+ * position - The number of bytes of output so far, including any that
+ *      didn't fit.
+ * fieldCount - The number of fields written to the current object.
+ */
+typedef struct {
+    char* buffer;
+    size_t length;
+    size_t position;
+    int fieldCount;
+} JsonWriter;
+
+static void writeBytes(JsonWriter* writer, const char* data, size_t length) {
+    if(writer->position < writer->length) {
+        memcpy(writer->buffer + writer->position, data,
+                MIN(length, writer->length - writer->position));
+    }
+    writer->position += length;
+}
+
+static void writeCharacter(JsonWriter* writer, char character) {
+    if(writer->position < writer->length) {
+        writer->buffer[writer->position] = character;
+    }
+    ++writer->position;
+}
+
+/* Private: Write a quoted string, escaped the same way as cJSON.
+ */
+static void writeString(JsonWriter* writer, const char* value) {
+    writeCharacter(writer, '\"');
+    for(const char* start = value; *value != '\0'; start = ++value) {
+        while((unsigned char)*value > 31 && *value != '\"' && *value != '\\') {
+            ++value;
+        }
+        writeBytes(writer, start, value - start);
+        if(*value == '\0') {
+            break;
+        }
+
+        writeCharacter(writer, '\\');
+        switch(*value) {
+            case '\\': writeCharacter(writer, '\\'); break;
+            case '\"': writeCharacter(writer, '\"'); break;
+            case '\b': writeCharacter(writer, 'b'); break;
+            case '\f': writeCharacter(writer, 'f'); break;
+            case '\n': writeCharacter(writer, 'n'); break;
+            case '\r': writeCharacter(writer, 'r'); break;
+            case '\t': writeCharacter(writer, 't'); break;
+            default: {
+                char escaped[6];
+                snprintf(escaped, sizeof(escaped), "u%04x",
+                        (unsigned char)*value);
+                writeBytes(writer, escaped, 5);
+                break;
+            }
+        }
+    }
+    writeCharacter(writer, '\"');
+}
+
+/* Private: Start a field of the current object, separating it from the last.
+ */
+static void writeKey(JsonWriter* writer, const char* name) {
+    if(writer->fieldCount++ > 0) {
+        writeCharacter(writer, ',');
+    }
+    writeString(writer, name);
+    writeCharacter(writer, ':');
+}
+
+/* Private: Write the decimal digits of an unsigned integer into the end of a
+ * buffer, with integer arithmetic.
+ *
+ * end - One past the last byte of the buffer to write the digits to.
+ * value - The number to write.
+ * minimumDigits - The number of digits to zero pad the value to.
+ *
+ * Returns a pointer to the first digit written.
+ */
+static char* formatDigits(char* end, uint64_t value, int minimumDigits) {
+    char* digit = end;
+    while(value > 0 || minimumDigits > 0) {
+        *--digit = '0' + value % 10;
+        value /= 10;
+        --minimumDigits;
+    }
+    return digit;
+}
+
+/* Private: Write a number with a fixed number of decimal places, dropping any
+ * trailing zeros, using integer arithmetic instead of printf.
+ *
+ * value - The number to write, which must be less than 1e9 in magnitude.
+ * places - The most decimal places to write, up to MAX_JSON_NUMBER_PRECISION.
+ */
+static void writeFixed(JsonWriter* writer, double value, int places) {
+    static const uint32_t POWERS_OF_TEN[] = {1, 10, 100, 1000, 10000, 100000,
+            1000000, 10000000, 100000000, 1000000000};
+    bool negative = value < 0;
+    uint64_t scaled = (uint64_t)((negative ? -value : value) *
+            POWERS_OF_TEN[places] + 0.5);
+    uint64_t whole = scaled / POWERS_OF_TEN[places];
+    uint32_t fraction = scaled % POWERS_OF_TEN[places];
+    while(places > 0 && fraction % 10 == 0) {
+        fraction /= 10;
+        --places;
+    }
+
+    char number[24];
+    char* end = number + sizeof(number);
+    char* start = end;
+    if(places > 0) {
+        start = formatDigits(start, fraction, places);
+        *--start = '.';
+    }
+    start = formatDigits(start, whole, 1);
+    if(negative && scaled > 0) {
+        *--start = '-';
+    }
+    writeBytes(writer, start, end - start);
+}
+
+/* Private: Write a number - as an integer if it is one, otherwise with the
+ * given number of decimal places. Only numbers too large or too small for
+ * that are formatted with printf, in exponent notation.
+ *
+ * precision - The most decimal places to write, or -1 for the default of
+ *      JSON_NUMBER_PRECISION.
+ */
+static void writeNumber(JsonWriter* writer, double value, int precision) {
+    if(fabs(value) < 1.0e18 && fabs(floor(value) - value) <= DBL_EPSILON) {
+        char number[24];
+        char* end = number + sizeof(number);
+        char* start = formatDigits(end, (uint64_t)fabs(value), 1);
+        if(value <= -1) {
+            *--start = '-';
+        }
+        writeBytes(writer, start, end - start);
+    } else if(fabs(value) < 1.0e9 && (precision >= 0 ||
+                fabs(value) >= 1.0e-6)) {
+        writeFixed(writer, value, precision < 0 ? JSON_NUMBER_PRECISION :
+                MIN(precision, MAX_JSON_NUMBER_PRECISION));
+    } else {
+        char number[64];
+        int length = snprintf(number, sizeof(number),
+                fabs(floor(value) - value) <= DBL_EPSILON &&
+                    fabs(value) < 1.0e60 ? "%.0f" : "%e", value);
+        writeBytes(writer, number, MIN(length, (int)sizeof(number) - 1));
+    }
+}
+
+/* Private: Write an array of unsigned integers, without the brackets so the
+ * caller can add other elements, e.g. "1,2,3".
+ */
+static void writeUnsignedElements(JsonWriter* writer, const uint32_t* values,
+        int count) {
+    char number[12];
+    char* end = number + sizeof(number);
+    for(int i = 0; i < count; i++) {
+        if(i > 0) {
+            writeCharacter(writer, ',');
+        }
+        char* start = formatDigits(end, values[i], 1);
+        writeBytes(writer, start, end - start);
+    }
+}
+
+static void writeBool(JsonWriter* writer, bool value) {
+    if(value) {
+        writeBytes(writer, "true", 4);
+    } else {
+        writeBytes(writer, "false", 5);
+    }
+}
+
+static void writeNumberField(JsonWriter* writer, const char* name,
+        double value) {
+    writeKey(writer, name);
+    writeNumber(writer, value, -1);
+}
+
+static void writeStringField(JsonWriter* writer, const char* name,
+        const char* value) {
+    writeKey(writer, name);
+    writeString(writer, value);
+}
+
+static void writeBoolField(JsonWriter* writer, const char* name, bool value) {
+    writeKey(writer, name);
+    writeBool(writer, value);
+}
+
+/* Private: Write a byte array as a hex string field, e.g. "0x1234".
+ *
+ * maxLength - The most characters of the string to write, including the "0x"
+ *      prefix - the same limit as the fixed buffers the strings used to be
+ *      formatted in.
+ */
+static void writeHexField(JsonWriter* writer, const char* name,
+        const uint8_t* bytes, size_t size, size_t maxLength) {
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    writeKey(writer, name);
+    writeCharacter(writer, '\"');
+    writeBytes(writer, "0x", 2);
+    size_t digitCount = MIN(size * 2, maxLength - 2);
+    for(size_t i = 0; i < digitCount; i++) {
+        uint8_t byte = bytes[i / 2];
+        writeCharacter(writer, HEX_DIGITS[i % 2 == 0 ? byte >> 4 : byte & 0xf]);
+    }
+    writeCharacter(writer, '\"');
+}
+
+static bool serializeDiagnostic(openxc_VehicleMessage* message,
+        JsonWriter* writer) {
+    writeNumberField(writer, payload::json::BUS_FIELD_NAME,
             message->diagnostic_response.bus);
-    cJSON_AddNumberToObject(root, payload::json::ID_FIELD_NAME,
+    writeNumberField(writer, payload::json::ID_FIELD_NAME,
             message->diagnostic_response.message_id);
-    cJSON_AddNumberToObject(root, payload::json::DIAGNOSTIC_MODE_FIELD_NAME,
+    writeNumberField(writer, payload::json::DIAGNOSTIC_MODE_FIELD_NAME,
             message->diagnostic_response.mode);
-    cJSON_AddBoolToObject(root, payload::json::DIAGNOSTIC_SUCCESS_FIELD_NAME,
+    writeBoolField(writer, payload::json::DIAGNOSTIC_SUCCESS_FIELD_NAME,
             message->diagnostic_response.success);
 
     if(message->diagnostic_response.has_pid) {
-        cJSON_AddNumberToObject(root, payload::json::DIAGNOSTIC_PID_FIELD_NAME,
+        writeNumberField(writer, payload::json::DIAGNOSTIC_PID_FIELD_NAME,
                 message->diagnostic_response.pid);
     }
 
     if(message->diagnostic_response.has_negative_response_code) {
-        cJSON_AddNumberToObject(root, payload::json::DIAGNOSTIC_NRC_FIELD_NAME,
+        writeNumberField(writer, payload::json::DIAGNOSTIC_NRC_FIELD_NAME,
                 message->diagnostic_response.negative_response_code);
     }
 
     if(message->diagnostic_response.has_value) {
-        cJSON_AddNumberToObject(root, payload::json::DIAGNOSTIC_VALUE_FIELD_NAME,
+        writeNumberField(writer, payload::json::DIAGNOSTIC_VALUE_FIELD_NAME,
                 message->diagnostic_response.value);
     } else if(message->diagnostic_response.has_payload) {
-        char encodedData[MAX_DIAGNOSTIC_PAYLOAD_SIZE];
-        const char* maxAddress = encodedData + sizeof(encodedData);
-        char* encodedDataIndex = encodedData;
-        encodedDataIndex += sprintf(encodedDataIndex, "0x");
-        for(uint8_t i = 0; i < message->diagnostic_response.payload.size &&
-                encodedDataIndex < maxAddress; i++) {
-            encodedDataIndex += snprintf(encodedDataIndex,
-                    maxAddress - encodedDataIndex,
-                    "%02x",
-                    message->diagnostic_response.payload.bytes[i]);
-        }
-        cJSON_AddStringToObject(root, payload::json::DIAGNOSTIC_PAYLOAD_FIELD_NAME,
-                encodedData);
+        writeHexField(writer, payload::json::DIAGNOSTIC_PAYLOAD_FIELD_NAME,
+                message->diagnostic_response.payload.bytes,
+                message->diagnostic_response.payload.size,
+                MAX_DIAGNOSTIC_PAYLOAD_SIZE - 1);
     }
     return true;
 }
 
 static bool serializeCommandResponse(openxc_VehicleMessage* message,
-        cJSON* root) {
+        JsonWriter* writer) {
     const char* typeString = NULL;
     if(message->command_response.type == openxc_ControlCommand_Type_VERSION) {
         typeString = payload::json::VERSION_COMMAND_NAME;
@@ -118,47 +355,44 @@ static bool serializeCommandResponse(openxc_VehicleMessage* message,
         typeString = payload::json::RTC_CONFIGURATION_COMMAND_NAME;
     } else if(message->command_response.type == openxc_ControlCommand_Type_SD_MOUNT_STATUS) {
         typeString = payload::json::SD_MOUNT_STATUS_COMMAND_NAME;
+    } else if(message->command_response.type == payload::SUBSCRIBE_COMMAND_TYPE) {
+        typeString = payload::json::SUBSCRIBE_COMMAND_NAME;
+    } else if(message->command_response.type == payload::UNSUBSCRIBE_COMMAND_TYPE) {
+        typeString = payload::json::UNSUBSCRIBE_COMMAND_NAME;
+    } else if(message->command_response.type == payload::METRICS_COMMAND_TYPE) {
+        typeString = payload::json::METRICS_COMMAND_NAME;
     } else {
         return false;
     }
 
-    cJSON_AddStringToObject(root, payload::json::COMMAND_RESPONSE_FIELD_NAME,
+    writeStringField(writer, payload::json::COMMAND_RESPONSE_FIELD_NAME,
             typeString);
     if(message->command_response.has_message) {
-        cJSON_AddStringToObject(root,
+        writeStringField(writer,
                 payload::json::COMMAND_RESPONSE_MESSAGE_FIELD_NAME,
                 message->command_response.message);
     }
 
     if(message->command_response.has_status) {
-        cJSON_AddBoolToObject(root,
+        writeBoolField(writer,
                 payload::json::COMMAND_RESPONSE_STATUS_FIELD_NAME,
                 message->command_response.status);
     }
     return true;
 }
 
-static bool serializeCan(openxc_VehicleMessage* message, cJSON* root) {
-    cJSON_AddNumberToObject(root, payload::json::BUS_FIELD_NAME,
+static bool serializeCan(openxc_VehicleMessage* message, JsonWriter* writer) {
+    writeNumberField(writer, payload::json::BUS_FIELD_NAME,
             message->can_message.bus);
-    cJSON_AddNumberToObject(root, payload::json::ID_FIELD_NAME,
+    writeNumberField(writer, payload::json::ID_FIELD_NAME,
             message->can_message.id);
-
-    char encodedData[67];
-    const char* maxAddress = encodedData + sizeof(encodedData);
-    char* encodedDataIndex = encodedData;
-    encodedDataIndex += sprintf(encodedDataIndex, "0x");
-    for(uint8_t i = 0; i < message->can_message.data.size &&
-            encodedDataIndex < maxAddress; i++) {
-        encodedDataIndex += snprintf(encodedDataIndex,
-                maxAddress - encodedDataIndex,
-                "%02x", message->can_message.data.bytes[i]);
-    }
-    cJSON_AddStringToObject(root, payload::json::DATA_FIELD_NAME,
-            encodedData);
+    // At most 32 bytes of the data are sent
+    writeHexField(writer, payload::json::DATA_FIELD_NAME,
+            message->can_message.data.bytes, message->can_message.data.size,
+            66);
 
     if(message->can_message.has_frame_format) {
-        cJSON_AddStringToObject(root, payload::json::FRAME_FORMAT_FIELD_NAME,
+        writeStringField(writer, payload::json::FRAME_FORMAT_FIELD_NAME,
                 message->can_message.frame_format == openxc_CanMessage_FrameFormat_STANDARD ?
                     payload::json::FRAME_FORMAT_STANDARD_NAME :
                         payload::json::FRAME_FORMAT_EXTENDED_NAME);
@@ -166,43 +400,440 @@ static bool serializeCan(openxc_VehicleMessage* message, cJSON* root) {
     return true;
 }
 
-static cJSON* serializeDynamicField(openxc_DynamicField* field) {
-    cJSON* value = NULL;
+static void serializeDynamicField(JsonWriter* writer, const char* name,
+        openxc_DynamicField* field, int precision) {
     if(field->has_numeric_value) {
-        value = cJSON_CreateNumber(field->numeric_value);
+        writeKey(writer, name);
+        writeNumber(writer, field->numeric_value, precision);
     } else if(field->has_boolean_value) {
-        value = cJSON_CreateBool(field->boolean_value);
+        writeBoolField(writer, name, field->boolean_value);
     } else if(field->has_string_value) {
-        value = cJSON_CreateString(field->string_value);
+        writeStringField(writer, name, field->string_value);
     }
-    return value;
 }
 
-static bool serializeSimple(openxc_VehicleMessage* message, cJSON* root) {
-    const char* name = message->simple_message.name;
-    cJSON_AddStringToObject(root, payload::json::NAME_FIELD_NAME, name);
+static bool serializeSimple(openxc_VehicleMessage* message,
+        JsonWriter* writer, int precision) {
+    writeStringField(writer, payload::json::NAME_FIELD_NAME,
+            message->simple_message.name);
 
-    cJSON* value = NULL;
     if(message->simple_message.has_value) {
-        value = serializeDynamicField(&message->simple_message.value);
-        if(value != NULL) {
-            cJSON_AddItemToObject(root, payload::json::VALUE_FIELD_NAME, value);
-        }
+        serializeDynamicField(writer, payload::json::VALUE_FIELD_NAME,
+                &message->simple_message.value, precision);
     }
 
-    cJSON* event = NULL;
     if(message->simple_message.has_event) {
-        event = serializeDynamicField(&message->simple_message.event);
-        if(event != NULL) {
-            cJSON_AddItemToObject(root, payload::json::EVENT_FIELD_NAME, event);
-        }
+        serializeDynamicField(writer, payload::json::EVENT_FIELD_NAME,
+                &message->simple_message.event, precision);
     }
     return true;
 }
 
-/* Private: Parse a hex string as a byte array.
+typedef enum {
+    JSON_TOKEN_OBJECT,
+    JSON_TOKEN_ARRAY,
+    JSON_TOKEN_STRING,
+    JSON_TOKEN_NUMBER,
+    JSON_TOKEN_TRUE,
+    JSON_TOKEN_FALSE,
+    JSON_TOKEN_NULL
+} JsonTokenType;
+
+/* Private: A JSON value found in the input, without copying any of it.
+ *
+ * type - The type of the value.
+ * start - The offset of the value's first character in the input - for a
+ *      string, the first character after the opening quote.
+ * end - The offset just past the value's last character - for a string, the
+ *      offset of the closing quote.
+ * next - The index of the first token after this value and everything it
+ *      contains, to skip over objects and arrays.
+ */
+typedef struct {
+    uint8_t type;
+    uint16_t start;
+    uint16_t end;
+    uint16_t next;
+} JsonToken;
+
+/* Private: The tokens of a parsed JSON document. Objects are followed by their
+ * fields' tokens, each key string followed by its value.
+ */
+typedef struct {
+    const char* json;
+    JsonToken tokens[MAX_JSON_TOKENS];
+    int tokenCount;
+} JsonDocument;
+
+static const char* skipWhitespace(const char* position) {
+    while(*position != '\0' && (unsigned char)*position <= 32) {
+        ++position;
+    }
+    return position;
+}
+
+static int addToken(JsonDocument* document, JsonTokenType type,
+        const char* start) {
+    if(document->tokenCount >= MAX_JSON_TOKENS) {
+        return -1;
+    }
+    JsonToken* token = &document->tokens[document->tokenCount];
+    token->type = type;
+    token->start = start - document->json;
+    return document->tokenCount++;
+}
+
+static const char* tokenizeValue(JsonDocument* document, const char* position);
+
+/* Private: Tokenize a string starting at its opening quote.
+ *
+ * Returns the position after the closing quote, or NULL if the string isn't
+ * terminated or there are no more tokens.
+ */
+static const char* tokenizeString(JsonDocument* document,
+        const char* position) {
+    int index = addToken(document, JSON_TOKEN_STRING, ++position);
+    if(index == -1) {
+        return NULL;
+    }
+
+    while(*position != '\"') {
+        if(*position == '\0' || (*position == '\\' && *++position == '\0')) {
+            return NULL;
+        }
+        ++position;
+    }
+    document->tokens[index].end = position - document->json;
+    document->tokens[index].next = document->tokenCount;
+    return position + 1;
+}
+
+/* Private: Tokenize an object or array starting at its opening bracket.
+ */
+static const char* tokenizeContainer(JsonDocument* document,
+        const char* position) {
+    bool object = *position == '{';
+    int index = addToken(document,
+            object ? JSON_TOKEN_OBJECT : JSON_TOKEN_ARRAY, position);
+    if(index == -1) {
+        return NULL;
+    }
+
+    const char closing = object ? '}' : ']';
+    position = skipWhitespace(position + 1);
+    if(*position != closing) {
+        while(true) {
+            if(object) {
+                if(*position != '\"') {
+                    return NULL;
+                }
+                position = tokenizeString(document, position);
+                if(position == NULL) {
+                    return NULL;
+                }
+                position = skipWhitespace(position);
+                if(*position != ':') {
+                    return NULL;
+                }
+                position = skipWhitespace(position + 1);
+            }
+
+            position = tokenizeValue(document, position);
+            if(position == NULL) {
+                return NULL;
+            }
+            position = skipWhitespace(position);
+            if(*position != ',') {
+                break;
+            }
+            position = skipWhitespace(position + 1);
+        }
+
+        if(*position != closing) {
+            return NULL;
+        }
+    }
+    document->tokens[index].end = position + 1 - document->json;
+    document->tokens[index].next = document->tokenCount;
+    return position + 1;
+}
+
+/* Private: Parse a number the same way as cJSON, so values are converted
+ * exactly as they were before.
  *
- * source - The hex string to parse - each byte in the string *must* be
+ * end - An output parameter, set to the position after the number.
+ */
+static double parseNumber(const char* position, const char** end) {
+    double number = 0, sign = 1, scale = 0;
+    int subscale = 0, signsubscale = 1;
+
+    if(*position == '-') {
+        sign = -1;
+        ++position;
+    }
+    if(*position == '0') {
+        ++position;
+    }
+    if(*position >= '1' && *position <= '9') {
+        do {
+            number = (number * 10.0) + (*position++ - '0');
+        } while(*position >= '0' && *position <= '9');
+    }
+    if(*position == '.' && position[1] >= '0' && position[1] <= '9') {
+        ++position;
+        do {
+            number = (number * 10.0) + (*position++ - '0');
+            --scale;
+        } while(*position >= '0' && *position <= '9');
+    }
+    if(*position == 'e' || *position == 'E') {
+        ++position;
+        if(*position == '+') {
+            ++position;
+        } else if(*position == '-') {
+            signsubscale = -1;
+            ++position;
+        }
+        while(*position >= '0' && *position <= '9') {
+            subscale = (subscale * 10) + (*position++ - '0');
+        }
+    }
+
+    if(end != NULL) {
+        *end = position;
+    }
+    if(scale == 0 && subscale == 0) {
+        return sign * number;
+    }
+    return sign * number * pow(10.0, (scale + subscale * signsubscale));
+}
+
+static const char* tokenizeValue(JsonDocument* document,
+        const char* position) {
+    JsonTokenType type;
+    const char* end;
+    if(*position == '{' || *position == '[') {
+        return tokenizeContainer(document, position);
+    } else if(*position == '\"') {
+        return tokenizeString(document, position);
+    } else if(*position == '-' || (*position >= '0' && *position <= '9')) {
+        type = JSON_TOKEN_NUMBER;
+        parseNumber(position, &end);
+    } else if(!strncmp(position, "true", 4)) {
+        type = JSON_TOKEN_TRUE;
+        end = position + 4;
+    } else if(!strncmp(position, "false", 5)) {
+        type = JSON_TOKEN_FALSE;
+        end = position + 5;
+    } else if(!strncmp(position, "null", 4)) {
+        type = JSON_TOKEN_NULL;
+        end = position + 4;
+    } else {
+        return NULL;
+    }
+
+    int index = addToken(document, type, position);
+    if(index == -1) {
+        return NULL;
+    }
+    document->tokens[index].end = end - document->json;
+    document->tokens[index].next = document->tokenCount;
+    return end;
+}
+
+/* Private: Tokenize the JSON value at the start of a NULL terminated string,
+ * ignoring anything after it like cJSON_Parse does.
+ *
+ * Returns true if a complete value was found and there were enough tokens for
+ * it.
+ */
+static bool tokenize(JsonDocument* document, const char* json) {
+    document->json = json;
+    document->tokenCount = 0;
+    return tokenizeValue(document, skipWhitespace(json)) != NULL;
+}
+
+/* Private: Find a field of an object by name. Like cJSON_GetObjectItem, the
+ * name is not case sensitive.
+ *
+ * Returns the index of the field's value token, or -1 if the object has no
+ * such field.
+ */
+static int findField(const JsonDocument* document, int object,
+        const char* name) {
+    if(object < 0 || document->tokens[object].type != JSON_TOKEN_OBJECT) {
+        return -1;
+    }
+
+    size_t nameLength = strlen(name);
+    for(int key = object + 1; key < document->tokens[object].next;
+            key = document->tokens[key + 1].next) {
+        const JsonToken* token = &document->tokens[key];
+        if((size_t)(token->end - token->start) != nameLength) {
+            continue;
+        }
+
+        const char* keyName = document->json + token->start;
+        size_t i = 0;
+        while(i < nameLength && tolower(keyName[i]) == tolower(name[i])) {
+            ++i;
+        }
+        if(i == nameLength) {
+            return key + 1;
+        }
+    }
+    return -1;
+}
+
+static double numberValue(const JsonDocument* document, int index) {
+    const JsonToken* token = &document->tokens[index];
+    if(token->type == JSON_TOKEN_NUMBER) {
+        return parseNumber(document->json + token->start, NULL);
+    }
+    return 0;
+}
+
+/* Private: Read a value as an integer the same way as cJSON's valueint - a
+ * truncated number, 1 for true and 0 for anything else.
+ */
+static int intValue(const JsonDocument* document, int index) {
+    const JsonToken* token = &document->tokens[index];
+    if(token->type == JSON_TOKEN_TRUE) {
+        return 1;
+    }
+    return (int)numberValue(document, index);
+}
+
+/* Private: Compare a string value to a C string, without unescaping it.
+ */
+static bool stringEquals(const JsonDocument* document, int index,
+        const char* value) {
+    const JsonToken* token = &document->tokens[index];
+    size_t length = strlen(value);
+    return token->type == JSON_TOKEN_STRING &&
+            (size_t)(token->end - token->start) == length &&
+            !strncmp(document->json + token->start, value, length);
+}
+
+static int hexValue(char character) {
+    if(character >= '0' && character <= '9') {
+        return character - '0';
+    } else if(character >= 'a' && character <= 'f') {
+        return character - 'a' + 10;
+    } else if(character >= 'A' && character <= 'F') {
+        return character - 'A' + 10;
+    }
+    return -1;
+}
+
+static size_t encodeUtf8(unsigned long codepoint, char* destination) {
+    if(codepoint < 0x80) {
+        destination[0] = codepoint;
+        return 1;
+    } else if(codepoint < 0x800) {
+        destination[0] = 0xc0 | (codepoint >> 6);
+        destination[1] = 0x80 | (codepoint & 0x3f);
+        return 2;
+    } else if(codepoint < 0x10000) {
+        destination[0] = 0xe0 | (codepoint >> 12);
+        destination[1] = 0x80 | ((codepoint >> 6) & 0x3f);
+        destination[2] = 0x80 | (codepoint & 0x3f);
+        return 3;
+    }
+    destination[0] = 0xf0 | (codepoint >> 18);
+    destination[1] = 0x80 | ((codepoint >> 12) & 0x3f);
+    destination[2] = 0x80 | ((codepoint >> 6) & 0x3f);
+    destination[3] = 0x80 | (codepoint & 0x3f);
+    return 4;
+}
+
+static unsigned long parseHexQuad(const char* position) {
+    unsigned long value = 0;
+    for(int i = 0; i < 4; i++) {
+        int digit = hexValue(position[i]);
+        if(digit == -1) {
+            return 0;
+        }
+        value = (value << 4) | digit;
+    }
+    return value;
+}
+
+/* Private: Copy a string value into a buffer, unescaping it like cJSON.
+ *
+ * destination - The buffer to store the NULL terminated string.
+ * size - The size of the buffer - longer strings are truncated.
+ *
+ * Returns true if the value was a string.
+ */
+static bool copyString(const JsonDocument* document, int index,
+        char* destination, size_t size) {
+    const JsonToken* token = &document->tokens[index];
+    size_t length = 0;
+    if(token->type == JSON_TOKEN_STRING) {
+        const char* end = document->json + token->end;
+        for(const char* position = document->json + token->start;
+                position < end && length < size - 1; ++position) {
+            if(*position != '\\') {
+                destination[length++] = *position;
+                continue;
+            }
+
+            char encoded[4];
+            size_t encodedLength = 1;
+            switch(*++position) {
+                case 'b': encoded[0] = '\b'; break;
+                case 'f': encoded[0] = '\f'; break;
+                case 'n': encoded[0] = '\n'; break;
+                case 'r': encoded[0] = '\r'; break;
+                case 't': encoded[0] = '\t'; break;
+                case 'u': {
+                    if(end - position < 5) {
+                        encodedLength = 0;
+                        position = end;
+                        break;
+                    }
+                    unsigned long codepoint = parseHexQuad(position + 1);
+                    position += 4;
+                    if(codepoint >= 0xd800 && codepoint <= 0xdbff) {
+                        // A UTF-16 surrogate pair - skip it if it's incomplete
+                        unsigned long low = 0;
+                        if(end - position >= 7 && position[1] == '\\' &&
+                                position[2] == 'u') {
+                            low = parseHexQuad(position + 3);
+                        }
+                        if(low >= 0xdc00 && low <= 0xdfff) {
+                            codepoint = 0x10000 + (((codepoint & 0x3ff) << 10)
+                                    | (low & 0x3ff));
+                            position += 6;
+                        } else {
+                            codepoint = 0;
+                        }
+                    }
+                    if(codepoint == 0 ||
+                            (codepoint >= 0xdc00 && codepoint <= 0xdfff)) {
+                        encodedLength = 0;
+                    } else {
+                        encodedLength = encodeUtf8(codepoint, encoded);
+                    }
+                    break;
+                }
+                default: encoded[0] = *position; break;
+            }
+            if(length + encodedLength > size - 1) {
+                break;
+            }
+            memcpy(destination + length, encoded, encodedLength);
+            length += encodedLength;
+        }
+    }
+    destination[length] = '\0';
+    return token->type == JSON_TOKEN_STRING;
+}
+
+/* Private: Parse a hex string value as a byte array.
+ *
+ * index - The string token to parse - each byte in the string *must* be
  *      represented with 2 characters, e.g. `1` is `01` - the complete string
  *      must have an even number of characters. The string can optionally begin
  *      with a '0x' prefix.
@@ -211,56 +842,68 @@ static bool serializeSimple(openxc_VehicleMessage* message, cJSON* root) {
  *
  * Returns the size of the byte array stored in dest.
  */
-static size_t dehexlify(const char source[], uint8_t* destination,
-        size_t destinationLength) {
+static size_t dehexlify(const JsonDocument* document, int index,
+        uint8_t* destination, size_t destinationLength) {
+    const JsonToken* token = &document->tokens[index];
+    if(token->type != JSON_TOKEN_STRING) {
+        return 0;
+    }
+
+    const char* source = document->json + token->start;
+    size_t sourceLength = token->end - token->start;
     size_t i = 0;
-    if(strstr(source, "0x") != NULL) {
+    if(sourceLength >= 2 && source[0] == '0' && source[1] == 'x') {
         i += 2;
     }
 
     size_t byteIndex = 0;
-    for(; i < strlen(source) && byteIndex < destinationLength; i += 2) {
-        char bytestring[3] = {0};
-        strncpy(bytestring, &(source[i]), 2);
-
-        char* end = NULL;
-        destination[byteIndex++] = strtoul(bytestring, &end, 16);
+    for(; i < sourceLength && byteIndex < destinationLength; i += 2) {
+        // Like strtoul, stop at the first character that isn't a hex digit
+        uint8_t byte = 0;
+        for(size_t j = i; j < MIN(i + 2, sourceLength); j++) {
+            int digit = hexValue(source[j]);
+            if(digit == -1) {
+                break;
+            }
+            byte = (byte << 4) | digit;
+        }
+        destination[byteIndex++] = byte;
     }
     return byteIndex;
 }
 
-static void deserializePassthrough(cJSON* root, openxc_ControlCommand* command) {
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_PASSTHROUGH;
+static void deserializePassthrough(const JsonDocument* document, int root,
+        openxc_VehicleMessage* message) {
+    openxc_ControlCommand* command = &message->control_command;
     command->has_passthrough_mode_request = true;
 
-    cJSON* element = cJSON_GetObjectItem(root, "bus");
-    if(element != NULL) {
+    int element = findField(document, root, "bus");
+    if(element != -1) {
         command->passthrough_mode_request.has_bus = true;
-        command->passthrough_mode_request.bus = element->valueint;
+        command->passthrough_mode_request.bus = intValue(document, element);
     }
 
-    element = cJSON_GetObjectItem(root, "enabled");
-    if(element != NULL) {
+    element = findField(document, root, "enabled");
+    if(element != -1) {
         command->passthrough_mode_request.has_enabled = true;
-        command->passthrough_mode_request.enabled = bool(element->valueint);
+        command->passthrough_mode_request.enabled =
+                bool(intValue(document, element));
     }
 }
 
-static void deserializePayloadFormat(cJSON* root,
-        openxc_ControlCommand* command) {
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_PAYLOAD_FORMAT;
+static void deserializePayloadFormat(const JsonDocument* document, int root,
+        openxc_VehicleMessage* message) {
+    openxc_ControlCommand* command = &message->control_command;
     command->has_payload_format_command = true;
 
-    cJSON* element = cJSON_GetObjectItem(root, "format");
-    if(element != NULL) {
-        if(!strcmp(element->valuestring,
+    int element = findField(document, root, "format");
+    if(element != -1) {
+        if(stringEquals(document, element,
                     openxc::payload::json::PAYLOAD_FORMAT_JSON_NAME)) {
             command->payload_format_command.has_format = true;
             command->payload_format_command.format =
                     openxc_PayloadFormatCommand_PayloadFormat_JSON;
-        } else if(!strcmp(element->valuestring,
+        } else if(stringEquals(document, element,
                     openxc::payload::json::PAYLOAD_FORMAT_PROTOBUF_NAME)) {
             command->payload_format_command.has_format = true;
             command->payload_format_command.format =
@@ -269,50 +912,52 @@ static void deserializePayloadFormat(cJSON* root,
     }
 }
 
-static void deserializePredefinedObd2RequestsCommand(cJSON* root,
-        openxc_ControlCommand* command) {
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_PREDEFINED_OBD2_REQUESTS;
+static void deserializePredefinedObd2RequestsCommand(
+        const JsonDocument* document, int root,
+        openxc_VehicleMessage* message) {
+    openxc_ControlCommand* command = &message->control_command;
     command->has_predefined_obd2_requests_command = true;
 
-    cJSON* element = cJSON_GetObjectItem(root, "enabled");
-    if(element != NULL) {
+    int element = findField(document, root, "enabled");
+    if(element != -1) {
         command->predefined_obd2_requests_command.has_enabled = true;
-        command->predefined_obd2_requests_command.enabled = bool(element->valueint);
+        command->predefined_obd2_requests_command.enabled =
+                bool(intValue(document, element));
     }
 }
 
-static void deserializeAfBypass(cJSON* root, openxc_ControlCommand* command) {
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_ACCEPTANCE_FILTER_BYPASS;
+static void deserializeAfBypass(const JsonDocument* document, int root,
+        openxc_VehicleMessage* message) {
+    openxc_ControlCommand* command = &message->control_command;
     command->has_acceptance_filter_bypass_command = true;
 
-    cJSON* element = cJSON_GetObjectItem(root, "bus");
-    if(element != NULL) {
+    int element = findField(document, root, "bus");
+    if(element != -1) {
         command->acceptance_filter_bypass_command.has_bus = true;
-        command->acceptance_filter_bypass_command.bus = element->valueint;
+        command->acceptance_filter_bypass_command.bus =
+                intValue(document, element);
     }
 
-    element = cJSON_GetObjectItem(root, "bypass");
-    if(element != NULL) {
+    element = findField(document, root, "bypass");
+    if(element != -1) {
         command->acceptance_filter_bypass_command.has_bypass = true;
         command->acceptance_filter_bypass_command.bypass =
-            bool(element->valueint);
+            bool(intValue(document, element));
     }
 }
 
-static void deserializeDiagnostic(cJSON* root, openxc_ControlCommand* command) {
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_DIAGNOSTIC;
+static void deserializeDiagnostic(const JsonDocument* document, int root,
+        openxc_VehicleMessage* message) {
+    openxc_ControlCommand* command = &message->control_command;
     command->has_diagnostic_request = true;
 
-    cJSON* action = cJSON_GetObjectItem(root, "action");
-    if(action != NULL && action->type == cJSON_String) {
+    int action = findField(document, root, "action");
+    if(action != -1 && document->tokens[action].type == JSON_TOKEN_STRING) {
         command->diagnostic_request.has_action = true;
-        if(!strcmp(action->valuestring, "add")) {
+        if(stringEquals(document, action, "add")) {
             command->diagnostic_request.action =
                     openxc_DiagnosticControlCommand_Action_ADD;
-        } else if(!strcmp(action->valuestring, "cancel")) {
+        } else if(stringEquals(document, action, "cancel")) {
             command->diagnostic_request.action =
                     openxc_DiagnosticControlCommand_Action_CANCEL;
         } else {
@@ -320,100 +965,102 @@ static void deserializeDiagnostic(cJSON* root, openxc_ControlCommand* command) {
         }
     }
 
-    cJSON* request = cJSON_GetObjectItem(root, "request");
-    if(request != NULL) {
-        cJSON* element = cJSON_GetObjectItem(request, "bus");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_bus = true;
-            command->diagnostic_request.request.bus = element->valueint;
+    int request = findField(document, root, "request");
+    if(request != -1) {
+        openxc_DiagnosticRequest* diagnosticRequest =
+                &command->diagnostic_request.request;
+        int element = findField(document, request, "bus");
+        if(element != -1) {
+            diagnosticRequest->has_bus = true;
+            diagnosticRequest->bus = intValue(document, element);
         }
 
-        element = cJSON_GetObjectItem(request, "mode");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_mode = true;
-            command->diagnostic_request.request.mode = element->valueint;
+        element = findField(document, request, "mode");
+        if(element != -1) {
+            diagnosticRequest->has_mode = true;
+            diagnosticRequest->mode = intValue(document, element);
         }
 
-        element = cJSON_GetObjectItem(request, "id");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_message_id = true;
-            command->diagnostic_request.request.message_id = element->valueint;
+        element = findField(document, request, "id");
+        if(element != -1) {
+            diagnosticRequest->has_message_id = true;
+            diagnosticRequest->message_id = intValue(document, element);
         }
 
-        element = cJSON_GetObjectItem(request, "pid");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_pid = true;
-            command->diagnostic_request.request.pid = element->valueint;
+        element = findField(document, request, "pid");
+        if(element != -1) {
+            diagnosticRequest->has_pid = true;
+            diagnosticRequest->pid = intValue(document, element);
         }
 
-        element = cJSON_GetObjectItem(request, "payload");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_payload = true;
-            command->diagnostic_request.request.payload.size = dehexlify(
-                    element->valuestring,
-                    command->diagnostic_request.request.payload.bytes,
-                    sizeof(((openxc_DiagnosticRequest*)0)->payload.bytes));
+        element = findField(document, request, "payload");
+        if(element != -1) {
+            diagnosticRequest->has_payload = true;
+            diagnosticRequest->payload.size = dehexlify(document, element,
+                    diagnosticRequest->payload.bytes,
+                    sizeof(diagnosticRequest->payload.bytes));
         }
 
-        element = cJSON_GetObjectItem(request, "multiple_responses");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_multiple_responses = true;
-            command->diagnostic_request.request.multiple_responses =
-                bool(element->valueint);
+        element = findField(document, request, "multiple_responses");
+        if(element != -1) {
+            diagnosticRequest->has_multiple_responses = true;
+            diagnosticRequest->multiple_responses =
+                bool(intValue(document, element));
         }
 
-        element = cJSON_GetObjectItem(request, "frequency");
-        if(element != NULL) {
-            command->diagnostic_request.request.has_frequency = true;
-            command->diagnostic_request.request.frequency =
-                element->valuedouble;
+        element = findField(document, request, "frequency");
+        if(element != -1) {
+            diagnosticRequest->has_frequency = true;
+            diagnosticRequest->frequency = numberValue(document, element);
         }
 
-        element = cJSON_GetObjectItem(request, "decoded_type");
-        if(element != NULL) {
-            if(!strcmp(element->valuestring, "obd2")) {
-                command->diagnostic_request.request.has_decoded_type = true;
-                command->diagnostic_request.request.decoded_type =
+        element = findField(document, request, "decoded_type");
+        if(element != -1) {
+            if(stringEquals(document, element, "obd2")) {
+                diagnosticRequest->has_decoded_type = true;
+                diagnosticRequest->decoded_type =
                         openxc_DiagnosticRequest_DecodedType_OBD2;
-            } else if(!strcmp(element->valuestring, "none")) {
-                command->diagnostic_request.request.has_decoded_type = true;
-                command->diagnostic_request.request.decoded_type =
+            } else if(stringEquals(document, element, "none")) {
+                diagnosticRequest->has_decoded_type = true;
+                diagnosticRequest->decoded_type =
                         openxc_DiagnosticRequest_DecodedType_NONE;
             }
         }
 
-        element = cJSON_GetObjectItem(request, "name");
-        if(element != NULL && element->type == cJSON_String) {
-            command->diagnostic_request.request.has_name = true;
-            strcpy(command->diagnostic_request.request.name,
-                    element->valuestring);
+        element = findField(document, request, "name");
+        if(element != -1 && copyString(document, element,
+                    diagnosticRequest->name,
+                    sizeof(diagnosticRequest->name))) {
+            diagnosticRequest->has_name = true;
         }
     }
 }
 
-static bool deserializeDynamicField(cJSON* element,
-        openxc_DynamicField* field) {
+static bool deserializeDynamicField(const JsonDocument* document,
+        int element, openxc_DynamicField* field) {
     bool status = true;
     field->has_type = true;
-    switch(element->type) {
-        case cJSON_String:
+    switch(document->tokens[element].type) {
+        case JSON_TOKEN_STRING:
             field->type = openxc_DynamicField_Type_STRING;
             field->has_string_value = true;
-            strcpy(field->string_value, element->valuestring);
+            copyString(document, element, field->string_value,
+                    sizeof(field->string_value));
             break;
-        case cJSON_False:
-        case cJSON_True:
+        case JSON_TOKEN_FALSE:
+        case JSON_TOKEN_TRUE:
             field->type = openxc_DynamicField_Type_BOOL;
             field->has_boolean_value = true;
-            field->boolean_value = bool(element->valueint);
+            field->boolean_value = bool(intValue(document, element));
             break;
-        case cJSON_Number:
+        case JSON_TOKEN_NUMBER:
             field->type = openxc_DynamicField_Type_NUM;
             field->has_numeric_value = true;
-            field->numeric_value = element->valuedouble;
+            field->numeric_value = numberValue(document, element);
             break;
         default:
-            debug("Unsupported type in value field: %d", element->type);
+            debug("Unsupported type in value field: %d",
+                    document->tokens[element].type);
             field->has_type = false;
             status = false;
             break;
@@ -421,66 +1068,67 @@ static bool deserializeDynamicField(cJSON* element,
     return status;
 }
 
-static void deserializeSimple(cJSON* root, openxc_VehicleMessage* message) {
+static void deserializeSimple(const JsonDocument* document, int root,
+        openxc_VehicleMessage* message) {
     message->has_type = true;
     message->type = openxc_VehicleMessage_Type_SIMPLE;
     message->has_simple_message = true;
     openxc_SimpleMessage* simpleMessage = &message->simple_message;
 
-    cJSON* element = cJSON_GetObjectItem(root, "name");
-    if(element != NULL && element->type == cJSON_String) {
+    int element = findField(document, root, "name");
+    if(element != -1 && copyString(document, element, simpleMessage->name,
+                sizeof(simpleMessage->name))) {
         simpleMessage->has_name = true;
-        strcpy(simpleMessage->name, element->valuestring);
     }
 
-    element = cJSON_GetObjectItem(root, "value");
-    if(element != NULL) {
-        if(deserializeDynamicField(element, &simpleMessage->value)) {
+    element = findField(document, root, "value");
+    if(element != -1) {
+        if(deserializeDynamicField(document, element, &simpleMessage->value)) {
             simpleMessage->has_value = true;
         }
     }
 
-    element = cJSON_GetObjectItem(root, "event");
-    if(element != NULL) {
-        if(deserializeDynamicField(element, &simpleMessage->event)) {
+    element = findField(document, root, "event");
+    if(element != -1) {
+        if(deserializeDynamicField(document, element, &simpleMessage->event)) {
             simpleMessage->has_event = true;
         }
     }
 }
 
-static void deserializeCan(cJSON* root, openxc_VehicleMessage* message) {
+static void deserializeCan(const JsonDocument* document, int root,
+        openxc_VehicleMessage* message) {
     message->has_type = true;
     message->type = openxc_VehicleMessage_Type_CAN;
     message->has_can_message = true;
     openxc_CanMessage* canMessage = &message->can_message;
 
-    cJSON* element = cJSON_GetObjectItem(root, "id");
-    if(element != NULL) {
+    int element = findField(document, root, "id");
+    if(element != -1) {
         canMessage->has_id = true;
-        canMessage->id = element->valueint;
+        canMessage->id = intValue(document, element);
 
-        element = cJSON_GetObjectItem(root, "data");
-        if(element != NULL) {
+        element = findField(document, root, "data");
+        if(element != -1) {
             canMessage->has_data = true;
-            canMessage->data.size = dehexlify(
-                    element->valuestring,
-                    canMessage->data.bytes,
-                    sizeof(((openxc_CanMessage*)0)->data.bytes));
+            canMessage->data.size = dehexlify(document, element,
+                    canMessage->data.bytes, sizeof(canMessage->data.bytes));
         }
 
-        element = cJSON_GetObjectItem(root, "bus");
-        if(element != NULL) {
+        element = findField(document, root, "bus");
+        if(element != -1) {
             canMessage->has_bus = true;
-            canMessage->bus = element->valueint;
+            canMessage->bus = intValue(document, element);
         }
 
-        element = cJSON_GetObjectItem(root, payload::json::FRAME_FORMAT_FIELD_NAME);
-        if(element != NULL) {
+        element = findField(document, root,
+                payload::json::FRAME_FORMAT_FIELD_NAME);
+        if(element != -1) {
             canMessage->has_frame_format = true;
-            if(!strcmp(element->valuestring,
+            if(stringEquals(document, element,
                         payload::json::FRAME_FORMAT_STANDARD_NAME)) {
                 canMessage->frame_format = openxc_CanMessage_FrameFormat_STANDARD;
-            } else if(!strcmp(element->valuestring,
+            } else if(stringEquals(document, element,
                         payload::json::FRAME_FORMAT_EXTENDED_NAME)) {
                 canMessage->frame_format = openxc_CanMessage_FrameFormat_EXTENDED;
             } else {
@@ -492,43 +1140,176 @@ static void deserializeCan(cJSON* root, openxc_VehicleMessage* message) {
     }
 }
 
-static void deserializeModemConfiguration(cJSON* root, openxc_ControlCommand* command) {
+static void deserializeModemConfiguration(const JsonDocument* document,
+        int root, openxc_VehicleMessage* message) {
     // set up the struct for a modem configuration message
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_MODEM_CONFIGURATION;
+    openxc_ControlCommand* command = &message->control_command;
     command->has_modem_configuration_command = true;
     openxc_ModemConfigurationCommand* modemConfigurationCommand = &command->modem_configuration_command;
-    
+
     // parse server command
-    cJSON* server = cJSON_GetObjectItem(root, "server");
-    if(server != NULL) {
+    int server = findField(document, root, "server");
+    if(server != -1) {
         modemConfigurationCommand->has_serverConnectSettings = true;
-        cJSON* host = cJSON_GetObjectItem(server, "host");
-        if(host != NULL) {
+        int host = findField(document, server, "host");
+        if(host != -1) {
             modemConfigurationCommand->serverConnectSettings.has_host = true;
-            strcpy(modemConfigurationCommand->serverConnectSettings.host, host->valuestring);
+            copyString(document, host,
+                    modemConfigurationCommand->serverConnectSettings.host,
+                    sizeof(modemConfigurationCommand->serverConnectSettings.host));
         }
-        cJSON* port = cJSON_GetObjectItem(server, "port");
-        if(port != NULL) {
+        int port = findField(document, server, "port");
+        if(port != -1) {
             modemConfigurationCommand->serverConnectSettings.has_port = true;
-            modemConfigurationCommand->serverConnectSettings.port = port->valueint;
+            modemConfigurationCommand->serverConnectSettings.port =
+                    intValue(document, port);
         }
     }
 }
 
-static void deserializeRTCConfiguration(cJSON* root, openxc_ControlCommand* command) {
-
-    command->has_type = true;
-    command->type = openxc_ControlCommand_Type_RTC_CONFIGURATION;
+static void deserializeRTCConfiguration(const JsonDocument* document,
+        int root, openxc_VehicleMessage* message) {
+    openxc_ControlCommand* command = &message->control_command;
     command->has_rtc_configuration_command = true;
     openxc_RTCConfigurationCommand* rtcConfigurationCommand = &command->rtc_configuration_command;
-    
-    cJSON* time = cJSON_GetObjectItem(root, "unix_time");
-    if(time != NULL) {
-        
+
+    int time = findField(document, root, "unix_time");
+    if(time != -1) {
         rtcConfigurationCommand->has_unix_time = true;
-        rtcConfigurationCommand->unix_time = time->valueint;
+        rtcConfigurationCommand->unix_time = intValue(document, time);
+    }
+}
+
+/* Private: Parse a subscription command - the signal name and CAN message it
+ * refers to are stored in the message's simple and CAN message fields, as there
+ * are no fields for them in the control command.
+ */
+static void deserializeSubscription(const JsonDocument* document, int root,
+        openxc_VehicleMessage* message) {
+    int element = findField(document, root, "name");
+    if(element != -1 && copyString(document, element,
+                message->simple_message.name,
+                sizeof(message->simple_message.name))) {
+        message->has_simple_message = true;
+        message->simple_message.has_name = true;
+
+        element = findField(document, root, "frequency");
+        if(element != -1) {
+            message->simple_message.has_value = true;
+            message->simple_message.value = payload::wrapNumber(
+                    numberValue(document, element));
+        }
+    }
+
+    int bus = findField(document, root, "bus");
+    int id = findField(document, root, "id");
+    if(bus != -1 && id != -1) {
+        message->has_can_message = true;
+        message->can_message.has_bus = true;
+        message->can_message.bus = intValue(document, bus);
+        message->can_message.has_id = true;
+        message->can_message.id = intValue(document, id);
+    }
+}
+
+typedef void (*CommandDeserializer)(const JsonDocument* document, int root,
+        openxc_VehicleMessage* message);
+
+/* Private: How to parse the command with a name.
+ *
+ * name - The value of the "command" field.
+ * type - The type of the command.
+ * deserialize - A function to parse the command's other fields, or NULL if it
+ *      has none.
+ * nameHash - The hash of the name, filled in the first time a command is
+ *      parsed.
+ */
+typedef struct {
+    const char* name;
+    openxc_ControlCommand_Type type;
+    CommandDeserializer deserialize;
+    uint32_t nameHash;
+} CommandParser;
+
+static CommandParser COMMAND_PARSERS[] = {
+    {payload::json::VERSION_COMMAND_NAME,
+        openxc_ControlCommand_Type_VERSION, NULL, 0},
+    {payload::json::DEVICE_ID_COMMAND_NAME,
+        openxc_ControlCommand_Type_DEVICE_ID, NULL, 0},
+    {payload::json::DEVICE_PLATFORM_COMMAND_NAME,
+        openxc_ControlCommand_Type_PLATFORM, NULL, 0},
+    {payload::json::DIAGNOSTIC_COMMAND_NAME,
+        openxc_ControlCommand_Type_DIAGNOSTIC, deserializeDiagnostic, 0},
+    {payload::json::PASSTHROUGH_COMMAND_NAME,
+        openxc_ControlCommand_Type_PASSTHROUGH, deserializePassthrough, 0},
+    {payload::json::PREDEFINED_OBD2_REQUESTS_COMMAND_NAME,
+        openxc_ControlCommand_Type_PREDEFINED_OBD2_REQUESTS,
+        deserializePredefinedObd2RequestsCommand, 0},
+    {payload::json::ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME,
+        openxc_ControlCommand_Type_ACCEPTANCE_FILTER_BYPASS,
+        deserializeAfBypass, 0},
+    {payload::json::PAYLOAD_FORMAT_COMMAND_NAME,
+        openxc_ControlCommand_Type_PAYLOAD_FORMAT, deserializePayloadFormat,
+        0},
+    {payload::json::MODEM_CONFIGURATION_COMMAND_NAME,
+        openxc_ControlCommand_Type_MODEM_CONFIGURATION,
+        deserializeModemConfiguration, 0},
+    {payload::json::RTC_CONFIGURATION_COMMAND_NAME,
+        openxc_ControlCommand_Type_RTC_CONFIGURATION,
+        deserializeRTCConfiguration, 0},
+    {payload::json::SD_MOUNT_STATUS_COMMAND_NAME,
+        openxc_ControlCommand_Type_SD_MOUNT_STATUS, NULL, 0},
+    {payload::json::SUBSCRIBE_COMMAND_NAME,
+        payload::SUBSCRIBE_COMMAND_TYPE, deserializeSubscription, 0},
+    {payload::json::UNSUBSCRIBE_COMMAND_NAME,
+        payload::UNSUBSCRIBE_COMMAND_TYPE, deserializeSubscription, 0},
+    {payload::json::METRICS_COMMAND_NAME,
+        payload::METRICS_COMMAND_TYPE, NULL, 0},
+};
+
+/* Private: The 32-bit FNV-1a hash of a string.
+ */
+static uint32_t hashName(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
     }
+    return hash;
+}
+
+/* Private: Find the parser for a command by its name, comparing hashes before
+ * comparing the names themselves.
+ *
+ * Returns the parser, or NULL if the command isn't recognized.
+ */
+static const CommandParser* findCommandParser(const JsonDocument* document,
+        int commandName) {
+    static bool hashed = false;
+    const int parserCount = sizeof(COMMAND_PARSERS) / sizeof(CommandParser);
+    if(!hashed) {
+        for(int i = 0; i < parserCount; i++) {
+            COMMAND_PARSERS[i].nameHash = hashName(COMMAND_PARSERS[i].name,
+                    strlen(COMMAND_PARSERS[i].name));
+        }
+        hashed = true;
+    }
+
+    const JsonToken* token = &document->tokens[commandName];
+    if(token->type != JSON_TOKEN_STRING) {
+        return NULL;
+    }
+
+    const char* name = document->json + token->start;
+    size_t length = token->end - token->start;
+    uint32_t hash = hashName(name, length);
+    for(int i = 0; i < parserCount; i++) {
+        if(COMMAND_PARSERS[i].nameHash == hash &&
+                !strncmp(COMMAND_PARSERS[i].name, name, length) &&
+                COMMAND_PARSERS[i].name[length] == '\0') {
+            return &COMMAND_PARSERS[i];
+        }
+    }
+    return NULL;
 }
 
 size_t openxc::payload::json::deserialize(uint8_t payload[], size_t length,
@@ -537,136 +1318,143 @@ size_t openxc::payload::json::deserialize(uint8_t payload[], size_t length,
     size_t messageLength = 0;
     if(delimiter != NULL) {
         messageLength = (size_t)(delimiter - (const char*)payload) + 1;
-        uint8_t messageBuffer[messageLength];
-        if(messageLength > 0) {
-            memcpy(messageBuffer, payload, messageLength);
-        }
         // There may be junk data at the start of the payload - seek ahead to the
         // start of the message.
-        char* jsonStart = strchr((char*)messageBuffer, '{');
+        const char* jsonStart = strchr((const char*)payload, '{');
         if(jsonStart == NULL) {
             debug("%s", "No JSON object start found");
             // Return message length so this bogus front matter is erased
             return messageLength;
         }
 
-        cJSON *root = cJSON_Parse(jsonStart);
-        if(root == NULL) {
+        JsonDocument document;
+        // Token offsets are only 16 bits
+        if(messageLength > 0xffff || !tokenize(&document, jsonStart)) {
             debug("No JSON found in %u byte payload", length);
-            // TODO should this return messageLength to eat up corrupt data, or
-            // does it need to be 0 so we preserve partial messages?
-            return 0;
+            // The message is complete but can't be parsed - it's invalid or
+            // has more than MAX_JSON_TOKENS tokens - so eat it up, otherwise
+            // it would hold up every message behind it.
+            return messageLength;
         }
 
+        const int root = 0;
         message->has_type = true;
-        cJSON* commandNameObject = cJSON_GetObjectItem(root, "command");
-        if(commandNameObject != NULL) {
+        int commandName = findField(&document, root, "command");
+        if(commandName != -1) {
             message->has_type = true;
             message->type = openxc_VehicleMessage_Type_CONTROL_COMMAND;
             message->has_control_command = true;
-            openxc_ControlCommand* command = &message->control_command;
-
-            if(!strncmp(commandNameObject->valuestring, VERSION_COMMAND_NAME,
-                        strlen(VERSION_COMMAND_NAME))) {
-                command->has_type = true;
-                command->type = openxc_ControlCommand_Type_VERSION;
-            } else if(!strncmp(commandNameObject->valuestring,
-                        DEVICE_ID_COMMAND_NAME, strlen(DEVICE_ID_COMMAND_NAME))) {
-                command->has_type = true;
-                command->type = openxc_ControlCommand_Type_DEVICE_ID;
-            } else if(!strncmp(commandNameObject->valuestring,
-                        DEVICE_PLATFORM_COMMAND_NAME, strlen(DEVICE_PLATFORM_COMMAND_NAME))) {
-                command->has_type = true;
-                command->type = openxc_ControlCommand_Type_PLATFORM;
-            } else if(!strncmp(commandNameObject->valuestring,
-                        DIAGNOSTIC_COMMAND_NAME, strlen(DIAGNOSTIC_COMMAND_NAME))) {
-                deserializeDiagnostic(root, command);
-            } else if(!strncmp(commandNameObject->valuestring,
-                        PASSTHROUGH_COMMAND_NAME, strlen(PASSTHROUGH_COMMAND_NAME))) {
-                deserializePassthrough(root, command);
-            } else if(!strncmp(commandNameObject->valuestring,
-                        PREDEFINED_OBD2_REQUESTS_COMMAND_NAME,
-                            strlen(PREDEFINED_OBD2_REQUESTS_COMMAND_NAME))) {
-                deserializePredefinedObd2RequestsCommand(root, command);
-            } else if(!strncmp(commandNameObject->valuestring,
-                        ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME,
-                        strlen(ACCEPTANCE_FILTER_BYPASS_COMMAND_NAME))) {
-                deserializeAfBypass(root, command);
-            } else if(!strncmp(commandNameObject->valuestring,
-                        PAYLOAD_FORMAT_COMMAND_NAME,
-                        strlen(PAYLOAD_FORMAT_COMMAND_NAME))) {
-                deserializePayloadFormat(root, command);
-            } 
-            else if(!strncmp(commandNameObject->valuestring,
-                        MODEM_CONFIGURATION_COMMAND_NAME,
-                        strlen(MODEM_CONFIGURATION_COMMAND_NAME))) {
-                deserializeModemConfiguration(root, command);
-            }
-            else if(!strncmp(commandNameObject->valuestring,
-                        RTC_CONFIGURATION_COMMAND_NAME,
-                        strlen(RTC_CONFIGURATION_COMMAND_NAME))) {
-                deserializeRTCConfiguration(root, command);
-            }
-            else if(!strncmp(commandNameObject->valuestring,
-                        SD_MOUNT_STATUS_COMMAND_NAME,
-                        strlen(SD_MOUNT_STATUS_COMMAND_NAME))) {
-                command->has_type = true;
-                command->type = openxc_ControlCommand_Type_SD_MOUNT_STATUS;
-            }
-            else {
-                debug("Unrecognized command: %s", commandNameObject->valuestring);
+
+            const CommandParser* parser = findCommandParser(&document,
+                    commandName);
+            if(parser != NULL) {
+                message->control_command.has_type = true;
+                message->control_command.type = parser->type;
+                if(parser->deserialize != NULL) {
+                    parser->deserialize(&document, root, message);
+                }
+            } else {
+                const JsonToken* token = &document.tokens[commandName];
+                debug("Unrecognized command: %.*s", token->end - token->start,
+                        document.json + token->start);
                 message->has_control_command = false;
             }
         } else {
-            cJSON* nameObject = cJSON_GetObjectItem(root, "name");
-            if(nameObject == NULL) {
-                deserializeCan(root, message);
+            if(findField(&document, root, "name") == -1) {
+                deserializeCan(&document, root, message);
             } else {
-                deserializeSimple(root, message);
+                deserializeSimple(&document, root, message);
             }
         }
-        cJSON_Delete(root);
     }
 
     return messageLength;
 }
 
+int openxc::payload::json::serializeMetrics(
+        const openxc::metrics::MetricsSnapshot* snapshot, uint8_t payload[],
+        size_t length) {
+    JsonWriter writer = {(char*)payload, length, 0, 0};
+    writeCharacter(&writer, '{');
+    writeStringField(&writer, payload::json::COMMAND_RESPONSE_FIELD_NAME,
+            payload::json::METRICS_COMMAND_NAME);
+    writeBoolField(&writer, payload::json::COMMAND_RESPONSE_STATUS_FIELD_NAME,
+            true);
+
+    writeKey(&writer, payload::json::METRICS_CAN_FIELD_NAME);
+    writeCharacter(&writer, '[');
+    for(int i = 0; i < snapshot->busCount; i++) {
+        uint32_t row[BUS_METRICS_ROW_LENGTH];
+        openxc::metrics::busMetricsRow(&snapshot->buses[i], row);
+        writeBytes(&writer, i > 0 ? ",[" : "[", i > 0 ? 2 : 1);
+        writeUnsignedElements(&writer, row, BUS_METRICS_ROW_LENGTH);
+        writeCharacter(&writer, ']');
+    }
+    writeCharacter(&writer, ']');
+
+    writeKey(&writer, payload::json::METRICS_INTERFACES_FIELD_NAME);
+    writeCharacter(&writer, '[');
+    for(int i = 0; i < snapshot->interfaceCount; i++) {
+        uint32_t row[INTERFACE_METRICS_ROW_LENGTH];
+        openxc::metrics::interfaceMetricsRow(&snapshot->interfaces[i], row);
+        writeBytes(&writer, i > 0 ? ",[" : "[", i > 0 ? 2 : 1);
+        writeString(&writer, snapshot->interfaces[i].name);
+        writeCharacter(&writer, ',');
+        writeUnsignedElements(&writer, row, INTERFACE_METRICS_ROW_LENGTH);
+        writeCharacter(&writer, ']');
+    }
+    writeCharacter(&writer, ']');
+
+    writeKey(&writer, payload::json::METRICS_LOOP_FIELD_NAME);
+    uint32_t loop[] = {snapshot->loopPasses, snapshot->loopAverageUs,
+            snapshot->loopMaxUs};
+    writeCharacter(&writer, '[');
+    writeUnsignedElements(&writer, loop, sizeof(loop) / sizeof(loop[0]));
+    writeCharacter(&writer, ']');
+
+    writeCharacter(&writer, '}');
+    // Include the NULL character as a delimiter
+    writeCharacter(&writer, '\0');
+
+    if(writer.position > length) {
+        debug("Metrics need %d bytes, more than the payload buffer",
+                writer.position);
+        return 0;
+    }
+    return writer.position;
+}
+
 int openxc::payload::json::serialize(openxc_VehicleMessage* message,
         uint8_t payload[], size_t length) {
-    cJSON* root = cJSON_CreateObject();
-    size_t finalLength = 0;
-    if(root != NULL) {
-        bool status = true;
-        if(message->has_timestamp) {
-            cJSON_AddNumberToObject(root, "timestamp", message->timestamp);
-        }
-        if(message->type == openxc_VehicleMessage_Type_SIMPLE) {
-            status = serializeSimple(message, root);
-        } else if(message->type == openxc_VehicleMessage_Type_CAN) {
-            status = serializeCan(message, root);
-        } else if(message->type == openxc_VehicleMessage_Type_DIAGNOSTIC) {
-            status = serializeDiagnostic(message, root);
-        } else if(message->type == openxc_VehicleMessage_Type_COMMAND_RESPONSE) {
-            status = serializeCommandResponse(message, root);
-        } else {
-            debug("Unrecognized message type -- not sending");
-        }
-
-        char* serialized = cJSON_PrintUnformatted(root);
-        if(status && serialized != NULL) {
-            // set the length to the strlen + 1, so we include the NULL
-            // character as a delimiter
-            finalLength = MIN(length, strlen(serialized) + 1);
-            memcpy(payload, serialized, finalLength);
-
-            free(serialized);
-        } else {
-            debug("Converting JSON to string failed -- possibly OOM");
-        }
+    return serialize(message, payload, length, -1);
+}
 
-        cJSON_Delete(root);
+int openxc::payload::json::serialize(openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length, int precision) {
+    JsonWriter writer = {(char*)payload, length, 0, 0};
+    bool status = true;
+    writeCharacter(&writer, '{');
+    if(message->has_timestamp) {
+        writeNumberField(&writer, "timestamp", message->timestamp);
+    }
+    if(message->type == openxc_VehicleMessage_Type_SIMPLE) {
+        status = serializeSimple(message, &writer, precision);
+    } else if(message->type == openxc_VehicleMessage_Type_CAN) {
+        status = serializeCan(message, &writer);
+    } else if(message->type == openxc_VehicleMessage_Type_DIAGNOSTIC) {
+        status = serializeDiagnostic(message, &writer);
+    } else if(message->type == openxc_VehicleMessage_Type_COMMAND_RESPONSE) {
+        status = serializeCommandResponse(message, &writer);
     } else {
-        debug("JSON object is NULL -- probably OOM");
+        debug("Unrecognized message type -- not sending");
+    }
+    writeCharacter(&writer, '}');
+    // Include the NULL character as a delimiter
+    writeCharacter(&writer, '\0');
+
+    if(!status) {
+        debug("Converting JSON to string failed");
+        return 0;
     }
-    return finalLength;
+    return MIN(length, writer.position);
 }
@@ -2,6 +2,7 @@
 #define __JSON_H__
 
 #include "openxc.pb.h"
+#include "metrics.h"
 
 #define MAX_DIAGNOSTIC_PAYLOAD_SIZE 260
 
@@ -47,6 +48,13 @@ extern const char DIAGNOSTIC_VALUE_FIELD_NAME[];
 extern const char MODEM_CONFIGURATION_COMMAND_NAME[];
 extern const char RTC_CONFIGURATION_COMMAND_NAME[];
 extern const char SD_MOUNT_STATUS_COMMAND_NAME[];
+extern const char SUBSCRIBE_COMMAND_NAME[];
+extern const char UNSUBSCRIBE_COMMAND_NAME[];
+extern const char METRICS_COMMAND_NAME[];
+
+extern const char METRICS_CAN_FIELD_NAME[];
+extern const char METRICS_INTERFACES_FIELD_NAME[];
+extern const char METRICS_LOOP_FIELD_NAME[];
 
 /* Public: Deserialize an OpenXC message from a payload containing JSON.
  *
@@ -70,6 +78,37 @@ size_t deserialize(uint8_t payload[], size_t length, openxc_VehicleMessage* mess
  */
 int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length);
 
+/* Public: Serialize an OpenXC message as JSON, writing the numeric value and
+ * event of a simple message with at most the given number of decimal places.
+ * Trailing zeros are dropped, e.g. 12.5 instead of 12.500000.
+ *
+ * precision - The most decimal places for a simple message's numbers, or -1
+ *      for the default.
+ *
+ * Returns the number of bytes written to the payload. If the length is 0, an
+ * error occurred while serializing.
+ */
+int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length,
+        int precision);
+
+/* Public: Serialize a snapshot of the device's health metrics as the JSON
+ * response to a metrics command, with each section as arrays of integers to
+ * keep it small enough for one message, e.g.:
+ *
+ *      {"command_response": "metrics", "status": true,
+ *          "can": [[<bus row>], ...],
+ *          "out": [["usb", <interface row>], ...],
+ *          "loop": [<passes>, <average us>, <max us>]}
+ *
+ * See metrics::busMetricsRow and metrics::interfaceMetricsRow for the order of
+ * the values in each row.
+ *
+ * Returns the number of bytes written to the payload, or 0 if the snapshot
+ * doesn't fit.
+ */
+int serializeMetrics(const openxc::metrics::MetricsSnapshot* snapshot,
+        uint8_t payload[], size_t length);
+
 } // namespace json
 } // namespace payload
 } // namespace openxc
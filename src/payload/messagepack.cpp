@@ -11,18 +11,39 @@
 #include "config.h"
 #include "util/log.h"
 
-#define MESSAGE_PACK_SERIAL_BUF_SZ      128
 #define MESSAGE_PACK_FIXMAP_MARKER     0x80    
 #define MESSAGE_PACK_FIXMAP_SIZE     0x0F
 #define MESSAGE_PACK_FALSE_MARKER    0xC2
 #define MESSAGE_PACK_TRUE_MARKER     0xC3
+#define MESSAGE_PACK_FLOAT_MARKER    0xCA
 #define MESSAGE_PACK_DOUBLE_MARKER   0xCB
+#define MESSAGE_PACK_UINT8_MARKER    0xCC
+#define MESSAGE_PACK_UINT16_MARKER   0xCD
+#define MESSAGE_PACK_UINT32_MARKER   0xCE
+#define MESSAGE_PACK_UINT64_MARKER   0xCF
+#define MESSAGE_PACK_INT8_MARKER     0xD0
+#define MESSAGE_PACK_INT16_MARKER    0xD1
+#define MESSAGE_PACK_INT32_MARKER    0xD2
+#define MESSAGE_PACK_INT64_MARKER    0xD3
+#define MESSAGE_PACK_STR8_MARKER     0xD9
+#define MESSAGE_PACK_STR16_MARKER    0xDA
+#define MESSAGE_PACK_BIN8_MARKER     0xC4
+#define MESSAGE_PACK_BIN16_MARKER    0xC5
 #define MESSAGE_PACK_FIXSTR_MARKER   0xA0
-#define MESSAGE_PACK_FIXMAP_MARKER   0x80
+#define MESSAGE_PACK_FIXARRAY_MARKER 0x90
+#define MESSAGE_PACK_FIXARRAY_SIZE   0x0F
+#define MESSAGE_PACK_ARRAY16_MARKER  0xDC
 #define MESSAGE_PACK_MAX_STRLEN      0x1F
+#define MESSAGE_PACK_POSITIVE_FIXNUM_MAX 0x7F
+#define MESSAGE_PACK_NEGATIVE_FIXNUM_MIN -0x20
 
 #define MAX_STRLEN 25
 #define MAX_BINLEN 25
+
+// The bytes available for the nodes and strings of one decoded message
+#ifndef MESSAGE_PACK_ARENA_SIZE
+#define MESSAGE_PACK_ARENA_SIZE 1024
+#endif
     
 namespace payload = openxc::payload;
 using openxc::util::log::debug;
@@ -64,12 +85,13 @@ const char openxc::payload::messagepack::DIAGNOSTIC_NRC_FIELD_NAME[] = "negative
 const char openxc::payload::messagepack::DIAGNOSTIC_PAYLOAD_FIELD_NAME[] = "payload";
 const char openxc::payload::messagepack::DIAGNOSTIC_VALUE_FIELD_NAME[] = "value";
 const char openxc::payload::messagepack::SD_MOUNT_STATUS_COMMAND_NAME[] = "sd_mount_status";
+const char openxc::payload::messagepack::SUBSCRIBE_COMMAND_NAME[] = "subscribe";
+const char openxc::payload::messagepack::UNSUBSCRIBE_COMMAND_NAME[] = "unsubscribe";
+const char openxc::payload::messagepack::METRICS_COMMAND_NAME[] = "metrics";
 
 
 enum msgpack_var_type{TYPE_STRING,TYPE_NUMBER,TYPE_TRUE,TYPE_FALSE,TYPE_BINARY,TYPE_MAP};
 
-int32_t dynamic_allocation_bytes = 0;
-
 typedef struct sMsgPackNode{
     char * string; //points to string header and not the string inorder to derive string 
     enum   msgpack_var_type type;
@@ -81,6 +103,17 @@ typedef struct sMsgPackNode{
     sMsgPackNode *next,*child;
 }sMsgPackNode; 
 
+/* Private: Fixed storage for the nodes of a decoded message, so decoding
+ * doesn't touch the heap. Everything is freed at once by resetting used.
+ *
+ * storage - The memory to allocate from - doubles to keep nodes aligned.
+ * used - The number of bytes allocated so far.
+ */
+typedef struct{
+    double storage[MESSAGE_PACK_ARENA_SIZE / sizeof(double)];
+    size_t used;
+}sMsgPackArena;
+
 typedef struct{
     uint8_t MsgPackMapPairCount;
 }meta;
@@ -91,9 +124,10 @@ typedef struct{
     uint8_t * rp;
     uint8_t * wp;
     meta     mobj;
+    sMsgPackArena* arena;
 }sFile;    
 
-sMsgPackNode* msgPackParse(uint8_t* buf,uint32_t* len);
+sMsgPackNode* msgPackParse(uint8_t* buf,uint32_t* len, sMsgPackArena* arena);
 
 static size_t msgPackWriteBuffer(cmp_ctx_t *ctx, const void *data, size_t count) {
     
@@ -120,7 +154,7 @@ static bool msgPackReadBuffer(cmp_ctx_t *ctx, void *data, size_t count) {
     return count;
 }
 
-static void msgPackInitBuffer(sFile* smsgpackb, uint8_t* buf, uint8_t len){
+static void msgPackInitBuffer(sFile* smsgpackb, uint8_t* buf, uint32_t len){
 
     smsgpackb->end   = buf + len - 1;
     smsgpackb->start = buf;
@@ -129,159 +163,259 @@ static void msgPackInitBuffer(sFile* smsgpackb, uint8_t* buf, uint8_t len){
     
 }
  
-static void msgPackAddObjectString(cmp_ctx_t *ctx, const char* fname ,const char* obj){
-    sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
-    cmp_write_str(ctx, (const char *)obj, strlen(obj));
-    s->mobj.MsgPackMapPairCount++;
+/* Private: A position in the caller's buffer for writing MessagePack directly.
+ *
+ * buffer - The caller's buffer.
+ * length - The length of the buffer.
+ * position - The number of bytes of output so far, including any that
+ *      didn't fit.
+ * fieldCount - The number of fields written to the top level map.
+ */
+typedef struct{
+    uint8_t* buffer;
+    size_t length;
+    size_t position;
+    uint8_t fieldCount;
+}sMsgPackWriter;
+
+// Map keys with their fixstr headers already in front, so they're copied into
+// the output instead of encoded for every message
+static const char TIMESTAMP_KEY[] = "\xA9" "timestamp";
+static const char NAME_KEY[] = "\xA4" "name";
+static const char VALUE_KEY[] = "\xA5" "value";
+static const char EVENT_KEY[] = "\xA5" "event";
+static const char BUS_KEY[] = "\xA3" "bus";
+static const char ID_KEY[] = "\xA2" "id";
+static const char DATA_KEY[] = "\xA4" "data";
+static const char FRAME_FORMAT_KEY[] = "\xAC" "frame_format";
+static const char MODE_KEY[] = "\xA4" "mode";
+static const char SUCCESS_KEY[] = "\xA7" "success";
+static const char PID_KEY[] = "\xA3" "pid";
+static const char NRC_KEY[] = "\xB6" "negative_response_code";
+static const char PAYLOAD_KEY[] = "\xA7" "payload";
+static const char COMMAND_RESPONSE_KEY[] = "\xB0" "command_response";
+static const char MESSAGE_KEY[] = "\xA7" "message";
+static const char STATUS_KEY[] = "\xA6" "status";
+static const char CAN_KEY[] = "\xA3" "can";
+static const char INTERFACES_KEY[] = "\xA3" "out";
+static const char LOOP_KEY[] = "\xA4" "loop";
+
+static void msgPackWriteBytes(sMsgPackWriter* writer, const void* data,
+        size_t count){
+    if(writer->position + count <= writer->length){
+        memcpy(writer->buffer + writer->position, data, count);
+    }
+    writer->position += count;
 }
-static void msgPackAddObjectDouble(cmp_ctx_t *ctx, const char* fname ,double obj){
-    sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
-    cmp_write_double(ctx, obj);
-    s->mobj.MsgPackMapPairCount++;
+
+static void msgPackWriteByte(sMsgPackWriter* writer, uint8_t byte){
+    if(writer->position < writer->length){
+        writer->buffer[writer->position] = byte;
+    }
+    ++writer->position;
 }
-static void msgPackAddObject8bNumeric(cmp_ctx_t *ctx, const char* fname ,uint8_t obj){
-    sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
-    cmp_write_u8(ctx, obj);
-    s->mobj.MsgPackMapPairCount++;
+
+/* Private: Write a marker followed by a big endian value of size bytes.
+ */
+static void msgPackWriteBigEndian(sMsgPackWriter* writer, uint8_t marker,
+        uint64_t value, int size){
+    uint8_t bytes[9];
+    bytes[0] = marker;
+    for(int i = size; i > 0; i--){
+        bytes[i] = value & 0xFF;
+        value >>= 8;
+    }
+    msgPackWriteBytes(writer, bytes, size + 1);
 }
-static void msgPackAddObject16bNumeric(cmp_ctx_t *ctx, const char* fname ,uint16_t obj){
-    sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
-    cmp_write_u16(ctx, obj);
-    s->mobj.MsgPackMapPairCount++;
+
+/* Private: Start a field of the top level map.
+ *
+ * key - One of the *_KEY constants, with its header.
+ */
+static void msgPackWriteKey(sMsgPackWriter* writer, const char* key,
+        size_t size){
+    msgPackWriteBytes(writer, key, size);
+    ++writer->fieldCount;
 }
-/*
-static void msgPackAddObject32bNumeric(cmp_ctx_t *ctx, const char* fname ,uint32_t obj){
-    sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
-    cmp_write_u32(ctx, obj);
-    s->mobj.MsgPackMapPairCount++;
+
+#define WRITE_KEY(writer, key) \
+        msgPackWriteKey(writer, key, sizeof(key) - 1)
+
+/* Private: Write an unsigned integer in the fewest bytes that hold it.
+ */
+static void msgPackWriteUnsigned(sMsgPackWriter* writer, uint64_t value){
+    if(value <= MESSAGE_PACK_POSITIVE_FIXNUM_MAX){
+        msgPackWriteByte(writer, value);
+    } else if(value <= 0xFF){
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_UINT8_MARKER, value, 1);
+    } else if(value <= 0xFFFF){
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_UINT16_MARKER, value, 2);
+    } else if(value <= 0xFFFFFFFF){
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_UINT32_MARKER, value, 4);
+    } else {
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_UINT64_MARKER, value, 8);
+    }
 }
-*/
-static void msgPackAddObject64bNumeric(cmp_ctx_t *ctx, const char* fname ,uint32_t obj){
-    sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
-    cmp_write_u64(ctx, obj);
-    s->mobj.MsgPackMapPairCount++;
+
+/* Private: Write a signed integer in the fewest bytes that hold it.
+ */
+static void msgPackWriteSigned(sMsgPackWriter* writer, int64_t value){
+    if(value >= 0){
+        msgPackWriteUnsigned(writer, value);
+    } else if(value >= MESSAGE_PACK_NEGATIVE_FIXNUM_MIN){
+        msgPackWriteByte(writer, (uint8_t)value);
+    } else if(value >= -0x80){
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_INT8_MARKER, value, 1);
+    } else if(value >= -0x8000){
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_INT16_MARKER, value, 2);
+    } else if(value >= -0x80000000LL){
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_INT32_MARKER, value, 4);
+    } else {
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_INT64_MARKER, value, 8);
+    }
 }
-/*
-static void msgPackAddObjectFloat(cmp_ctx_t *ctx, const char* fname ,float obj){
-    sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
-    cmp_write_float(ctx, obj);
-    s->mobj.MsgPackMapPairCount++;
+
+/* Private: Write a number in the fewest bytes that hold it exactly - as an
+ * integer if it's a whole number, a float if it survives the conversion, and
+ * otherwise a double.
+ */
+static void msgPackWriteNumber(sMsgPackWriter* writer, double value){
+    if(value >= -9223372036854775808.0 && value < 9223372036854775808.0 &&
+            value == (double)(int64_t)value){
+        msgPackWriteSigned(writer, (int64_t)value);
+    } else if((double)(float)value == value){
+        union { float number; uint32_t bits; } single;
+        single.number = value;
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_FLOAT_MARKER, single.bits,
+                4);
+    } else {
+        union { double number; uint64_t bits; } bits;
+        bits.number = value;
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_DOUBLE_MARKER, bits.bits,
+                8);
+    }
+}
+
+static void msgPackWriteBoolean(sMsgPackWriter* writer, bool value){
+    msgPackWriteByte(writer, value ? MESSAGE_PACK_TRUE_MARKER :
+            MESSAGE_PACK_FALSE_MARKER);
 }
-*/
-static void msgPackAddObjectBoolean(cmp_ctx_t *ctx, const char* fname ,bool obj){
-    sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
-    cmp_write_bool(ctx, obj);
-    s->mobj.MsgPackMapPairCount++;
+
+static void msgPackWriteString(sMsgPackWriter* writer, const char* value){
+    size_t size = strlen(value);
+    if(size <= MESSAGE_PACK_MAX_STRLEN){
+        msgPackWriteByte(writer, MESSAGE_PACK_FIXSTR_MARKER | size);
+    } else if(size <= 0xFF){
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_STR8_MARKER, size, 1);
+    } else {
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_STR16_MARKER, size, 2);
+    }
+    msgPackWriteBytes(writer, value, size);
 }
-static void msgPackAddObjectBinary(cmp_ctx_t *ctx, const char* fname ,uint8_t* obj, uint8_t len){
-    sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
-    //cmp_write_bin_marker(ctx, len);
-    cmp_write_bin(ctx,(const void *)obj, len); //writes marker as well
-    s->mobj.MsgPackMapPairCount++;
+
+/* Private: Write the header of an array of count elements.
+ */
+static void msgPackWriteArrayHeader(sMsgPackWriter* writer, size_t count){
+    if(count <= MESSAGE_PACK_FIXARRAY_SIZE){
+        msgPackWriteByte(writer, MESSAGE_PACK_FIXARRAY_MARKER | count);
+    } else {
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_ARRAY16_MARKER, count, 2);
+    }
 }
-/*
-static void msgPackAddObjectMap(cmp_ctx_t *ctx, const char* fname ,uint8_t* obj,uint8_t len){
-    sFile *s = (sFile *)ctx->buf;
-    cmp_write_str(ctx, (const char *)fname, strlen((const char *)fname));
-    msgPackWriteBuffer(ctx, obj, len); 
-    s->mobj.MsgPackMapPairCount++;
+
+static void msgPackWriteBinary(sMsgPackWriter* writer, const uint8_t* value,
+        size_t size){
+    if(size <= 0xFF){
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_BIN8_MARKER, size, 1);
+    } else {
+        msgPackWriteBigEndian(writer, MESSAGE_PACK_BIN16_MARKER, size, 2);
+    }
+    msgPackWriteBytes(writer, value, size);
 }
-*/
-    
 
-static void msgPackAddDynamicField(cmp_ctx_t *ctx, openxc_DynamicField* field) {
+static void msgPackAddDynamicField(sMsgPackWriter* writer,
+        openxc_DynamicField* field) {
 
     if(field->has_numeric_value) {
-        cmp_write_double(ctx, field->numeric_value);
+        msgPackWriteNumber(writer, field->numeric_value);
     } else if(field->has_boolean_value) {
-        cmp_write_bool(ctx, field->boolean_value);
+        msgPackWriteBoolean(writer, field->boolean_value);
     } else if(field->has_string_value) {
-        cmp_write_str(ctx, field->string_value, strlen(field->string_value));
+        msgPackWriteString(writer, field->string_value);
     }
 
-} 
+}
 
-static void serializeSimple(openxc_VehicleMessage* message,  cmp_ctx_t *ctx) {
-        
-    const char* name = message->simple_message.name;    
-    sFile *s = (sFile *)ctx->buf;
-    msgPackAddObjectString(ctx, payload::messagepack::NAME_FIELD_NAME, name);
+static void serializeSimple(openxc_VehicleMessage* message,
+        sMsgPackWriter* writer) {
+    WRITE_KEY(writer, NAME_KEY);
+    msgPackWriteString(writer, message->simple_message.name);
 
     if(message->simple_message.has_value) {
-        cmp_write_str(ctx, payload::messagepack::VALUE_FIELD_NAME, strlen(payload::messagepack::VALUE_FIELD_NAME));
-        msgPackAddDynamicField(ctx, &message->simple_message.value);
-        s->mobj.MsgPackMapPairCount++;
+        WRITE_KEY(writer, VALUE_KEY);
+        msgPackAddDynamicField(writer, &message->simple_message.value);
     }
-    
+
     if(message->simple_message.has_event) {
-        cmp_write_str(ctx, payload::messagepack::EVENT_FIELD_NAME, strlen(payload::messagepack::EVENT_FIELD_NAME));        
-        msgPackAddDynamicField(ctx, &message->simple_message.event);
-        s->mobj.MsgPackMapPairCount++;
+        WRITE_KEY(writer, EVENT_KEY);
+        msgPackAddDynamicField(writer, &message->simple_message.event);
     }
 }
 
-void serializeCan(openxc_VehicleMessage* message, cmp_ctx_t *ctx) {
-    
-    msgPackAddObject8bNumeric(ctx, payload::messagepack::BUS_FIELD_NAME, message->can_message.bus);
-    
-    msgPackAddObject8bNumeric(ctx, payload::messagepack::ID_FIELD_NAME, message->can_message.bus);
-    
-    msgPackAddObjectBinary(ctx, payload::messagepack::DATA_FIELD_NAME,
-            message->can_message.data.bytes,message->can_message.data.size);
-            
+static void serializeCan(openxc_VehicleMessage* message,
+        sMsgPackWriter* writer) {
+    WRITE_KEY(writer, BUS_KEY);
+    msgPackWriteUnsigned(writer, message->can_message.bus);
+    WRITE_KEY(writer, ID_KEY);
+    msgPackWriteUnsigned(writer, message->can_message.id);
+    WRITE_KEY(writer, DATA_KEY);
+    msgPackWriteBinary(writer, message->can_message.data.bytes,
+            message->can_message.data.size);
+
     if(message->can_message.has_frame_format) {
-        msgPackAddObjectString(ctx, payload::messagepack::FRAME_FORMAT_FIELD_NAME,
+        WRITE_KEY(writer, FRAME_FORMAT_KEY);
+        msgPackWriteString(writer,
                 message->can_message.frame_format == openxc_CanMessage_FrameFormat_STANDARD ?
                     payload::messagepack::FRAME_FORMAT_STANDARD_NAME :
                         payload::messagepack::FRAME_FORMAT_EXTENDED_NAME);
     }
 }
 
-static void serializeDiagnostic(openxc_VehicleMessage* message, cmp_ctx_t *ctx) {
-        
-    msgPackAddObject8bNumeric(ctx, payload::messagepack::BUS_FIELD_NAME,
-            message->diagnostic_response.bus);
-    msgPackAddObject8bNumeric(ctx, payload::messagepack::ID_FIELD_NAME,
-            message->diagnostic_response.message_id);
-    msgPackAddObject8bNumeric(ctx, payload::messagepack::DIAGNOSTIC_MODE_FIELD_NAME,
-            message->diagnostic_response.mode);
-    msgPackAddObjectBoolean(ctx, payload::messagepack::DIAGNOSTIC_SUCCESS_FIELD_NAME,
-            message->diagnostic_response.success);
+static void serializeDiagnostic(openxc_VehicleMessage* message,
+        sMsgPackWriter* writer) {
+    WRITE_KEY(writer, BUS_KEY);
+    msgPackWriteUnsigned(writer, message->diagnostic_response.bus);
+    WRITE_KEY(writer, ID_KEY);
+    msgPackWriteUnsigned(writer, message->diagnostic_response.message_id);
+    WRITE_KEY(writer, MODE_KEY);
+    msgPackWriteUnsigned(writer, message->diagnostic_response.mode);
+    WRITE_KEY(writer, SUCCESS_KEY);
+    msgPackWriteBoolean(writer, message->diagnostic_response.success);
 
-            
     if(message->diagnostic_response.has_pid) {
-        msgPackAddObject16bNumeric(ctx, payload::messagepack::DIAGNOSTIC_PID_FIELD_NAME,
-                message->diagnostic_response.pid);
+        WRITE_KEY(writer, PID_KEY);
+        msgPackWriteUnsigned(writer, message->diagnostic_response.pid);
     }
 
     if(message->diagnostic_response.has_negative_response_code) {
-        msgPackAddObjectDouble(ctx, payload::messagepack::DIAGNOSTIC_NRC_FIELD_NAME,
+        WRITE_KEY(writer, NRC_KEY);
+        msgPackWriteUnsigned(writer,
                 message->diagnostic_response.negative_response_code);
     }
 
     if(message->diagnostic_response.has_value) {
-        msgPackAddObjectDouble(ctx, payload::messagepack::DIAGNOSTIC_VALUE_FIELD_NAME,
-                message->diagnostic_response.value);
-                
+        WRITE_KEY(writer, VALUE_KEY);
+        msgPackWriteNumber(writer, message->diagnostic_response.value);
     } else if(message->diagnostic_response.has_payload) {
-        
-        msgPackAddObjectBinary(ctx, payload::messagepack::DIAGNOSTIC_PAYLOAD_FIELD_NAME, 
-                message->diagnostic_response.payload.bytes, message->diagnostic_response.payload.size);
-        
+        WRITE_KEY(writer, PAYLOAD_KEY);
+        msgPackWriteBinary(writer, message->diagnostic_response.payload.bytes,
+                message->diagnostic_response.payload.size);
     }
- 
 }
 
-static bool serializeCommandResponse(openxc_VehicleMessage* message, cmp_ctx_t *ctx) {
+static bool serializeCommandResponse(openxc_VehicleMessage* message,
+        sMsgPackWriter* writer) {
+
     
     const char* typeString = NULL;
     
@@ -307,24 +441,27 @@ static bool serializeCommandResponse(openxc_VehicleMessage* message, cmp_ctx_t *
         typeString = payload::messagepack::RTC_CONFIGURATION_COMMAND_NAME;
     } else if(message->command_response.type == openxc_ControlCommand_Type_SD_MOUNT_STATUS) {
         typeString = payload::messagepack::SD_MOUNT_STATUS_COMMAND_NAME;
+    } else if(message->command_response.type == payload::SUBSCRIBE_COMMAND_TYPE) {
+        typeString = payload::messagepack::SUBSCRIBE_COMMAND_NAME;
+    } else if(message->command_response.type == payload::UNSUBSCRIBE_COMMAND_TYPE) {
+        typeString = payload::messagepack::UNSUBSCRIBE_COMMAND_NAME;
+    } else if(message->command_response.type == payload::METRICS_COMMAND_TYPE) {
+        typeString = payload::messagepack::METRICS_COMMAND_NAME;
     } else {
         return false;
     }
 
-    msgPackAddObjectString(ctx, payload::messagepack::COMMAND_RESPONSE_FIELD_NAME,
-            typeString);
-            
-            
+    WRITE_KEY(writer, COMMAND_RESPONSE_KEY);
+    msgPackWriteString(writer, typeString);
+
     if(message->command_response.has_message) {
-        msgPackAddObjectString(ctx,
-                payload::messagepack::COMMAND_RESPONSE_MESSAGE_FIELD_NAME,
-                message->command_response.message);
+        WRITE_KEY(writer, MESSAGE_KEY);
+        msgPackWriteString(writer, message->command_response.message);
     }
 
     if(message->command_response.has_status) {
-        msgPackAddObjectBoolean(ctx,
-                payload::messagepack::COMMAND_RESPONSE_STATUS_FIELD_NAME,
-                message->command_response.status);
+        WRITE_KEY(writer, STATUS_KEY);
+        msgPackWriteBoolean(writer, message->command_response.status);
     }
     return true;
 }
@@ -332,97 +469,94 @@ static bool serializeCommandResponse(openxc_VehicleMessage* message, cmp_ctx_t *
 
 int openxc::payload::messagepack::serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length)
 {
+    sMsgPackWriter writer = {payload, length, 0, 0};
+    bool status = true;
 
-    sFile smsgpackb;
-    
-    uint8_t MessagePackBuffer[MESSAGE_PACK_SERIAL_BUF_SZ]; 
-    
-    size_t finalLength = 0;
-
-    cmp_ctx_t cmp;
-    
-    memset((void*)&smsgpackb,0,sizeof(smsgpackb));
-    
-    msgPackInitBuffer(&smsgpackb, MessagePackBuffer, MESSAGE_PACK_SERIAL_BUF_SZ);
-    
-    cmp_init(&cmp,(void*)&smsgpackb, msgPackReadBuffer, msgPackWriteBuffer);
-    
-    cmp_write_map(&cmp,2);
-    
-    //"{\"command\": \"diagnostic_request\", \"actio"
-    //"n\": \"add\", \"request\": {\"bus\": 1, \"id\": 2, \"mode\": 1}}\0";
-    
-    //"{\"command\": \"version\"}\0";
-    
-    //msgPackAddObjectString(&cmp, "command", "device_id");
-    //cmp_write_map(&cmp,3);
-    //msgPackAddObjectString(&cmp, "command", "passthrough");
-    //msgPackAddObject8bNumeric(&cmp, "bus", 1);
-    //msgPackAddObjectBoolean(&cmp, "enabled", 1);
-    //goto x;
-    /*
-    cmp_write_map(&cmp,3);
-    msgPackAddObjectString(&cmp, "command", "diagnostic_request");
-    msgPackAddObjectString(&cmp, "action", "add");
-    cmp_write_str(&cmp, "request", 7);
-    cmp_write_map(&cmp,3);
-    msgPackAddObject8bNumeric(&cmp, "bus",  1);
-    msgPackAddObject8bNumeric(&cmp, "id",   2);
-    msgPackAddObject8bNumeric(&cmp, "mode", 1);
-    smsgpackb.mobj.MsgPackMapPairCount -=3;
-    goto x;
-    */
+    // The fixmap marker is filled in once the number of fields is known
+    msgPackWriteByte(&writer, MESSAGE_PACK_FIXMAP_MARKER);
     if(message->has_timestamp) {
-        
-        msgPackAddObject64bNumeric(&cmp, "timestamp", message->timestamp);
-                
+        WRITE_KEY(&writer, TIMESTAMP_KEY);
+        msgPackWriteUnsigned(&writer, message->timestamp);
     }
     if(message->type == openxc_VehicleMessage_Type_SIMPLE) {
-        serializeSimple(message, &cmp);
+        serializeSimple(message, &writer);
     } else if(message->type == openxc_VehicleMessage_Type_CAN) {
-        serializeCan(message, &cmp);
+        serializeCan(message, &writer);
     } else if(message->type == openxc_VehicleMessage_Type_DIAGNOSTIC) {
-        serializeDiagnostic(message, &cmp);
+        serializeDiagnostic(message, &writer);
     } else if(message->type == openxc_VehicleMessage_Type_COMMAND_RESPONSE) {
-        serializeCommandResponse(message, &cmp);
+        status = serializeCommandResponse(message, &writer);
     } else {
         debug("Unrecognized message type -- not sending");
     }
-    
-    if(cmp.error > 0){
-        debug("%s\n\n", cmp_strerror(&cmp));
+
+    if(!status) {
         return 0;
     }
-    if( smsgpackb.mobj.MsgPackMapPairCount > MESSAGE_PACK_FIXMAP_SIZE)
+    if(writer.position > length){
+        debug("Message pack payload buffer too small, need %d bytes",
+                writer.position);
+        return 0;
+    }
+    if(writer.fieldCount > MESSAGE_PACK_FIXMAP_SIZE)
     {
-        debug("Unhandled, excedded fix map limit %d",smsgpackb.mobj.MsgPackMapPairCount);
+        debug("Unhandled, excedded fix map limit %d",writer.fieldCount);
         return 0;
     }
-    
-    smsgpackb.start[0] = MESSAGE_PACK_FIXMAP_MARKER | smsgpackb.mobj.MsgPackMapPairCount; //todo create a function to add this more gracefully
-    
 
-    finalLength = smsgpackb.wp - smsgpackb.start;
-    
-    memcpy(payload, MessagePackBuffer, finalLength);
-    
-    //debug ("parsing %d bytes",finalLength);
-    //openxc_VehicleMessage m;
-    //int l = openxc::payload::messagepack::deserialize(payload,finalLength,&m);
-    //debug ("deserialized %d bytes",l);
-    //while(1);
-/*
-    for(int i = 0;i < finalLength; i ++)
-    {
-        debug("%x", payload[i]);
+    payload[0] = MESSAGE_PACK_FIXMAP_MARKER | writer.fieldCount;
+    return writer.position;
+}
+int openxc::payload::messagepack::serializeMetrics(
+        const openxc::metrics::MetricsSnapshot* snapshot, uint8_t payload[],
+        size_t length)
+{
+    sMsgPackWriter writer = {payload, length, 0, 0};
+    msgPackWriteByte(&writer, MESSAGE_PACK_FIXMAP_MARKER);
+    WRITE_KEY(&writer, COMMAND_RESPONSE_KEY);
+    msgPackWriteString(&writer, payload::messagepack::METRICS_COMMAND_NAME);
+    WRITE_KEY(&writer, STATUS_KEY);
+    msgPackWriteBoolean(&writer, true);
+
+    WRITE_KEY(&writer, CAN_KEY);
+    msgPackWriteArrayHeader(&writer, snapshot->busCount);
+    for(int i = 0; i < snapshot->busCount; i++) {
+        uint32_t row[BUS_METRICS_ROW_LENGTH];
+        openxc::metrics::busMetricsRow(&snapshot->buses[i], row);
+        msgPackWriteArrayHeader(&writer, BUS_METRICS_ROW_LENGTH);
+        for(int j = 0; j < BUS_METRICS_ROW_LENGTH; j++) {
+            msgPackWriteUnsigned(&writer, row[j]);
+        }
     }
-    
-    debug("\n\n");
 
-    
-*/
-    return finalLength;
+    WRITE_KEY(&writer, INTERFACES_KEY);
+    msgPackWriteArrayHeader(&writer, snapshot->interfaceCount);
+    for(int i = 0; i < snapshot->interfaceCount; i++) {
+        uint32_t row[INTERFACE_METRICS_ROW_LENGTH];
+        openxc::metrics::interfaceMetricsRow(&snapshot->interfaces[i], row);
+        msgPackWriteArrayHeader(&writer, INTERFACE_METRICS_ROW_LENGTH + 1);
+        msgPackWriteString(&writer, snapshot->interfaces[i].name);
+        for(int j = 0; j < INTERFACE_METRICS_ROW_LENGTH; j++) {
+            msgPackWriteUnsigned(&writer, row[j]);
+        }
+    }
+
+    WRITE_KEY(&writer, LOOP_KEY);
+    msgPackWriteArrayHeader(&writer, 3);
+    msgPackWriteUnsigned(&writer, snapshot->loopPasses);
+    msgPackWriteUnsigned(&writer, snapshot->loopAverageUs);
+    msgPackWriteUnsigned(&writer, snapshot->loopMaxUs);
+
+    if(writer.position > length){
+        debug("Message pack payload buffer too small, need %d bytes",
+                writer.position);
+        return 0;
+    }
+
+    payload[0] = MESSAGE_PACK_FIXMAP_MARKER | writer.fieldCount;
+    return writer.position;
 }
+
 sMsgPackNode * msgPackSeekNode(sMsgPackNode* root,const char * name ){
     sMsgPackNode * node = root;
     while(node){
@@ -437,6 +571,28 @@ sMsgPackNode * msgPackSeekNode(sMsgPackNode* root,const char * name ){
     return node;
 }
 
+/* Private: Allocate memory from an arena, or return NULL if it's full.
+ */
+static void* msgPackAllocate(sMsgPackArena* arena, size_t size){
+    size = (size + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+    if(arena->used + size > sizeof(arena->storage)){
+        debug("Message pack arena full");
+        return NULL;
+    }
+    void* allocation = (uint8_t*)arena->storage + arena->used;
+    arena->used += size;
+    return allocation;
+}
+
+static char* msgPackCopyString(sMsgPackArena* arena, const char* str){
+    size_t str_size = strlen(str);
+    char* copy = (char*)msgPackAllocate(arena, str_size + 1);
+    if(copy != NULL){
+        memcpy(copy, str, str_size + 1);
+    }
+    return copy;
+}
+
 sMsgPackNode* getnode(cmp_ctx_t * ctx){
 
     
@@ -490,13 +646,13 @@ sMsgPackNode* getnode(cmp_ctx_t * ctx){
                 sFile * s = (sFile *)ctx->buf;
                 s->rp--;
                 uint32_t plen = (s->end - s->rp) + 1;
-                ch = msgPackParse(s->rp,&plen);
+                ch = msgPackParse(s->rp,&plen,s->arena);
                 if(ch == NULL){
                     //debug("Child incomplete %s",cmp_strerror(ctx));
                     return NULL;
                 }
                     
-                s->rp += plen + 1;
+                s->rp += plen;
                 type = msgpack_var_type::TYPE_MAP;
                  break;
             }
@@ -592,39 +748,35 @@ sMsgPackNode* getnode(cmp_ctx_t * ctx){
         //debug("Node incomplete %s",cmp_strerror(ctx));
         return NULL;
     }
-    sMsgPackNode* node = (sMsgPackNode*)malloc(sizeof(sMsgPackNode));
-    dynamic_allocation_bytes += sizeof(sMsgPackNode);
+    sMsgPackArena* arena = ((sFile *)ctx->buf)->arena;
+    sMsgPackNode* node = (sMsgPackNode*)msgPackAllocate(arena,
+            sizeof(sMsgPackNode));
     if(node == NULL){
-        debug("Unable to create node in memory");
         return NULL;
     }
     
-    str_size = strlen(nstr);
-    node->string = (char*)malloc(str_size + 1);
-    dynamic_allocation_bytes += str_size + 1;
-    memcpy(node->string,nstr,str_size);    //copy null terminator as well
-    node->string[str_size] = '\0';    
+    node->string = msgPackCopyString(arena, nstr);
+    if(node->string == NULL){
+        return NULL;
+    }
     node->type = type;
+    node->valuestring = NULL;
+    node->bin = NULL;
+    node->binsz = 0;
     
     if(node->type == msgpack_var_type::TYPE_BINARY){
-        node->bin = (uint8_t *)malloc(binsz);
-        dynamic_allocation_bytes += binsz;
-        if(node->bin ==NULL){
-            debug("Unable to allocate mem bin");
+        node->bin = (uint8_t *)msgPackAllocate(arena, binsz);
+        if(node->bin == NULL){
+            return NULL;
         }
         memcpy(node->bin,binarr,binsz);
         node->binsz = binsz;
-        //debug("allocated node");
     }
     if(node->type == msgpack_var_type::TYPE_STRING){
-        str_size = strlen(vstr);
-        node->valuestring = (char *)malloc(str_size+1);
-        dynamic_allocation_bytes += str_size + 1;
+        node->valuestring = msgPackCopyString(arena, vstr);
         if(node->valuestring == NULL){
-            debug("Unable to allocate mem str");
+            return NULL;
         }
-        memcpy(node->valuestring,vstr,str_size);
-        node->valuestring[str_size] = '\0';
     }
     node->child = NULL;
     if(type == msgpack_var_type::TYPE_MAP){
@@ -652,60 +804,10 @@ void msgPackListNodes(sMsgPackNode* root)
     }
 }
 
-void MsgPackDelete(sMsgPackNode* root)//rentrant
-{
-    sMsgPackNode *pv, *rp;
-    
-    rp = root;
-    while(root->next){
-        pv = rp->next;
-        while(pv->next){
-                rp = pv;
-                pv = pv->next;
-                if(pv->child){
-                    MsgPackDelete(pv->child);
-                    pv->child = NULL;
-                    goto x;
-                }
-        }
-        //debug("deleting:%s",pv->string);
-        dynamic_allocation_bytes -= (strlen(pv->string) + 1);
-        free(pv->string);
-        
-        if(pv->type == msgpack_var_type::TYPE_STRING){
-            dynamic_allocation_bytes -= (strlen(pv->valuestring) + 1);
-            free(pv->valuestring);
-            
-        }
-        if(pv->type == msgpack_var_type::TYPE_BINARY){
-            dynamic_allocation_bytes -= (pv->binsz);
-            free(pv->bin);
-        }
-        if(pv->child){
-            MsgPackDelete(pv->child);
-        }
-        free(pv);
-        dynamic_allocation_bytes -= sizeof(sMsgPackNode);
-        rp->next = NULL;
-x:
-        rp = root;
-    }
-    //debug("deleting:%s",root->string);
-    dynamic_allocation_bytes -= (strlen(root->string) + 1);
-    free(root->string);
-    if(root->type == msgpack_var_type::TYPE_STRING){
-        dynamic_allocation_bytes -= (strlen(root->valuestring) + 1);
-        free(root->valuestring);
-    }
-    if(pv->type == msgpack_var_type::TYPE_BINARY){
-        dynamic_allocation_bytes -= (root->binsz);
-        free(root->bin);
-    }
-    free(root);
-    dynamic_allocation_bytes -= sizeof(sMsgPackNode);
-}
-
-sMsgPackNode* msgPackParse(uint8_t* buf,uint32_t* len){ //reentrant
+/* Private: Decode a map into a list of nodes allocated from the arena - the
+ * nodes are only valid until the arena is reset.
+ */
+sMsgPackNode* msgPackParse(uint8_t* buf,uint32_t* len, sMsgPackArena* arena){ //reentrant
     
     sMsgPackNode *node = NULL;
     sMsgPackNode *root = NULL;
@@ -721,6 +823,7 @@ sMsgPackNode* msgPackParse(uint8_t* buf,uint32_t* len){ //reentrant
     uint32_t map_len;
 
     msgPackInitBuffer(&smsgpackb, buf, *len);
+    smsgpackb.arena = arena;
     
     cmp_init(&cmp,(void*)&smsgpackb, msgPackReadBuffer, msgPackWriteBuffer);
     
@@ -731,7 +834,7 @@ sMsgPackNode* msgPackParse(uint8_t* buf,uint32_t* len){ //reentrant
     }
     
     //debug("Maplen %d", map_len);
-    root = getnode(&cmp); //get node creates a node on the heap using malloc
+    root = getnode(&cmp); //get node creates a node in the arena
     
     if( root == NULL)
     {
@@ -746,7 +849,6 @@ sMsgPackNode* msgPackParse(uint8_t* buf,uint32_t* len){ //reentrant
         
         if(node->next == NULL){
             //debug("Message pack contains partial information");
-            MsgPackDelete(root);
             return NULL;            
         }        
         node = node->next;
@@ -885,10 +987,10 @@ static void deserializeDiagnostic(sMsgPackNode* root, openxc_ControlCommand* com
         element = msgPackSeekNode(request, "payload");
         if(element != NULL) {
             command->diagnostic_request.request.has_payload = true;
-            if(request->type == msgpack_var_type::TYPE_BINARY){
-                command->diagnostic_request.request.payload.size = request->binsz;
+            if(element->type == msgpack_var_type::TYPE_BINARY){
+                command->diagnostic_request.request.payload.size = element->binsz;
                 memcpy(command->diagnostic_request.request.payload.bytes, 
-                        request->bin,request->binsz);
+                        element->bin,element->binsz);
             }
         }
 
@@ -1072,6 +1174,48 @@ static void deserializeRTCConfiguration(sMsgPackNode* root, openxc_ControlComman
 
 
 
+/* Private: Parse a subscription command - the signal name and CAN message it
+ * refers to are stored in the message's simple and CAN message fields, as there
+ * are no fields for them in the control command.
+ */
+static void deserializeSubscription(sMsgPackNode* root,
+        openxc_VehicleMessage* message, openxc_ControlCommand_Type type) {
+    message->control_command.has_type = true;
+    message->control_command.type = type;
+
+    sMsgPackNode* element = msgPackSeekNode(root, "name");
+    if(element != NULL && element->type == msgpack_var_type::TYPE_STRING) {
+        message->has_simple_message = true;
+        message->simple_message.has_name = true;
+        strncpy(message->simple_message.name, element->valuestring,
+                sizeof(message->simple_message.name) - 1);
+
+        element = msgPackSeekNode(root, "frequency");
+        if(element != NULL) {
+            // Integers are only stored in valueint
+            message->simple_message.has_value = true;
+            message->simple_message.value = payload::wrapNumber(
+                    element->valuedouble != 0 ? element->valuedouble :
+                        element->valueint);
+        }
+    }
+
+    sMsgPackNode* bus = msgPackSeekNode(root, "bus");
+    sMsgPackNode* id = msgPackSeekNode(root, "id");
+    if(bus != NULL && id != NULL) {
+        message->has_can_message = true;
+        message->can_message.has_bus = true;
+        message->can_message.bus = bus->valueint;
+        message->can_message.has_id = true;
+        message->can_message.id = id->valueint;
+    }
+}
+
+/* Private: The arena for the message being deserialized. It's too big for the
+ * stack, and only one message is ever deserialized at a time.
+ */
+static sMsgPackArena deserializeArena;
+
 //Entire data is chunked into a single packet by higher level protocol
 //unable to decode partial messages at this moment correctly
 size_t openxc::payload::messagepack::deserialize(uint8_t payload[], size_t length,
@@ -1086,7 +1230,8 @@ size_t openxc::payload::messagepack::deserialize(uint8_t payload[], size_t lengt
     while(i < length){
         if(payload[i] > 0x80 && payload[i] < 0x8f){//attempt to parse message if found
             uint32_t len = length-i;
-            root = msgPackParse(&payload[i],&len);
+            deserializeArena.used = 0;
+            root = msgPackParse(&payload[i],&len,&deserializeArena);
             if( root != NULL)//we found a message
             {
                 //debug("Message Pack Data Complete %d bytes", len);
@@ -1099,7 +1244,6 @@ size_t openxc::payload::messagepack::deserialize(uint8_t payload[], size_t lengt
     }
     if(root == NULL)
     {
-        //debug("MessagePackMemUsed:%d bytes", dynamic_allocation_bytes);
         return 0;
     }
     sMsgPackNode* commandNameObject = msgPackSeekNode(root, "command");
@@ -1159,6 +1303,24 @@ size_t openxc::payload::messagepack::deserialize(uint8_t payload[], size_t lengt
                 command->has_type = true;
                 command->type = openxc_ControlCommand_Type_SD_MOUNT_STATUS;
         }
+        else if(!strncmp(commandNameObject->valuestring,
+                    SUBSCRIBE_COMMAND_NAME,
+                    strlen(SUBSCRIBE_COMMAND_NAME))) {
+            deserializeSubscription(root, message,
+                    openxc::payload::SUBSCRIBE_COMMAND_TYPE);
+        }
+        else if(!strncmp(commandNameObject->valuestring,
+                    UNSUBSCRIBE_COMMAND_NAME,
+                    strlen(UNSUBSCRIBE_COMMAND_NAME))) {
+            deserializeSubscription(root, message,
+                    openxc::payload::UNSUBSCRIBE_COMMAND_TYPE);
+        }
+        else if(!strncmp(commandNameObject->valuestring,
+                    METRICS_COMMAND_NAME,
+                    strlen(METRICS_COMMAND_NAME))) {
+            command->has_type = true;
+            command->type = openxc::payload::METRICS_COMMAND_TYPE;
+        }
         else {
             debug("Unrecognized command: %s", commandNameObject->valuestring);
             message->has_control_command = false;
@@ -1172,10 +1334,8 @@ size_t openxc::payload::messagepack::deserialize(uint8_t payload[], size_t lengt
         }
     }
     
-    MsgPackDelete(root);
     Messagelen = MIN(Messagelen,length);
     //debug("Parsed: %d bytes", Messagelen);
-    //debug("MessagePackMemUsed:%d bytes", dynamic_allocation_bytes);    
     return Messagelen;        
 }
         
@@ -2,6 +2,7 @@
 #define __MESSAGEPACK_H__
 
 #include "openxc.pb.h"
+#include "metrics.h"
 
 namespace openxc {
 namespace payload {
@@ -46,6 +47,10 @@ extern const char MODEM_CONFIGURATION_COMMAND_NAME[];
 extern const char RTC_CONFIGURATION_COMMAND_NAME[];
 
 extern const char SD_MOUNT_STATUS_COMMAND_NAME[];
+extern const char SUBSCRIBE_COMMAND_NAME[];
+extern const char UNSUBSCRIBE_COMMAND_NAME[];
+extern const char METRICS_COMMAND_NAME[];
+
 /* Public: Deserialize an OpenXC message from a payload containing MessagePack.
  *
  * payload - The bytestream payload to parse a message from.
@@ -68,6 +73,16 @@ size_t deserialize(uint8_t payload[], size_t length, openxc_VehicleMessage* mess
  */
 int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length);
 
+/* Public: Serialize a snapshot of the device's health metrics as the
+ * MessagePack response to a metrics command - a map with the same fields and
+ * arrays as the JSON response (see json::serializeMetrics).
+ *
+ * Returns the number of bytes written to the payload, or 0 if the snapshot
+ * doesn't fit.
+ */
+int serializeMetrics(const openxc::metrics::MetricsSnapshot* snapshot,
+        uint8_t payload[], size_t length);
+
 } // namespace messagepack
 } // namespace payload
 } // namespace openxc
@@ -52,9 +52,16 @@ size_t openxc::payload::deserialize(uint8_t payload[], size_t length,
 
 int openxc::payload::serialize(openxc_VehicleMessage* message,
         uint8_t payload[], size_t length, PayloadFormat format) {
+    return serialize(message, payload, length, format, -1);
+}
+
+int openxc::payload::serialize(openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length, PayloadFormat format,
+        int precision) {
     int serializedLength = 0;
     if(format == PayloadFormat::JSON) {
-        serializedLength = payload::json::serialize(message, payload, length);
+        serializedLength = payload::json::serialize(message, payload, length,
+                precision);
     } else if(format == PayloadFormat::PROTOBUF) {
         serializedLength = payload::protobuf::serialize(message, payload, length);
     } else if(format == PayloadFormat::MESSAGEPACK) {
@@ -64,3 +71,17 @@ int openxc::payload::serialize(openxc_VehicleMessage* message,
     }
     return serializedLength;
 }
+
+int openxc::payload::serializeMetrics(
+        const openxc::metrics::MetricsSnapshot* snapshot, uint8_t payload[],
+        size_t length, PayloadFormat format) {
+    int serializedLength = 0;
+    if(format == PayloadFormat::JSON) {
+        serializedLength = payload::json::serializeMetrics(snapshot, payload,
+                length);
+    } else if(format == PayloadFormat::MESSAGEPACK) {
+        serializedLength = payload::messagepack::serializeMetrics(snapshot,
+                payload, length);
+    }
+    return serializedLength;
+}
@@ -2,6 +2,7 @@
 #define __PAYLOAD_H__
 
 #include "openxc.pb.h"
+#include "metrics.h"
 #include <stdint.h>
 
 namespace openxc {
@@ -15,6 +16,31 @@ typedef enum {
     MESSAGEPACK,
 } PayloadFormat;
 
+#define PAYLOAD_FORMAT_COUNT 3
+
+/* Public: Control command types handled by this firmware that aren't defined
+ * by the OpenXC message format. They're numbered well above the values in
+ * openxc_ControlCommand_Type so they can share the same field, but are only
+ * recognized by name in the JSON and MessagePack payload formats.
+ *
+ * SUBSCRIBE - Only send the interface the command arrived on the signals and
+ *      raw CAN messages it subscribes to. The signal is given by name in the
+ *      message's simple_message field, or the CAN message by bus and ID in its
+ *      can_message field. A signal subscription can also set the most times per
+ *      second the interface receives the signal, in the simple_message value.
+ * UNSUBSCRIBE - Remove a subscription given the same way as for SUBSCRIBE, or
+ *      all of the interface's subscriptions if neither is given.
+ * METRICS - Report the message counts, queues and latency of each CAN bus and
+ *      output interface, and the timing of the main loop, in one response (see
+ *      serializeMetrics).
+ */
+const openxc_ControlCommand_Type SUBSCRIBE_COMMAND_TYPE =
+        (openxc_ControlCommand_Type) 0x80;
+const openxc_ControlCommand_Type UNSUBSCRIBE_COMMAND_TYPE =
+        (openxc_ControlCommand_Type) 0x81;
+const openxc_ControlCommand_Type METRICS_COMMAND_TYPE =
+        (openxc_ControlCommand_Type) 0x82;
+
 /* Public: Deserialize an OpenXC message from the given payload, using the given
  * format.
  *
@@ -49,6 +75,30 @@ size_t deserialize(uint8_t payload[], size_t length, PayloadFormat format,
 int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length,
         PayloadFormat format);
 
+/* Public: Serialize an OpenXC message into a payload of bytes, writing the
+ * numeric value of a simple message with the given number of decimal places in
+ * text formats.
+ *
+ * precision - The most decimal places for a simple message's numbers in JSON,
+ *      or -1 for the default. It's ignored by the binary formats.
+ *
+ * Returns the number of bytes written to the payload. If the length is 0, an
+ * error occurred while serializing.
+ */
+int serialize(openxc_VehicleMessage* message, uint8_t payload[], size_t length,
+        PayloadFormat format, int precision);
+
+/* Public: Serialize a snapshot of the device's health metrics as the response
+ * to a METRICS command, in one message.
+ *
+ * Only the JSON and MessagePack formats can carry it, like the command itself.
+ *
+ * Returns the number of bytes written to the payload. If the length is 0, the
+ * format can't carry the metrics or they didn't fit.
+ */
+int serializeMetrics(const openxc::metrics::MetricsSnapshot* snapshot,
+        uint8_t payload[], size_t length, PayloadFormat format);
+
 /* Public: Helper functions to wrap values in an openxc_DynamicField
  */
 openxc_DynamicField wrapNumber(float value);
@@ -1,12 +1,14 @@
+#include <string.h>
 #include "emqueue.h"
 #include "pipeline.h"
 #include "util/log.h"
 #include "util/timer.h"
 #include "util/statistics.h"
-#include "util/bytebuffer.h"
+#include "util/messagepool.h"
 #include "config.h"
+#include "signals.h"
 #include "lights.h"
-#define PIPELINE_ENDPOINT_COUNT 5
+#define PIPELINE_ENDPOINT_COUNT 6
 #define PIPELINE_STATS_LOG_FREQUENCY_S 15
 #define QUEUE_FLUSH_MAX_TRIES 100
 #include "platform_profile.h"
@@ -23,52 +25,422 @@ namespace time = openxc::util::time;
 namespace statistics = openxc::util::statistics;
 namespace config = openxc::config;
 
-using openxc::util::bytebuffer::conditionalEnqueue;
-using openxc::util::bytebuffer::messageFits;
+using openxc::util::messagepool::MessageQueue;
+using openxc::util::messagepool::allocateMessage;
+using openxc::util::messagepool::allocatePriorityMessage;
+using openxc::util::messagepool::releaseMessage;
+using openxc::util::messagepool::messageLength;
+using openxc::util::messagepool::enqueueMessage;
+using openxc::util::messagepool::enqueuePriorityMessage;
+using openxc::util::messagepool::messageFits;
+using openxc::util::messagepool::dropOldestMessage;
+using openxc::util::messagepool::queuedBytes;
+using openxc::util::messagepool::setMessageOrigin;
+using openxc::util::statistics::Statistic;
 using openxc::util::statistics::DeltaStatistic;
+using openxc::util::statistics::Histogram;
 using openxc::util::log::debug;
 using openxc::pipeline::Pipeline;
 using openxc::pipeline::MessageClass;
 using openxc::interface::InterfaceDescriptor;
 using openxc::interface::InterfaceType;
+using openxc::interface::BackpressurePolicy;
 using openxc::config::LoggingOutputInterface;
 using openxc::util::time::uptimeMs;
+using openxc::signals::getSignals;
+using openxc::signals::getSignalCount;
 
 unsigned int droppedMessages[PIPELINE_ENDPOINT_COUNT];
+unsigned int droppedMessagesByClass[PIPELINE_ENDPOINT_COUNT][MESSAGE_CLASS_COUNT];
 unsigned int sentMessages[PIPELINE_ENDPOINT_COUNT];
 unsigned int dataSent[PIPELINE_ENDPOINT_COUNT];
 unsigned int sendQueueLength[PIPELINE_ENDPOINT_COUNT];
 unsigned int receiveQueueLength[PIPELINE_ENDPOINT_COUNT];
 
-void conditionalFlush(Pipeline* pipeline,
-        QUEUE_TYPE(uint8_t)* sendQueue, uint8_t* message, int messageSize) {
-    int timeout = QUEUE_FLUSH_MAX_TRIES;
-    while(timeout > 0 && !messageFits(sendQueue, message, messageSize)) {
-        process(pipeline);
-        --timeout;
+/* Private: A raw CAN message an interface has subscribed to.
+ */
+typedef struct {
+    uint8_t bus;
+    uint32_t id;
+} CanMessageSubscription;
+
+/* Private: The most often an interface receives a signal.
+ */
+typedef struct {
+    int signalIndex;
+    time::FrequencyClock clock;
+} SignalRateLimit;
+
+/* Private: The messages an interface has asked to receive.
+ *
+ * signals - A bitset over the active message set's signal array.
+ * signalCount - The number of bits set in signals - if 0, the interface
+ *      receives every signal.
+ * canMessages - The raw CAN messages the interface receives.
+ * canMessageCount - The length of canMessages - if 0, the interface receives
+ *      every CAN message.
+ * rateLimits - The signals the interface receives less often than they're
+ *      published.
+ * rateLimitCount - The length of rateLimits.
+ */
+typedef struct {
+    uint8_t signals[(MAX_SUBSCRIBED_SIGNALS + 7) / 8];
+    int signalCount;
+    CanMessageSubscription canMessages[MAX_SUBSCRIBED_CAN_MESSAGES];
+    int canMessageCount;
+    SignalRateLimit rateLimits[MAX_SIGNAL_RATE_LIMITS];
+    int rateLimitCount;
+} Subscriptions;
+
+/* Private: The state of the token bucket limiting an interface's data rate.
+ *
+ * milliBytes - The bytes the interface can still send, in thousandths of a
+ *      byte so a refill after a few milliseconds isn't rounded away.
+ * lastRefill - The uptime in milliseconds the bucket was last refilled.
+ */
+typedef struct {
+    unsigned long milliBytes;
+    unsigned long lastRefill;
+    bool started;
+} ByteBucket;
+
+static Subscriptions subscriptions[PIPELINE_ENDPOINT_COUNT];
+static ByteBucket byteBuckets[PIPELINE_ENDPOINT_COUNT];
+
+/* Private: How long each interface with the BOUNDED_WAIT policy has spent
+ * waiting for room in its send queue in this pass of the main loop, reset by
+ * process().
+ */
+static unsigned long backpressureWaitedUs[PIPELINE_ENDPOINT_COUNT];
+
+static bool subscribedToSignal(Subscriptions* subscriptions, int signalIndex) {
+    return signalIndex >= 0 && signalIndex < MAX_SUBSCRIBED_SIGNALS &&
+            (subscriptions->signals[signalIndex / 8] &
+                (1 << (signalIndex % 8)));
+}
+
+static int findCanMessageSubscription(Subscriptions* subscriptions,
+        uint8_t bus, uint32_t id) {
+    for(int i = 0; i < subscriptions->canMessageCount; i++) {
+        if(subscriptions->canMessages[i].bus == bus &&
+                subscriptions->canMessages[i].id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int findSignalRateLimit(Subscriptions* subscriptions,
+        int signalIndex) {
+    for(int i = 0; i < subscriptions->rateLimitCount; i++) {
+        if(subscriptions->rateLimits[i].signalIndex == signalIndex) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Private: Return true if a signal's rate limit for an interface allows
+ * sending it another value now, ticking the limit's clock if so.
+ */
+static bool underRateLimit(Subscriptions* subscriptions, int signalIndex) {
+    int index = findSignalRateLimit(subscriptions, signalIndex);
+    return index == -1 || time::conditionalTick(
+            &subscriptions->rateLimits[index].clock);
+}
+
+/* Private: Return true if an interface wants a message, according to its
+ * subscriptions and rate limits.
+ *
+ * signalIndex - The index of the signal the message is from, or -1 if it's
+ *      not from a signal in the active message set.
+ */
+static bool wantsMessage(Subscriptions* subscriptions,
+        openxc_VehicleMessage* message, int signalIndex) {
+    switch(message->type) {
+        case openxc_VehicleMessage_Type_SIMPLE:
+            return (subscriptions->signalCount == 0 ||
+                    subscribedToSignal(subscriptions, signalIndex)) &&
+                underRateLimit(subscriptions, signalIndex);
+        case openxc_VehicleMessage_Type_CAN:
+            return subscriptions->canMessageCount == 0 ||
+                    findCanMessageSubscription(subscriptions,
+                        message->can_message.bus,
+                        message->can_message.id) != -1;
+        default:
+            return true;
+    }
+}
+
+/* Private: Return true if any interface subscribes to or rate limits
+ * individual signals, so needs to know which signal a message is from.
+ */
+static bool anySignalFilters() {
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        if(subscriptions[i].signalCount > 0 ||
+                subscriptions[i].rateLimitCount > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void countDroppedMessage(InterfaceType endpointType,
+        int messageClass) {
+    ++droppedMessages[endpointType];
+    if(messageClass >= 0 && messageClass < MESSAGE_CLASS_COUNT) {
+        ++droppedMessagesByClass[endpointType][messageClass];
     }
 }
 
-void sendToEndpoint(openxc::interface::InterfaceType endpointType,
-        QUEUE_TYPE(uint8_t)* sendQueue, QUEUE_TYPE(uint8_t)* receiveQueue,
-        uint8_t* message, int messageSize) {
-    if(!conditionalEnqueue(sendQueue, message, messageSize)) {
-        ++droppedMessages[endpointType];
+/* Private: Process the send queue of a single interface, the same as process
+ * does for all of them.
+ */
+static void processEndpoint(Pipeline* pipeline, InterfaceType endpointType) {
+    switch(endpointType) {
+        case InterfaceType::USB:
+            usb::processSendQueue(pipeline->usb);
+            break;
+        #ifdef TELIT_HE910_SUPPORT
+        case InterfaceType::TELIT:
+            if(openxc::telitHE910::connected(pipeline->telit)) {
+                openxc::telitHE910::processSendQueue(pipeline->telit);
+            }
+            break;
+        #endif
+        #ifdef BLE_SUPPORT
+        case InterfaceType::BLE:
+            if(ble::connected(pipeline->ble)) {
+                ble::processSendQueue(pipeline->ble);
+            }
+            break;
+        #endif
+        #ifdef FS_SUPPORT
+        case InterfaceType::FS:
+            if(fs::connected(pipeline->fs)) {
+                fs::processSendQueue(pipeline->fs);
+            }
+            break;
+        #endif
+        case InterfaceType::UART:
+            if(uart::connected(pipeline->uart)) {
+                uart::processSendQueue(pipeline->uart);
+            }
+            break;
+        case InterfaceType::NETWORK:
+            if(pipeline->network != NULL) {
+               network::processSendQueue(pipeline->network);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* Private: Drop the oldest message from an interface's send queue, if its
+ * backpressure policy allows it.
+ *
+ * Returns true if a message was dropped.
+ */
+static bool dropOldest(InterfaceDescriptor* descriptor,
+        MessageQueue* sendQueue) {
+    if(descriptor->backpressurePolicy != BackpressurePolicy::DROP_OLDEST) {
+        return false;
+    }
+
+    int messageClass = dropOldestMessage(sendQueue);
+    if(messageClass == -1) {
+        return false;
+    }
+    countDroppedMessage(descriptor->type, messageClass);
+    return true;
+}
+
+/* Private: Drop the oldest message from every interface with the DROP_OLDEST
+ * policy, to free up space in the message pool when it's full.
+ *
+ * Returns true if any message was dropped.
+ */
+static bool dropOldestFromAll(Pipeline* pipeline) {
+    bool dropped = false;
+    if(pipeline->usb->configured) {
+        dropped |= dropOldest(&pipeline->usb->descriptor,
+                &pipeline->usb->endpoints[IN_ENDPOINT_INDEX].sendQueue);
+        dropped |= dropOldest(&pipeline->usb->descriptor,
+                &pipeline->usb->endpoints[LOG_ENDPOINT_INDEX].sendQueue);
+    }
+    #ifdef TELIT_HE910_SUPPORT
+    if(openxc::telitHE910::connected(pipeline->telit)) {
+        dropped |= dropOldest(&pipeline->telit->descriptor,
+                &pipeline->telit->sendQueue);
+    }
+    #endif
+    #ifdef BLE_SUPPORT
+    if(ble::connected(pipeline->ble)) {
+        dropped |= dropOldest(&pipeline->ble->descriptor,
+                &pipeline->ble->sendQueue);
+    }
+    #endif
+    #ifdef FS_SUPPORT
+    if(fs::connected(pipeline->fs)) {
+        dropped |= dropOldest(&pipeline->fs->descriptor,
+                &pipeline->fs->sendQueue);
+    }
+    #endif
+    if(uart::connected(pipeline->uart)) {
+        dropped |= dropOldest(&pipeline->uart->descriptor,
+                &pipeline->uart->sendQueue);
+    }
+    if(pipeline->network != NULL) {
+        dropped |= dropOldest(&pipeline->network->descriptor,
+                &pipeline->network->sendQueue);
+    }
+    return dropped;
+}
+
+/* Private: Apply an interface's backpressure policy if its send queue doesn't
+ * have room for a message.
+ *
+ * The BOUNDED_WAIT policy only processes this interface's queue, so a slow
+ * interface can't hold up the others. The interface's backpressureWaitUs is
+ * shared by every message in a pass of the main loop, and once a wait runs out
+ * the rest of the pass drops messages straight away - a host that has stopped
+ * reading only costs one wait per pass, not one per message. Each wait is also
+ * limited by a number of tries, in case the clock isn't running.
+ *
+ * Returns true if the message now fits in the queue.
+ */
+static bool makeRoom(Pipeline* pipeline, InterfaceDescriptor* descriptor,
+        MessageQueue* sendQueue, int messageSize) {
+    if(messageFits(sendQueue, messageSize)) {
+        return true;
+    } else if(messageSize > MESSAGE_QUEUE_MAX_BYTES) {
+        return false;
+    }
+
+    switch(descriptor->backpressurePolicy) {
+        case BackpressurePolicy::DROP_OLDEST:
+            while(!messageFits(sendQueue, messageSize)) {
+                if(!dropOldest(descriptor, sendQueue)) {
+                    break;
+                }
+            }
+            break;
+        case BackpressurePolicy::BOUNDED_WAIT: {
+            unsigned long* waited = &backpressureWaitedUs[descriptor->type];
+            unsigned long start = time::systemTimeUs();
+            for(int tries = QUEUE_FLUSH_MAX_TRIES; tries > 0 &&
+                    !messageFits(sendQueue, messageSize) &&
+                    *waited + (time::systemTimeUs() - start) <
+                        descriptor->backpressureWaitUs; --tries) {
+                processEndpoint(pipeline, descriptor->type);
+            }
+
+            if(messageFits(sendQueue, messageSize)) {
+                *waited += time::systemTimeUs() - start;
+            } else {
+                // Don't wait again until the next pass
+                *waited = descriptor->backpressureWaitUs;
+            }
+            break;
+        }
+        case BackpressurePolicy::DROP_NEWEST:
+        default:
+            break;
+    }
+    return messageFits(sendQueue, messageSize);
+}
+
+/* Private: Return true if messages of a class are replies the host is
+ * waiting for, and should skip ahead of telemetry in the send queues.
+ */
+static bool isPriorityClass(MessageClass messageClass) {
+    return messageClass == MessageClass::COMMAND_RESPONSE ||
+            messageClass == MessageClass::DIAGNOSTIC;
+}
+
+/* Private: Refill an interface's token bucket, if it has a data rate limit,
+ * and check that it has the bytes for a message. The bytes aren't taken until
+ * the message is queued - see chargeBytes().
+ *
+ * The bucket holds up to one second of data, so an interface that has been
+ * quiet can send a short burst. Replies the host is waiting for are always
+ * sent, but still use up the interface's allowance.
+ *
+ * Returns true if the message is within the interface's data rate.
+ */
+static bool withinByteRate(InterfaceDescriptor* descriptor, int messageSize,
+        MessageClass messageClass) {
+    unsigned long rate = descriptor->maxBytesPerSecond;
+    if(rate == 0) {
+        return true;
+    }
+
+    ByteBucket* bucket = &byteBuckets[descriptor->type];
+    unsigned long capacity = rate * 1000;
+    unsigned long now = uptimeMs();
+    if(!bucket->started) {
+        bucket->milliBytes = capacity;
+        bucket->started = true;
     } else {
+        // Bytes per second is the same as thousandths of a byte per ms - cap
+        // the elapsed time at a second so the multiplication can't overflow
+        unsigned long elapsed = MIN(now - bucket->lastRefill, 1000);
+        bucket->milliBytes = MIN(bucket->milliBytes + elapsed * rate,
+                capacity);
+    }
+    bucket->lastRefill = now;
+
+    return bucket->milliBytes >= (unsigned long)messageSize * 1000 ||
+            isPriorityClass(messageClass);
+}
+
+/* Private: Take the bytes for a queued message from an interface's token
+ * bucket, if it has a data rate limit.
+ */
+static void chargeBytes(InterfaceDescriptor* descriptor, int messageSize) {
+    if(descriptor->maxBytesPerSecond == 0) {
+        return;
+    }
+
+    ByteBucket* bucket = &byteBuckets[descriptor->type];
+    unsigned long cost = (unsigned long)messageSize * 1000;
+    bucket->milliBytes = bucket->milliBytes >= cost ?
+            bucket->milliBytes - cost : 0;
+}
+
+void sendToEndpoint(Pipeline* pipeline, InterfaceDescriptor* descriptor,
+        MessageQueue* sendQueue, QUEUE_TYPE(uint8_t)* receiveQueue,
+        int message, int messageSize, MessageClass messageClass) {
+    InterfaceType endpointType = descriptor->type;
+    // Replies go in the priority lane if there's room, otherwise they wait
+    // with the telemetry, making room for themselves like any other message.
+    bool queued = message != -1 &&
+            withinByteRate(descriptor, messageSize, messageClass) &&
+            ((isPriorityClass(messageClass) &&
+                enqueuePriorityMessage(sendQueue, message)) ||
+            (makeRoom(pipeline, descriptor, sendQueue, messageSize) &&
+                enqueueMessage(sendQueue, message)));
+    if(!queued) {
+        countDroppedMessage(endpointType, messageClass);
+    } else {
+        chargeBytes(descriptor, messageSize);
         ++sentMessages[endpointType];
-        dataSent[endpointType] += messageSize;
+        dataSent[endpointType] += messageLength(message);
     }
-    sendQueueLength[endpointType] = QUEUE_LENGTH(uint8_t, sendQueue);
+    sendQueueLength[endpointType] = queuedBytes(sendQueue);
     // TODO This may not belong here after USB refactoring
-    receiveQueueLength[endpointType] = QUEUE_LENGTH(uint8_t, receiveQueue);
+    if(receiveQueue != NULL) {
+        receiveQueueLength[endpointType] = QUEUE_LENGTH(uint8_t, receiveQueue);
+    }
 }
 
-void sendToUsb(Pipeline* pipeline, uint8_t* message, int messageSize,
+void sendToUsb(Pipeline* pipeline, int message, int messageSize,
         MessageClass messageClass) {
     if(pipeline->usb->configured) {
-        QUEUE_TYPE(uint8_t)* sendQueue;
+        MessageQueue* sendQueue;
         if(messageClass == MessageClass::LOG) {
-            sendQueue = &pipeline->usb->endpoints[LOG_ENDPOINT_INDEX].queue;
+            sendQueue = &pipeline->usb->endpoints[LOG_ENDPOINT_INDEX].sendQueue;
             if(config::getConfiguration()->loggingOutput !=
                         LoggingOutputInterface::BOTH &&
                     config::getConfiguration()->loggingOutput !=
@@ -76,87 +448,199 @@ void sendToUsb(Pipeline* pipeline, uint8_t* message, int messageSize,
                 return;
             }
         } else {
-            sendQueue = &pipeline->usb->endpoints[IN_ENDPOINT_INDEX].queue;
+            sendQueue = &pipeline->usb->endpoints[IN_ENDPOINT_INDEX].sendQueue;
         }
 
-        conditionalFlush(pipeline, sendQueue, message, messageSize);
-        sendToEndpoint(pipeline->usb->descriptor.type, sendQueue,
-                &pipeline->usb->endpoints[OUT_ENDPOINT_INDEX].queue,
-                message, messageSize);
+        sendToEndpoint(pipeline, &pipeline->usb->descriptor, sendQueue,
+                &pipeline->usb->receiveQueue, message, messageSize,
+                messageClass);
     }
 }
 
-void sendToUart(Pipeline* pipeline, uint8_t* message, int messageSize,
+void sendToUart(Pipeline* pipeline, int message, int messageSize,
         MessageClass messageClass) {
     if(uart::connected(pipeline->uart) && messageClass != MessageClass::LOG) {
 		//if(uart::connected(pipeline->uart)) {
-        QUEUE_TYPE(uint8_t)* sendQueue = &pipeline->uart->sendQueue;
-        conditionalFlush(pipeline, sendQueue, message, messageSize);
-        sendToEndpoint(pipeline->uart->descriptor.type, sendQueue,
-                &pipeline->uart->receiveQueue, message, messageSize);
+        sendToEndpoint(pipeline, &pipeline->uart->descriptor,
+                &pipeline->uart->sendQueue, &pipeline->uart->receiveQueue,
+                message, messageSize, messageClass);
     }
 }
 
 #ifdef TELIT_HE910_SUPPORT
-void sendToTelit(Pipeline* pipeline, uint8_t* message, int messageSize,
+void sendToTelit(Pipeline* pipeline, int message, int messageSize,
         MessageClass messageClass) {
     if(openxc::telitHE910::connected(pipeline->telit) && messageClass != MessageClass::LOG) {
-        QUEUE_TYPE(uint8_t)* sendQueue = &pipeline->telit->sendQueue;
-        conditionalFlush(pipeline, sendQueue, message, messageSize);
-        sendToEndpoint(pipeline->telit->descriptor.type, sendQueue, &pipeline->telit->receiveQueue, message,
-                messageSize);
+        sendToEndpoint(pipeline, &pipeline->telit->descriptor,
+                &pipeline->telit->sendQueue, &pipeline->telit->receiveQueue,
+                message, messageSize, messageClass);
     }
     // removed UART logging from the telit
 }
 #endif
 
 #ifdef BLE_SUPPORT
-void sendToBle(Pipeline* pipeline, uint8_t* message, int messageSize,
+void sendToBle(Pipeline* pipeline, int message, int messageSize,
         MessageClass messageClass) {
         
     if(ble::connected(pipeline->ble) && messageClass != MessageClass::LOG) { //TODO add a characteristic for sending debug notification messages
-        QUEUE_TYPE(uint8_t)* sendQueue = (QUEUE_TYPE(uint8_t)* )&pipeline->ble->sendQueue;
-        conditionalFlush(pipeline,sendQueue, message, messageSize);
-        sendToEndpoint(pipeline->ble->descriptor.type, sendQueue,(QUEUE_TYPE(uint8_t)* )&pipeline->ble->receiveQueue, message,
-                messageSize);
+        sendToEndpoint(pipeline, &pipeline->ble->descriptor,
+                &pipeline->ble->sendQueue,
+                (QUEUE_TYPE(uint8_t)* )&pipeline->ble->receiveQueue, message,
+                messageSize, messageClass);
     }
 
 }
 #endif
 #ifdef FS_SUPPORT
-void sendToFS(Pipeline* pipeline, uint8_t* message, int messageSize,
+void sendToFS(Pipeline* pipeline, int message, int messageSize,
         MessageClass messageClass) {
     if(fs::connected(pipeline->fs) && messageClass != MessageClass::LOG
                     && messageClass != MessageClass::COMMAND_RESPONSE
     ) { 
-        QUEUE_TYPE(uint8_t)* sendQueue = (QUEUE_TYPE(uint8_t)* )&pipeline->fs->sendQueue;
-        conditionalFlush(pipeline,sendQueue, message, messageSize);
-        openxc::interface::InterfaceType endpointType = pipeline->fs->descriptor.type;
-        if(!conditionalEnqueue(sendQueue, message, messageSize)) {
-            ++droppedMessages[endpointType];
-        } else {
-        ++sentMessages[endpointType];
-        dataSent[endpointType] += messageSize;
-        }
-        sendQueueLength[endpointType] = QUEUE_LENGTH(uint8_t, sendQueue);
+        sendToEndpoint(pipeline, &pipeline->fs->descriptor,
+                &pipeline->fs->sendQueue, NULL, message, messageSize,
+                messageClass);
     }
 }
 #endif
 
 
-void sendToNetwork(Pipeline* pipeline, uint8_t* message, int messageSize,
+void sendToNetwork(Pipeline* pipeline, int message, int messageSize,
         MessageClass messageClass) {
     if(pipeline->network != NULL && messageClass != MessageClass::LOG) {
-        QUEUE_TYPE(uint8_t)* sendQueue = &pipeline->network->sendQueue;
-        conditionalFlush(pipeline, sendQueue, message, messageSize);
-        sendToEndpoint(pipeline->network->descriptor.type, sendQueue,
-                &pipeline->network->receiveQueue, message, messageSize);
+        sendToEndpoint(pipeline, &pipeline->network->descriptor,
+                &pipeline->network->sendQueue, &pipeline->network->receiveQueue,
+                message, messageSize, messageClass);
+    }
+}
+
+/* Private: Return the descriptor of an interface if it's connected and the
+ * pipeline would send it messages, otherwise NULL.
+ */
+static InterfaceDescriptor* connectedDescriptor(Pipeline* pipeline,
+        InterfaceType endpointType) {
+    switch(endpointType) {
+        case InterfaceType::USB:
+            return pipeline->usb->configured ?
+                    &pipeline->usb->descriptor : NULL;
+        #ifdef TELIT_HE910_SUPPORT
+        case InterfaceType::TELIT:
+            return openxc::telitHE910::connected(pipeline->telit) ?
+                    &pipeline->telit->descriptor : NULL;
+        #elif defined BLE_SUPPORT
+        case InterfaceType::BLE:
+            return ble::connected(pipeline->ble) ?
+                    &pipeline->ble->descriptor : NULL;
+        #else
+        case InterfaceType::UART:
+            return uart::connected(pipeline->uart) ?
+                    &pipeline->uart->descriptor : NULL;
+        #endif
+        #ifdef FS_SUPPORT
+        case InterfaceType::FS:
+            return fs::connected(pipeline->fs) ?
+                    &pipeline->fs->descriptor : NULL;
+        #endif
+        case InterfaceType::NETWORK:
+            return pipeline->network != NULL ?
+                    &pipeline->network->descriptor : NULL;
+        default:
+            return NULL;
+    }
+}
+
+#define ALL_ENDPOINTS 0xff
+
+/* Private: Queue a serialized message for each interface in a set.
+ *
+ * endpoints - A bitmask of the interfaces to send to, by InterfaceType.
+ */
+static void sendToEndpoints(Pipeline* pipeline, uint8_t* message,
+        int messageSize, MessageClass messageClass, uint8_t endpoints) {
+    // Copy the message into the pool once - each endpoint only queues a
+    // reference to it, and it's freed when the last one has sent it. Replies
+    // can use the space telemetry is never allowed to fill.
+    bool priority = isPriorityClass(messageClass);
+    int pooledMessage = priority ?
+            allocatePriorityMessage(message, messageSize, messageClass) :
+            allocateMessage(message, messageSize, messageClass);
+    // If the pool is full, take the space back from interfaces that would
+    // rather lose old messages than new ones - if there's still no room, the
+    // message is dropped for every interface.
+    while(pooledMessage == -1 && messageSize <= MESSAGE_QUEUE_MAX_BYTES &&
+            dropOldestFromAll(pipeline)) {
+        pooledMessage = priority ?
+                allocatePriorityMessage(message, messageSize, messageClass) :
+                allocateMessage(message, messageSize, messageClass);
+    }
+    setMessageOrigin(pooledMessage, pipeline->originUs != 0 ?
+            pipeline->originUs : time::systemTimeUs());
+
+    if(endpoints & (1 << InterfaceType::USB)) {
+        sendToUsb(pipeline, pooledMessage, messageSize, messageClass);
+    }
+    #ifdef TELIT_HE910_SUPPORT
+    if(endpoints & (1 << InterfaceType::TELIT)) {
+        sendToTelit(pipeline, pooledMessage, messageSize, messageClass);
+    }
+    #elif defined BLE_SUPPORT
+    if(endpoints & (1 << InterfaceType::BLE)) {
+        sendToBle(pipeline, pooledMessage, messageSize, messageClass);
+    }
+    #else
+    //#ifndef FS_SUPPORT //UART shared with RTC, disable
+    if(endpoints & (1 << InterfaceType::UART)) {
+        sendToUart(pipeline, pooledMessage, messageSize, messageClass);
+    }
+    //#endif
+    #endif
+    #ifdef FS_SUPPORT
+    if(endpoints & (1 << InterfaceType::FS)) {
+        sendToFS(pipeline, pooledMessage, messageSize, messageClass);
     }
+    #endif
+
+    if(endpoints & (1 << InterfaceType::NETWORK)) {
+        sendToNetwork(pipeline, pooledMessage, messageSize, messageClass);
+    }
+    releaseMessage(pooledMessage);
 }
 
 void openxc::pipeline::publish(openxc_VehicleMessage* message,
         Pipeline* pipeline) {
-    uint8_t payload[MAX_OUTGOING_PAYLOAD_SIZE] = {0};
+    int signalIndex = -1;
+    // Only look the signal up by name if an interface needs to know
+    if(message->type == openxc_VehicleMessage_Type_SIMPLE &&
+            anySignalFilters()) {
+        const CanSignal* signal = openxc::can::lookupSignal(
+                message->simple_message.name, getSignals(), getSignalCount());
+        if(signal != NULL) {
+            signalIndex = signal - getSignals();
+        }
+    }
+    publishSignal(message, signalIndex, pipeline);
+}
+
+void openxc::pipeline::publishSignal(openxc_VehicleMessage* message,
+        int signalIndex, Pipeline* pipeline) {
+    // The interfaces that want the message, by the payload format they use
+    uint8_t endpointsByFormat[PAYLOAD_FORMAT_COUNT] = {0};
+    bool wanted = false;
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        InterfaceDescriptor* descriptor = connectedDescriptor(pipeline,
+                (InterfaceType) i);
+        if(descriptor != NULL &&
+                wantsMessage(&subscriptions[i], message, signalIndex)) {
+            endpointsByFormat[interface::payloadFormat(descriptor)] |= 1 << i;
+            wanted = true;
+        }
+    }
+    if(!wanted) {
+        // Nobody wants it, so don't waste time serializing it
+        return;
+    }
+
     #ifdef RTC_SUPPORT
     message->timestamp = syst.tm;
     message->has_timestamp = true;
@@ -164,9 +648,7 @@ void openxc::pipeline::publish(openxc_VehicleMessage* message,
     message->timestamp = uptimeMs();
     message->has_timestamp = true;
     #endif
-    
-    size_t length = payload::serialize(message, payload, sizeof(payload),
-            config::getConfiguration()->payloadFormat);
+
     MessageClass messageClass;
     bool matched = false;
     switch(message->type) {
@@ -189,30 +671,63 @@ void openxc::pipeline::publish(openxc_VehicleMessage* message,
         case openxc_VehicleMessage_Type_CONTROL_COMMAND:
             break;
     }
-    if(matched) {
-        sendMessage(pipeline, payload, length, messageClass);
-    } else {
+    if(!matched) {
         debug("Trying to serialize unrecognized type: %d", message->type);
+        return;
+    }
+
+    int precision = -1;
+    if(signalIndex >= 0 &&
+            endpointsByFormat[payload::PayloadFormat::JSON] != 0) {
+        precision = openxc::can::signalPrecision(&getSignals()[signalIndex]);
+    }
+
+    // Serialize once for each format in use - the pool keeps the copy each
+    // interface queues, so the same buffer can be reused for the next format.
+    uint8_t payload[MAX_OUTGOING_PAYLOAD_SIZE];
+    for(int format = 0; format < PAYLOAD_FORMAT_COUNT; format++) {
+        if(endpointsByFormat[format] != 0) {
+            memset(payload, 0, sizeof(payload));
+            size_t length = payload::serialize(message, payload,
+                    sizeof(payload), (payload::PayloadFormat) format,
+                    precision);
+            sendToEndpoints(pipeline, payload, length, messageClass,
+                    endpointsByFormat[format]);
+        }
+    }
+}
+
+void openxc::pipeline::publishMetrics(
+        const openxc::metrics::MetricsSnapshot* snapshot,
+        Pipeline* pipeline) {
+    uint8_t endpointsByFormat[PAYLOAD_FORMAT_COUNT] = {0};
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        InterfaceDescriptor* descriptor = connectedDescriptor(pipeline,
+                (InterfaceType) i);
+        if(descriptor != NULL) {
+            endpointsByFormat[interface::payloadFormat(descriptor)] |= 1 << i;
+        }
+    }
+
+    uint8_t payload[MAX_OUTGOING_PAYLOAD_SIZE];
+    for(int format = 0; format < PAYLOAD_FORMAT_COUNT; format++) {
+        if(endpointsByFormat[format] != 0) {
+            memset(payload, 0, sizeof(payload));
+            size_t length = payload::serializeMetrics(snapshot, payload,
+                    sizeof(payload), (payload::PayloadFormat) format);
+            if(length > 0) {
+                sendToEndpoints(pipeline, payload, length,
+                        MessageClass::COMMAND_RESPONSE,
+                        endpointsByFormat[format]);
+            }
+        }
     }
 }
 
 void openxc::pipeline::sendMessage(Pipeline* pipeline, uint8_t* message,
         int messageSize, MessageClass messageClass) {
-    sendToUsb(pipeline, message, messageSize, messageClass);
-    #ifdef TELIT_HE910_SUPPORT
-    sendToTelit(pipeline, message, messageSize, messageClass);
-    #elif defined BLE_SUPPORT
-    sendToBle(pipeline, message, messageSize, messageClass);
-    #else
-    //#ifndef FS_SUPPORT //UART shared with RTC, disable
-    sendToUart(pipeline, message, messageSize, messageClass);
-    //#endif
-    #endif
-    #ifdef FS_SUPPORT
-    sendToFS(pipeline, message, messageSize, messageClass);
-    #endif
-    
-    sendToNetwork(pipeline, message, messageSize, messageClass);
+    sendToEndpoints(pipeline, message, messageSize, messageClass,
+            ALL_ENDPOINTS);
 
     if((config::getConfiguration()->loggingOutput == LoggingOutputInterface::BOTH ||
         config::getConfiguration()->loggingOutput == LoggingOutputInterface::UART)
@@ -222,46 +737,171 @@ void openxc::pipeline::sendMessage(Pipeline* pipeline, uint8_t* message,
     }
 }
 
+void openxc::pipeline::setOrigin(Pipeline* pipeline, unsigned long originUs) {
+    pipeline->originUs = originUs;
+}
+
+const Histogram* openxc::pipeline::sendLatency(Pipeline* pipeline,
+        InterfaceType interfaceType) {
+    switch(interfaceType) {
+        case InterfaceType::USB:
+            return pipeline->usb != NULL ?
+                &pipeline->usb->endpoints[IN_ENDPOINT_INDEX].sendQueue.latency :
+                NULL;
+        case InterfaceType::UART:
+            return pipeline->uart != NULL ?
+                    &pipeline->uart->sendQueue.latency : NULL;
+        #ifdef TELIT_HE910_SUPPORT
+        case InterfaceType::TELIT:
+            return pipeline->telit != NULL ?
+                    &pipeline->telit->sendQueue.latency : NULL;
+        #endif
+        #ifdef BLE_SUPPORT
+        case InterfaceType::BLE:
+            return pipeline->ble != NULL ?
+                    &pipeline->ble->sendQueue.latency : NULL;
+        #endif
+        #ifdef FS_SUPPORT
+        case InterfaceType::FS:
+            return pipeline->fs != NULL ?
+                    &pipeline->fs->sendQueue.latency : NULL;
+        #endif
+        case InterfaceType::NETWORK:
+            return pipeline->network != NULL ?
+                    &pipeline->network->sendQueue.latency : NULL;
+        default:
+            return NULL;
+    }
+}
+
 void openxc::pipeline::process(Pipeline* pipeline) {
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        backpressureWaitedUs[i] = 0;
+    }
+
     // Must always process USB, because this function usually runs the MCU's USB
     // task that handles SETUP and enumeration.
-    usb::processSendQueue(pipeline->usb);
+    processEndpoint(pipeline, InterfaceType::USB);
     #ifdef TELIT_HE910_SUPPORT
-    if(telitHE910::connected(pipeline->telit)) {
-        telitHE910::processSendQueue(pipeline->telit);
-    }
+    processEndpoint(pipeline, InterfaceType::TELIT);
     #endif
     #ifdef BLE_SUPPORT
-    if(ble::connected(pipeline->ble)){
-        ble::processSendQueue(pipeline->ble);
-    }
+    processEndpoint(pipeline, InterfaceType::BLE);
     #endif
     #ifdef FS_SUPPORT
-    if(fs::connected(pipeline->fs)){
-        fs::processSendQueue(pipeline->fs);
-    }
+    processEndpoint(pipeline, InterfaceType::FS);
     #endif
-    if(uart::connected(pipeline->uart)) {
-        uart::processSendQueue(pipeline->uart);
+    processEndpoint(pipeline, InterfaceType::UART);
+    processEndpoint(pipeline, InterfaceType::NETWORK);
+}
+
+bool openxc::pipeline::subscribeToSignal(InterfaceType interfaceType,
+        int signalIndex) {
+    if(signalIndex < 0 || signalIndex >= MAX_SUBSCRIBED_SIGNALS) {
+        return false;
     }
-    if(pipeline->network != NULL) {
-       network::processSendQueue(pipeline->network);
+
+    Subscriptions* endpointSubscriptions = &subscriptions[interfaceType];
+    if(!subscribedToSignal(endpointSubscriptions, signalIndex)) {
+        endpointSubscriptions->signals[signalIndex / 8] |=
+                1 << (signalIndex % 8);
+        ++endpointSubscriptions->signalCount;
+    }
+    return true;
+}
+
+bool openxc::pipeline::unsubscribeFromSignal(InterfaceType interfaceType,
+        int signalIndex) {
+    Subscriptions* endpointSubscriptions = &subscriptions[interfaceType];
+    if(!subscribedToSignal(endpointSubscriptions, signalIndex)) {
+        return false;
     }
 
+    endpointSubscriptions->signals[signalIndex / 8] &=
+            ~(1 << (signalIndex % 8));
+    --endpointSubscriptions->signalCount;
+    return true;
 }
 
-void openxc::pipeline::logStatistics(Pipeline* pipeline) {
-    if(!config::getConfiguration()->calculateMetrics) {
-        return;
+bool openxc::pipeline::subscribeToCanMessage(InterfaceType interfaceType,
+        uint8_t bus, uint32_t id) {
+    Subscriptions* endpointSubscriptions = &subscriptions[interfaceType];
+    if(findCanMessageSubscription(endpointSubscriptions, bus, id) != -1) {
+        return true;
+    } else if(endpointSubscriptions->canMessageCount >=
+            MAX_SUBSCRIBED_CAN_MESSAGES) {
+        return false;
     }
 
-    static unsigned long lastTimeLogged;
-    static DeltaStatistic droppedMessageStats[PIPELINE_ENDPOINT_COUNT];
-    static DeltaStatistic sentMessageStats[PIPELINE_ENDPOINT_COUNT];
-    static DeltaStatistic totalMessageStats[PIPELINE_ENDPOINT_COUNT];
-    static DeltaStatistic dataSentStats[PIPELINE_ENDPOINT_COUNT];
-    static DeltaStatistic sendQueueStats[PIPELINE_ENDPOINT_COUNT];
-    static DeltaStatistic receiveQueueStats[PIPELINE_ENDPOINT_COUNT];
+    endpointSubscriptions->canMessages[
+            endpointSubscriptions->canMessageCount++] = {bus, id};
+    return true;
+}
+
+bool openxc::pipeline::unsubscribeFromCanMessage(InterfaceType interfaceType,
+        uint8_t bus, uint32_t id) {
+    Subscriptions* endpointSubscriptions = &subscriptions[interfaceType];
+    int index = findCanMessageSubscription(endpointSubscriptions, bus, id);
+    if(index == -1) {
+        return false;
+    }
+
+    --endpointSubscriptions->canMessageCount;
+    endpointSubscriptions->canMessages[index] =
+            endpointSubscriptions->canMessages[
+                endpointSubscriptions->canMessageCount];
+    return true;
+}
+
+bool openxc::pipeline::setSignalRateLimit(InterfaceType interfaceType,
+        int signalIndex, float frequency) {
+    if(signalIndex < 0) {
+        return false;
+    }
+
+    Subscriptions* endpointSubscriptions = &subscriptions[interfaceType];
+    int index = findSignalRateLimit(endpointSubscriptions, signalIndex);
+    if(frequency <= 0) {
+        if(index != -1) {
+            --endpointSubscriptions->rateLimitCount;
+            endpointSubscriptions->rateLimits[index] =
+                    endpointSubscriptions->rateLimits[
+                        endpointSubscriptions->rateLimitCount];
+        }
+        return true;
+    }
+
+    if(index == -1) {
+        if(endpointSubscriptions->rateLimitCount >= MAX_SIGNAL_RATE_LIMITS) {
+            return false;
+        }
+        index = endpointSubscriptions->rateLimitCount++;
+        SignalRateLimit* rateLimit = &endpointSubscriptions->rateLimits[index];
+        rateLimit->signalIndex = signalIndex;
+        time::initializeClock(&rateLimit->clock);
+    }
+    time::setFrequency(&endpointSubscriptions->rateLimits[index].clock,
+            frequency);
+    return true;
+}
+
+void openxc::pipeline::clearSubscriptions(InterfaceType interfaceType) {
+    memset(&subscriptions[interfaceType], 0, sizeof(Subscriptions));
+}
+
+unsigned int openxc::pipeline::droppedMessageCount(InterfaceType interfaceType,
+        MessageClass messageClass) {
+    return droppedMessagesByClass[interfaceType][messageClass];
+}
+
+static DeltaStatistic droppedMessageStats[PIPELINE_ENDPOINT_COUNT];
+static DeltaStatistic sentMessageStats[PIPELINE_ENDPOINT_COUNT];
+static DeltaStatistic totalMessageStats[PIPELINE_ENDPOINT_COUNT];
+static DeltaStatistic dataSentStats[PIPELINE_ENDPOINT_COUNT];
+static Statistic sendQueueStats[PIPELINE_ENDPOINT_COUNT];
+static Statistic receiveQueueStats[PIPELINE_ENDPOINT_COUNT];
+
+static void initializeStatistics() {
     static bool initializedStats = false;
     if(!initializedStats) {
         for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
@@ -274,43 +914,99 @@ void openxc::pipeline::logStatistics(Pipeline* pipeline) {
         }
         initializedStats = true;
     }
+}
 
-    if(time::systemTimeMs() - lastTimeLogged >
+/* Private: Sample the counters of each interface into their statistics, once
+ * every PIPELINE_STATS_LOG_FREQUENCY_S. This is cheap, so it runs whether or
+ * not metrics are being logged.
+ *
+ * Returns true if a new sample was taken.
+ */
+static bool sampleStatistics() {
+    static unsigned long lastTimeSampled;
+    initializeStatistics();
+    if(time::systemTimeMs() - lastTimeSampled <=
             PIPELINE_STATS_LOG_FREQUENCY_S * 1000) {
-        for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
-            statistics::update(&sentMessageStats[i], sentMessages[i]);
-            statistics::update(&droppedMessageStats[i], droppedMessages[i]);
-            statistics::update(&totalMessageStats[i],
-                    sentMessages[i] + droppedMessages[i]);
-            statistics::update(&dataSentStats[i], dataSent[i]);
-            statistics::update(&dataSentStats[i], dataSent[i]);
-
-            statistics::update(&sendQueueStats[i], sendQueueLength[i]);
-            statistics::update(&receiveQueueStats[i], receiveQueueLength[i]);
-
-            if(totalMessageStats[i].total > 0) {
-                InterfaceDescriptor descriptor;
-                descriptor.type = (InterfaceType) i;
-                debug("%s avg queue fill percents, Rx: %f, Tx: %f",
-                        descriptorToString(&descriptor),
-                        statistics::exponentialMovingAverage(&receiveQueueStats[i])
-                            / QUEUE_MAX_LENGTH(uint8_t) * 100,
-                        statistics::exponentialMovingAverage(&sendQueueStats[i])
-                            / QUEUE_MAX_LENGTH(uint8_t) * 100);
-                debug("%s msgs sent: %d, dropped: %d (avg %f percent)",
-                        descriptorToString(&descriptor),
-                        sentMessageStats[i].total,
-                        droppedMessageStats[i].total,
-                        statistics::exponentialMovingAverage(&droppedMessageStats[i]) /
-                            statistics::exponentialMovingAverage(&totalMessageStats[i]) * 100);
-                debug("%s avg throughput: %fKB / s, %d msgs / s",
+        return false;
+    }
+
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        statistics::update(&sentMessageStats[i], sentMessages[i]);
+        statistics::update(&droppedMessageStats[i], droppedMessages[i]);
+        statistics::update(&totalMessageStats[i],
+                sentMessages[i] + droppedMessages[i]);
+        statistics::update(&dataSentStats[i], dataSent[i]);
+
+        statistics::update(&sendQueueStats[i], sendQueueLength[i]);
+        statistics::update(&receiveQueueStats[i], receiveQueueLength[i]);
+    }
+    lastTimeSampled = time::systemTimeMs();
+    return true;
+}
+
+bool openxc::pipeline::endpointMetrics(InterfaceType interfaceType,
+        EndpointMetrics* metrics) {
+    int i = interfaceType;
+    if(i < 0 || i >= PIPELINE_ENDPOINT_COUNT ||
+            sentMessages[i] + droppedMessages[i] == 0) {
+        return false;
+    }
+
+    initializeStatistics();
+    metrics->sent = sentMessages[i];
+    metrics->dropped = droppedMessages[i];
+    metrics->bytesSent = dataSent[i];
+    metrics->sendQueueFill = sendQueueStats[i];
+    return true;
+}
+
+void openxc::pipeline::logStatistics(Pipeline* pipeline) {
+    if(!sampleStatistics() || !config::getConfiguration()->calculateMetrics) {
+        return;
+    }
+
+    for(int i = 0; i < PIPELINE_ENDPOINT_COUNT; i++) {
+        if(totalMessageStats[i].total > 0) {
+            InterfaceDescriptor descriptor;
+            descriptor.type = (InterfaceType) i;
+            debug("%s avg queue fill percents, Rx: %f, Tx: %f",
+                    descriptorToString(&descriptor),
+                    statistics::exponentialMovingAverage(&receiveQueueStats[i])
+                        / QUEUE_MAX_LENGTH(uint8_t) * 100,
+                    statistics::exponentialMovingAverage(&sendQueueStats[i])
+                        / MESSAGE_QUEUE_MAX_BYTES * 100);
+            debug("%s msgs sent: %d, dropped: %d (avg %f percent)",
+                    descriptorToString(&descriptor),
+                    sentMessageStats[i].total,
+                    droppedMessageStats[i].total,
+                    statistics::exponentialMovingAverage(&droppedMessageStats[i]) /
+                        statistics::exponentialMovingAverage(&totalMessageStats[i]) * 100);
+            debug("%s avg throughput: %fKB / s, %d msgs / s",
+                    descriptorToString(&descriptor),
+                    statistics::exponentialMovingAverage(&dataSentStats[i])
+                        / 1024.0 / PIPELINE_STATS_LOG_FREQUENCY_S,
+                    (int)(statistics::exponentialMovingAverage(&sentMessageStats[i])
+                        / PIPELINE_STATS_LOG_FREQUENCY_S));
+            const Histogram* latency = sendLatency(pipeline,
+                    (InterfaceType) i);
+            if(latency != NULL && latency->count > 0) {
+                char buckets[96];
+                statistics::formatBuckets(latency, buckets,
+                        sizeof(buckets));
+                debug("%s send latency max: %luus, buckets from <%dus: %s",
+                        descriptorToString(&descriptor), latency->max,
+                        HISTOGRAM_FIRST_BUCKET_US, buckets);
+            }
+            if(droppedMessageStats[i].total > 0) {
+                debug("%s msgs dropped by class, simple: %d, CAN: %d, "
+                        "diagnostic: %d, log: %d, command response: %d",
                         descriptorToString(&descriptor),
-                        statistics::exponentialMovingAverage(&dataSentStats[i])
-                            / 1024.0 / PIPELINE_STATS_LOG_FREQUENCY_S,
-                        (int)(statistics::exponentialMovingAverage(&sentMessageStats[i])
-                            / PIPELINE_STATS_LOG_FREQUENCY_S));
+                        droppedMessagesByClass[i][MessageClass::SIMPLE],
+                        droppedMessagesByClass[i][MessageClass::CAN],
+                        droppedMessagesByClass[i][MessageClass::DIAGNOSTIC],
+                        droppedMessagesByClass[i][MessageClass::LOG],
+                        droppedMessagesByClass[i][MessageClass::COMMAND_RESPONSE]);
             }
-            lastTimeLogged = time::systemTimeMs();
         }
     }
 }
@@ -8,6 +8,7 @@
 #include "interface/fs.h"
 #include "platform_profile.h"
 #include "platform/pic32/telit_he910.h"
+#include "metrics.h"
 
 
 #ifdef FS_SUPPORT
@@ -23,6 +24,22 @@ using openxc::telitHE910::TelitDevice;
 
 #define MAX_OUTGOING_PAYLOAD_SIZE 340
 
+// The number of signals at the start of the active message set's signal array
+// that an interface can subscribe to individually.
+#ifndef MAX_SUBSCRIBED_SIGNALS
+#define MAX_SUBSCRIBED_SIGNALS 256
+#endif
+
+// The most raw CAN messages an interface can subscribe to.
+#ifndef MAX_SUBSCRIBED_CAN_MESSAGES
+#define MAX_SUBSCRIBED_CAN_MESSAGES 8
+#endif
+
+// The most signals each interface can have its own rate limit for.
+#ifndef MAX_SIGNAL_RATE_LIMITS
+#define MAX_SIGNAL_RATE_LIMITS 8
+#endif
+
 namespace openxc {
 namespace pipeline {
 
@@ -34,6 +51,24 @@ typedef enum {
     COMMAND_RESPONSE,
 } MessageClass;
 
+// The number of MessageClass values.
+#define MESSAGE_CLASS_COUNT 5
+
+/* Public: A snapshot of an interface's activity since startup.
+ *
+ * sent - The number of messages queued to send on the interface.
+ * dropped - The number of messages dropped for the interface.
+ * bytesSent - The total length of the messages queued to send.
+ * sendQueueFill - The number of bytes waiting in the send queue, sampled
+ *      every few seconds.
+ */
+typedef struct {
+    unsigned int sent;
+    unsigned int dropped;
+    unsigned int bytesSent;
+    openxc::util::statistics::Statistic sendQueueFill;
+} EndpointMetrics;
+
 /* Public: A container for all output devices that want to be notified of new
  *      messages from the CAN bus.
  *
@@ -45,6 +80,11 @@ typedef enum {
  * output interfaces would all have the same type, so this could just be a list
  * of "receiver" functions. maybe instead of the devices, this is a list of the
  * sendQueues?
+ *
+ * originUs - The time (in us) the data being published was first seen, e.g.
+ *      when the CAN message it's decoded from was received. Set it with
+ *      setOrigin around the calls that publish the data. If 0, messages are
+ *      timed from when they're queued.
  */
 typedef struct {
     UsbDevice* usb;
@@ -57,6 +97,7 @@ typedef struct {
 #endif
     TelitDevice* telit;
     NetworkDevice* network;
+    unsigned long originUs;
 } Pipeline;
 
 /* Public: Serialize the message to a bytestream (conforming to the OpenXC
@@ -71,12 +112,55 @@ typedef struct {
 void publish(openxc_VehicleMessage* message,
         openxc::pipeline::Pipeline* pipeline);
 
+/* Public: The same as publish, for a message decoded from a signal in the
+ * active message set - the signal doesn't need to be looked up by name to
+ * check which interfaces are subscribed to it.
+ *
+ * Interfaces that haven't subscribed to any signals receive every simple
+ * message, and those that haven't subscribed to any raw CAN messages receive
+ * every CAN message. The message isn't serialized at all if no connected
+ * interface wants it. In text payloads, the value is written with only as many
+ * decimal places as the signal's factor and offset need.
+ *
+ * message - A message structure containing the type and data for the message.
+ * signalIndex - The index of the signal in the array returned by
+ *      signals::getSignals(), or -1 if the message isn't from a signal.
+ * pipeline - The pipeline to send on.
+ */
+void publishSignal(openxc_VehicleMessage* message, int signalIndex,
+        openxc::pipeline::Pipeline* pipeline);
+
+/* Public: Send a snapshot of the device's health metrics to every connected
+ * interface as one command response, serialized once for each payload format
+ * in use. Interfaces using a format that can't carry the metrics (see
+ * payload::serializeMetrics) don't receive anything.
+ *
+ * snapshot - The metrics to send.
+ * pipeline - The pipeline to send on.
+ */
+void publishMetrics(const openxc::metrics::MetricsSnapshot* snapshot,
+        openxc::pipeline::Pipeline* pipeline);
+
 /* Public: Queue the message to send on all of the interfaces registered with
  *      the pipeline. If the any of the queues does not have sufficient capacity
  *      to store the message, it will be dropped for that interface only (i.e.
  *      UART can be overloaded and dropping messages but USB will continue
  *      with a 100% translation rate).
  *
+ * The message is copied once into the shared message pool (see
+ * util/messagepool.h) and each interface's queue holds a reference to it.
+ *
+ * Each interface's backpressure policy decides which message is dropped when
+ * its queue is full - see BackpressurePolicy in interface/interface.h. Only
+ * an interface with the BOUNDED_WAIT policy can delay this function, only
+ * that interface's queue is processed while it waits, and it waits for no more
+ * than its backpressureWaitUs between calls to process().
+ *
+ * COMMAND_RESPONSE and DIAGNOSTIC messages are replies the host is waiting for,
+ * so they go in each queue's priority lane and are sent ahead of any queued
+ * telemetry. The lane has its own space, so telemetry is dropped first when
+ * an interface can't keep up.
+ *
  * pipeline - Container of all pipelines to send the message on.
  * message - The message data as an array of uint8_t.
  * messageSize - The length of the message's byte array.
@@ -96,8 +180,109 @@ void sendMessage(Pipeline* pipeline, uint8_t* message, int messageSize,
  */
 void process(Pipeline* pipeline);
 
+/* Public: Sample the activity of each interface for its EndpointMetrics and,
+ * if calculateMetrics is set in the configuration, log it as debug messages.
+ * Call this once each pass of the main loop.
+ */
 void logStatistics(Pipeline* pipeline);
 
+/* Public: Fill in a snapshot of an interface's activity.
+ *
+ * interfaceType - The interface to report on.
+ * metrics - The snapshot to fill in.
+ *
+ * Returns false if the interface hasn't had any messages to send, in which
+ * case metrics is left unchanged.
+ */
+bool endpointMetrics(openxc::interface::InterfaceType interfaceType,
+        EndpointMetrics* metrics);
+
+/* Public: Set the origin time for the messages published from now on, so each
+ * interface's send latency histogram covers the whole path from the origin
+ * until the message leaves the device.
+ *
+ * pipeline - The pipeline the messages will be sent on.
+ * originUs - The origin time in microseconds, or 0 to time messages from when
+ *      they're queued.
+ */
+void setOrigin(Pipeline* pipeline, unsigned long originUs);
+
+/* Public: Return the histogram of the time (in us) from each message's origin
+ * until it was read out of an interface's send queue, or NULL if the
+ * interface isn't in the pipeline. For USB this is the data endpoint.
+ */
+const openxc::util::statistics::Histogram* sendLatency(Pipeline* pipeline,
+        openxc::interface::InterfaceType interfaceType);
+
+/* Public: Only send an interface the signals it has subscribed to, adding one
+ * to its list.
+ *
+ * interfaceType - The interface subscribing.
+ * signalIndex - The index of the signal in the array returned by
+ *      signals::getSignals(), less than MAX_SUBSCRIBED_SIGNALS.
+ *
+ * Returns true if the subscription was added.
+ */
+bool subscribeToSignal(openxc::interface::InterfaceType interfaceType,
+        int signalIndex);
+
+/* Public: Remove a signal from the list an interface has subscribed to. Once
+ * the list is empty, the interface receives every signal again.
+ *
+ * Returns true if the interface was subscribed to the signal.
+ */
+bool unsubscribeFromSignal(openxc::interface::InterfaceType interfaceType,
+        int signalIndex);
+
+/* Public: Only send an interface the raw CAN messages it has subscribed to,
+ * adding one to its list.
+ *
+ * interfaceType - The interface subscribing.
+ * bus - The address of the CAN bus the message is received on.
+ * id - The ID of the message.
+ *
+ * Returns true if the subscription was added, or it already existed. Returns
+ * false if the interface already has MAX_SUBSCRIBED_CAN_MESSAGES.
+ */
+bool subscribeToCanMessage(openxc::interface::InterfaceType interfaceType,
+        uint8_t bus, uint32_t id);
+
+/* Public: Remove a raw CAN message from the list an interface has subscribed
+ * to. Once the list is empty, the interface receives every CAN message again.
+ *
+ * Returns true if the interface was subscribed to the message.
+ */
+bool unsubscribeFromCanMessage(openxc::interface::InterfaceType interfaceType,
+        uint8_t bus, uint32_t id);
+
+/* Public: Send an interface a signal at most a number of times per second,
+ * regardless of how often it's published - e.g. to send a signal at full rate
+ * over USB but only once a second over a metered cellular link. This doesn't
+ * change what the other interfaces receive.
+ *
+ * interfaceType - The interface to limit.
+ * signalIndex - The index of the signal in the array returned by
+ *      signals::getSignals().
+ * frequency - The most values of the signal to send per second, or 0 to
+ *      remove the interface's limit for the signal.
+ *
+ * Returns true if the limit was changed. Returns false if the interface
+ * already has MAX_SIGNAL_RATE_LIMITS.
+ */
+bool setSignalRateLimit(openxc::interface::InterfaceType interfaceType,
+        int signalIndex, float frequency);
+
+/* Public: Remove all of an interface's subscriptions and signal rate limits,
+ * so it receives every message again.
+ */
+void clearSubscriptions(openxc::interface::InterfaceType interfaceType);
+
+/* Public: Return the number of messages of a class that have been dropped for
+ * an interface because its send queue was full.
+ */
+unsigned int droppedMessageCount(openxc::interface::InterfaceType interfaceType,
+        MessageClass messageClass);
+
 } // namespace interface
 } // namespace openxc
 
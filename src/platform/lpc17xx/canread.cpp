@@ -7,6 +7,7 @@ using openxc::util::log::debug;
 using openxc::signals::getCanBusCount;
 using openxc::signals::getCanBuses;
 using openxc::can::shouldAcceptMessage;
+using openxc::can::enqueueReceivedMessage;
 
 CanMessage receiveCanMessage(CanBus* bus) {
     CAN_MSG_Type message;
@@ -17,7 +18,9 @@ CanMessage receiveCanMessage(CanBus* bus) {
         format: message.format == STD_ID_FORMAT ?
             CanMessageFormat::STANDARD : CanMessageFormat::EXTENDED,
         data: {0},
-        length: message.len
+        length: message.len,
+        timestamped: true,
+        receivedUs: openxc::util::time::systemTimeUs()
     };
 
     memcpy(result.data, message.dataA, 4);
@@ -32,8 +35,8 @@ void CAN_IRQHandler() {
         CanBus* bus = &getCanBuses()[i];
         if((CAN_IntGetStatus(CAN_CONTROLLER(bus)) & 0x01) == 1) {
             CanMessage message = receiveCanMessage(bus);
-            if(shouldAcceptMessage(bus, message.id) &&
-                    !QUEUE_PUSH(CanMessage, &bus->receiveQueue, message)) {
+            if(shouldAcceptMessage(bus, message.id, message.format) &&
+                    !enqueueReceivedMessage(bus, &message)) {
                 // An exception to the "don't leave commented out code" rule,
                 // this log statement is useful for debugging performance issues
                 // but if left enabled all of the time, it can can slown down
@@ -42,7 +45,6 @@ void CAN_IRQHandler() {
                 //
                 // debug("Dropped CAN message with ID 0x%02x -- queue is full",
                 // message.id);
-                ++bus->messagesDropped;
             }
         }
     }
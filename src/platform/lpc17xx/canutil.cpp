@@ -1,4 +1,5 @@
 #include "can/canutil.h"
+#include "can/canfilter.h"
 #include "canutil_lpc17xx.h"
 #include "signals.h"
 #include "util/log.h"
@@ -12,9 +13,15 @@
 #define CAN_PORT_NUM(BUS) 0
 #define CAN_FUNCNUM(BUS) (BUS == LPC_CAN1 ? 3 : 2)
 
+// The number of explicit and group entries to load into the AF table, which is
+// shared by both controllers. Each bus's acceptance filters are compiled into
+// ranges to fit.
+#define MAX_AF_TABLE_ENTRIES 32
+
 using openxc::signals::getCanBusCount;
 using openxc::signals::getCanBuses;
 using openxc::util::log::debug;
+using openxc::can::filter::AcceptanceFilterRange;
 
 extern uint16_t CANAF_std_cnt;
 extern uint16_t CANAF_ext_cnt;
@@ -70,27 +77,47 @@ bool openxc::can::updateAcceptanceFilterTable(CanBus* buses, const int busCount)
     for(int i = 0; i < busCount; i++) {
         CanBus* bus = &buses[i];
         bypassFilters |= bus->bypassFilters;
-        AcceptanceFilterListEntry* entry;
-        LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
-            if(filterCount >= MAX_ACCEPTANCE_FILTERS) {
-                break;
+
+        // Split what's left of the shared table evenly between this and the
+        // remaining buses.
+        int budget = (MAX_AF_TABLE_ENTRIES - filterCount) / (busCount - i);
+        AcceptanceFilterRange ranges[MAX_AF_TABLE_ENTRIES];
+        int rangeCount = filter::compileRanges(bus, ranges, budget);
+        if(rangeCount == -1) {
+            debug("Unable to fit filters for bus %d in AF table, bypassing",
+                    bus->address);
+            bypassFilters = true;
+            continue;
+        }
+
+        for(int j = 0; j < rangeCount; j++) {
+            AcceptanceFilterRange* range = &ranges[j];
+            CAN_ID_FORMAT_Type format =
+                    range->format == CanMessageFormat::STANDARD ?
+                        STD_ID_FORMAT : EXT_ID_FORMAT;
+            if(range->lower == range->upper) {
+                result = CAN_LoadExplicitEntry(CAN_CONTROLLER(bus),
+                        range->lower, format);
+            } else {
+                result = CAN_LoadGroupEntry(CAN_CONTROLLER(bus), range->lower,
+                        range->upper, format);
             }
-            result = CAN_LoadExplicitEntry(CAN_CONTROLLER(bus), entry->filter,
-                   entry->format == CanMessageFormat::STANDARD ?
-                       STD_ID_FORMAT : EXT_ID_FORMAT);
-           if(result != CAN_OK) {
-                debug("Couldn't add filter 0x%x to bus %d", entry->filter,
-                        bus->address);
+
+            if(result != CAN_OK) {
+                debug("Couldn't add filter 0x%x-0x%x to bus %d", range->lower,
+                        range->upper, bus->address);
                 break;
-           }
-           ++filterCount;
+            }
+            ++filterCount;
         }
     }
 
     // On the LPC17xx, the AF mode is global - if it's off, it's off for
     // both controllers. That's why this is outside the loop above, and
     // we're counting *total* filters, not filters per bus. We also disable the
-    // AF if any of the busses has bypassFilters == true.
+    // AF if any of the busses has bypassFilters == true. Any IDs a group entry
+    // lets through that weren't requested are dropped by the software filter
+    // in the CAN interrupt handler.
     bypassFilters |= filterCount == 0;
     if(bypassFilters) {
         debug("No filters configured or a bus in bypass, disabling AF");
@@ -138,6 +165,8 @@ void openxc::can::initialize(CanBus* bus, bool writable, CanBus* buses,
             openxc::signals::getMessageCount(), buses, busCount)) {
         debug("Unable to initialize CAN acceptance filters");
     }
+    openxc::can::indexMessageDefinitions(bus, openxc::signals::getMessages(),
+            openxc::signals::getMessageCount());
 
     // enable receiver interrupt
     CAN_IRQCmd(CAN_CONTROLLER(bus), CANINT_RIE, ENABLE);
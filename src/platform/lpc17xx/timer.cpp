@@ -35,6 +35,19 @@ unsigned long openxc::util::time::systemTimeMs() {
     return SYSTEM_TICK_COUNT;
 }
 
+unsigned long openxc::util::time::systemTimeUs() {
+    // SysTick counts down from LOAD to 0 once per millisecond - re-read if the
+    // tick interrupt fired between reading the counter and the tick count.
+    unsigned int ticks;
+    uint32_t remaining;
+    do {
+        ticks = SYSTEM_TICK_COUNT;
+        remaining = SysTick->VAL;
+    } while(ticks != SYSTEM_TICK_COUNT);
+    return ticks * 1000 +
+        (SysTick->LOAD - remaining) / (SystemCoreClock / 1000000);
+}
+
 void openxc::util::time::initialize() {
     // Configure for 1ms tick
     SysTick_Config(SystemCoreClock / 1000);
@@ -5,6 +5,7 @@
 #include "pipeline.h"
 #include "config.h"
 #include "util/bytebuffer.h"
+#include "util/messagepool.h"
 #include "util/log.h"
 #include "gpio.h"
 
@@ -45,6 +46,10 @@ using openxc::config::getConfiguration;
 using openxc::util::log::debug;
 using openxc::pipeline::Pipeline;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::bytebuffer::ByteSpan;
+using openxc::util::messagepool::readableSpans;
+using openxc::util::messagepool::discardBytes;
+using openxc::util::messagepool::queueEmpty;
 using openxc::gpio::GpioValue;
 using openxc::gpio::GpioDirection;
 
@@ -100,22 +105,23 @@ void handleTransmitInterrupt() {
 
     while(UART_CheckBusy(UART1_DEVICE) == SET);
 
-    while(!QUEUE_EMPTY(uint8_t, &getConfiguration()->uart.sendQueue)) {
-        uint8_t byte = QUEUE_PEEK(uint8_t, &getConfiguration()->uart.sendQueue);
+    ByteSpan spans[2];
+    while(readableSpans(&getConfiguration()->uart.sendQueue, spans) > 0) {
         // We used to use non-blocking here, but then we got into a race
         // condition - if the transmit interrupt occurred while adding more data
         // to the queue, you could lose data. We should be able to switch back
         // to non-blocking if we disabled interrupts while modifying the queue
         // (good practice anyway) but for now switching this to block sends
         // seems to work OK without any significant impacts.
-        if(UART_Send(UART1_DEVICE, &byte, 1, BLOCKING)) {
-            QUEUE_POP(uint8_t, &getConfiguration()->uart.sendQueue);
-        } else {
+        int sent = UART_Send(UART1_DEVICE, spans[0].data, spans[0].length,
+                BLOCKING);
+        discardBytes(&getConfiguration()->uart.sendQueue, sent);
+        if(sent < spans[0].length) {
             break;
         }
     }
 
-    if(QUEUE_EMPTY(uint8_t, &getConfiguration()->uart.sendQueue)) {
+    if(queueEmpty(&getConfiguration()->uart.sendQueue)) {
         disableTransmitInterrupt();
         TRANSMIT_INTERRUPT_STATUS = RESET;
     } else {
@@ -269,7 +275,7 @@ void openxc::interface::uart::initialize(UartDevice* device) {
 }
 
 void openxc::interface::uart::processSendQueue(UartDevice* device) {
-    if(!QUEUE_EMPTY(uint8_t, &device->sendQueue)) {
+    if(!queueEmpty(&device->sendQueue)) {
         if(TRANSMIT_INTERRUPT_STATUS == RESET) {
             handleTransmitInterrupt();
         } else {
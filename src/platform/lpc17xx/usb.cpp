@@ -6,6 +6,7 @@
 
 #include "util/log.h"
 #include "util/bytebuffer.h"
+#include "util/messagepool.h"
 #include "gpio.h"
 #include "usb_config.h"
 #include "config.h"
@@ -41,6 +42,10 @@ using openxc::interface::usb::UsbDevice;
 using openxc::interface::usb::UsbEndpoint;
 using openxc::interface::usb::UsbEndpointDirection;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::messagepool::dequeueBytes;
+using openxc::util::messagepool::queueEmpty;
+using openxc::util::messagepool::queuedBytes;
+using openxc::util::coalesce::coalescedLength;
 using openxc::gpio::GPIO_VALUE_HIGH;
 using openxc::gpio::GPIO_VALUE_LOW;
 
@@ -112,20 +117,18 @@ void EVENT_USB_Device_ConfigurationChanged(void) {
 
 /* Private: Flush any queued data out to the USB host. */
 static void flushQueueToHost(UsbDevice* usbDevice, UsbEndpoint* endpoint) {
-    if(!usb::connected(usbDevice) || QUEUE_EMPTY(uint8_t, &endpoint->queue)) {
+    if(!usb::connected(usbDevice) || queueEmpty(&endpoint->sendQueue)) {
         return;
     }
 
     uint8_t previousEndpoint = Endpoint_GetCurrentEndpoint();
     Endpoint_SelectEndpoint(endpoint->address);
     if(Endpoint_IsINReady()) {
-        // get bytes from transmit FIFO into intermediate buffer
-        int byteCount = 0;
-        while(!QUEUE_EMPTY(uint8_t, &endpoint->queue)
-                && byteCount < USB_SEND_BUFFER_SIZE) {
-            endpoint->sendBuffer[byteCount++] = QUEUE_POP(uint8_t,
-                    &endpoint->queue);
-        }
+        // get bytes from transmit FIFO into intermediate buffer, in whole
+        // packets unless they've waited too long for more
+        int byteCount = dequeueBytes(&endpoint->sendQueue, endpoint->sendBuffer,
+                coalescedLength(&endpoint->coalescer,
+                    queuedBytes(&endpoint->sendQueue), USB_SEND_BUFFER_SIZE));
 
         if(byteCount > 0) {
             Endpoint_Write_Stream_LE(endpoint->sendBuffer, byteCount, NULL);
@@ -251,7 +254,7 @@ void openxc::interface::usb::read(UsbDevice* device, UsbEndpoint* endpoint,
     bool receivedData = false;
     while(Endpoint_IsOUTReceived()) {
         while(Endpoint_BytesInEndpoint()) {
-            if(!QUEUE_PUSH(uint8_t, &endpoint->queue, Endpoint_Read_8())) {
+            if(!QUEUE_PUSH(uint8_t, &device->receiveQueue, Endpoint_Read_8())) {
                 debug("Dropped write from host -- queue is full");
             }
             receivedData = true;
@@ -260,7 +263,7 @@ void openxc::interface::usb::read(UsbDevice* device, UsbEndpoint* endpoint,
     }
 
     if(receivedData) {
-        while(processQueue(&endpoint->queue, callback)) {
+        while(processQueue(&device->receiveQueue, callback)) {
             continue;
         }
     }
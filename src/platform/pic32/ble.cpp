@@ -15,6 +15,7 @@
 
 #include "util/log.h"
 #include "util/timer.h"
+#include "util/coalesce.h"
 
 #include "libs/STBTLE/ble_status.h"
 #include "libs/STBTLE/bluenrg_aci.h"
@@ -34,6 +35,11 @@
 
 
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::bytebuffer::ByteSpan;
+using openxc::util::bytebuffer::discardBytes;
+using openxc::util::messagepool::readableSpans;
+using openxc::util::messagepool::discardBytes;
+using openxc::util::messagepool::queuedBytes;
 using openxc::util::log::debug;
 using openxc::util::time::uptimeMs;
 
@@ -41,6 +47,8 @@ using openxc::config::getConfiguration;
 
 using openxc::interface::ble::BleStatus;
 using openxc::interface::ble::BleError;
+using openxc::util::coalesce::Coalescer;
+using openxc::util::coalesce::coalescedLength;
 
 
 
@@ -126,11 +134,16 @@ bool send_l2cap_request = false;
 uint32_t l2cap_request_attempts=0;
 uint32_t l2captimer=0;
 
+// The most data in one notification - the BlueNRG stack doesn't negotiate a
+// larger ATT MTU than the default of 23 bytes, 3 of which are the header.
+#define NOTIFY_PACKET_SIZE 20
+
 #ifdef OPTIMIZE_NOTIFICATION
-#define SMALL_NOTIFY_PACKET_TIMEOUT 1000
-    bool small_packet_notify_present = false;
-    uint32_t small_packet_notify_time_ms;
+#define SMALL_NOTIFY_PACKET_TIMEOUT BLE_COALESCE_MAX_LATENCY_MS
+#else
+#define SMALL_NOTIFY_PACKET_TIMEOUT 0
 #endif
+Coalescer notify_coalescer;
 
 uint32_t notification_fail_retries =0;    
 
@@ -138,16 +151,12 @@ uint32_t notification_fail_retries =0;
 static void flush_ble_buffers(void) //flushing out old unsent data sitting in memory
 {
     debug("Flushing ble buffers");
-    while(QUEUE_EMPTY(uint8_t, &getConfiguration()->ble->sendQueue)==false)
-    {
-        QUEUE_POP(uint8_t, &getConfiguration()->ble->sendQueue);
-    }
+    discardBytes(&getConfiguration()->ble->sendQueue,
+            queuedBytes(&getConfiguration()->ble->sendQueue));
     RingBuffer_Clear(&notify_buffer_ring);
     
-    while(QUEUE_EMPTY(uint8_t, &getConfiguration()->ble->receiveQueue)==false)
-    {
-        QUEUE_POP(uint8_t, &getConfiguration()->ble->receiveQueue);
-    }
+    discardBytes(&getConfiguration()->ble->receiveQueue,
+            QUEUE_LENGTH(uint8_t, &getConfiguration()->ble->receiveQueue));
     
 }
 
@@ -513,6 +522,8 @@ bool openxc::interface::ble::initialize(BleDevice* device)
     uint16_t fwVersion;
     
     RingBuffer_Initialize(&notify_buffer_ring,(char*)notify_buffer, NOTIFY_BUFFER_SZ);
+    openxc::util::coalesce::initialize(&notify_coalescer, NOTIFY_PACKET_SIZE,
+            SMALL_NOTIFY_PACKET_TIMEOUT);
     
     device->status = BleStatus::RADIO_OFF;
     
@@ -746,54 +757,33 @@ bool openxc::interface::ble::connected(BleDevice* device)
 
 void openxc::interface::ble::processSendQueue(BleDevice* device) 
 {    
-    static uint8_t ndata[21];
-    char d;uint8_t ret;
+    static uint8_t ndata[NOTIFY_PACKET_SIZE + 1];
+    uint8_t ret;
     uint32_t sz;
     
     if(connected(device))
     {
 
-        while((RingBuffer_FreeSpace(&notify_buffer_ring) > 0) && QUEUE_EMPTY(uint8_t, &device->sendQueue)==false)
+        ByteSpan spans[2];
+        while(RingBuffer_FreeSpace(&notify_buffer_ring) > 0 &&
+                readableSpans(&device->sendQueue, spans) > 0)
         {
-            d = QUEUE_POP(uint8_t,&device->sendQueue);
-            RingBuffer_Write(&notify_buffer_ring, &d, 1);
-            
+            uint32_t length = spans[0].length;
+            if(length > RingBuffer_FreeSpace(&notify_buffer_ring))
+            {
+                length = RingBuffer_FreeSpace(&notify_buffer_ring);
+            }
+            RingBuffer_Write(&notify_buffer_ring, (char*)spans[0].data, length);
+            discardBytes(&device->sendQueue, length);
         }
         
-        sz = RingBuffer_UsedSpace(&notify_buffer_ring);
+        // Only send full notifications, unless the data has waited too long
+        // for more
+        sz = coalescedLength(&notify_coalescer,
+                RingBuffer_UsedSpace(&notify_buffer_ring), NOTIFY_PACKET_SIZE);
         
         if(sz > 0)
         {
-            if(sz > 20)
-            {
-                sz = 20;
-        
-                small_packet_notify_present = false;
-
-            }
-            else
-            {
-
-                if(small_packet_notify_present == false)
-                {
-                    small_packet_notify_time_ms = uptimeMs();
-                    small_packet_notify_present = true;
-                    return;
-                }
-                else{
-                    if( uptimeMs() > small_packet_notify_time_ms + SMALL_NOTIFY_PACKET_TIMEOUT)
-                    {
-                        small_packet_notify_time_ms = uptimeMs();
-                        small_packet_notify_present = false;
-                    }
-                    else
-                    {
-                        return;
-                    }
-                }
-
-            }
-            
             RingBuffer_Peek(&notify_buffer_ring,(char*) ndata, sz);
             
             //Avoiding retries to allow more bandwidth to foreground application
@@ -8,6 +8,8 @@ namespace power = openxc::power;
 
 using openxc::util::log::debug;
 using openxc::signals::getCanBuses;
+using openxc::can::shouldAcceptMessage;
+using openxc::can::enqueueReceivedMessage;
 
 static CanMessage receiveCanMessage(CanBus* bus) {
     CAN::RxMessageBuffer* message = CAN_CONTROLLER(bus)->getRxMessage(
@@ -17,7 +19,9 @@ static CanMessage receiveCanMessage(CanBus* bus) {
         id: message->msgSID.SID,
         format: CanMessageFormat::STANDARD,
         data: {0},
-        length: (uint8_t) message->msgEID.DLC
+        length: (uint8_t) message->msgEID.DLC,
+        timestamped: true,
+        receivedUs: openxc::util::time::systemTimeUs()
     };
     memcpy(result.data, message->data, CAN_MESSAGE_SIZE);
 
@@ -47,7 +51,12 @@ void openxc::can::pic32::handleCanInterrupt(CanBus* bus) {
                 CAN::RX_CHANNEL_NOT_EMPTY, false);
 
         CanMessage message = receiveCanMessage(bus);
-        if(!QUEUE_PUSH(CanMessage, &bus->receiveQueue, message)) {
+        // The controller's filters may accept groups of IDs, so drop any
+        // messages that weren't actually requested. With no filters at all,
+        // the controller's AF is off and everything is let through.
+        if((LIST_EMPTY(&bus->acceptanceFilters) ||
+                    shouldAcceptMessage(bus, message.id, message.format)) &&
+                !enqueueReceivedMessage(bus, &message)) {
             // An exception to the "don't leave commented out code" rule,
             // this log statement is useful for debugging performance issues
             // but if left enabled all of the time, it can can slown down
@@ -56,7 +65,6 @@ void openxc::can::pic32::handleCanInterrupt(CanBus* bus) {
             //
             // debug("Dropped CAN message with ID 0x%02x -- queue is full with %d",
                     // message.id, QUEUE_LENGTH(CanMessage, &bus->receiveQueue));
-            ++bus->messagesDropped;
         }
 
         /* Call the CAN::updateChannel() function to let the CAN module know
@@ -1,4 +1,5 @@
 #include "can/canutil.h"
+#include "can/canfilter.h"
 #include "canutil_pic32.h"
 #include "signals.h"
 #include "util/log.h"
@@ -39,11 +40,15 @@
 
 #define CAN_RX_CHANNEL 1
 #define BUS_MEMORY_BUFFER_SIZE 2 * 8 * 16
+// The number of filters in each CAN controller. Each bus's acceptance filters
+// are compiled into value and mask pairs to fit.
+#define CAN_CONTROLLER_FILTER_COUNT 32
 
 namespace gpio = openxc::gpio;
 
 using openxc::signals::getCanBuses;
 using openxc::util::log::debug;
+using openxc::can::filter::AcceptanceFilterMask;
 using openxc::gpio::GpioValue;
 using openxc::gpio::GPIO_VALUE_LOW;
 using openxc::gpio::GPIO_VALUE_HIGH;
@@ -103,13 +108,20 @@ bool openxc::can::resetAcceptanceFilterStatus(CanBus* bus, bool enabled) {
 bool openxc::can::updateAcceptanceFilterTable(CanBus* buses, const int busCount) {
     // For the PIC32 we *could* only change the filters for one bus, but to
     // simplify things we'll reset everything like we have to with the LPC1768
-    uint16_t totalFilterCount = 0;
     for(int i = 0; i < busCount; i++) {
         CanBus* bus = &buses[i];
-        uint16_t busFilterCount = 0;
         CAN::OP_MODE previousMode = switchControllerMode(bus, CAN::CONFIGURATION);
 
-        if(LIST_EMPTY(&bus->acceptanceFilters) || bus->bypassFilters) {
+        AcceptanceFilterMask masks[CAN_CONTROLLER_FILTER_COUNT];
+        int maskCount = filter::compileMasks(bus, masks,
+                CAN_CONTROLLER_FILTER_COUNT);
+        if(maskCount == -1) {
+            debug("Unable to fit filters for bus %d in the controller, "
+                    "relying on the software filter", bus->address);
+        }
+
+        if(LIST_EMPTY(&bus->acceptanceFilters) || bus->bypassFilters
+                || maskCount == -1) {
             debug("Bus %d has no filters configured or manually set to bypass, "
                     "turning off acceptance filter", bus->address);
             resetAcceptanceFilterStatus(bus, false);
@@ -119,42 +131,50 @@ bool openxc::can::updateAcceptanceFilterTable(CanBus* buses, const int busCount)
             // when you set it.
             resetAcceptanceFilterStatus(bus, true);
 
-            AcceptanceFilterListEntry* entry;
-            LIST_FOREACH(entry, &bus->acceptanceFilters, entries) {
-                if(busFilterCount >= MAX_ACCEPTANCE_FILTERS) {
-                    break;
+            int filterIndex = 0;
+            for(; filterIndex < maskCount; ++filterIndex) {
+                AcceptanceFilterMask* mask = &masks[filterIndex];
+                bool exact = mask->mask == filter::fullFilterMask(mask->format);
+                CAN::FILTER_MASK filterMask;
+                if(mask->format == CanMessageFormat::STANDARD) {
+                    // Standard format message IDs match filter mask 0, or 2
+                    // for groups of IDs
+                    filterMask = exact ? CAN::FILTER_MASK0 : CAN::FILTER_MASK2;
+                } else {
+                    // Extended format message IDs match filter mask 1, or 3
+                    // for groups of IDs
+                    filterMask = exact ? CAN::FILTER_MASK1 : CAN::FILTER_MASK3;
                 }
 
-                // Must disable before changing or else the filters do not work!
-                CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(totalFilterCount), false);
-                if(entry->format == CanMessageFormat::STANDARD) {
-                    // Standard format message IDs match filter mask 0
-                    debug("Added acceptance filter for STD 0x%x on bus %d to AF",
-                            entry->filter, bus->address);
-                    CAN_CONTROLLER(bus)->configureFilter(
-                            CAN::FILTER(totalFilterCount), entry->filter, CAN::SID);
-                    CAN_CONTROLLER(bus)->linkFilterToChannel(CAN::FILTER(totalFilterCount),
-                            CAN::FILTER_MASK0, CAN::CHANNEL(CAN_RX_CHANNEL));
-                } else {
-                    // Extended format message IDs match filter mask 1
-                    debug("Added acceptance filter for EXT 0x%x on bus %d to AF",
-                            entry->filter, bus->address);
-                    CAN_CONTROLLER(bus)->configureFilter(
-                            CAN::FILTER(totalFilterCount), entry->filter, CAN::EID);
-                    CAN_CONTROLLER(bus)->linkFilterToChannel(CAN::FILTER(totalFilterCount),
-                            CAN::FILTER_MASK1, CAN::CHANNEL(CAN_RX_CHANNEL));
+                if(!exact) {
+                    // All groups of the same format share a mask, so it's fine
+                    // to configure it again for each one
+                    CAN_CONTROLLER(bus)->configureFilterMask(filterMask,
+                            mask->mask,
+                            mask->format == CanMessageFormat::STANDARD ?
+                                CAN::SID : CAN::EID,
+                            CAN::FILTER_MASK_IDE_TYPE);
                 }
-                CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(totalFilterCount), true);
 
-                ++totalFilterCount;
-                ++busFilterCount;
+                // Must disable before changing or else the filters do not work!
+                CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(filterIndex), false);
+                debug("Added acceptance filter for %s 0x%x/0x%x on bus %d to AF",
+                        mask->format == CanMessageFormat::STANDARD ?
+                            "STD" : "EXT",
+                        mask->value, mask->mask, bus->address);
+                CAN_CONTROLLER(bus)->configureFilter(CAN::FILTER(filterIndex),
+                        mask->value,
+                        mask->format == CanMessageFormat::STANDARD ?
+                            CAN::SID : CAN::EID);
+                CAN_CONTROLLER(bus)->linkFilterToChannel(CAN::FILTER(filterIndex),
+                        filterMask, CAN::CHANNEL(CAN_RX_CHANNEL));
+                CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(filterIndex), true);
             }
 
             // Disable the remaining unused filters. When AF is "off" we are
             // actually using filter 0, so we don't want to disable that.
-            for(int disabledFilters = busFilterCount;
-                    disabledFilters < MAX_ACCEPTANCE_FILTERS; ++disabledFilters) {
-                CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(disabledFilters), false);
+            for(; filterIndex < CAN_CONTROLLER_FILTER_COUNT; ++filterIndex) {
+                CAN_CONTROLLER(bus)->enableFilter(CAN::FILTER(filterIndex), false);
             }
         }
 
@@ -250,6 +270,8 @@ void openxc::can::initialize(CanBus* bus, bool writable, CanBus* buses,
                 openxc::signals::getMessageCount(), buses, busCount)) {
         debug("Unable to initialize CAN acceptance filters");
     }
+    openxc::can::indexMessageDefinitions(bus, openxc::signals::getMessages(),
+            openxc::signals::getMessageCount());
 
     // Enable interrupt and events. Enable the receive channel not empty event
     // (channel event) and the receive channel event (module event). The
@@ -22,6 +22,9 @@ static uint32_t file_flush_timer=0;
  
 using openxc::util::log::debug;
 using openxc::config::getConfiguration;
+using openxc::util::bytebuffer::ByteSpan;
+using openxc::util::messagepool::readableSpans;
+using openxc::util::messagepool::discardBytes;
 
 namespace lights = openxc::lights;
 namespace uart = openxc::interface::uart;
@@ -88,11 +91,15 @@ bool openxc::interface::fs::getSDStatus(void){
 }
 void openxc::interface::fs::processSendQueue(FsDevice* device) 
 {    
-    uint8_t d;
-    while(QUEUE_EMPTY(uint8_t, &device->sendQueue)==false && fsman_available()>0)
+    ByteSpan spans[2];
+    while(fsman_available() > 0 && readableSpans(&device->sendQueue, spans) > 0)
     {
-        d = QUEUE_POP(uint8_t,&device->sendQueue);
-        write(device, &d, 1);
+        uint32_t length = spans[0].length;
+        if(length > fsman_available()){
+            length = fsman_available();
+        }
+        write(device, spans[0].data, length);
+        discardBytes(&device->sendQueue, length);
     }
     
 }
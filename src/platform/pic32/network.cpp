@@ -1,6 +1,7 @@
 #include "interface/network.h"
 #include "util/log.h"
 #include "util/bytebuffer.h"
+#include "util/messagepool.h"
 #include <stddef.h>
 
 #ifdef __USE_NETWORK__
@@ -15,6 +16,7 @@
 
 using openxc::util::log::debug;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::messagepool::dequeueBytes;
 
 Server server = Server(DEFAULT_NETWORK_PORT);
 
@@ -34,17 +36,14 @@ void openxc::interface::network::initialize(NetworkDevice* device) {
     }
 }
 
-// The message bytes are sequentially popped from the
-// send queue to the send buffer. After the buffer is full
-// or the queue is empty, the contents of the buffer are
-// sent over the network to listening clients.
+// The message bytes are moved from the send queue to the
+// send buffer until the buffer is full or the queue is
+// empty, then the contents of the buffer are sent over
+// the network to listening clients.
 void openxc::interface::network::processSendQueue(NetworkDevice* device) {
-    unsigned int byteCount = 0;
-    char sendBuffer[MAX_MESSAGE_SIZE];
-    while(!QUEUE_EMPTY(uint8_t, &device->sendQueue) &&
-            byteCount < MAX_MESSAGE_SIZE) {
-        sendBuffer[byteCount++] = QUEUE_POP(uint8_t, &device->sendQueue);
-    }
+    uint8_t sendBuffer[MAX_MESSAGE_SIZE];
+    int byteCount = dequeueBytes(&device->sendQueue, sendBuffer,
+            MAX_MESSAGE_SIZE);
 
     // must call at least one Network method to keep the TCP/IP stack alive,
     // because it's implemented all in software - a quirk of the chipKIT
@@ -52,7 +51,7 @@ void openxc::interface::network::processSendQueue(NetworkDevice* device) {
     // purpose, but it doesn't seem to have any effect while this does.
     device->server->available();
     if(byteCount > 0) {
-        device->server->write((uint8_t*) sendBuffer, byteCount);
+        device->server->write(sendBuffer, byteCount);
     }
 }
 
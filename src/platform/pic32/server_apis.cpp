@@ -45,7 +45,7 @@ API_RETURN openxc::server_api::serverPOSTdata(char* deviceId, char* host, char*
                     "Content-Length: %u\r\n"
                     "Content-Type: %s\r\n"
                     "Host: %s\r\n"
-                    "Connection: Keep-Alive\r\n\r\n", deviceId, len, getConfiguration()->payloadFormat == PayloadFormat::PROTOBUF ? ctPROTOBUF : ctJSON, host);
+                    "Connection: Keep-Alive\r\n\r\n", deviceId, len, openxc::interface::payloadFormat(&getConfiguration()->telit->descriptor) == PayloadFormat::PROTOBUF ? ctPROTOBUF : ctJSON, host);
             // configure the HTTP client
             client = http::httpClient();
             client.socketNumber = POST_DATA_SOCKET;
@@ -159,7 +159,7 @@ void openxc::server_task::flushDataBuffer(TelitDevice* device) {
             
         case 2:
             
-            switch(getConfiguration()->payloadFormat)
+            switch(openxc::interface::payloadFormat(&device->descriptor))
             {
                 case PayloadFormat::JSON:
                 
@@ -29,6 +29,7 @@ using openxc::gpio::GPIO_VALUE_LOW;
 using openxc::util::time::delayMs;
 using openxc::util::log::debug;
 using openxc::util::time::uptimeMs;
+using openxc::util::messagepool::dequeueBytes;
 using openxc::config::getConfiguration;
 using openxc::telitHE910::TELIT_CONNECTION_STATE;
 using openxc::payload::PayloadFormat;
@@ -186,6 +187,9 @@ static TELIT_CONNECTION_STATE openxc::telitHE910::DSM_Power_Off(TelitDevice* dev
     TELIT_CONNECTION_STATE l_state = POWER_OFF;
 
     device->descriptor.type = openxc::interface::InterfaceType::TELIT;
+    device->descriptor.backpressurePolicy =
+            openxc::interface::BackpressurePolicy::DROP_OLDEST;
+    device->descriptor.maxBytesPerSecond = TELIT_MAX_BYTES_PER_SECOND;
         
     setPowerState(false);
     telitDevice = device;
@@ -1586,10 +1590,9 @@ void openxc::telitHE910::processSendQueue(TelitDevice* device) {
     // Thus the QUEUE is buffering data between successive iterations of firmwareLoop(), and 
     // our "sendBuffer" will buffer up multiple QUEUEs before flushing on a time and/or data watermark.
 
-    // pop bytes from the device send queue (stop short of sendBuffer overflow)
-    while(!QUEUE_EMPTY(uint8_t, &device->sendQueue) && (pSendBuffer - sendBuffer) < SEND_BUFFER_SIZE) {
-        *pSendBuffer++ = QUEUE_POP(uint8_t, &device->sendQueue);
-    }
+    // move bytes from the device send queue (stop short of sendBuffer overflow)
+    pSendBuffer += dequeueBytes(&device->sendQueue, pSendBuffer,
+            SEND_BUFFER_SIZE - (pSendBuffer - sendBuffer));
 
     return;
 
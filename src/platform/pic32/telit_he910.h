@@ -108,7 +108,7 @@ typedef struct {
     openxc::interface::InterfaceDescriptor descriptor;
     ModemConfigurationDescriptor config;
     openxc::interface::uart::UartDevice* uart;
-    QUEUE_TYPE(uint8_t) sendQueue;
+    openxc::util::messagepool::MessageQueue sendQueue;
     QUEUE_TYPE(uint8_t) receiveQueue;
     char deviceId[MAX_DEVICE_ID_LENGTH];
     char ICCID[MAX_ICCID_LENGTH];
@@ -129,6 +129,12 @@ typedef enum {
 
 #define SEND_BUFFER_SIZE 4096
 
+// The most data to queue for the cellular uplink per second, or 0 for no
+// limit - the uplink is metered, so this caps its cost.
+#ifndef TELIT_MAX_BYTES_PER_SECOND
+#define TELIT_MAX_BYTES_PER_SECOND 0
+#endif
+
 /*
  * INITIALIZATION FUNCTIONS
  *
@@ -9,4 +9,8 @@ unsigned long openxc::util::time::systemTimeMs() {
     return millis();
 }
 
+unsigned long openxc::util::time::systemTimeUs() {
+    return micros();
+}
+
 void openxc::util::time::initialize() { }
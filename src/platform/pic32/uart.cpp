@@ -22,6 +22,7 @@
  */
 #include "interface/uart.h"
 #include "util/bytebuffer.h"
+#include "util/messagepool.h"
 #include "util/log.h"
 #include "atcommander.h"
 #include "WProgram.h"
@@ -62,6 +63,7 @@ namespace gpio = openxc::gpio;
 
 using openxc::util::log::debug;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::messagepool::dequeueBytes;
 using openxc::util::time::uptimeMs;
 
 extern const AtCommanderPlatform AT_PLATFORM_RN42;
@@ -141,16 +143,11 @@ void openxc::interface::uart::initialize(UartDevice* device) {
 // The chipKIT version of this function is blocking. It will entirely flush the
 // send queue before returning.
 void openxc::interface::uart::processSendQueue(UartDevice* device) {
-    int byteCount = 0;
-    char sendBuffer[MAX_MESSAGE_SIZE];
-    while(!QUEUE_EMPTY(uint8_t, &device->sendQueue) &&
-                    byteCount < MAX_MESSAGE_SIZE) {
-        sendBuffer[byteCount++] = QUEUE_POP(uint8_t, &device->sendQueue);
-    }
-
+    uint8_t sendBuffer[MAX_MESSAGE_SIZE];
+    int byteCount = dequeueBytes(&device->sendQueue, sendBuffer,
+            MAX_MESSAGE_SIZE);
     if(byteCount > 0) {
-        ((HardwareSerial*)device->controller)->write((const uint8_t*)sendBuffer,
-                byteCount);
+        ((HardwareSerial*)device->controller)->write(sendBuffer, byteCount);
     }
 }
 
@@ -1,5 +1,6 @@
 #include "interface/usb.h"
 #include "util/bytebuffer.h"
+#include "util/messagepool.h"
 #include "util/log.h"
 #include "power.h"
 #include "config.h"
@@ -21,6 +22,10 @@ using openxc::interface::usb::UsbEndpoint;
 using openxc::interface::usb::UsbEndpointDirection;
 using openxc::gpio::GPIO_DIRECTION_INPUT;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::messagepool::dequeueBytes;
+using openxc::util::messagepool::queueEmpty;
+using openxc::util::messagepool::queuedBytes;
+using openxc::util::coalesce::coalescedLength;
 using openxc::config::getConfiguration;
 
 // This is a reference to the last packet read
@@ -150,14 +155,13 @@ void openxc::interface::usb::processSendQueue(UsbDevice* usbDevice) {
             return;
         }
 
-        while(usbDevice->configured &&
-                !QUEUE_EMPTY(uint8_t, &endpoint->queue)) {
-            int byteCount = 0;
-            while(!QUEUE_EMPTY(uint8_t, &endpoint->queue) &&
-                    byteCount < USB_SEND_BUFFER_SIZE) {
-                endpoint->sendBuffer[byteCount++] = QUEUE_POP(uint8_t,
-                        &endpoint->queue);
-            }
+        // Send whole packets, unless the bytes have waited too long for more
+        int byteCount;
+        while(usbDevice->configured && (byteCount = dequeueBytes(
+                    &endpoint->sendQueue, endpoint->sendBuffer,
+                    coalescedLength(&endpoint->coalescer,
+                        queuedBytes(&endpoint->sendQueue),
+                        USB_SEND_BUFFER_SIZE))) > 0) {
 
             int nextByteIndex = 0;
             while(nextByteIndex < byteCount) {
@@ -225,14 +229,14 @@ void openxc::interface::usb::read(UsbDevice* device, UsbEndpoint* endpoint,
         size_t length = device->device.HandleGetLength(
                 endpoint->hostToDeviceHandle);
         for(int i = 0; i < endpoint->size && i < length; i++) {
-            if(!QUEUE_PUSH(uint8_t, &endpoint->queue,
+            if(!QUEUE_PUSH(uint8_t, &device->receiveQueue,
                         endpoint->receiveBuffer[i])) {
                 debug("Dropped write from host -- queue is full");
             }
         }
 
         if(length > 0) {
-            while(processQueue(&endpoint->queue, callback)) {
+            while(processQueue(&device->receiveQueue, callback)) {
                 continue;
             }
         }
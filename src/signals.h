@@ -100,6 +100,29 @@ CanBus* getCanBuses() __attribute__((weak));
  */
 void decodeCanMessage(openxc::pipeline::Pipeline* pipeline, CanBus* bus, CanMessage* message) __attribute__((weak));
 
+/* Public: Return the decoder table for the active configuration, which the
+ * code generator emits in place of decodeCanMessage() when the firmware is
+ * built with TABLE_DRIVEN_DECODING. There's one row for each CAN message,
+ * sorted by bus address, format and ID, with the range of its signals in the
+ * array returned by getSignals() and its custom message handler, if any:
+ *
+ *      const can::read::MessageDecoder DECODERS[][MAX_DECODER_COUNT] = {
+ *          { // message set: example
+ *              {1, 0x128, CanMessageFormat::STANDARD, 0, 3, NULL},
+ *              {1, 0x204, CanMessageFormat::STANDARD, 3, 1, handleGear},
+ *          },
+ *      };
+ *
+ * Messages are passed through by the firmware when the bus has
+ * passthroughCanMessages set, so the table has no rows for that.
+ */
+const openxc::can::read::MessageDecoder* getMessageDecoders() __attribute__((weak));
+
+/* Public: Return the length of the array returned by getMessageDecoders(), or
+ * -1 if no decoder table was generated for the active configuration.
+ */
+int getMessageDecoderCount() __attribute__((weak));
+
 } // namespace signals
 } // namespace openxc
 
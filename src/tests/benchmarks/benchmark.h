@@ -0,0 +1,28 @@
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCHMARK_UNIT "cycles"
+#else
+#define BENCHMARK_UNIT "ns"
+#endif
+
+/* Public: Read a free-running counter for timing benchmarks - the CPU's cycle
+ * counter on x86, or a monotonic clock in nanoseconds everywhere else.
+ * BENCHMARK_UNIT is the name of the counter's unit.
+ */
+static inline uint64_t readBenchmarkCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+#endif // __BENCHMARK_H__
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "util/timer.h"
+#include "benchmark.h"
+
+using openxc::util::time::FrequencyClock;
+using openxc::util::time::initializeClock;
+using openxc::util::time::setFrequency;
+using openxc::util::time::conditionalTick;
+
+// The number of times to check each clock
+#define BENCHMARK_TICK_COUNT 10000000
+
+static unsigned long fakeTime;
+
+/* Private: A time function that moves forward 1ms every call, so clocks with
+ * a frequency tick every so often instead of never or always.
+ */
+static unsigned long advancingTime() {
+    return ++fakeTime;
+}
+
+/* Private: The check conditionalTick used before the period was cached,
+ * calculating a float period every call, for comparison. It's kept out of line
+ * like conditionalTick so the comparison is fair.
+ */
+static bool __attribute__((noinline)) floatPeriodTick(FrequencyClock* clock) {
+    float period = 1 / clock->frequency * 1000;
+    unsigned long now = clock->timeFunction();
+    float elapsedTime = clock->lastTick == 0 ? period : now - clock->lastTick;
+    bool tick = clock->frequency == 0 || elapsedTime >= period;
+    if(tick) {
+        clock->lastTick = now;
+    }
+    return tick;
+}
+
+/* Private: Check a clock with the given frequency BENCHMARK_TICK_COUNT times.
+ *
+ * Returns the average time per check, in BENCHMARK_UNIT.
+ */
+static double runBenchmark(float frequency, bool cachedPeriod) {
+    FrequencyClock clock;
+    initializeClock(&clock);
+    clock.timeFunction = advancingTime;
+    setFrequency(&clock, frequency);
+    fakeTime = 0;
+
+    volatile int ticks = 0;
+    uint64_t start = readBenchmarkCounter();
+    for(int i = 0; i < BENCHMARK_TICK_COUNT; i++) {
+        if(cachedPeriod ? conditionalTick(&clock) :
+                floatPeriodTick(&clock)) {
+            ++ticks;
+        }
+    }
+    uint64_t elapsed = readBenchmarkCounter() - start;
+    return (double)elapsed / BENCHMARK_TICK_COUNT;
+}
+
+int main(void) {
+    const float frequencies[] = {0, 10, 3};
+    printf("FrequencyClock checks, %d per clock:\n", BENCHMARK_TICK_COUNT);
+    for(unsigned int i = 0; i < sizeof(frequencies) / sizeof(frequencies[0]);
+            i++) {
+        printf("  %4.1f Hz: float period %6.1f %s, cached period %6.1f %s "
+                "per check\n", frequencies[i],
+                runBenchmark(frequencies[i], false), BENCHMARK_UNIT,
+                runBenchmark(frequencies[i], true), BENCHMARK_UNIT);
+    }
+    printf("The host has a floating point unit - the supported "
+            "microcontrollers don't,\nso the difference is much larger on "
+            "the device.\n");
+    return 0;
+}
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cJSON.h>
+#include "payload/json.h"
+#include "benchmark.h"
+
+namespace json = openxc::payload::json;
+
+// The number of messages to parse with each parser
+#define BENCHMARK_MESSAGE_COUNT 200000
+
+static unsigned long allocationCount;
+
+static void* countingMalloc(size_t size) {
+    ++allocationCount;
+    return malloc(size);
+}
+
+static const char* MESSAGES[] = {
+    "{\"bus\": 1, \"id\": 2015, \"data\": \"0x0201000000000000\"}",
+    "{\"command\": \"diagnostic_request\", \"action\": \"add\", \"request\": "
+        "{\"bus\": 1, \"id\": 2015, \"mode\": 1, \"pid\": 12, "
+        "\"frequency\": 1}}",
+    "{\"bus\": 2, \"id\": 1234, \"data\": \"0x1122334455667788\", "
+        "\"frame_format\": \"standard\"}",
+    "{\"command\": \"diagnostic_request\", \"action\": \"cancel\", "
+        "\"request\": {\"bus\": 1, \"id\": 2015, \"mode\": 34, "
+        "\"payload\": \"0xf190\"}}",
+};
+
+static size_t dehexlify(const char source[], uint8_t* destination,
+        size_t destinationLength) {
+    size_t i = 0;
+    if(strstr(source, "0x") != NULL) {
+        i += 2;
+    }
+
+    size_t byteIndex = 0;
+    for(; i < strlen(source) && byteIndex < destinationLength; i += 2) {
+        char bytestring[3] = {0};
+        strncpy(bytestring, &(source[i]), 2);
+        destination[byteIndex++] = strtoul(bytestring, NULL, 16);
+    }
+    return byteIndex;
+}
+
+/* Private: The parser used before commands were tokenized in place, building
+ * a cJSON tree from a copy of the payload, for comparison. It only handles the
+ * messages in this benchmark.
+ */
+static size_t cJSONTreeDeserialize(uint8_t payload[], size_t length,
+        openxc_VehicleMessage* message) {
+    size_t messageLength = strnlen((const char*)payload, length) + 1;
+    uint8_t messageBuffer[messageLength];
+    memcpy(messageBuffer, payload, messageLength);
+    cJSON* root = cJSON_Parse((const char*)messageBuffer);
+    if(root == NULL) {
+        return 0;
+    }
+
+    message->has_type = true;
+    cJSON* commandNameObject = cJSON_GetObjectItem(root, "command");
+    if(commandNameObject != NULL) {
+        message->type = openxc_VehicleMessage_Type_CONTROL_COMMAND;
+        message->has_control_command = true;
+        openxc_ControlCommand* command = &message->control_command;
+        if(!strncmp(commandNameObject->valuestring,
+                    json::DIAGNOSTIC_COMMAND_NAME,
+                    strlen(json::DIAGNOSTIC_COMMAND_NAME))) {
+            command->has_type = true;
+            command->type = openxc_ControlCommand_Type_DIAGNOSTIC;
+            command->has_diagnostic_request = true;
+            cJSON* action = cJSON_GetObjectItem(root, "action");
+            command->diagnostic_request.has_action = true;
+            command->diagnostic_request.action =
+                    !strcmp(action->valuestring, "add") ?
+                        openxc_DiagnosticControlCommand_Action_ADD :
+                        openxc_DiagnosticControlCommand_Action_CANCEL;
+
+            openxc_DiagnosticRequest* request =
+                    &command->diagnostic_request.request;
+            cJSON* requestObject = cJSON_GetObjectItem(root, "request");
+            cJSON* element = cJSON_GetObjectItem(requestObject, "bus");
+            request->has_bus = true;
+            request->bus = element->valueint;
+            element = cJSON_GetObjectItem(requestObject, "mode");
+            request->has_mode = true;
+            request->mode = element->valueint;
+            element = cJSON_GetObjectItem(requestObject, "id");
+            request->has_message_id = true;
+            request->message_id = element->valueint;
+            element = cJSON_GetObjectItem(requestObject, "pid");
+            if(element != NULL) {
+                request->has_pid = true;
+                request->pid = element->valueint;
+            }
+            element = cJSON_GetObjectItem(requestObject, "payload");
+            if(element != NULL) {
+                request->has_payload = true;
+                request->payload.size = dehexlify(element->valuestring,
+                        request->payload.bytes,
+                        sizeof(request->payload.bytes));
+            }
+            element = cJSON_GetObjectItem(requestObject, "frequency");
+            if(element != NULL) {
+                request->has_frequency = true;
+                request->frequency = element->valuedouble;
+            }
+        }
+    } else {
+        message->type = openxc_VehicleMessage_Type_CAN;
+        message->has_can_message = true;
+        openxc_CanMessage* canMessage = &message->can_message;
+        canMessage->has_id = true;
+        canMessage->id = cJSON_GetObjectItem(root, "id")->valueint;
+        canMessage->has_data = true;
+        canMessage->data.size = dehexlify(
+                cJSON_GetObjectItem(root, "data")->valuestring,
+                canMessage->data.bytes, sizeof(canMessage->data.bytes));
+        canMessage->has_bus = true;
+        canMessage->bus = cJSON_GetObjectItem(root, "bus")->valueint;
+        cJSON* element = cJSON_GetObjectItem(root,
+                json::FRAME_FORMAT_FIELD_NAME);
+        if(element != NULL) {
+            canMessage->has_frame_format = true;
+            canMessage->frame_format =
+                    !strcmp(element->valuestring,
+                        json::FRAME_FORMAT_STANDARD_NAME) ?
+                    openxc_CanMessage_FrameFormat_STANDARD :
+                    openxc_CanMessage_FrameFormat_EXTENDED;
+        }
+    }
+    cJSON_Delete(root);
+    return messageLength;
+}
+
+typedef size_t (*Deserializer)(uint8_t payload[], size_t length,
+        openxc_VehicleMessage* message);
+
+/* Private: Parse BENCHMARK_MESSAGE_COUNT messages with the parser.
+ *
+ * Returns the average time per message, in BENCHMARK_UNIT, and sets
+ * allocations to the average number of heap allocations per message.
+ */
+static double runBenchmark(Deserializer deserialize, double* allocations) {
+    const int messageCount = sizeof(MESSAGES) / sizeof(MESSAGES[0]);
+    allocationCount = 0;
+    uint64_t start = readBenchmarkCounter();
+    for(int i = 0; i < BENCHMARK_MESSAGE_COUNT; i++) {
+        const char* json = MESSAGES[i % messageCount];
+        openxc_VehicleMessage message = {0};
+        deserialize((uint8_t*)json, strlen(json) + 1, &message);
+    }
+    uint64_t elapsed = readBenchmarkCounter() - start;
+    *allocations = (double)allocationCount / BENCHMARK_MESSAGE_COUNT;
+    return (double)elapsed / BENCHMARK_MESSAGE_COUNT;
+}
+
+int main(void) {
+    cJSON_Hooks hooks = {countingMalloc, free};
+    cJSON_InitHooks(&hooks);
+
+    for(size_t i = 0; i < sizeof(MESSAGES) / sizeof(MESSAGES[0]); i++) {
+        openxc_VehicleMessage expected, actual;
+        memset(&expected, 0, sizeof(expected));
+        memset(&actual, 0, sizeof(actual));
+        cJSONTreeDeserialize((uint8_t*)MESSAGES[i], strlen(MESSAGES[i]) + 1,
+                &expected);
+        json::deserialize((uint8_t*)MESSAGES[i], strlen(MESSAGES[i]) + 1,
+                &actual);
+        if(memcmp(&expected, &actual, sizeof(expected))) {
+            printf("Parsed message differs: %s\n", MESSAGES[i]);
+            return 1;
+        }
+    }
+
+    double treeAllocations, tokenAllocations;
+    double treeTime = runBenchmark(cJSONTreeDeserialize, &treeAllocations);
+    double tokenTime = runBenchmark(json::deserialize, &tokenAllocations);
+    printf("JSON parsing, %d CAN writes and diagnostic requests:\n",
+            BENCHMARK_MESSAGE_COUNT);
+    printf("  cJSON tree:       %8.1f %s, %4.1f allocations per message\n",
+            treeTime, BENCHMARK_UNIT, treeAllocations);
+    printf("  in-place tokens:  %8.1f %s, %4.1f allocations per message\n",
+            tokenTime, BENCHMARK_UNIT, tokenAllocations);
+    return 0;
+}
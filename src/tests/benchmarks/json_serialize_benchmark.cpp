@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <cJSON.h>
+#include "payload/json.h"
+#include "benchmark.h"
+
+namespace json = openxc::payload::json;
+
+// The number of messages to serialize with each serializer
+#define BENCHMARK_MESSAGE_COUNT 200000
+
+#define PAYLOAD_BUFFER_SIZE 256
+
+static unsigned long allocationCount;
+
+static void* countingMalloc(size_t size) {
+    ++allocationCount;
+    return malloc(size);
+}
+
+/* Private: The serializer used before JSON was written directly into the
+ * payload buffer, building a cJSON tree and printing it, for comparison. It
+ * only handles the message types in this benchmark.
+ */
+static int cJSONTreeSerialize(openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length) {
+    cJSON* root = cJSON_CreateObject();
+    size_t finalLength = 0;
+    if(root != NULL) {
+        if(message->has_timestamp) {
+            cJSON_AddNumberToObject(root, "timestamp", message->timestamp);
+        }
+        if(message->type == openxc_VehicleMessage_Type_SIMPLE) {
+            cJSON_AddStringToObject(root, json::NAME_FIELD_NAME,
+                    message->simple_message.name);
+            openxc_DynamicField* field = &message->simple_message.value;
+            cJSON* value = NULL;
+            if(field->has_numeric_value) {
+                value = cJSON_CreateNumber(field->numeric_value);
+            } else if(field->has_boolean_value) {
+                value = cJSON_CreateBool(field->boolean_value);
+            } else if(field->has_string_value) {
+                value = cJSON_CreateString(field->string_value);
+            }
+            if(value != NULL) {
+                cJSON_AddItemToObject(root, json::VALUE_FIELD_NAME, value);
+            }
+        } else if(message->type == openxc_VehicleMessage_Type_CAN) {
+            cJSON_AddNumberToObject(root, json::BUS_FIELD_NAME,
+                    message->can_message.bus);
+            cJSON_AddNumberToObject(root, json::ID_FIELD_NAME,
+                    message->can_message.id);
+            char encodedData[67];
+            const char* maxAddress = encodedData + sizeof(encodedData);
+            char* encodedDataIndex = encodedData;
+            encodedDataIndex += sprintf(encodedDataIndex, "0x");
+            for(uint8_t i = 0; i < message->can_message.data.size &&
+                    encodedDataIndex < maxAddress; i++) {
+                encodedDataIndex += snprintf(encodedDataIndex,
+                        maxAddress - encodedDataIndex,
+                        "%02x", message->can_message.data.bytes[i]);
+            }
+            cJSON_AddStringToObject(root, json::DATA_FIELD_NAME, encodedData);
+        }
+
+        char* serialized = cJSON_PrintUnformatted(root);
+        if(serialized != NULL) {
+            finalLength = MIN(length, strlen(serialized) + 1);
+            memcpy(payload, serialized, finalLength);
+            free(serialized);
+        }
+        cJSON_Delete(root);
+    }
+    return finalLength;
+}
+
+/* Private: Serialize numbers with one decimal place, as for a signal with a
+ * factor of 0.1 or 0.5.
+ */
+static int fixedPrecisionSerialize(openxc_VehicleMessage* message,
+        uint8_t payload[], size_t length) {
+    return json::serialize(message, payload, length, 1);
+}
+
+/* Private: Returns true if two serialized messages have the same fields, with
+ * numbers compared by value rather than by how they're formatted.
+ */
+static bool sameFields(const uint8_t* expected, const uint8_t* actual) {
+    cJSON* expectedRoot = cJSON_Parse((const char*)expected);
+    cJSON* actualRoot = cJSON_Parse((const char*)actual);
+    bool same = expectedRoot != NULL && actualRoot != NULL;
+    cJSON* expectedField = same ? expectedRoot->child : NULL;
+    cJSON* actualField = same ? actualRoot->child : NULL;
+    for(; same && expectedField != NULL && actualField != NULL;
+            expectedField = expectedField->next,
+            actualField = actualField->next) {
+        same = !strcmp(expectedField->string, actualField->string) &&
+            expectedField->type == actualField->type &&
+            expectedField->valuedouble == actualField->valuedouble &&
+            (expectedField->valuestring == NULL ||
+                !strcmp(expectedField->valuestring,
+                    actualField->valuestring));
+    }
+    same = same && expectedField == NULL && actualField == NULL;
+    cJSON_Delete(expectedRoot);
+    cJSON_Delete(actualRoot);
+    return same;
+}
+
+typedef int (*Serializer)(openxc_VehicleMessage* message, uint8_t payload[],
+        size_t length);
+
+/* Private: Build the messages to serialize - a mix of numeric, boolean and
+ * string signals and raw CAN messages, like a typical vehicle's output.
+ */
+static void initializeMessages(openxc_VehicleMessage* messages, int count) {
+    memset(messages, 0, sizeof(openxc_VehicleMessage) * count);
+    for(int i = 0; i < count; i++) {
+        openxc_VehicleMessage* message = &messages[i];
+        message->has_type = true;
+        if(i % 4 == 3) {
+            message->type = openxc_VehicleMessage_Type_CAN;
+            message->has_can_message = true;
+            message->can_message.has_bus = true;
+            message->can_message.bus = 1;
+            message->can_message.has_id = true;
+            message->can_message.id = 0x100 + i;
+            message->can_message.has_data = true;
+            message->can_message.data.size = 8;
+            for(int j = 0; j < 8; j++) {
+                message->can_message.data.bytes[j] = i * 31 + j;
+            }
+            continue;
+        }
+
+        message->type = openxc_VehicleMessage_Type_SIMPLE;
+        message->has_simple_message = true;
+        message->simple_message.has_name = true;
+        message->simple_message.has_value = true;
+        openxc_DynamicField* value = &message->simple_message.value;
+        value->has_type = true;
+        if(i % 4 == 0) {
+            strcpy(message->simple_message.name, "vehicle_speed");
+            value->type = openxc_DynamicField_Type_NUM;
+            value->has_numeric_value = true;
+            value->numeric_value = 42.5;
+        } else if(i % 4 == 1) {
+            strcpy(message->simple_message.name, "engine_speed");
+            value->type = openxc_DynamicField_Type_NUM;
+            value->has_numeric_value = true;
+            value->numeric_value = 2150;
+        } else if(i % 8 == 2) {
+            strcpy(message->simple_message.name, "brake_pedal_status");
+            value->type = openxc_DynamicField_Type_BOOL;
+            value->has_boolean_value = true;
+            value->boolean_value = true;
+        } else {
+            strcpy(message->simple_message.name, "transmission_gear_position");
+            value->type = openxc_DynamicField_Type_STRING;
+            value->has_string_value = true;
+            strcpy(value->string_value, "third");
+        }
+    }
+}
+
+/* Private: Serialize BENCHMARK_MESSAGE_COUNT messages with the serializer.
+ *
+ * Returns the average time per message, in BENCHMARK_UNIT, and sets
+ * allocations to the average number of heap allocations per message and bytes
+ * to the average size of a serialized message.
+ */
+static double runBenchmark(Serializer serialize,
+        openxc_VehicleMessage* messages, int messageCount,
+        double* allocations, double* bytes) {
+    uint8_t payload[PAYLOAD_BUFFER_SIZE];
+    unsigned long totalBytes = 0;
+    allocationCount = 0;
+    uint64_t start = readBenchmarkCounter();
+    for(int i = 0; i < BENCHMARK_MESSAGE_COUNT; i++) {
+        totalBytes += serialize(&messages[i % messageCount], payload,
+                sizeof(payload));
+    }
+    uint64_t elapsed = readBenchmarkCounter() - start;
+    *allocations = (double)allocationCount / BENCHMARK_MESSAGE_COUNT;
+    *bytes = (double)totalBytes / BENCHMARK_MESSAGE_COUNT;
+    return (double)elapsed / BENCHMARK_MESSAGE_COUNT;
+}
+
+int main(void) {
+    cJSON_Hooks hooks = {countingMalloc, free};
+    cJSON_InitHooks(&hooks);
+
+    openxc_VehicleMessage messages[16];
+    initializeMessages(messages, 16);
+    for(int i = 0; i < 16; i++) {
+        uint8_t expected[PAYLOAD_BUFFER_SIZE];
+        uint8_t actual[PAYLOAD_BUFFER_SIZE];
+        cJSONTreeSerialize(&messages[i], expected, sizeof(expected));
+        json::serialize(&messages[i], actual, sizeof(actual));
+        if(!sameFields(expected, actual)) {
+            printf("Serialized JSON differs: %s != %s\n", expected, actual);
+            return 1;
+        }
+    }
+
+    double treeAllocations, directAllocations, fixedAllocations;
+    double treeBytes, directBytes, fixedBytes;
+    double treeTime = runBenchmark(cJSONTreeSerialize, messages, 16,
+            &treeAllocations, &treeBytes);
+    double directTime = runBenchmark(json::serialize, messages, 16,
+            &directAllocations, &directBytes);
+    double fixedTime = runBenchmark(fixedPrecisionSerialize, messages, 16,
+            &fixedAllocations, &fixedBytes);
+    printf("JSON serialization, %d messages:\n", BENCHMARK_MESSAGE_COUNT);
+    printf("  cJSON tree:      %8.1f %s, %4.1f allocations, %5.1f bytes "
+            "per message\n", treeTime, BENCHMARK_UNIT, treeAllocations,
+            treeBytes);
+    printf("  direct write:    %8.1f %s, %4.1f allocations, %5.1f bytes "
+            "per message\n", directTime, BENCHMARK_UNIT, directAllocations,
+            directBytes);
+    printf("  1 decimal place: %8.1f %s, %4.1f allocations, %5.1f bytes "
+            "per message\n", fixedTime, BENCHMARK_UNIT, fixedAllocations,
+            fixedBytes);
+    return 0;
+}
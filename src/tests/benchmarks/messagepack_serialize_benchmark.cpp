@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <cmp.h>
+#include "payload/messagepack.h"
+#include "benchmark.h"
+
+namespace messagepack = openxc::payload::messagepack;
+
+// The number of messages to serialize with each serializer
+#define BENCHMARK_MESSAGE_COUNT 200000
+
+#define PAYLOAD_BUFFER_SIZE 256
+
+/* Private: A buffer for cmp to read from or write to.
+ */
+typedef struct {
+    uint8_t* buffer;
+    size_t length;
+    size_t position;
+} CmpBuffer;
+
+static size_t writeCmpBuffer(cmp_ctx_t* ctx, const void* data, size_t count) {
+    CmpBuffer* buffer = (CmpBuffer*)ctx->buf;
+    if(buffer->position + count > buffer->length) {
+        return 0;
+    }
+    memcpy(buffer->buffer + buffer->position, data, count);
+    buffer->position += count;
+    return count;
+}
+
+static bool readCmpBuffer(cmp_ctx_t* ctx, void* data, size_t count) {
+    CmpBuffer* buffer = (CmpBuffer*)ctx->buf;
+    if(buffer->position + count > buffer->length) {
+        return false;
+    }
+    memcpy(data, buffer->buffer + buffer->position, count);
+    buffer->position += count;
+    return true;
+}
+
+static void writeCmpString(cmp_ctx_t* ctx, const char* value) {
+    cmp_write_str(ctx, value, strlen(value));
+}
+
+/* Private: The serializer used before MessagePack was encoded directly into
+ * the payload buffer, writing every key and number through cmp into a stack
+ * buffer and copying it out, for comparison. It only handles the message
+ * types in this benchmark.
+ */
+static int cmpSerialize(openxc_VehicleMessage* message, uint8_t payload[],
+        size_t length) {
+    uint8_t messagePackBuffer[128];
+    CmpBuffer buffer = {messagePackBuffer, sizeof(messagePackBuffer), 0};
+    cmp_ctx_t cmp;
+    cmp_init(&cmp, &buffer, readCmpBuffer, writeCmpBuffer);
+
+    cmp_write_map(&cmp, 2);
+    uint8_t fieldCount = 0;
+    if(message->has_timestamp) {
+        writeCmpString(&cmp, "timestamp");
+        cmp_write_u64(&cmp, message->timestamp);
+        ++fieldCount;
+    }
+    if(message->type == openxc_VehicleMessage_Type_SIMPLE) {
+        writeCmpString(&cmp, messagepack::NAME_FIELD_NAME);
+        writeCmpString(&cmp, message->simple_message.name);
+        ++fieldCount;
+        openxc_DynamicField* field = &message->simple_message.value;
+        writeCmpString(&cmp, messagepack::VALUE_FIELD_NAME);
+        if(field->has_numeric_value) {
+            cmp_write_double(&cmp, field->numeric_value);
+        } else if(field->has_boolean_value) {
+            cmp_write_bool(&cmp, field->boolean_value);
+        } else if(field->has_string_value) {
+            writeCmpString(&cmp, field->string_value);
+        }
+        ++fieldCount;
+    } else if(message->type == openxc_VehicleMessage_Type_CAN) {
+        writeCmpString(&cmp, messagepack::BUS_FIELD_NAME);
+        cmp_write_u8(&cmp, message->can_message.bus);
+        writeCmpString(&cmp, messagepack::ID_FIELD_NAME);
+        cmp_write_uint(&cmp, message->can_message.id);
+        writeCmpString(&cmp, messagepack::DATA_FIELD_NAME);
+        cmp_write_bin(&cmp, message->can_message.data.bytes,
+                message->can_message.data.size);
+        fieldCount += 3;
+    }
+
+    messagePackBuffer[0] = 0x80 | fieldCount;
+    if(buffer.position > length) {
+        return 0;
+    }
+    memcpy(payload, messagePackBuffer, buffer.position);
+    return buffer.position;
+}
+
+/* Private: Decode a map of MessagePack into text, with every number printed
+ * the same way whatever its encoding, so the output of the two serializers
+ * can be compared.
+ *
+ * Returns true if the payload was a complete map of supported types.
+ */
+static bool describe(uint8_t payload[], size_t length, char* description,
+        size_t descriptionLength) {
+    CmpBuffer buffer = {payload, length, 0};
+    cmp_ctx_t cmp;
+    cmp_init(&cmp, &buffer, readCmpBuffer, writeCmpBuffer);
+
+    uint32_t fieldCount;
+    if(!cmp_read_map(&cmp, &fieldCount)) {
+        return false;
+    }
+
+    size_t written = 0;
+    description[0] = '\0';
+    for(uint32_t i = 0; i < fieldCount * 2; i++) {
+        cmp_object_t object;
+        if(!cmp_read_object(&cmp, &object)) {
+            return false;
+        }
+
+        char value[80];
+        switch(object.type) {
+        case CMP_TYPE_POSITIVE_FIXNUM:
+        case CMP_TYPE_UINT8:
+            snprintf(value, sizeof(value), "%u", object.as.u8);
+            break;
+        case CMP_TYPE_UINT16:
+            snprintf(value, sizeof(value), "%u", object.as.u16);
+            break;
+        case CMP_TYPE_UINT32:
+            snprintf(value, sizeof(value), "%u", object.as.u32);
+            break;
+        case CMP_TYPE_UINT64:
+            snprintf(value, sizeof(value), "%llu",
+                    (unsigned long long)object.as.u64);
+            break;
+        case CMP_TYPE_FLOAT:
+            snprintf(value, sizeof(value), "%.17g", object.as.flt);
+            break;
+        case CMP_TYPE_DOUBLE:
+            snprintf(value, sizeof(value), "%.17g", object.as.dbl);
+            break;
+        case CMP_TYPE_BOOLEAN:
+            snprintf(value, sizeof(value), "%s",
+                    object.as.boolean ? "true" : "false");
+            break;
+        case CMP_TYPE_FIXSTR:
+        case CMP_TYPE_STR8:
+        case CMP_TYPE_STR16:
+            if(object.as.str_size >= sizeof(value) ||
+                    !readCmpBuffer(&cmp, value, object.as.str_size)) {
+                return false;
+            }
+            value[object.as.str_size] = '\0';
+            break;
+        case CMP_TYPE_BIN8:
+        case CMP_TYPE_BIN16: {
+            uint8_t bytes[32];
+            if(object.as.bin_size > sizeof(bytes) ||
+                    !readCmpBuffer(&cmp, bytes, object.as.bin_size)) {
+                return false;
+            }
+            value[0] = '\0';
+            for(uint32_t j = 0; j < object.as.bin_size; j++) {
+                snprintf(value + j * 2, sizeof(value) - j * 2, "%02x",
+                        bytes[j]);
+            }
+            break;
+        }
+        default:
+            return false;
+        }
+
+        written += snprintf(description + written,
+                descriptionLength - written, "%s%c", value,
+                i % 2 == 0 ? '=' : ' ');
+        if(written >= descriptionLength) {
+            return false;
+        }
+    }
+    return buffer.position == length;
+}
+
+typedef int (*Serializer)(openxc_VehicleMessage* message, uint8_t payload[],
+        size_t length);
+
+/* Private: Build the messages to serialize - a mix of numeric, boolean and
+ * string signals and raw CAN messages, like a typical vehicle's output.
+ */
+static void initializeMessages(openxc_VehicleMessage* messages, int count) {
+    memset(messages, 0, sizeof(openxc_VehicleMessage) * count);
+    for(int i = 0; i < count; i++) {
+        openxc_VehicleMessage* message = &messages[i];
+        message->has_type = true;
+        message->has_timestamp = i % 2 == 0;
+        message->timestamp = 1332794184319ULL + i;
+        if(i % 4 == 3) {
+            message->type = openxc_VehicleMessage_Type_CAN;
+            message->has_can_message = true;
+            message->can_message.has_bus = true;
+            message->can_message.bus = 1;
+            message->can_message.has_id = true;
+            message->can_message.id = 0x100 + i;
+            message->can_message.has_data = true;
+            message->can_message.data.size = 8;
+            for(int j = 0; j < 8; j++) {
+                message->can_message.data.bytes[j] = i * 31 + j;
+            }
+            continue;
+        }
+
+        message->type = openxc_VehicleMessage_Type_SIMPLE;
+        message->has_simple_message = true;
+        message->simple_message.has_name = true;
+        message->simple_message.has_value = true;
+        openxc_DynamicField* value = &message->simple_message.value;
+        value->has_type = true;
+        if(i % 4 == 0) {
+            strcpy(message->simple_message.name, "vehicle_speed");
+            value->type = openxc_DynamicField_Type_NUM;
+            value->has_numeric_value = true;
+            value->numeric_value = 42.5;
+        } else if(i % 4 == 1) {
+            strcpy(message->simple_message.name, "engine_speed");
+            value->type = openxc_DynamicField_Type_NUM;
+            value->has_numeric_value = true;
+            value->numeric_value = 2150;
+        } else if(i % 8 == 2) {
+            strcpy(message->simple_message.name, "brake_pedal_status");
+            value->type = openxc_DynamicField_Type_BOOL;
+            value->has_boolean_value = true;
+            value->boolean_value = true;
+        } else {
+            strcpy(message->simple_message.name, "fuel_consumed_since_restart");
+            value->type = openxc_DynamicField_Type_NUM;
+            value->has_numeric_value = true;
+            value->numeric_value = 0.123456;
+        }
+    }
+}
+
+/* Private: Serialize BENCHMARK_MESSAGE_COUNT messages with the serializer.
+ *
+ * Returns the average time per message, in BENCHMARK_UNIT, and sets bytes to
+ * the average size of a serialized message.
+ */
+static double runBenchmark(Serializer serialize,
+        openxc_VehicleMessage* messages, int messageCount, double* bytes) {
+    uint8_t payload[PAYLOAD_BUFFER_SIZE];
+    unsigned long totalBytes = 0;
+    uint64_t start = readBenchmarkCounter();
+    for(int i = 0; i < BENCHMARK_MESSAGE_COUNT; i++) {
+        totalBytes += serialize(&messages[i % messageCount], payload,
+                sizeof(payload));
+    }
+    uint64_t elapsed = readBenchmarkCounter() - start;
+    *bytes = (double)totalBytes / BENCHMARK_MESSAGE_COUNT;
+    return (double)elapsed / BENCHMARK_MESSAGE_COUNT;
+}
+
+int main(void) {
+    openxc_VehicleMessage messages[16];
+    initializeMessages(messages, 16);
+    for(int i = 0; i < 16; i++) {
+        uint8_t expected[PAYLOAD_BUFFER_SIZE];
+        uint8_t actual[PAYLOAD_BUFFER_SIZE];
+        char expectedDescription[256];
+        char actualDescription[256];
+        int expectedLength = cmpSerialize(&messages[i], expected,
+                sizeof(expected));
+        int actualLength = messagepack::serialize(&messages[i], actual,
+                sizeof(actual));
+        if(!describe(expected, expectedLength, expectedDescription,
+                    sizeof(expectedDescription)) ||
+                !describe(actual, actualLength, actualDescription,
+                    sizeof(actualDescription)) ||
+                strcmp(expectedDescription, actualDescription)) {
+            printf("Serialized MessagePack differs: %s != %s\n",
+                    expectedDescription, actualDescription);
+            return 1;
+        }
+    }
+
+    double cmpBytes, directBytes;
+    double cmpTime = runBenchmark(cmpSerialize, messages, 16, &cmpBytes);
+    double directTime = runBenchmark(messagepack::serialize, messages, 16,
+            &directBytes);
+    printf("MessagePack serialization, %d messages:\n",
+            BENCHMARK_MESSAGE_COUNT);
+    printf("  cmp:          %8.1f %s, %5.1f bytes per message\n",
+            cmpTime, BENCHMARK_UNIT, cmpBytes);
+    printf("  direct write: %8.1f %s, %5.1f bytes per message\n",
+            directTime, BENCHMARK_UNIT, directBytes);
+    return 0;
+}
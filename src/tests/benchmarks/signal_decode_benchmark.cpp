@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "signals.h"
+#include "can/canread.h"
+#include "config.h"
+#include "benchmark.h"
+
+namespace can = openxc::can;
+
+using openxc::pipeline::Pipeline;
+using openxc::signals::getSignalCount;
+using openxc::signals::getSignals;
+using openxc::signals::getMessageCount;
+using openxc::signals::getMessages;
+using openxc::config::getConfiguration;
+
+extern void initializeVehicleInterface();
+
+// The number of CAN messages to decode every signal from, for each decoder
+#define BENCHMARK_MESSAGE_COUNT 200000
+
+// Real signals repeat the same value most of the time - change the data every
+// this many messages.
+#define MESSAGES_PER_VALUE_CHANGE 16
+
+typedef void (*SignalTranslator)(CanSignal* signal, const CanMessage* message,
+        CanSignal* signals, int signalCount, Pipeline* pipeline);
+
+static void resetSignals() {
+    for(int i = 0; i < getSignalCount(); i++) {
+        getSignals()[i].received = false;
+        getSignals()[i].sendSame = false;
+        getSignals()[i].frequencyClock = {0};
+        getSignals()[i].decoder = NULL;
+    }
+    for(int i = 0; i < getMessageCount(); i++) {
+        getMessages()[i].changesTracked = false;
+    }
+}
+
+/* Private: Decode every signal from a stream of CAN messages with the given
+ * translator, optionally tracking which bits changed in each message first like
+ * the firmware does.
+ *
+ * Returns the average time spent per signal, in BENCHMARK_UNIT.
+ */
+static double runBenchmark(SignalTranslator translate, bool trackChanges) {
+    resetSignals();
+    CanMessage message = {0};
+    uint64_t start = readBenchmarkCounter();
+    for(int i = 0; i < BENCHMARK_MESSAGE_COUNT; i++) {
+        uint8_t value = i / MESSAGES_PER_VALUE_CHANGE;
+        memset(message.data, value, CAN_MESSAGE_SIZE);
+        if(trackChanges) {
+            for(int j = 0; j < getMessageCount(); j++) {
+                can::read::trackMessageChanges(&getMessages()[j], &message);
+            }
+        }
+        for(int j = 0; j < getSignalCount(); j++) {
+            translate(&getSignals()[j], &message, getSignals(),
+                    getSignalCount(), &getConfiguration()->pipeline);
+        }
+    }
+    uint64_t elapsed = readBenchmarkCounter() - start;
+    return (double)elapsed / BENCHMARK_MESSAGE_COUNT / getSignalCount();
+}
+
+int main(void) {
+    initializeVehicleInterface();
+
+    // translateSignal uses floats unless built with INTEGER_SIGNAL_DECODING=1
+    double floatTime = runBenchmark(can::read::translateSignal, false);
+    double integerTime = runBenchmark(can::read::translateSignalRaw, false);
+    double trackedFloatTime = runBenchmark(can::read::translateSignal, true);
+    double trackedIntegerTime = runBenchmark(can::read::translateSignalRaw,
+            true);
+    printf("Signal decoding, %d signals, value changes every %d messages:\n",
+            getSignalCount(), MESSAGES_PER_VALUE_CHANGE);
+    printf("  translateSignal:                    %8.1f %s per signal\n",
+            floatTime, BENCHMARK_UNIT);
+    printf("  translateSignalRaw:                 %8.1f %s per signal\n",
+            integerTime, BENCHMARK_UNIT);
+    printf("  translateSignal, tracked changes:   %8.1f %s per signal\n",
+            trackedFloatTime, BENCHMARK_UNIT);
+    printf("  translateSignalRaw, tracked changes:%8.1f %s per signal\n",
+            trackedIntegerTime, BENCHMARK_UNIT);
+    return 0;
+}
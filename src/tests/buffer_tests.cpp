@@ -4,6 +4,12 @@
 
 using openxc::util::bytebuffer::conditionalEnqueue;
 using openxc::util::bytebuffer::processQueue;
+using openxc::util::bytebuffer::enqueueBytes;
+using openxc::util::bytebuffer::readableSpans;
+using openxc::util::bytebuffer::peekBytes;
+using openxc::util::bytebuffer::discardBytes;
+using openxc::util::bytebuffer::dequeueBytes;
+using openxc::util::bytebuffer::ByteSpan;
 
 QUEUE_TYPE(uint8_t) queue;
 bool called;
@@ -158,6 +164,93 @@ START_TEST (test_enqueue_no_room_for_crlf)
 }
 END_TEST
 
+/* Move the queue's read and write positions to just before the end of its
+ * storage, so the next block of bytes added wraps around.
+ */
+static void moveToEnd(int bytesBeforeEnd) {
+    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) - bytesBeforeEnd + 1; i++) {
+        QUEUE_PUSH(uint8_t, &queue, 0);
+        QUEUE_POP(uint8_t, &queue);
+    }
+}
+
+START_TEST (test_enqueue_bytes)
+{
+    uint8_t message[] = {1, 2, 3, 4};
+    fail_unless(enqueueBytes(&queue, message, sizeof(message)));
+    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), 4);
+    for(size_t i = 0; i < sizeof(message); i++) {
+        ck_assert_int_eq(QUEUE_POP(uint8_t, &queue), message[i]);
+    }
+}
+END_TEST
+
+START_TEST (test_enqueue_bytes_wraps)
+{
+    moveToEnd(2);
+    uint8_t message[] = {1, 2, 3, 4, 5};
+    fail_unless(enqueueBytes(&queue, message, sizeof(message)));
+
+    ByteSpan spans[2];
+    ck_assert_int_eq(readableSpans(&queue, spans), 2);
+    ck_assert_int_eq(spans[0].length + spans[1].length, 5);
+    ck_assert_int_eq(spans[0].data[0], 1);
+    ck_assert_int_eq(spans[1].data[spans[1].length - 1], 5);
+
+    uint8_t copy[sizeof(message)];
+    ck_assert_int_eq(peekBytes(&queue, copy, sizeof(copy)), 5);
+    fail_if(memcmp(copy, message, sizeof(message)));
+    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), 5);
+}
+END_TEST
+
+START_TEST (test_enqueue_bytes_no_room)
+{
+    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) - 2; i++) {
+        QUEUE_PUSH(uint8_t, &queue, 128);
+    }
+
+    uint8_t message[] = {1, 2, 3};
+    fail_if(enqueueBytes(&queue, message, sizeof(message)));
+    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue),
+            QUEUE_MAX_LENGTH(uint8_t) - 2);
+    fail_if(enqueueBytes(NULL, message, sizeof(message)));
+}
+END_TEST
+
+START_TEST (test_readable_spans_empty)
+{
+    ByteSpan spans[2];
+    ck_assert_int_eq(readableSpans(&queue, spans), 0);
+}
+END_TEST
+
+START_TEST (test_dequeue_bytes_partial)
+{
+    moveToEnd(1);
+    uint8_t message[] = {1, 2, 3, 4};
+    enqueueBytes(&queue, message, sizeof(message));
+
+    uint8_t buffer[3];
+    ck_assert_int_eq(dequeueBytes(&queue, buffer, sizeof(buffer)), 3);
+    ck_assert_int_eq(buffer[0], 1);
+    ck_assert_int_eq(buffer[2], 3);
+    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), 1);
+    ck_assert_int_eq(QUEUE_PEEK(uint8_t, &queue), 4);
+}
+END_TEST
+
+START_TEST (test_discard_more_than_queued)
+{
+    uint8_t message[] = {1, 2, 3};
+    enqueueBytes(&queue, message, sizeof(message));
+    discardBytes(&queue, 10);
+    fail_unless(QUEUE_EMPTY(uint8_t, &queue));
+    fail_unless(enqueueBytes(&queue, message, sizeof(message)));
+    ck_assert_int_eq(QUEUE_LENGTH(uint8_t, &queue), 3);
+}
+END_TEST
+
 Suite* buffersSuite(void) {
     Suite* s = suite_create("buffers");
     TCase *tc_core = tcase_create("core");
@@ -180,6 +273,16 @@ Suite* buffersSuite(void) {
     tcase_add_test(tc_conditional, test_enqueue_just_enough_room);
     suite_add_tcase(s, tc_conditional);
 
+    TCase *tc_spans = tcase_create("spans");
+    tcase_add_checked_fixture (tc_spans, setup, teardown);
+    tcase_add_test(tc_spans, test_enqueue_bytes);
+    tcase_add_test(tc_spans, test_enqueue_bytes_wraps);
+    tcase_add_test(tc_spans, test_enqueue_bytes_no_room);
+    tcase_add_test(tc_spans, test_readable_spans_empty);
+    tcase_add_test(tc_spans, test_dequeue_bytes_partial);
+    tcase_add_test(tc_spans, test_discard_more_than_queued);
+    suite_add_tcase(s, tc_spans);
+
     return s;
 }
 
@@ -0,0 +1,186 @@
+#include <check.h>
+#include <stdint.h>
+#include "signals.h"
+#include "can/canutil.h"
+#include "can/canfilter.h"
+
+namespace can = openxc::can;
+
+using openxc::can::addAcceptanceFilter;
+using openxc::can::filter::AcceptanceFilterRange;
+using openxc::can::filter::AcceptanceFilterMask;
+using openxc::can::filter::compileRanges;
+using openxc::can::filter::compileMasks;
+using openxc::can::filter::fullFilterMask;
+using openxc::signals::getCanBusCount;
+using openxc::signals::getCanBuses;
+
+CanBus* bus;
+
+void setup() {
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::initializeCommon(&getCanBuses()[i]);
+    }
+    bus = &getCanBuses()[0];
+}
+
+void teardown() {
+    for(int i = 0; i < getCanBusCount(); i++) {
+        can::destroy(&getCanBuses()[i]);
+    }
+}
+
+static void addFilter(uint32_t id, CanMessageFormat format) {
+    ck_assert(addAcceptanceFilter(bus, id, format, getCanBuses(),
+                getCanBusCount()));
+}
+
+START_TEST (test_ranges_empty)
+{
+    AcceptanceFilterRange ranges[4];
+    ck_assert_int_eq(compileRanges(bus, ranges, 4), 0);
+}
+END_TEST
+
+START_TEST (test_ranges_consecutive_ids)
+{
+    addFilter(0x102, CanMessageFormat::STANDARD);
+    addFilter(0x100, CanMessageFormat::STANDARD);
+    addFilter(0x101, CanMessageFormat::STANDARD);
+    addFilter(0x200, CanMessageFormat::STANDARD);
+
+    AcceptanceFilterRange ranges[4];
+    ck_assert_int_eq(compileRanges(bus, ranges, 4), 2);
+    ck_assert_int_eq(ranges[0].lower, 0x100);
+    ck_assert_int_eq(ranges[0].upper, 0x102);
+    ck_assert_int_eq(ranges[1].lower, 0x200);
+    ck_assert_int_eq(ranges[1].upper, 0x200);
+}
+END_TEST
+
+START_TEST (test_ranges_merge_smallest_gap)
+{
+    addFilter(0x100, CanMessageFormat::STANDARD);
+    addFilter(0x110, CanMessageFormat::STANDARD);
+    addFilter(0x400, CanMessageFormat::STANDARD);
+    addFilter(0x7e8, CanMessageFormat::EXTENDED);
+
+    AcceptanceFilterRange ranges[3];
+    ck_assert_int_eq(compileRanges(bus, ranges, 3), 3);
+    ck_assert_int_eq(ranges[0].lower, 0x100);
+    ck_assert_int_eq(ranges[0].upper, 0x110);
+    ck_assert(ranges[0].format == CanMessageFormat::STANDARD);
+    ck_assert_int_eq(ranges[1].lower, 0x400);
+    ck_assert_int_eq(ranges[1].upper, 0x400);
+    ck_assert_int_eq(ranges[2].lower, 0x7e8);
+    ck_assert(ranges[2].format == CanMessageFormat::EXTENDED);
+}
+END_TEST
+
+START_TEST (test_ranges_formats_never_merged)
+{
+    addFilter(0x100, CanMessageFormat::STANDARD);
+    addFilter(0x101, CanMessageFormat::EXTENDED);
+
+    AcceptanceFilterRange ranges[2];
+    ck_assert_int_eq(compileRanges(bus, ranges, 1), -1);
+    ck_assert_int_eq(compileRanges(bus, ranges, 2), 2);
+}
+END_TEST
+
+START_TEST (test_ranges_more_than_hardware_table)
+{
+    for(int i = 0; i < MAX_ACCEPTANCE_FILTERS; i++) {
+        addFilter(0x10 * i, CanMessageFormat::STANDARD);
+    }
+
+    AcceptanceFilterRange ranges[8];
+    int rangeCount = compileRanges(bus, ranges, 8);
+    ck_assert_int_eq(rangeCount, 8);
+    ck_assert_int_eq(ranges[0].lower, 0);
+    ck_assert_int_eq(ranges[rangeCount - 1].upper,
+            0x10 * (MAX_ACCEPTANCE_FILTERS - 1));
+    for(int i = 1; i < rangeCount; i++) {
+        ck_assert(ranges[i].lower > ranges[i - 1].upper);
+    }
+}
+END_TEST
+
+START_TEST (test_masks_exact_when_they_fit)
+{
+    addFilter(0x100, CanMessageFormat::STANDARD);
+    addFilter(0x18daf110, CanMessageFormat::EXTENDED);
+
+    AcceptanceFilterMask masks[4];
+    ck_assert_int_eq(compileMasks(bus, masks, 4), 2);
+    ck_assert_int_eq(masks[0].value, 0x100);
+    ck_assert_int_eq(masks[0].mask, 0x7ff);
+    ck_assert(masks[0].format == CanMessageFormat::STANDARD);
+    ck_assert_int_eq(masks[1].value, 0x18daf110);
+    ck_assert_int_eq(masks[1].mask, 0x1fffffff);
+    ck_assert(masks[1].format == CanMessageFormat::EXTENDED);
+}
+END_TEST
+
+START_TEST (test_masks_grouped)
+{
+    for(int i = 0; i < 8; i++) {
+        addFilter(0x7e8 + i, CanMessageFormat::STANDARD);
+    }
+    addFilter(0x100, CanMessageFormat::STANDARD);
+
+    AcceptanceFilterMask masks[2];
+    ck_assert_int_eq(compileMasks(bus, masks, 2), 2);
+    ck_assert_int_eq(masks[0].value, 0x100);
+    ck_assert_int_eq(masks[0].mask, fullFilterMask(CanMessageFormat::STANDARD));
+    ck_assert_int_eq(masks[1].value, 0x7e8);
+    ck_assert_int_eq(masks[1].mask, 0x7f8);
+    for(int i = 0; i < 8; i++) {
+        ck_assert_int_eq((0x7e8 + i) & masks[1].mask,
+                masks[1].value & masks[1].mask);
+    }
+}
+END_TEST
+
+START_TEST (test_masks_cant_fit)
+{
+    addFilter(0x100, CanMessageFormat::STANDARD);
+    addFilter(0x100, CanMessageFormat::EXTENDED);
+
+    AcceptanceFilterMask masks[1];
+    ck_assert_int_eq(compileMasks(bus, masks, 1), -1);
+}
+END_TEST
+
+Suite* canfilterSuite(void) {
+    Suite* s = suite_create("canfilter");
+    TCase *tc_ranges = tcase_create("ranges");
+    tcase_add_checked_fixture(tc_ranges, setup, teardown);
+    tcase_add_test(tc_ranges, test_ranges_empty);
+    tcase_add_test(tc_ranges, test_ranges_consecutive_ids);
+    tcase_add_test(tc_ranges, test_ranges_merge_smallest_gap);
+    tcase_add_test(tc_ranges, test_ranges_formats_never_merged);
+    tcase_add_test(tc_ranges, test_ranges_more_than_hardware_table);
+    suite_add_tcase(s, tc_ranges);
+
+    TCase *tc_masks = tcase_create("masks");
+    tcase_add_checked_fixture(tc_masks, setup, teardown);
+    tcase_add_test(tc_masks, test_masks_exact_when_they_fit);
+    tcase_add_test(tc_masks, test_masks_grouped);
+    tcase_add_test(tc_masks, test_masks_cant_fit);
+    suite_add_tcase(s, tc_masks);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = canfilterSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
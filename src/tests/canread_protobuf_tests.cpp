@@ -10,6 +10,7 @@
 #include "can/canwrite.h"
 
 namespace usb = openxc::interface::usb;
+namespace messagepool = openxc::util::messagepool;
 namespace can = openxc::can;
 
 using openxc::util::log::debug;
@@ -21,6 +22,7 @@ using openxc::can::read::publishBooleanMessage;
 using openxc::can::read::publishNumericalMessage;
 using openxc::can::read::publishStringMessage;
 using openxc::pipeline::Pipeline;
+using openxc::util::messagepool::MessageQueue;
 using openxc::signals::getSignalCount;
 using openxc::signals::getSignals;
 using openxc::signals::getCanBuses;
@@ -28,10 +30,10 @@ using openxc::config::getConfiguration;
 
 extern void initializeVehicleInterface();
 
-QUEUE_TYPE(uint8_t)* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue;
+MessageQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].sendQueue;
 
 bool queueEmpty() {
-    return QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE);
+    return messagepool::queueEmpty(OUTPUT_QUEUE);
 }
 
 void setup() {
@@ -47,8 +49,8 @@ void setup() {
 }
 
 openxc_VehicleMessage decodeProtobufMessage(Pipeline* pipeline) {
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, &pipeline->usb->endpoints[IN_ENDPOINT_INDEX].queue) + 1];
-    QUEUE_SNAPSHOT(uint8_t, &pipeline->usb->endpoints[IN_ENDPOINT_INDEX].queue, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(&pipeline->usb->endpoints[IN_ENDPOINT_INDEX].sendQueue) + 1];
+    messagepool::peekBytes(&pipeline->usb->endpoints[IN_ENDPOINT_INDEX].sendQueue, snapshot, sizeof(snapshot));
 
     openxc_VehicleMessage decodedMessage = {0};
     pb_istream_t stream = pb_istream_from_buffer(snapshot, sizeof(snapshot));
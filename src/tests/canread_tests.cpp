@@ -9,6 +9,7 @@
 #include "config.h"
 
 namespace usb = openxc::interface::usb;
+namespace messagepool = openxc::util::messagepool;
 namespace can = openxc::can;
 
 using openxc::can::read::booleanDecoder;
@@ -19,7 +20,12 @@ using openxc::can::read::publishBooleanMessage;
 using openxc::can::read::publishNumericalMessage;
 using openxc::can::read::publishStringMessage;
 using openxc::can::read::publishVehicleMessage;
+using openxc::can::read::MessageDecoder;
+using openxc::can::read::buildMessageDecoders;
+using openxc::can::read::lookupMessageDecoder;
+using openxc::can::read::dispatchMessage;
 using openxc::pipeline::Pipeline;
+using openxc::util::messagepool::MessageQueue;
 using openxc::signals::getSignalCount;
 using openxc::signals::getSignals;
 using openxc::signals::getCanBuses;
@@ -39,11 +45,11 @@ const CanMessage TEST_MESSAGE = {
 extern unsigned long FAKE_TIME;
 extern void initializeVehicleInterface();
 
-QUEUE_TYPE(uint8_t)* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
-        IN_ENDPOINT_INDEX].queue;
+MessageQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
+        IN_ENDPOINT_INDEX].sendQueue;
 
 bool queueEmpty() {
-    return QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE);
+    return messagepool::queueEmpty(OUTPUT_QUEUE);
 }
 
 
@@ -61,6 +67,9 @@ void setup() {
         getSignals()[i].frequencyClock = {0};
         getSignals()[i].decoder = NULL;
     }
+    for(int i = 0; i < getMessageCount(); i++) {
+        getMessages()[i].changesTracked = false;
+    }
 }
 
 START_TEST (test_passthrough_decoder)
@@ -119,8 +128,8 @@ START_TEST (test_send_numerical)
     publishNumericalMessage("test", 42, &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot, "{\"name\":\"test\",\"value\":42}\0");
 }
@@ -133,11 +142,11 @@ START_TEST (test_preserve_float_precision)
     publishNumericalMessage("test", value, &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
-            "{\"name\":\"test\",\"value\":42.500000}\0");
+            "{\"name\":\"test\",\"value\":42.5}\0");
 }
 END_TEST
 
@@ -147,8 +156,8 @@ START_TEST (test_send_boolean)
     publishBooleanMessage("test", false, &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"test\",\"value\":false}\0");
@@ -161,8 +170,8 @@ START_TEST (test_send_string)
     publishStringMessage("test", "string", &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"test\",\"value\":\"string\"}\0");
@@ -188,8 +197,8 @@ START_TEST (test_send_evented_boolean)
     publishVehicleMessage("test", &value, &event, &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"test\",\"value\":\"value\",\"event\":false}\0");
@@ -215,8 +224,8 @@ START_TEST (test_send_evented_string)
     publishVehicleMessage("test", &value, &event, &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"test\",\"value\":\"value\",\"event\":\"event\"}\0");
@@ -241,8 +250,8 @@ START_TEST (test_send_evented_float)
     publishVehicleMessage("test", &value, &event, &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"test\",\"value\":\"value\",\"event\":43}\0");
@@ -260,7 +269,7 @@ START_TEST (test_passthrough_force_send_changed)
     can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
             getMessageCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
-    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    messagepool::initializeQueue(OUTPUT_QUEUE);
     can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
             getMessageCount(), &getConfiguration()->pipeline);
     fail_unless(queueEmpty());
@@ -283,7 +292,7 @@ START_TEST (test_passthrough_limited_frequency)
     can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
             getMessageCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
-    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    messagepool::initializeQueue(OUTPUT_QUEUE);
     can::read::passthroughMessage(&getCanBuses()[0], &message, getMessages(),
             getMessageCount(), &getConfiguration()->pipeline);
     fail_unless(queueEmpty());
@@ -307,8 +316,8 @@ START_TEST (test_passthrough_message)
             &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"bus\":1,\"id\":42,\"data\":\"0x123456789abcdef1\"}\0");
@@ -343,8 +352,8 @@ START_TEST (test_default_decoder)
     fail_if(queueEmpty());
     fail_unless(getSignals()[0].received);
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"torque_at_transmission\",\"value\":-19990}\0");
@@ -371,11 +380,11 @@ START_TEST (test_translate_many_signals)
         fail_unless(getSignals()[i].received);
     }
     fail_unless(USB_PROCESSED);
-    // 8 signals sent - depends on queue size
+    // 11 signals sent - depends on queue size
     ck_assert_int_eq(11 * 34 + 2, SENT_BYTES);
     // 1 in the output queue
     fail_if(queueEmpty());
-    ck_assert_int_eq(1 * 34, QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE));
+    ck_assert_int_eq(1 * 34, messagepool::queuedBytes(OUTPUT_QUEUE));
 }
 END_TEST
 
@@ -387,8 +396,8 @@ START_TEST (test_translate_float)
     fail_if(queueEmpty());
     fail_unless(getSignals()[0].received);
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"torque_at_transmission\",\"value\":42}\0");
@@ -444,8 +453,8 @@ START_TEST (test_translate_string)
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"torque_at_transmission\",\"value\":\"foo\"}\0");
@@ -465,7 +474,7 @@ START_TEST (test_unlimited_frequency)
     can::read::translateSignal(&getSignals()[0],
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
-    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    messagepool::initializeQueue(OUTPUT_QUEUE);
     can::read::translateSignal(&getSignals()[0],
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
@@ -479,7 +488,7 @@ START_TEST (test_limited_frequency)
     can::read::translateSignal(&getSignals()[0],
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
-    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    messagepool::initializeQueue(OUTPUT_QUEUE);
     can::read::translateSignal(&getSignals()[0],
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_unless(queueEmpty());
@@ -513,7 +522,7 @@ START_TEST (test_preserve_last_value)
     can::read::translateSignal(&getSignals()[0],
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
-    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    messagepool::initializeQueue(OUTPUT_QUEUE);
 
     CanMessage message = {
         id: 0,
@@ -525,8 +534,8 @@ START_TEST (test_preserve_last_value)
             getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"torque_at_transmission\",\"value\":-19990}\0");
@@ -541,19 +550,285 @@ START_TEST (test_dont_send_same)
             getSignalCount(), &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot,
             "{\"name\":\"brake_pedal_status\",\"value\":true}\0");
 
-    QUEUE_INIT(uint8_t, OUTPUT_QUEUE);
+    messagepool::initializeQueue(OUTPUT_QUEUE);
     can::read::translateSignal(&getSignals()[2],
             &TEST_MESSAGE, getSignals(), getSignalCount(), &getConfiguration()->pipeline);
     fail_unless(queueEmpty());
 }
 END_TEST
 
+START_TEST (test_parse_raw)
+{
+    CanSignal* signal = &getSignals()[0];
+    uint64_t rawValue = can::read::parseSignalBitfieldRaw(signal,
+            &TEST_MESSAGE);
+    ck_assert_int_eq(rawValue, 0xa);
+    ck_assert(can::read::scaleSignalValue(signal, rawValue) ==
+            can::read::parseSignalBitfield(signal, &TEST_MESSAGE));
+}
+END_TEST
+
+START_TEST (test_translate_raw_default_decoder)
+{
+    can::read::translateSignalRaw(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+    fail_unless(getSignals()[0].received);
+    ck_assert_int_eq(getSignals()[0].lastRawValue, 0xa);
+    ck_assert_int_eq(getSignals()[0].lastValue, -19990);
+
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert_str_eq((char*)snapshot,
+            "{\"name\":\"torque_at_transmission\",\"value\":-19990}\0");
+}
+END_TEST
+
+START_TEST (test_translate_raw_dont_send_same)
+{
+    getSignals()[0].sendSame = false;
+    can::read::translateSignalRaw(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+
+    messagepool::initializeQueue(OUTPUT_QUEUE);
+    can::read::translateSignalRaw(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_unless(queueEmpty());
+
+    CanMessage message = {
+        id: 0,
+        format: STANDARD,
+        data: {0xff},
+    };
+    can::read::translateSignalRaw(&getSignals()[0], &message, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+    ck_assert_int_eq(getSignals()[0].lastRawValue, 0xf);
+}
+END_TEST
+
+START_TEST (test_translate_raw_decoder_called_every_time)
+{
+    frequencyTestCounter = 0;
+    getSignals()[0].sendSame = false;
+    getSignals()[0].decoder = floatDecoderFrequencyTest;
+    can::read::translateSignalRaw(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    can::read::translateSignalRaw(&getSignals()[0], &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(frequencyTestCounter, 2);
+}
+END_TEST
+
+START_TEST (test_unchanged_signal_not_parsed)
+{
+    CanSignal* signal = &getSignals()[0];
+    can::read::trackMessageChanges(signal->message, &TEST_MESSAGE);
+    can::read::translateSignal(signal, &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+    messagepool::initializeQueue(OUTPUT_QUEUE);
+
+    // A bit outside of the signal changes, so the last value is reused - which
+    // we can tell by changing it
+    CanMessage message = TEST_MESSAGE;
+    message.data[0] ^= 0x80;
+    message.data[7] = 0x12;
+    signal->lastValue = 42;
+    can::read::trackMessageChanges(signal->message, &message);
+    can::read::translateSignal(signal, &message, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert_str_eq((char*)snapshot,
+            "{\"name\":\"torque_at_transmission\",\"value\":42}\0");
+}
+END_TEST
+
+START_TEST (test_changed_signal_parsed)
+{
+    CanSignal* signal = &getSignals()[0];
+    can::read::trackMessageChanges(signal->message, &TEST_MESSAGE);
+    can::read::translateSignal(signal, &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    messagepool::initializeQueue(OUTPUT_QUEUE);
+
+    CanMessage message = TEST_MESSAGE;
+    message.data[0] = 0xff;
+    can::read::trackMessageChanges(signal->message, &message);
+    can::read::translateSignal(signal, &message, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(signal->lastValue, -14985);
+}
+END_TEST
+
+START_TEST (test_unchanged_signal_dont_send_same)
+{
+    CanSignal* signal = &getSignals()[0];
+    signal->sendSame = false;
+    can::read::trackMessageChanges(signal->message, &TEST_MESSAGE);
+    can::read::translateSignal(signal, &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_if(queueEmpty());
+    messagepool::initializeQueue(OUTPUT_QUEUE);
+
+    can::read::trackMessageChanges(signal->message, &TEST_MESSAGE);
+    can::read::translateSignal(signal, &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    fail_unless(queueEmpty());
+}
+END_TEST
+
+START_TEST (test_unchanged_signal_custom_decoder_called)
+{
+    frequencyTestCounter = 0;
+    CanSignal* signal = &getSignals()[0];
+    signal->decoder = floatDecoderFrequencyTest;
+    can::read::trackMessageChanges(signal->message, &TEST_MESSAGE);
+    can::read::translateSignal(signal, &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    can::read::trackMessageChanges(signal->message, &TEST_MESSAGE);
+    can::read::translateSignal(signal, &TEST_MESSAGE, getSignals(),
+            getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(frequencyTestCounter, 2);
+}
+END_TEST
+
+START_TEST (test_build_decoders_sorted)
+{
+    MessageDecoder decoders[MAX_MESSAGE_DECODERS];
+    int decoderCount = buildMessageDecoders(getSignals(), getSignalCount(),
+            decoders, MAX_MESSAGE_DECODERS);
+    ck_assert_int_eq(decoderCount, 6);
+    for(int i = 1; i < decoderCount; i++) {
+        ck_assert(decoders[i].id >= decoders[i - 1].id);
+    }
+
+    // Signals of the same message that aren't next to each other get separate
+    // rows, in the order they were defined
+    ck_assert_int_eq(decoders[0].id, 0);
+    ck_assert_int_eq(decoders[0].signalIndex, 0);
+    ck_assert_int_eq(decoders[1].id, 0);
+    ck_assert_int_eq(decoders[1].signalIndex, 6);
+
+    // ...and consecutive signals share one
+    ck_assert_int_eq(decoders[4].id, 2);
+    ck_assert_int_eq(decoders[4].signalIndex, 4);
+    ck_assert_int_eq(decoders[4].signalCount, 2);
+    ck_assert(decoders[4].handler == NULL);
+}
+END_TEST
+
+START_TEST (test_build_decoders_too_many)
+{
+    MessageDecoder decoders[5];
+    ck_assert_int_eq(buildMessageDecoders(getSignals(), getSignalCount(),
+                decoders, 5), -1);
+}
+END_TEST
+
+START_TEST (test_dispatch_message)
+{
+    MessageDecoder decoders[MAX_MESSAGE_DECODERS];
+    int decoderCount = buildMessageDecoders(getSignals(), getSignalCount(),
+            decoders, MAX_MESSAGE_DECODERS);
+    CanMessage message = TEST_MESSAGE;
+    fail_unless(dispatchMessage(decoders, decoderCount, &getCanBuses()[0],
+                &message, getSignals(), getSignalCount(),
+                &getConfiguration()->pipeline));
+    fail_if(queueEmpty());
+    fail_unless(getSignals()[0].received);
+    fail_unless(getSignals()[6].received);
+    fail_if(getSignals()[1].received);
+}
+END_TEST
+
+START_TEST (test_dispatch_unknown_message)
+{
+    MessageDecoder decoders[MAX_MESSAGE_DECODERS];
+    int decoderCount = buildMessageDecoders(getSignals(), getSignalCount(),
+            decoders, MAX_MESSAGE_DECODERS);
+    CanMessage message = TEST_MESSAGE;
+    message.id = 0x7ff;
+    fail_if(dispatchMessage(decoders, decoderCount, &getCanBuses()[0],
+                &message, getSignals(), getSignalCount(),
+                &getConfiguration()->pipeline));
+    fail_unless(queueEmpty());
+
+    // The same ID on another bus isn't in the table either
+    message.id = 0;
+    fail_if(dispatchMessage(decoders, decoderCount, &getCanBuses()[1],
+                &message, getSignals(), getSignalCount(),
+                &getConfiguration()->pipeline));
+}
+END_TEST
+
+static int handlerCalls = 0;
+
+void countingMessageHandler(CanMessage* message, CanSignal* signals,
+        int signalCount, Pipeline* pipeline) {
+    ++handlerCalls;
+}
+
+START_TEST (test_dispatch_message_handler)
+{
+    handlerCalls = 0;
+    MessageDecoder decoders[MAX_MESSAGE_DECODERS];
+    int decoderCount = buildMessageDecoders(getSignals(), getSignalCount(),
+            decoders, MAX_MESSAGE_DECODERS);
+    MessageDecoder* decoder = lookupMessageDecoder(decoders, decoderCount,
+            &getCanBuses()[0], 1, CanMessageFormat::STANDARD);
+    ck_assert(decoder != NULL);
+    decoder->handler = countingMessageHandler;
+    ck_assert(lookupMessageDecoder(decoders, decoderCount, &getCanBuses()[0],
+                1, CanMessageFormat::EXTENDED) == NULL);
+
+    CanMessage message = TEST_MESSAGE;
+    message.id = 1;
+    dispatchMessage(decoders, decoderCount, &getCanBuses()[0], &message,
+            getSignals(), getSignalCount(), &getConfiguration()->pipeline);
+    ck_assert_int_eq(handlerCalls, 1);
+    fail_unless(getSignals()[1].received);
+}
+END_TEST
+
+START_TEST (test_dispatch_generated_table)
+{
+    // A table like the code generator emits, with a message that only has a
+    // custom handler
+    const MessageDecoder decoders[] = {
+        {1, 1, CanMessageFormat::STANDARD, 1, 1, NULL},
+        {1, 0x100, CanMessageFormat::STANDARD, 0, 0, countingMessageHandler},
+    };
+    handlerCalls = 0;
+    CanMessage message = TEST_MESSAGE;
+    message.id = 0x100;
+    fail_unless(dispatchMessage(decoders, 2, &getCanBuses()[0], &message,
+                getSignals(), getSignalCount(),
+                &getConfiguration()->pipeline));
+    ck_assert_int_eq(handlerCalls, 1);
+    fail_unless(queueEmpty());
+
+    message.id = 1;
+    fail_unless(dispatchMessage(decoders, 2, &getCanBuses()[0], &message,
+                getSignals(), getSignalCount(),
+                &getConfiguration()->pipeline));
+    ck_assert_int_eq(handlerCalls, 1);
+    fail_unless(getSignals()[1].received);
+}
+END_TEST
+
 Suite* canreadSuite(void) {
     Suite* s = suite_create("canread");
     TCase *tc_core = tcase_create("core");
@@ -596,8 +871,27 @@ Suite* canreadSuite(void) {
             test_decoder_called_every_time_with_unlimited_frequency);
     tcase_add_test(tc_translate,
             test_translate_many_signals);
+    tcase_add_test(tc_translate, test_parse_raw);
+    tcase_add_test(tc_translate, test_translate_raw_default_decoder);
+    tcase_add_test(tc_translate, test_translate_raw_dont_send_same);
+    tcase_add_test(tc_translate,
+            test_translate_raw_decoder_called_every_time);
+    tcase_add_test(tc_translate, test_unchanged_signal_not_parsed);
+    tcase_add_test(tc_translate, test_changed_signal_parsed);
+    tcase_add_test(tc_translate, test_unchanged_signal_dont_send_same);
+    tcase_add_test(tc_translate, test_unchanged_signal_custom_decoder_called);
     suite_add_tcase(s, tc_translate);
 
+    TCase *tc_dispatch = tcase_create("dispatch");
+    tcase_add_checked_fixture(tc_dispatch, setup, NULL);
+    tcase_add_test(tc_dispatch, test_build_decoders_sorted);
+    tcase_add_test(tc_dispatch, test_build_decoders_too_many);
+    tcase_add_test(tc_dispatch, test_dispatch_message);
+    tcase_add_test(tc_dispatch, test_dispatch_unknown_message);
+    tcase_add_test(tc_dispatch, test_dispatch_message_handler);
+    tcase_add_test(tc_dispatch, test_dispatch_generated_table);
+    suite_add_tcase(s, tc_dispatch);
+
     return s;
 }
 
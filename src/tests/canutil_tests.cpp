@@ -3,6 +3,7 @@
 #include "signals.h"
 #include "can/canread.h"
 #include "can/canwrite.h"
+#include "payload/payload.h"
 #include "config.h"
 
 #include "canutil_spy.h"
@@ -11,10 +12,18 @@ namespace can = openxc::can;
 
 using openxc::can::lookupSignal;
 using openxc::can::lookupSignalState;
+using openxc::can::signalPrecision;
 using openxc::can::lookupMessageDefinition;
 using openxc::can::registerMessageDefinition;
 using openxc::can::unregisterMessageDefinition;
 using openxc::can::setAcceptanceFilterStatus;
+using openxc::can::addAcceptanceFilter;
+using openxc::can::removeAcceptanceFilter;
+using openxc::can::shouldAcceptMessage;
+using openxc::can::beginAcceptanceFilterUpdate;
+using openxc::can::commitAcceptanceFilterUpdate;
+using openxc::can::effectiveQueueDepth;
+using openxc::can::enqueueReceivedMessage;
 using openxc::signals::getCanBusCount;
 using openxc::signals::getCanBuses;
 using openxc::signals::getMessages;
@@ -24,8 +33,13 @@ using openxc::signals::getSignalCount;
 using openxc::signals::getCommands;
 using openxc::signals::getCommandCount;
 
+extern unsigned long FAKE_TIME;
+
 void setup() {
     for(int i = 0; i < getCanBusCount(); i++) {
+        getCanBuses()[i].receiveQueueDepth = 0;
+        getCanBuses()[i].sendQueueDepth = 0;
+        getCanBuses()[i].messagesDropped = 0;
         can::initializeCommon(&getCanBuses()[i]);
     }
 }
@@ -104,6 +118,51 @@ START_TEST (test_lookup_signal_state_by_value)
 }
 END_TEST
 
+static openxc_DynamicField precisionTestDecoder(CanSignal* signal,
+        CanSignal* signals, int signalCount, openxc::pipeline::Pipeline* pipeline,
+        float value, bool* send) {
+    return openxc::payload::wrapNumber(value);
+}
+
+START_TEST (test_signal_precision)
+{
+    CanSignal signal = {0};
+    signal.factor = 1001;
+    signal.offset = -30000;
+    ck_assert_int_eq(0, signalPrecision(&signal));
+
+    signal = CanSignal();
+    signal.factor = 0.001;
+    ck_assert_int_eq(3, signalPrecision(&signal));
+    ck_assert_int_eq(3, signal.precision);
+
+    signal = CanSignal();
+    signal.factor = 1;
+    signal.offset = -40.5;
+    ck_assert_int_eq(1, signalPrecision(&signal));
+
+    signal = CanSignal();
+    signal.factor = 1.0 / 3;
+    ck_assert_int_eq(6, signalPrecision(&signal));
+}
+END_TEST
+
+START_TEST (test_signal_precision_configured)
+{
+    CanSignal signal = {0};
+    signal.factor = 0.001;
+    signal.precision = 1;
+    ck_assert_int_eq(1, signalPrecision(&signal));
+
+    signal.precision = -1;
+    ck_assert_int_eq(0, signalPrecision(&signal));
+
+    signal.precision = 0;
+    signal.decoder = precisionTestDecoder;
+    ck_assert_int_eq(-1, signalPrecision(&signal));
+}
+END_TEST
+
 START_TEST (test_lookup_command)
 {
     fail_unless(lookupCommand("does_not_exist", getCommands(), getCommandCount()
@@ -137,6 +196,82 @@ START_TEST (test_get_can_message_definition_undefined)
 }
 END_TEST
 
+START_TEST (test_get_can_message_definition_wrong_format)
+{
+    CanMessageDefinition* message = lookupMessageDefinition(&getCanBuses()[0], 1,
+            CanMessageFormat::EXTENDED, getMessages(), getMessageCount());
+    ck_assert(message == NULL);
+}
+END_TEST
+
+START_TEST (test_get_can_message_definition_new_predefined_array)
+{
+    CanMessageDefinition messages[] = {
+        {&getCanBuses()[0], MESSAGE_ID},
+    };
+    ck_assert(lookupMessageDefinition(&getCanBuses()[0], 1,
+            CanMessageFormat::STANDARD, getMessages(), getMessageCount()) ==
+            &getMessages()[1]);
+    ck_assert(lookupMessageDefinition(&getCanBuses()[0], MESSAGE_ID,
+            CanMessageFormat::STANDARD, messages, 1) == &messages[0]);
+    ck_assert(lookupMessageDefinition(&getCanBuses()[0], 1,
+            CanMessageFormat::STANDARD, messages, 1) == NULL);
+}
+END_TEST
+
+START_TEST (test_register_many_and_unregister)
+{
+    CanBus* bus = &getCanBuses()[0];
+    for(uint32_t i = 0; i < MAX_DYNAMIC_MESSAGE_COUNT; i++) {
+        ck_assert(registerMessageDefinition(bus, 0x18fef100 + (i << 8),
+                    CanMessageFormat::EXTENDED, getMessages(),
+                    getMessageCount()));
+    }
+    ck_assert(!registerMessageDefinition(bus, MESSAGE_ID,
+                CanMessageFormat::STANDARD, getMessages(), getMessageCount()));
+
+    for(uint32_t i = 0; i < MAX_DYNAMIC_MESSAGE_COUNT; i += 2) {
+        ck_assert(unregisterMessageDefinition(bus, 0x18fef100 + (i << 8),
+                    CanMessageFormat::EXTENDED));
+    }
+
+    for(uint32_t i = 0; i < MAX_DYNAMIC_MESSAGE_COUNT; i++) {
+        CanMessageDefinition* message = lookupMessageDefinition(bus,
+                0x18fef100 + (i << 8), CanMessageFormat::EXTENDED,
+                getMessages(), getMessageCount());
+        if(i % 2 == 0) {
+            ck_assert(message == NULL);
+        } else {
+            ck_assert(message != NULL);
+            ck_assert_int_eq(message->id, 0x18fef100 + (i << 8));
+        }
+    }
+    ck_assert(lookupMessageDefinition(bus, 1, CanMessageFormat::STANDARD,
+            getMessages(), getMessageCount()) == &getMessages()[1]);
+}
+END_TEST
+
+START_TEST (test_index_too_small_for_message_set)
+{
+    CanBus* bus = &getCanBuses()[0];
+    ck_assert(can::indexMessageDefinitions(bus, getMessages(),
+                getMessageCount()));
+
+    // One more message than there are slots
+    const int messageCount = CAN_MESSAGE_INDEX_SIZE + 1;
+    static CanMessageDefinition messages[messageCount];
+    for(int i = 0; i < messageCount; i++) {
+        messages[i].bus = bus;
+        messages[i].id = 0x100 + i;
+    }
+    ck_assert(!can::indexMessageDefinitions(bus, messages, messageCount));
+    // Lookups are still correct, just slower
+    ck_assert(lookupMessageDefinition(bus, 0x100 + messageCount - 1,
+            CanMessageFormat::STANDARD, messages, messageCount) ==
+            &messages[messageCount - 1]);
+}
+END_TEST
+
 START_TEST (test_register_can_message)
 {
     ck_assert(registerMessageDefinition(&getCanBuses()[0], MESSAGE_ID, CanMessageFormat::STANDARD, getMessages(), getMessageCount()));
@@ -219,6 +354,227 @@ START_TEST (test_set_acceptance_filter_status)
 }
 END_TEST
 
+START_TEST (test_software_filter_standard)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    ck_assert(!shouldAcceptMessage(bus, 0x7df, CanMessageFormat::STANDARD));
+    ck_assert(addAcceptanceFilter(bus, 0x7df, CanMessageFormat::STANDARD,
+                getCanBuses(), getCanBusCount()));
+    ck_assert(shouldAcceptMessage(bus, 0x7df, CanMessageFormat::STANDARD));
+    ck_assert(!shouldAcceptMessage(bus, 0x7de, CanMessageFormat::STANDARD));
+    ck_assert(!shouldAcceptMessage(bus, 0x7df, CanMessageFormat::EXTENDED));
+    ck_assert(!shouldAcceptMessage(&getCanBuses()[1], 0x7df,
+                CanMessageFormat::STANDARD));
+
+    removeAcceptanceFilter(bus, 0x7df, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    ck_assert(!shouldAcceptMessage(bus, 0x7df, CanMessageFormat::STANDARD));
+}
+END_TEST
+
+START_TEST (test_software_filter_extended)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    for(uint32_t i = 0; i < 8; i++) {
+        ck_assert(addAcceptanceFilter(bus, 0x18fef100 + (i << 8),
+                    CanMessageFormat::EXTENDED, getCanBuses(),
+                    getCanBusCount()));
+    }
+
+    for(uint32_t i = 0; i < 8; i += 2) {
+        removeAcceptanceFilter(bus, 0x18fef100 + (i << 8),
+                CanMessageFormat::EXTENDED, getCanBuses(), getCanBusCount());
+    }
+
+    for(uint32_t i = 0; i < 8; i++) {
+        ck_assert(shouldAcceptMessage(bus, 0x18fef100 + (i << 8),
+                    CanMessageFormat::EXTENDED) == (i % 2 == 1));
+    }
+    ck_assert(!shouldAcceptMessage(bus, 0x18fef1ff,
+                CanMessageFormat::EXTENDED));
+}
+END_TEST
+
+START_TEST (test_software_filter_extended_clears_removed)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    for(uint32_t i = 0; i < 32; i++) {
+        ck_assert(addAcceptanceFilter(bus, 0x18fef100 + (i << 8),
+                    CanMessageFormat::EXTENDED, getCanBuses(),
+                    getCanBusCount()));
+    }
+
+    beginAcceptanceFilterUpdate();
+    for(uint32_t i = 1; i < 32; i++) {
+        removeAcceptanceFilter(bus, 0x18fef100 + (i << 8),
+                CanMessageFormat::EXTENDED, getCanBuses(), getCanBusCount());
+    }
+    ck_assert(commitAcceptanceFilterUpdate(getCanBuses(), getCanBusCount()));
+
+    for(int i = 0; i < CAN_EXTENDED_FILTER_SET_SIZE; i++) {
+        ck_assert(bus->extendedFilters[i] != CAN_EXTENDED_FILTER_REMOVED);
+    }
+    ck_assert(shouldAcceptMessage(bus, 0x18fef100, CanMessageFormat::EXTENDED));
+    ck_assert(!shouldAcceptMessage(bus, 0x18fef200,
+                CanMessageFormat::EXTENDED));
+}
+END_TEST
+
+START_TEST (test_software_filter_bypass)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = true;
+    ck_assert(shouldAcceptMessage(bus, 0x7df, CanMessageFormat::STANDARD));
+    ck_assert(shouldAcceptMessage(bus, 0x18fef100, CanMessageFormat::EXTENDED));
+}
+END_TEST
+
+START_TEST (test_batched_filter_updates)
+{
+    CanBus* bus = &getCanBuses()[0];
+    int updates = can::spy::acceptanceFilterTableUpdates();
+    beginAcceptanceFilterUpdate();
+    for(uint32_t i = 0; i < 8; i++) {
+        ck_assert(addAcceptanceFilter(bus, 0x7e8 + i,
+                    CanMessageFormat::STANDARD, getCanBuses(),
+                    getCanBusCount()));
+    }
+    ck_assert(shouldAcceptMessage(bus, 0x7e8, CanMessageFormat::STANDARD));
+    ck_assert_int_eq(can::spy::acceptanceFilterTableUpdates(), updates);
+
+    ck_assert(commitAcceptanceFilterUpdate(getCanBuses(), getCanBusCount()));
+    ck_assert_int_eq(can::spy::acceptanceFilterTableUpdates(), updates + 1);
+}
+END_TEST
+
+START_TEST (test_batched_filter_updates_nested)
+{
+    CanBus* bus = &getCanBuses()[0];
+    int updates = can::spy::acceptanceFilterTableUpdates();
+    beginAcceptanceFilterUpdate();
+    beginAcceptanceFilterUpdate();
+    ck_assert(addAcceptanceFilter(bus, 0x7e8, CanMessageFormat::STANDARD,
+                getCanBuses(), getCanBusCount()));
+    ck_assert(commitAcceptanceFilterUpdate(getCanBuses(), getCanBusCount()));
+    ck_assert_int_eq(can::spy::acceptanceFilterTableUpdates(), updates);
+    ck_assert(commitAcceptanceFilterUpdate(getCanBuses(), getCanBusCount()));
+    ck_assert_int_eq(can::spy::acceptanceFilterTableUpdates(), updates + 1);
+}
+END_TEST
+
+START_TEST (test_failed_batch_removes_new_filters)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    ck_assert(addAcceptanceFilter(bus, 0x7e0, CanMessageFormat::STANDARD,
+                getCanBuses(), getCanBusCount()));
+    int updates = can::spy::acceptanceFilterTableUpdates();
+
+    beginAcceptanceFilterUpdate();
+    ck_assert(addAcceptanceFilter(bus, 0x7e8, CanMessageFormat::STANDARD,
+                getCanBuses(), getCanBusCount()));
+    can::spy::failNextAcceptanceFilterTableUpdate();
+    ck_assert(!commitAcceptanceFilterUpdate(getCanBuses(), getCanBusCount()));
+
+    // rewritten again without the new filter
+    ck_assert_int_eq(can::spy::acceptanceFilterTableUpdates(), updates + 2);
+    ck_assert(!shouldAcceptMessage(bus, 0x7e8, CanMessageFormat::STANDARD));
+    ck_assert(shouldAcceptMessage(bus, 0x7e0, CanMessageFormat::STANDARD));
+}
+END_TEST
+
+START_TEST (test_batch_without_changes_skips_update)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    ck_assert(addAcceptanceFilter(bus, 0x7e8, CanMessageFormat::STANDARD,
+                getCanBuses(), getCanBusCount()));
+    int updates = can::spy::acceptanceFilterTableUpdates();
+
+    beginAcceptanceFilterUpdate();
+    removeAcceptanceFilter(bus, 0x7e8, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    // not removed until the batch is committed
+    ck_assert(shouldAcceptMessage(bus, 0x7e8, CanMessageFormat::STANDARD));
+    ck_assert(addAcceptanceFilter(bus, 0x7e8, CanMessageFormat::STANDARD,
+                getCanBuses(), getCanBusCount()));
+    ck_assert(commitAcceptanceFilterUpdate(getCanBuses(), getCanBusCount()));
+
+    ck_assert_int_eq(can::spy::acceptanceFilterTableUpdates(), updates);
+    ck_assert(shouldAcceptMessage(bus, 0x7e8, CanMessageFormat::STANDARD));
+}
+END_TEST
+
+START_TEST (test_batched_remove_applied_on_commit)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->bypassFilters = false;
+    ck_assert(addAcceptanceFilter(bus, 0x7e8, CanMessageFormat::STANDARD,
+                getCanBuses(), getCanBusCount()));
+    int updates = can::spy::acceptanceFilterTableUpdates();
+
+    beginAcceptanceFilterUpdate();
+    removeAcceptanceFilter(bus, 0x7e8, CanMessageFormat::STANDARD,
+            getCanBuses(), getCanBusCount());
+    ck_assert(commitAcceptanceFilterUpdate(getCanBuses(), getCanBusCount()));
+
+    ck_assert_int_eq(can::spy::acceptanceFilterTableUpdates(), updates + 1);
+    ck_assert(!shouldAcceptMessage(bus, 0x7e8, CanMessageFormat::STANDARD));
+    ck_assert(LIST_EMPTY(&bus->acceptanceFilters));
+}
+END_TEST
+
+START_TEST (test_queue_depth_defaults_to_capacity)
+{
+    ck_assert_int_eq(effectiveQueueDepth(0), QUEUE_MAX_LENGTH(CanMessage));
+    ck_assert_int_eq(effectiveQueueDepth(QUEUE_MAX_LENGTH(CanMessage) + 1),
+            QUEUE_MAX_LENGTH(CanMessage));
+    ck_assert_int_eq(effectiveQueueDepth(2), 2);
+}
+END_TEST
+
+START_TEST (test_receive_queue_depth_limit)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->receiveQueueDepth = 2;
+    CanMessage message = {id: MESSAGE_ID};
+
+    FAKE_TIME = 5000;
+    ck_assert(enqueueReceivedMessage(bus, &message));
+    ck_assert(enqueueReceivedMessage(bus, &message));
+    ck_assert(!enqueueReceivedMessage(bus, &message));
+    ck_assert_int_eq(QUEUE_LENGTH(CanMessage, &bus->receiveQueue), 2);
+    ck_assert_int_eq(bus->messagesDropped, 1);
+    ck_assert_int_eq(bus->receiveQueueMetrics.highWaterMark, 2);
+    ck_assert_int_eq(bus->receiveQueueMetrics.overflowCount, 1);
+    ck_assert_int_eq(bus->receiveQueueMetrics.firstOverflow, 5000);
+
+    // only the first overflow is timestamped
+    FAKE_TIME = 6000;
+    ck_assert(!enqueueReceivedMessage(bus, &message));
+    ck_assert_int_eq(bus->receiveQueueMetrics.overflowCount, 2);
+    ck_assert_int_eq(bus->receiveQueueMetrics.firstOverflow, 5000);
+}
+END_TEST
+
+START_TEST (test_send_queue_high_water_mark)
+{
+    CanBus* bus = &getCanBuses()[0];
+    CanMessage message = {id: MESSAGE_ID};
+    can::write::enqueueMessage(bus, &message);
+    can::write::enqueueMessage(bus, &message);
+    can::write::enqueueMessage(bus, &message);
+    QUEUE_POP(CanMessage, &bus->sendQueue);
+    can::write::enqueueMessage(bus, &message);
+    ck_assert_int_eq(bus->sendQueueMetrics.highWaterMark, 3);
+    ck_assert_int_eq(bus->sendQueueMetrics.overflowCount, 0);
+    ck_assert_int_eq(bus->sendQueueMetrics.firstOverflow, 0);
+}
+END_TEST
+
 Suite* canutilSuite(void) {
     Suite* s = suite_create("canutil");
     TCase *tc_core = tcase_create("core");
@@ -229,15 +585,32 @@ Suite* canutilSuite(void) {
     tcase_add_test(tc_core, test_lookup_signal);
     tcase_add_test(tc_core, test_lookup_writable_signal);
     tcase_add_test(tc_core, test_lookup_signal_state_by_name);
+    tcase_add_test(tc_core, test_signal_precision);
+    tcase_add_test(tc_core, test_signal_precision_configured);
     tcase_add_test(tc_core, test_lookup_signal_state_by_value);
     tcase_add_test(tc_core, test_lookup_command);
     tcase_add_test(tc_core, test_set_acceptance_filter_status);
+    tcase_add_test(tc_core, test_software_filter_standard);
+    tcase_add_test(tc_core, test_software_filter_extended);
+    tcase_add_test(tc_core, test_software_filter_extended_clears_removed);
+    tcase_add_test(tc_core, test_software_filter_bypass);
+    tcase_add_test(tc_core, test_batched_filter_updates);
+    tcase_add_test(tc_core, test_batched_filter_updates_nested);
+    tcase_add_test(tc_core, test_failed_batch_removes_new_filters);
+    tcase_add_test(tc_core, test_batch_without_changes_skips_update);
+    tcase_add_test(tc_core, test_batched_remove_applied_on_commit);
     suite_add_tcase(s, tc_core);
 
     TCase *tc_message_def = tcase_create("message_definitions");
     tcase_add_checked_fixture(tc_message_def, setup, teardown);
     tcase_add_test(tc_message_def, test_get_can_message_definition_predefined);
     tcase_add_test(tc_message_def, test_get_can_message_definition_undefined);
+    tcase_add_test(tc_message_def,
+            test_get_can_message_definition_wrong_format);
+    tcase_add_test(tc_message_def,
+            test_get_can_message_definition_new_predefined_array);
+    tcase_add_test(tc_message_def, test_register_many_and_unregister);
+    tcase_add_test(tc_message_def, test_index_too_small_for_message_set);
     tcase_add_test(tc_message_def, test_register_can_message);
     tcase_add_test(tc_message_def, test_register_can_message_twice);
     tcase_add_test(tc_message_def, test_register_can_message_diff_bus);
@@ -246,6 +619,13 @@ Suite* canutilSuite(void) {
     tcase_add_test(tc_message_def, test_unregister_predefined);
     suite_add_tcase(s, tc_message_def);
 
+    TCase *tc_queues = tcase_create("queues");
+    tcase_add_checked_fixture(tc_queues, setup, teardown);
+    tcase_add_test(tc_queues, test_queue_depth_defaults_to_capacity);
+    tcase_add_test(tc_queues, test_receive_queue_depth_limit);
+    tcase_add_test(tc_queues, test_send_queue_high_water_mark);
+    suite_add_tcase(s, tc_queues);
+
     return s;
 }
 
@@ -0,0 +1,102 @@
+#include <check.h>
+#include <stdint.h>
+
+#include "util/coalesce.h"
+
+using openxc::util::coalesce::Coalescer;
+using openxc::util::coalesce::coalescedLength;
+
+namespace coalesce = openxc::util::coalesce;
+
+extern unsigned long FAKE_TIME;
+
+Coalescer coalescer;
+
+void setup() {
+    FAKE_TIME = 1000;
+    coalesce::initialize(&coalescer, 64, 5);
+}
+
+void teardown() {
+}
+
+START_TEST (test_nothing_queued)
+{
+    ck_assert_int_eq(coalescedLength(&coalescer, 0, 512), 0);
+}
+END_TEST
+
+START_TEST (test_full_unit_sent_right_away)
+{
+    ck_assert_int_eq(coalescedLength(&coalescer, 64, 512), 64);
+}
+END_TEST
+
+START_TEST (test_only_whole_units_sent)
+{
+    ck_assert_int_eq(coalescedLength(&coalescer, 150, 512), 128);
+    ck_assert_int_eq(coalescedLength(&coalescer, 22, 512), 0);
+}
+END_TEST
+
+START_TEST (test_limited_to_max_length)
+{
+    ck_assert_int_eq(coalescedLength(&coalescer, 600, 512), 512);
+}
+END_TEST
+
+START_TEST (test_partial_unit_waits)
+{
+    ck_assert_int_eq(coalescedLength(&coalescer, 10, 512), 0);
+    FAKE_TIME += 4;
+    ck_assert_int_eq(coalescedLength(&coalescer, 10, 512), 0);
+    FAKE_TIME += 1;
+    ck_assert_int_eq(coalescedLength(&coalescer, 10, 512), 10);
+}
+END_TEST
+
+START_TEST (test_partial_unit_filled_before_timeout)
+{
+    ck_assert_int_eq(coalescedLength(&coalescer, 10, 512), 0);
+    FAKE_TIME += 1;
+    ck_assert_int_eq(coalescedLength(&coalescer, 70, 512), 64);
+    // The remainder doesn't get a new deadline
+    FAKE_TIME += 4;
+    ck_assert_int_eq(coalescedLength(&coalescer, 6, 512), 6);
+}
+END_TEST
+
+START_TEST (test_zero_latency_never_waits)
+{
+    coalesce::initialize(&coalescer, 64, 0);
+    ck_assert_int_eq(coalescedLength(&coalescer, 10, 512), 10);
+}
+END_TEST
+
+Suite* suite(void) {
+    Suite* s = suite_create("coalesce");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_nothing_queued);
+    tcase_add_test(tc_core, test_full_unit_sent_right_away);
+    tcase_add_test(tc_core, test_only_whole_units_sent);
+    tcase_add_test(tc_core, test_limited_to_max_length);
+    tcase_add_test(tc_core, test_partial_unit_waits);
+    tcase_add_test(tc_core, test_partial_unit_filled_before_timeout);
+    tcase_add_test(tc_core, test_zero_latency_never_waits);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = suite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
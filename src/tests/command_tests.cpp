@@ -7,11 +7,15 @@
 #include "lights.h"
 #include "config.h"
 #include "pipeline.h"
+#include "can/canread.h"
+#include "metrics.h"
 
 namespace diagnostics = openxc::diagnostics;
 namespace usb = openxc::interface::usb;
+namespace messagepool = openxc::util::messagepool;
 
 using openxc::pipeline::Pipeline;
+using openxc::util::messagepool::MessageQueue;
 using openxc::signals::getCanBuses;
 using openxc::signals::getActiveMessageSet;
 using openxc::commands::handleIncomingMessage;
@@ -30,8 +34,8 @@ extern char LAST_COMMAND_NAME[];
 extern openxc_DynamicField LAST_COMMAND_VALUE;
 extern openxc_DynamicField LAST_COMMAND_EVENT;
 
-QUEUE_TYPE(uint8_t)* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
-        IN_ENDPOINT_INDEX].queue;
+MessageQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[
+        IN_ENDPOINT_INDEX].sendQueue;
 
 openxc_VehicleMessage CAN_MESSAGE = {0};
 openxc_VehicleMessage SIMPLE_MESSAGE = {0};
@@ -43,7 +47,7 @@ InterfaceDescriptor DESCRIPTOR = {
 };
 
 bool outputQueueEmpty() {
-    return QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE);
+    return messagepool::queueEmpty(OUTPUT_QUEUE);
 }
 
 static bool canQueueEmpty(int bus) {
@@ -64,11 +68,13 @@ void setup() {
     getConfiguration()->desiredRunLevel = openxc::config::RunLevel::ALL_IO;
     getConfiguration()->obd2BusAddress = 0;
     getConfiguration()->payloadFormat = PayloadFormat::JSON;
+    DESCRIPTOR.hasPayloadFormat = false;
     initializeVehicleInterface();
     getConfiguration()->usb.configured = true;
     fail_unless(canQueueEmpty(0));
     getActiveMessageSet()->busCount = 2;
     getCanBuses()[0].rawWritable = true;
+    openxc::pipeline::clearSubscriptions(InterfaceType::USB);
     resetQueues();
 
     CAN_MESSAGE.has_type = true;
@@ -588,8 +594,8 @@ START_TEST (test_version_message_in_stream)
     char firmwareDescriptor[256] = {0};
     getFirmwareDescriptor(firmwareDescriptor, sizeof(firmwareDescriptor));
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, firmwareDescriptor) != NULL);
 }
@@ -603,14 +609,145 @@ START_TEST (test_device_id_message_in_stream)
     ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
     ck_assert(!outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot,
                 getConfiguration()->uart.deviceId) != NULL);
 }
 END_TEST
 
+START_TEST (test_metrics_command)
+{
+    CanBus* bus = &getCanBuses()[0];
+    CanMessage message = {id: 0x42};
+    openxc::can::write::enqueueMessage(bus, &message);
+    openxc::can::write::enqueueMessage(bus, &message);
+    openxc::metrics::recordLoopPass(300);
+    const openxc::metrics::LoopMetrics* loop = openxc::metrics::loopMetrics();
+
+    uint8_t request[] = "{\"command\": \"metrics\"}\0";
+    ck_assert(outputQueueEmpty());
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    ck_assert(!outputQueueEmpty());
+
+    char expectedBus[96] = {0};
+    snprintf(expectedBus, sizeof(expectedBus),
+            "\"can\":[[%d,%u,%u,%d,%d,0,0,2,%d,0,0,", bus->address,
+            bus->messagesReceived, bus->messagesDropped,
+            bus->receiveQueueMetrics.highWaterMark,
+            (int)QUEUE_MAX_LENGTH(CanMessage),
+            (int)QUEUE_MAX_LENGTH(CanMessage));
+    char expectedLoop[48] = {0};
+    snprintf(expectedLoop, sizeof(expectedLoop), "\"loop\":[%lu,%lu,%lu]}",
+            (unsigned long)loop->passes,
+            openxc::metrics::averageLoopPassUs(),
+            (unsigned long)loop->maxUs);
+
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    // Everything is in a single response
+    ck_assert_int_eq(strlen((char*)snapshot) + 1,
+            messagepool::queuedBytes(OUTPUT_QUEUE));
+    ck_assert(strstr((char*)snapshot,
+                "{\"command_response\":\"metrics\",\"status\":true,") != NULL);
+    ck_assert(strstr((char*)snapshot, expectedBus) != NULL);
+    ck_assert(strstr((char*)snapshot, "\"out\":[") != NULL);
+    ck_assert(strstr((char*)snapshot, expectedLoop) != NULL);
+}
+END_TEST
+
+START_TEST (test_subscribe_command)
+{
+    uint8_t request[] = "{\"command\": \"subscribe\", \"name\": \"brake_pedal_status\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+    ck_assert(!outputQueueEmpty());
+
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "\"status\":true") != NULL);
+
+    resetQueues();
+    openxc_DynamicField value = openxc::payload::wrapNumber(1);
+    openxc::can::read::publishVehicleMessage("torque_at_transmission", &value,
+            &getConfiguration()->pipeline);
+    ck_assert(outputQueueEmpty());
+    openxc::can::read::publishVehicleMessage("brake_pedal_status", &value,
+            &getConfiguration()->pipeline);
+    ck_assert(!outputQueueEmpty());
+}
+END_TEST
+
+START_TEST (test_subscribe_rate_limits_full)
+{
+    for(int i = 0; i < MAX_SIGNAL_RATE_LIMITS; i++) {
+        ck_assert(openxc::pipeline::setSignalRateLimit(InterfaceType::USB,
+                    10 + i, 1));
+    }
+    uint8_t request[] = "{\"command\": \"subscribe\", \"name\": \"brake_pedal_status\", \"frequency\": 2}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "\"status\":false") != NULL);
+
+    // Not subscribed, so every signal is still sent
+    resetQueues();
+    openxc_DynamicField value = openxc::payload::wrapNumber(1);
+    openxc::can::read::publishVehicleMessage("torque_at_transmission", &value,
+            &getConfiguration()->pipeline);
+    ck_assert(!outputQueueEmpty());
+}
+END_TEST
+
+START_TEST (test_subscribe_unknown_signal)
+{
+    uint8_t request[] = "{\"command\": \"subscribe\", \"name\": \"nope\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    snapshot[sizeof(snapshot) - 1] = NULL;
+    ck_assert(strstr((char*)snapshot, "\"status\":false") != NULL);
+}
+END_TEST
+
+START_TEST (test_unsubscribe_all_command)
+{
+    ck_assert(openxc::pipeline::subscribeToSignal(InterfaceType::USB, 0));
+    uint8_t request[] = "{\"command\": \"unsubscribe\"}\0";
+    ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
+
+    resetQueues();
+    openxc_DynamicField value = openxc::payload::wrapNumber(1);
+    openxc::can::read::publishVehicleMessage("brake_pedal_status", &value,
+            &getConfiguration()->pipeline);
+    ck_assert(!outputQueueEmpty());
+}
+END_TEST
+
+START_TEST (test_validate_subscribe_command)
+{
+    CONTROL_COMMAND.control_command.type =
+            openxc::payload::SUBSCRIBE_COMMAND_TYPE;
+    ck_assert(!validate(&CONTROL_COMMAND));
+
+    CONTROL_COMMAND.has_can_message = true;
+    CONTROL_COMMAND.can_message.has_bus = true;
+    CONTROL_COMMAND.can_message.bus = 1;
+    CONTROL_COMMAND.can_message.has_id = true;
+    CONTROL_COMMAND.can_message.id = 0x42;
+    ck_assert(validate(&CONTROL_COMMAND));
+
+    CONTROL_COMMAND.control_command.type =
+            openxc::payload::UNSUBSCRIBE_COMMAND_TYPE;
+    CONTROL_COMMAND.has_can_message = false;
+    ck_assert(validate(&CONTROL_COMMAND));
+}
+END_TEST
 
 START_TEST (test_validate_raw)
 {
@@ -768,6 +905,14 @@ START_TEST (test_validate_version_command)
 }
 END_TEST
 
+START_TEST (test_validate_metrics_command)
+{
+    CONTROL_COMMAND.control_command.type =
+            openxc::payload::METRICS_COMMAND_TYPE;
+    ck_assert(validate(&CONTROL_COMMAND));
+}
+END_TEST
+
 START_TEST (test_validate_device_platform_command)
 {
     CONTROL_COMMAND.control_command.type = openxc_ControlCommand_Type_PLATFORM;
@@ -851,9 +996,13 @@ END_TEST
 START_TEST (test_payload_format_command)
 {
     uint8_t request[] = "{\"command\": \"payload_format\", \"bus\": 1, \"format\": \"protobuf\"}\0";
-    ck_assert_int_eq(PayloadFormat::JSON, getConfiguration()->payloadFormat);
+    ck_assert_int_eq(PayloadFormat::JSON,
+            openxc::interface::payloadFormat(&DESCRIPTOR));
     ck_assert(handleIncomingMessage(request, sizeof(request), &DESCRIPTOR));
-    ck_assert_int_eq(PayloadFormat::PROTOBUF, getConfiguration()->payloadFormat);
+    ck_assert_int_eq(PayloadFormat::PROTOBUF,
+            openxc::interface::payloadFormat(&DESCRIPTOR));
+    // Only the interface that sent the command changes format
+    ck_assert_int_eq(PayloadFormat::JSON, getConfiguration()->payloadFormat);
 }
 END_TEST
 
@@ -937,6 +1086,11 @@ Suite* suite(void) {
     tcase_add_test(tc_control_commands, test_bypass_command);
     tcase_add_test(tc_control_commands, test_payload_format_command);
     tcase_add_test(tc_control_commands, test_predefined_obd2_command);
+    tcase_add_test(tc_control_commands, test_metrics_command);
+    tcase_add_test(tc_control_commands, test_subscribe_command);
+    tcase_add_test(tc_control_commands, test_subscribe_rate_limits_full);
+    tcase_add_test(tc_control_commands, test_subscribe_unknown_signal);
+    tcase_add_test(tc_control_commands, test_unsubscribe_all_command);
     suite_add_tcase(s, tc_control_commands);
 
     TCase *tc_validation = tcase_create("validation");
@@ -970,6 +1124,8 @@ Suite* suite(void) {
     tcase_add_test(tc_validation, test_validate_bypass_command);
     tcase_add_test(tc_validation, test_validate_payload_format_command);
     tcase_add_test(tc_validation, test_validate_predefined_obd2_command);
+    tcase_add_test(tc_validation, test_validate_metrics_command);
+    tcase_add_test(tc_validation, test_validate_subscribe_command);
     suite_add_tcase(s, tc_validation);
 
     return s;
@@ -10,6 +10,7 @@
 
 namespace diagnostics = openxc::diagnostics;
 namespace usb = openxc::interface::usb;
+namespace messagepool = openxc::util::messagepool;
 
 using openxc::diagnostics::ActiveDiagnosticRequest;
 using openxc::diagnostics::DiagnosticsManager;
@@ -17,12 +18,13 @@ using openxc::signals::getCanBuses;
 using openxc::signals::getCanBusCount;
 using openxc::signals::getMessages;
 using openxc::pipeline::Pipeline;
+using openxc::util::messagepool::MessageQueue;
 using openxc::config::getConfiguration;
 
 extern void initializeVehicleInterface();
 extern long FAKE_TIME;
 
-QUEUE_TYPE(uint8_t)* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue;
+MessageQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].sendQueue;
 
 DiagnosticRequest request = {
     arbitration_id: 0x7e0,
@@ -44,7 +46,7 @@ static bool canQueueEmpty(int bus) {
 }
 
 bool outputQueueEmpty() {
-    return QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE);
+    return messagepool::queueEmpty(OUTPUT_QUEUE);
 }
 
 static void resetQueues() {
@@ -130,8 +132,8 @@ START_TEST (test_simultaneous_recurring_nonrecurring)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, "foo") == NULL);
     ck_assert(strstr((char*)snapshot, "bar") != NULL);
@@ -149,7 +151,7 @@ START_TEST (test_simultaneous_recurring_nonrecurring)
 
     diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager, &getCanBuses()[0],
             &message, &getConfiguration()->pipeline);
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, "foo") == NULL);
     ck_assert(strstr((char*)snapshot, "bar") != NULL);
@@ -162,7 +164,7 @@ START_TEST (test_simultaneous_recurring_nonrecurring)
 
     diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager, &getCanBuses()[0],
             &message, &getConfiguration()->pipeline);
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, "foo") != NULL);
     ck_assert(strstr((char*)snapshot, "bar") == NULL);
@@ -294,8 +296,8 @@ START_TEST (test_add_basic_request)
           &getCanBuses()[0], &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot, "{\"bus\":1,\"id\":2016,\"mode\":1,\"success\":true,\"pid\":2,\"payload\":\"0x45\"}\0");
 }
@@ -313,8 +315,8 @@ START_TEST (test_recognized_obd2_request_overridden)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, "value") != NULL);
     ck_assert(strstr((char*)snapshot, "payload") == NULL);
@@ -331,8 +333,8 @@ START_TEST (test_recognized_obd2_request)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     // only doing OBD-II autodetection for commands, still need to be able to
     // pass NULL to addRequest to say no decoder, and don't put 'value' in.
@@ -386,8 +388,8 @@ START_TEST (test_add_request_other_bus)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot, "{\"name\":\"mypid\",\"value\":69}\0");
 }
@@ -403,8 +405,8 @@ START_TEST (test_add_request_with_name)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot, "{\"name\":\"mypid\",\"value\":69}\0");
 }
@@ -478,8 +480,8 @@ START_TEST (test_add_request_with_name_and_decoder)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert_str_eq((char*)snapshot, "{\"name\":\"mypid\",\"value\":138}\0");
 }
@@ -865,8 +867,8 @@ START_TEST(test_broadcast_response_arb_id)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, "2024") != NULL);
     ck_assert(strstr((char*)snapshot, "2015") == NULL);
@@ -884,8 +886,8 @@ START_TEST(test_passthrough_decoder)
             &message, &getConfiguration()->pipeline);
     fail_if(outputQueueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     ck_assert(strstr((char*)snapshot, "69") != NULL);
 }
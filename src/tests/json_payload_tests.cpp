@@ -1,6 +1,7 @@
 #include <check.h>
 #include <stdint.h>
 #include <string>
+#include <string.h>
 
 #include "commands/commands.h"
 #include "payload/json.h"
@@ -142,6 +143,165 @@ START_TEST (test_predefined_obd2_requests_request)
 }
 END_TEST
 
+START_TEST (test_serialize_simple)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_SIMPLE;
+    message.has_simple_message = true;
+    message.simple_message.has_name = true;
+    strcpy(message.simple_message.name, "fo\"o");
+    message.simple_message.has_value = true;
+    message.simple_message.value.has_type = true;
+    message.simple_message.value.type = openxc_DynamicField_Type_NUM;
+    message.simple_message.value.has_numeric_value = true;
+    message.simple_message.value.numeric_value = 42.5;
+    message.simple_message.has_event = true;
+    message.simple_message.event.has_type = true;
+    message.simple_message.event.type = openxc_DynamicField_Type_BOOL;
+    message.simple_message.event.has_boolean_value = true;
+    message.simple_message.event.boolean_value = true;
+    uint8_t payload[256] = {0};
+
+    const char expected[] = "{\"name\":\"fo\\\"o\",\"value\":42.5,\"event\":true}";
+    ck_assert_int_eq(sizeof(expected),
+            json::serialize(&message, payload, sizeof(payload)));
+    ck_assert_str_eq((char*)payload, expected);
+}
+END_TEST
+
+START_TEST (test_serialize_with_precision)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_SIMPLE;
+    message.has_simple_message = true;
+    message.simple_message.has_name = true;
+    strcpy(message.simple_message.name, "foo");
+    message.simple_message.has_value = true;
+    message.simple_message.value.has_type = true;
+    message.simple_message.value.type = openxc_DynamicField_Type_NUM;
+    message.simple_message.value.has_numeric_value = true;
+    message.simple_message.value.numeric_value = -12.46f;
+    uint8_t payload[256] = {0};
+
+    json::serialize(&message, payload, sizeof(payload), 1);
+    ck_assert_str_eq((char*)payload, "{\"name\":\"foo\",\"value\":-12.5}");
+
+    json::serialize(&message, payload, sizeof(payload), 3);
+    ck_assert_str_eq((char*)payload, "{\"name\":\"foo\",\"value\":-12.46}");
+
+    json::serialize(&message, payload, sizeof(payload), -1);
+    ck_assert_str_eq((char*)payload, "{\"name\":\"foo\",\"value\":-12.46}");
+
+    message.simple_message.value.numeric_value = 0.04;
+    json::serialize(&message, payload, sizeof(payload), 1);
+    ck_assert_str_eq((char*)payload, "{\"name\":\"foo\",\"value\":0}");
+}
+END_TEST
+
+START_TEST (test_serialize_can)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_CAN;
+    message.has_can_message = true;
+    message.can_message.has_bus = true;
+    message.can_message.bus = 1;
+    message.can_message.has_id = true;
+    message.can_message.id = 42;
+    message.can_message.has_data = true;
+    message.can_message.data.size = 3;
+    message.can_message.data.bytes[0] = 0x12;
+    message.can_message.data.bytes[1] = 0xab;
+    message.can_message.data.bytes[2] = 0x0;
+    uint8_t payload[256] = {0};
+
+    const char expected[] = "{\"bus\":1,\"id\":42,\"data\":\"0x12ab00\"}";
+    ck_assert_int_eq(sizeof(expected),
+            json::serialize(&message, payload, sizeof(payload)));
+    ck_assert_str_eq((char*)payload, expected);
+}
+END_TEST
+
+START_TEST (test_serialize_truncated)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_CAN;
+    message.has_can_message = true;
+    message.can_message.has_bus = true;
+    message.can_message.bus = 1;
+    message.can_message.has_id = true;
+    message.can_message.id = 42;
+    uint8_t payload[8];
+    memset(payload, 0xff, sizeof(payload));
+
+    ck_assert_int_eq(4, json::serialize(&message, payload, 4));
+    ck_assert(!memcmp(payload, "{\"bu", 4));
+    ck_assert_int_eq(0xff, payload[4]);
+}
+END_TEST
+
+/* Private: A snapshot of one CAN bus and one interface for the metrics tests.
+ */
+static void fillMetrics(openxc::metrics::MetricsSnapshot* snapshot) {
+    snapshot->busCount = 1;
+    openxc::metrics::BusMetrics* bus = &snapshot->buses[0];
+    bus->address = 1;
+    bus->received = 200;
+    bus->dropped = 3;
+    bus->receiveQueue.highWaterMark = 5;
+    bus->receiveQueue.depth = 8;
+    bus->sendQueue.highWaterMark = 2;
+    bus->sendQueue.depth = 8;
+    bus->sendQueue.overflows = 1;
+    bus->sendQueue.firstOverflowMs = 1500;
+    bus->receiveLatencyUs = 256;
+    bus->receiveLatencyMaxUs = 300;
+    bus->decodeLatencyUs = 128;
+    bus->decodeLatencyMaxUs = 140;
+
+    snapshot->interfaceCount = 1;
+    openxc::metrics::InterfaceMetrics* interface = &snapshot->interfaces[0];
+    interface->name = "usb";
+    interface->sent = 10;
+    interface->bytesSent = 400;
+    interface->maxQueueFill = 68;
+    interface->latencyUs = 512;
+    interface->latencyMaxUs = 700;
+
+    snapshot->loopPasses = 1000;
+    snapshot->loopAverageUs = 85;
+    snapshot->loopMaxUs = 1200;
+}
+
+START_TEST (test_serialize_metrics)
+{
+    openxc::metrics::MetricsSnapshot snapshot = {0};
+    fillMetrics(&snapshot);
+    uint8_t payload[256] = {0};
+
+    const char expected[] = "{\"command_response\":\"metrics\",\"status\":true,"
+            "\"can\":[[1,200,3,5,8,0,0,2,8,1,1500,256,300,128,140]],"
+            "\"out\":[[\"usb\",10,0,400,68,512,700]],"
+            "\"loop\":[1000,85,1200]}";
+    ck_assert_int_eq(sizeof(expected),
+            json::serializeMetrics(&snapshot, payload, sizeof(payload)));
+    ck_assert_str_eq((char*)payload, expected);
+}
+END_TEST
+
+START_TEST (test_serialize_metrics_too_small)
+{
+    openxc::metrics::MetricsSnapshot snapshot = {0};
+    fillMetrics(&snapshot);
+    uint8_t payload[64] = {0};
+    ck_assert_int_eq(0, json::serializeMetrics(&snapshot, payload,
+                sizeof(payload)));
+}
+END_TEST
+
 START_TEST (test_deserialize_can_message_write)
 {
     uint8_t rawRequest[] = "{\"bus\": 1, \"id\": 42, \"data\": \"0x1234\"}\0";
@@ -164,6 +324,76 @@ START_TEST (test_deserialize_can_message_write_with_format)
 }
 END_TEST
 
+START_TEST (test_deserialize_diagnostic_request)
+{
+    uint8_t rawRequest[] = "{\"command\": \"diagnostic_request\", \"action\": \"add\", \"request\": {\"bus\": 1, \"id\": 2015, \"mode\": 34, \"payload\": \"0xf190\", \"frequency\": 0.5, \"name\": \"v\\u00e9\\n\"}}";
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(sizeof(rawRequest),
+            json::deserialize(rawRequest, sizeof(rawRequest), &deserialized));
+    ck_assert(validate(&deserialized));
+    openxc_DiagnosticRequest* request =
+            &deserialized.control_command.diagnostic_request.request;
+    ck_assert_int_eq(openxc_ControlCommand_Type_DIAGNOSTIC,
+            deserialized.control_command.type);
+    ck_assert_int_eq(2015, request->message_id);
+    ck_assert_int_eq(34, request->mode);
+    ck_assert_int_eq(2, request->payload.size);
+    ck_assert_int_eq(0xf1, request->payload.bytes[0]);
+    ck_assert_int_eq(0x90, request->payload.bytes[1]);
+    ck_assert(request->frequency == 0.5);
+    ck_assert_str_eq(request->name, "v\xc3\xa9\n");
+}
+END_TEST
+
+START_TEST (test_deserialize_unrecognized_command)
+{
+    uint8_t rawRequest[] = "{\"command\": \"versions\"}";
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(sizeof(rawRequest),
+            json::deserialize(rawRequest, sizeof(rawRequest), &deserialized));
+    ck_assert(!deserialized.has_control_command);
+}
+END_TEST
+
+START_TEST (test_deserialize_invalid_json)
+{
+    uint8_t rawRequest[] = "{\"bus\": 1, \"id\": }";
+    openxc_VehicleMessage deserialized = {0};
+    // The whole message is consumed, so it doesn't block the ones after it
+    ck_assert_int_eq(sizeof(rawRequest),
+            json::deserialize(rawRequest, sizeof(rawRequest), &deserialized));
+}
+END_TEST
+
+START_TEST (test_deserialize_too_many_tokens)
+{
+    std::string request = "{\"command\": \"version\"";
+    for(int i = 0; i < 40; i++) {
+        request += ", \"field\": 1";
+    }
+    request += "}";
+    size_t tooLongLength = request.length() + 1;
+    request.append(1, '\0');
+    request += "{\"command\": \"version\"}";
+    request.append(1, '\0');
+
+    uint8_t rawRequest[request.length()];
+    memcpy(rawRequest, request.data(), request.length());
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(tooLongLength, json::deserialize(rawRequest,
+                sizeof(rawRequest), &deserialized));
+
+    // The next command is still read
+    openxc_VehicleMessage next = {0};
+    ck_assert_int_eq(sizeof(rawRequest) - tooLongLength,
+            json::deserialize(&rawRequest[tooLongLength],
+                sizeof(rawRequest) - tooLongLength, &next));
+    ck_assert(next.has_control_command);
+    ck_assert_int_eq(openxc_ControlCommand_Type_VERSION,
+            next.control_command.type);
+}
+END_TEST
+
 START_TEST (test_deserialize_message_after_junk)
 {
     uint8_t rawRequest[] = "prime\0{\"bus\": 1, \"id\": 42, \"data\": \"0x1234\"}\0";
@@ -185,9 +415,19 @@ Suite* suite(void) {
     tcase_add_test(tc_json_payload, test_payload_format_request);
     tcase_add_test(tc_json_payload, test_predefined_obd2_requests_response);
     tcase_add_test(tc_json_payload, test_predefined_obd2_requests_request);
+    tcase_add_test(tc_json_payload, test_serialize_simple);
+    tcase_add_test(tc_json_payload, test_serialize_with_precision);
+    tcase_add_test(tc_json_payload, test_serialize_can);
+    tcase_add_test(tc_json_payload, test_serialize_truncated);
+    tcase_add_test(tc_json_payload, test_serialize_metrics);
+    tcase_add_test(tc_json_payload, test_serialize_metrics_too_small);
     tcase_add_test(tc_json_payload, test_deserialize_can_message_write);
     tcase_add_test(tc_json_payload, test_deserialize_can_message_write_with_format);
     tcase_add_test(tc_json_payload, test_deserialize_message_after_junk);
+    tcase_add_test(tc_json_payload, test_deserialize_diagnostic_request);
+    tcase_add_test(tc_json_payload, test_deserialize_unrecognized_command);
+    tcase_add_test(tc_json_payload, test_deserialize_invalid_json);
+    tcase_add_test(tc_json_payload, test_deserialize_too_many_tokens);
     suite_add_tcase(s, tc_json_payload);
 
     return s;
@@ -1,5 +1,6 @@
 #include <check.h>
 #include <stdint.h>
+#include <string.h>
 #include <string>
 
 #include "commands/commands.h"
@@ -175,6 +176,33 @@ START_TEST (test_deserialize_can_message_write_with_format)
 }
 END_TEST
 
+START_TEST (test_deserialize_diagnostic_request)
+{
+    //{"command":"diagnostic_request","request":{"bus":1,"id":2015,"mode":1,
+    //      "pid":12,"payload":"0x0102"},"action":"add"}
+    uint8_t rawRequest[82] = {
+    0x83, 0xA7, 0x63, 0x6F, 0x6D, 0x6D, 0x61, 0x6E, 0x64, 0xB2, 0x64, 0x69,
+    0x61, 0x67, 0x6E, 0x6F, 0x73, 0x74, 0x69, 0x63, 0x5F, 0x72, 0x65, 0x71,
+    0x75, 0x65, 0x73, 0x74, 0xA7, 0x72, 0x65, 0x71, 0x75, 0x65, 0x73, 0x74,
+    0x85, 0xA3, 0x62, 0x75, 0x73, 0x01, 0xA2, 0x69, 0x64, 0xCD, 0x07, 0xDF,
+    0xA4, 0x6D, 0x6F, 0x64, 0x65, 0x01, 0xA3, 0x70, 0x69, 0x64, 0x0C, 0xA7,
+    0x70, 0x61, 0x79, 0x6C, 0x6F, 0x61, 0x64, 0xC4, 0x02, 0x01, 0x02, 0xA6,
+    0x61, 0x63, 0x74, 0x69, 0x6F, 0x6E, 0xA3, 0x61, 0x64, 0x64
+    };
+    openxc_VehicleMessage deserialized = {0};
+    ck_assert_int_eq(sizeof(rawRequest), messagepack::deserialize(rawRequest,
+                sizeof(rawRequest), &deserialized));
+    ck_assert(validate(&deserialized));
+    openxc_DiagnosticRequest* request =
+            &deserialized.control_command.diagnostic_request.request;
+    ck_assert_int_eq(2015, request->message_id);
+    ck_assert_int_eq(12, request->pid);
+    ck_assert_int_eq(2, request->payload.size);
+    ck_assert_int_eq(0x01, request->payload.bytes[0]);
+    ck_assert_int_eq(0x02, request->payload.bytes[1]);
+}
+END_TEST
+
 START_TEST (test_deserialize_message_after_junk)
 {
     
@@ -192,6 +220,98 @@ START_TEST (test_deserialize_message_after_junk)
 END_TEST
 
 
+START_TEST (test_serialize_simple)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_SIMPLE;
+    message.has_simple_message = true;
+    message.simple_message.has_name = true;
+    strcpy(message.simple_message.name, "speed");
+    message.simple_message.has_value = true;
+    message.simple_message.value.has_type = true;
+    message.simple_message.value.type = openxc_DynamicField_Type_NUM;
+    message.simple_message.value.has_numeric_value = true;
+    message.simple_message.value.numeric_value = 42.5;
+    uint8_t payload[256] = {0};
+    const uint8_t expected[] = {0x82, 0xa4, 'n', 'a', 'm', 'e',
+            0xa5, 's', 'p', 'e', 'e', 'd', 0xa5, 'v', 'a', 'l', 'u', 'e',
+            0xca, 0x42, 0x2a, 0x00, 0x00};
+    ck_assert_int_eq(sizeof(expected), messagepack::serialize(&message,
+                payload, sizeof(payload)));
+    ck_assert(!memcmp(expected, payload, sizeof(expected)));
+}
+END_TEST
+
+START_TEST (test_serialize_can)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_CAN;
+    message.has_timestamp = true;
+    message.timestamp = 1332794184319ULL;
+    message.has_can_message = true;
+    message.can_message.has_bus = true;
+    message.can_message.bus = 1;
+    message.can_message.has_id = true;
+    message.can_message.id = 0x7df;
+    message.can_message.has_data = true;
+    message.can_message.data.size = 2;
+    message.can_message.data.bytes[0] = 0x12;
+    message.can_message.data.bytes[1] = 0x34;
+    uint8_t payload[256] = {0};
+    const uint8_t expected[] = {0x84,
+            0xa9, 't', 'i', 'm', 'e', 's', 't', 'a', 'm', 'p',
+            0xcf, 0x00, 0x00, 0x01, 0x36, 0x50, 0xb9, 0x52, 0x7f,
+            0xa3, 'b', 'u', 's', 0x01, 0xa2, 'i', 'd', 0xcd, 0x07, 0xdf,
+            0xa4, 'd', 'a', 't', 'a', 0xc4, 0x02, 0x12, 0x34};
+    ck_assert_int_eq(sizeof(expected), messagepack::serialize(&message,
+                payload, sizeof(payload)));
+    ck_assert(!memcmp(expected, payload, sizeof(expected)));
+}
+END_TEST
+
+START_TEST (test_serialize_too_small)
+{
+    openxc_VehicleMessage message = {0};
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_SIMPLE;
+    message.has_simple_message = true;
+    message.simple_message.has_name = true;
+    strcpy(message.simple_message.name, "speed");
+    uint8_t payload[8] = {0};
+    ck_assert_int_eq(0, messagepack::serialize(&message, payload,
+                sizeof(payload)));
+}
+END_TEST
+
+START_TEST (test_serialize_metrics)
+{
+    openxc::metrics::MetricsSnapshot snapshot = {0};
+    snapshot.interfaceCount = 1;
+    snapshot.interfaces[0].name = "usb";
+    snapshot.interfaces[0].sent = 10;
+    snapshot.interfaces[0].bytesSent = 400;
+    snapshot.interfaces[0].maxQueueFill = 68;
+    snapshot.loopPasses = 1;
+    snapshot.loopAverageUs = 2;
+    snapshot.loopMaxUs = 3;
+    uint8_t payload[256] = {0};
+    const uint8_t expected[] = {0x85,
+            0xb0, 'c', 'o', 'm', 'm', 'a', 'n', 'd', '_',
+                'r', 'e', 's', 'p', 'o', 'n', 's', 'e',
+            0xa7, 'm', 'e', 't', 'r', 'i', 'c', 's',
+            0xa6, 's', 't', 'a', 't', 'u', 's', 0xc3,
+            0xa3, 'c', 'a', 'n', 0x90,
+            0xa3, 'o', 'u', 't', 0x91, 0x97, 0xa3, 'u', 's', 'b',
+                0x0a, 0x00, 0xcd, 0x01, 0x90, 0x44, 0x00, 0x00,
+            0xa4, 'l', 'o', 'o', 'p', 0x93, 0x01, 0x02, 0x03};
+    ck_assert_int_eq(sizeof(expected), messagepack::serializeMetrics(
+                &snapshot, payload, sizeof(payload)));
+    ck_assert(!memcmp(expected, payload, sizeof(expected)));
+}
+END_TEST
+
 Suite* suite(void) {
     Suite* s = suite_create("messagepack_payload");
     TCase *tc_msgpck_payload = tcase_create("messagepack_payload");
@@ -207,6 +327,11 @@ Suite* suite(void) {
     tcase_add_test(tc_msgpck_payload, test_deserialize_can_message_write);
     tcase_add_test(tc_msgpck_payload, test_deserialize_can_message_write_with_format);
     tcase_add_test(tc_msgpck_payload, test_deserialize_message_after_junk);
+    tcase_add_test(tc_msgpck_payload, test_deserialize_diagnostic_request);
+    tcase_add_test(tc_msgpck_payload, test_serialize_simple);
+    tcase_add_test(tc_msgpck_payload, test_serialize_can);
+    tcase_add_test(tc_msgpck_payload, test_serialize_too_small);
+    tcase_add_test(tc_msgpck_payload, test_serialize_metrics);
     suite_add_tcase(s, tc_msgpck_payload);
     return s;
 }
@@ -0,0 +1,359 @@
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+#include "util/messagepool.h"
+
+using openxc::util::messagepool::MessageQueue;
+using openxc::util::messagepool::allocateMessage;
+using openxc::util::messagepool::allocatePriorityMessage;
+using openxc::util::messagepool::releaseMessage;
+using openxc::util::messagepool::messageLength;
+using openxc::util::messagepool::messageTag;
+using openxc::util::messagepool::availableBytes;
+using openxc::util::messagepool::initializeQueue;
+using openxc::util::messagepool::messageFits;
+using openxc::util::messagepool::enqueueMessage;
+using openxc::util::messagepool::priorityMessageFits;
+using openxc::util::messagepool::enqueuePriorityMessage;
+using openxc::util::messagepool::dropOldestMessage;
+using openxc::util::messagepool::queuedBytes;
+using openxc::util::messagepool::queueEmpty;
+using openxc::util::messagepool::readableSpans;
+using openxc::util::messagepool::peekBytes;
+using openxc::util::messagepool::discardBytes;
+using openxc::util::messagepool::dequeueBytes;
+using openxc::util::messagepool::setMessageOrigin;
+using openxc::util::messagepool::messageOrigin;
+using openxc::util::bytebuffer::ByteSpan;
+
+extern unsigned long FAKE_TIME;
+
+MessageQueue queue;
+MessageQueue otherQueue;
+
+void setup() {
+    initializeQueue(&queue);
+    initializeQueue(&otherQueue);
+}
+
+void teardown() {
+}
+
+/* Private: Add a message to both queues, giving up the publisher's reference
+ * like the pipeline does.
+ */
+static void publish(const char* message, int length) {
+    int pooledMessage = allocateMessage((const uint8_t*)message, length, 0);
+    ck_assert(pooledMessage != -1);
+    ck_assert(enqueueMessage(&queue, pooledMessage));
+    ck_assert(enqueueMessage(&otherQueue, pooledMessage));
+    releaseMessage(pooledMessage);
+}
+
+START_TEST (test_empty)
+{
+    fail_unless(queueEmpty(&queue));
+    ck_assert_int_eq(queuedBytes(&queue), 0);
+    ByteSpan spans[2];
+    ck_assert_int_eq(readableSpans(&queue, spans), 0);
+    ck_assert_int_eq(availableBytes(), MESSAGE_POOL_SIZE);
+}
+END_TEST
+
+START_TEST (test_one_copy_for_all_queues)
+{
+    publish("message", 8);
+    ck_assert_int_eq(availableBytes(), MESSAGE_POOL_SIZE - 8);
+
+    uint8_t snapshot[8];
+    ck_assert_int_eq(queuedBytes(&queue), 8);
+    ck_assert_int_eq(peekBytes(&queue, snapshot, sizeof(snapshot)), 8);
+    ck_assert_str_eq((char*)snapshot, "message");
+    ck_assert_int_eq(dequeueBytes(&otherQueue, snapshot, sizeof(snapshot)), 8);
+    ck_assert_str_eq((char*)snapshot, "message");
+    fail_unless(queueEmpty(&otherQueue));
+    fail_if(queueEmpty(&queue));
+}
+END_TEST
+
+START_TEST (test_freed_after_last_queue)
+{
+    publish("message", 8);
+    discardBytes(&queue, 8);
+    fail_unless(queueEmpty(&queue));
+    // Read messages are released lazily, from the main loop
+    ck_assert_int_eq(availableBytes(), MESSAGE_POOL_SIZE - 8);
+
+    fail_unless(messageFits(&queue, 8));
+    ck_assert_int_eq(availableBytes(), MESSAGE_POOL_SIZE - 8);
+
+    discardBytes(&otherQueue, 8);
+    fail_unless(messageFits(&otherQueue, 8));
+    ck_assert_int_eq(availableBytes(), MESSAGE_POOL_SIZE);
+}
+END_TEST
+
+START_TEST (test_long_message)
+{
+    char message[75];
+    for(unsigned int i = 0; i < sizeof(message); i++) {
+        message[i] = i;
+    }
+    publish(message, sizeof(message));
+    // Only the message's own bytes are used
+    ck_assert_int_eq(availableBytes(), MESSAGE_POOL_SIZE - sizeof(message));
+    ck_assert_int_eq(queuedBytes(&queue), sizeof(message));
+
+    // ...and they're contiguous
+    ByteSpan spans[2];
+    ck_assert_int_eq(readableSpans(&queue, spans), 1);
+    ck_assert_int_eq(spans[0].length, sizeof(message));
+    fail_unless(memcmp(spans[0].data, message, sizeof(message)) == 0);
+}
+END_TEST
+
+START_TEST (test_reuse_freed_gap)
+{
+    char message[MESSAGE_QUEUE_MAX_BYTES / 4] = {0};
+    publish("abc", 3);
+    publish(message, sizeof(message));
+    discardBytes(&queue, 3);
+    discardBytes(&otherQueue, 3);
+    fail_unless(messageFits(&queue, 2));
+    fail_unless(messageFits(&otherQueue, 2));
+
+    // The space freed in front of the long message is used again
+    publish("de", 2);
+    ck_assert_int_eq(availableBytes(), MESSAGE_POOL_SIZE - 2 -
+            sizeof(message));
+    ByteSpan spans[2];
+    ck_assert_int_eq(readableSpans(&queue, spans), 2);
+    ck_assert_int_eq(spans[0].length, sizeof(message));
+    fail_unless(memcmp(spans[1].data, "de", 2) == 0);
+    ck_assert(spans[1].data < spans[0].data);
+}
+END_TEST
+
+START_TEST (test_spans_cross_messages)
+{
+    publish("abc", 3);
+    publish("defg", 4);
+    discardBytes(&queue, 1);
+
+    ByteSpan spans[2];
+    ck_assert_int_eq(readableSpans(&queue, spans), 2);
+    ck_assert_int_eq(spans[0].length, 2);
+    fail_unless(memcmp(spans[0].data, "bc", 2) == 0);
+    ck_assert_int_eq(spans[1].length, 4);
+    fail_unless(memcmp(spans[1].data, "defg", 4) == 0);
+
+    discardBytes(&queue, 3);
+    ck_assert_int_eq(queuedBytes(&queue), 3);
+    ck_assert_int_eq(readableSpans(&queue, spans), 1);
+    fail_unless(memcmp(spans[0].data, "efg", 3) == 0);
+
+    discardBytes(&queue, 100);
+    fail_unless(queueEmpty(&queue));
+}
+END_TEST
+
+START_TEST (test_queue_limit)
+{
+    char message[MESSAGE_QUEUE_MAX_BYTES / 8] = {0};
+    for(int i = 0; i < 8; i++) {
+        fail_unless(messageFits(&queue, sizeof(message)));
+        int pooledMessage = allocateMessage((uint8_t*)message,
+                sizeof(message), 0);
+        ck_assert(enqueueMessage(&queue, pooledMessage));
+        releaseMessage(pooledMessage);
+    }
+    fail_if(messageFits(&queue, 1));
+
+    // Another queue can still use the rest of the pool
+    fail_unless(messageFits(&otherQueue, sizeof(message)));
+    int pooledMessage = allocateMessage((uint8_t*)message, sizeof(message),
+            0);
+    ck_assert(pooledMessage != -1);
+    fail_if(enqueueMessage(&queue, pooledMessage));
+    ck_assert(enqueueMessage(&otherQueue, pooledMessage));
+    releaseMessage(pooledMessage);
+    ck_assert_int_eq(messageLength(pooledMessage), sizeof(message));
+    ck_assert_int_eq(queuedBytes(&otherQueue), sizeof(message));
+}
+END_TEST
+
+START_TEST (test_too_long)
+{
+    uint8_t message[MESSAGE_QUEUE_MAX_BYTES + 1] = {0};
+    ck_assert_int_eq(allocateMessage(message, sizeof(message), 0), -1);
+    fail_if(messageFits(&queue, sizeof(message)));
+    fail_if(enqueueMessage(&queue, -1));
+    fail_if(messageFits(NULL, 1));
+}
+END_TEST
+
+START_TEST (test_drop_oldest)
+{
+    int pooledMessage = allocateMessage((const uint8_t*)"abc", 3, 7);
+    ck_assert_int_eq(messageTag(pooledMessage), 7);
+    enqueueMessage(&queue, pooledMessage);
+    releaseMessage(pooledMessage);
+    publish("defg", 4);
+
+    ck_assert_int_eq(dropOldestMessage(&queue), 7);
+    ck_assert_int_eq(queuedBytes(&queue), 4);
+    // Released right away, so the space can be used for a new message
+    ck_assert_int_eq(availableBytes(), MESSAGE_POOL_SIZE - 4);
+
+    // A partly sent message is never dropped
+    discardBytes(&queue, 1);
+    ck_assert_int_eq(dropOldestMessage(&queue), -1);
+    ck_assert_int_eq(queuedBytes(&queue), 3);
+
+    discardBytes(&queue, 3);
+    ck_assert_int_eq(dropOldestMessage(&queue), -1);
+    ck_assert_int_eq(dropOldestMessage(NULL), -1);
+}
+END_TEST
+
+START_TEST (test_priority_read_first)
+{
+    publish("abc", 3);
+    publish("defg", 4);
+    discardBytes(&queue, 1);
+
+    int pooledMessage = allocateMessage((const uint8_t*)"xy", 2, 0);
+    ck_assert(enqueuePriorityMessage(&queue, pooledMessage));
+    releaseMessage(pooledMessage);
+    ck_assert_int_eq(queuedBytes(&queue), 8);
+
+    // The message already started is finished first
+    uint8_t snapshot[8];
+    ck_assert_int_eq(peekBytes(&queue, snapshot, sizeof(snapshot)), 8);
+    fail_unless(memcmp(snapshot, "bcxydefg", 8) == 0);
+
+    ByteSpan spans[2];
+    ck_assert_int_eq(readableSpans(&queue, spans), 2);
+    fail_unless(memcmp(spans[1].data, "xy", 2) == 0);
+
+    discardBytes(&queue, 4);
+    ck_assert_int_eq(dequeueBytes(&queue, snapshot, sizeof(snapshot)), 4);
+    fail_unless(memcmp(snapshot, "defg", 4) == 0);
+    fail_unless(queueEmpty(&queue));
+}
+END_TEST
+
+START_TEST (test_priority_lane_has_own_space)
+{
+    char message[MESSAGE_QUEUE_MAX_BYTES / 8] = {0};
+    while(messageFits(&queue, sizeof(message))) {
+        int pooledMessage = allocateMessage((uint8_t*)message,
+                sizeof(message), 0);
+        ck_assert(enqueueMessage(&queue, pooledMessage));
+        releaseMessage(pooledMessage);
+    }
+
+    fail_unless(priorityMessageFits(&queue, sizeof(message)));
+    int pooledMessage = allocateMessage((const uint8_t*)"xy", 2, 0);
+    ck_assert(pooledMessage != -1);
+    ck_assert(enqueuePriorityMessage(&queue, pooledMessage));
+    releaseMessage(pooledMessage);
+
+    uint8_t snapshot[2];
+    ck_assert_int_eq(peekBytes(&queue, snapshot, sizeof(snapshot)), 2);
+    fail_unless(memcmp(snapshot, "xy", 2) == 0);
+    fail_if(priorityMessageFits(&queue, MESSAGE_QUEUE_PRIORITY_BYTES - 1));
+}
+END_TEST
+
+START_TEST (test_priority_reserve)
+{
+    char message[32] = {0};
+    int pooledMessages[MESSAGE_POOL_MAX_MESSAGES];
+    int count = 0;
+    while((pooledMessages[count] = allocateMessage((uint8_t*)message,
+                    sizeof(message), 0)) != -1) {
+        ++count;
+    }
+    ck_assert_int_eq(availableBytes(), MESSAGE_POOL_PRIORITY_BYTES);
+
+    int reply = allocatePriorityMessage((const uint8_t*)"xy", 2, 0);
+    ck_assert(reply != -1);
+    releaseMessage(reply);
+    for(int i = 0; i < count; i++) {
+        releaseMessage(pooledMessages[i]);
+    }
+    ck_assert_int_eq(availableBytes(), MESSAGE_POOL_SIZE);
+}
+END_TEST
+
+START_TEST (test_initialize_releases)
+{
+    publish("message", 8);
+    initializeQueue(&queue);
+    initializeQueue(&otherQueue);
+    ck_assert_int_eq(availableBytes(), MESSAGE_POOL_SIZE);
+}
+END_TEST
+
+START_TEST (test_latency_recorded_when_sent)
+{
+    FAKE_TIME = 10;
+    int message = allocateMessage((const uint8_t*)"message", 8, 0);
+    ck_assert_int_eq(messageOrigin(message), 0);
+    setMessageOrigin(message, 9000);
+    ck_assert_int_eq(messageOrigin(message), 9000);
+    ck_assert(enqueueMessage(&queue, message));
+    releaseMessage(message);
+
+    discardBytes(&queue, 4);
+    ck_assert_int_eq(queue.latency.count, 0);
+    discardBytes(&queue, 4);
+    ck_assert_int_eq(queue.latency.count, 1);
+    ck_assert_int_eq(queue.latency.max, 1000);
+}
+END_TEST
+
+START_TEST (test_no_latency_without_origin)
+{
+    publish("message", 8);
+    discardBytes(&queue, 8);
+    ck_assert_int_eq(queue.latency.count, 0);
+}
+END_TEST
+
+Suite* messagepoolSuite(void) {
+    Suite* s = suite_create("messagepool");
+    TCase *tc_core = tcase_create("core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_empty);
+    tcase_add_test(tc_core, test_one_copy_for_all_queues);
+    tcase_add_test(tc_core, test_freed_after_last_queue);
+    tcase_add_test(tc_core, test_long_message);
+    tcase_add_test(tc_core, test_reuse_freed_gap);
+    tcase_add_test(tc_core, test_spans_cross_messages);
+    tcase_add_test(tc_core, test_queue_limit);
+    tcase_add_test(tc_core, test_too_long);
+    tcase_add_test(tc_core, test_drop_oldest);
+    tcase_add_test(tc_core, test_priority_read_first);
+    tcase_add_test(tc_core, test_priority_lane_has_own_space);
+    tcase_add_test(tc_core, test_priority_reserve);
+    tcase_add_test(tc_core, test_initialize_releases);
+    tcase_add_test(tc_core, test_latency_recorded_when_sent);
+    tcase_add_test(tc_core, test_no_latency_without_origin);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int numberFailed;
+    Suite* s = messagepoolSuite();
+    SRunner *sr = srunner_create(s);
+    // Don't fork so we can actually use gdb
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    numberFailed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (numberFailed == 0) ? 0 : 1;
+}
@@ -7,26 +7,59 @@
 namespace uart = openxc::interface::uart;
 namespace network = openxc::interface::network;
 namespace usb = openxc::interface::usb;
+namespace messagepool = openxc::util::messagepool;
 
 using openxc::pipeline::Pipeline;
 using openxc::pipeline::MessageClass;
+using openxc::pipeline::droppedMessageCount;
+using openxc::pipeline::EndpointMetrics;
+using openxc::interface::InterfaceType;
+using openxc::interface::BackpressurePolicy;
+using openxc::util::messagepool::MessageQueue;
 using openxc::config::getConfiguration;
+using openxc::payload::PayloadFormat;
 
-QUEUE_TYPE(uint8_t)* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue;
-QUEUE_TYPE(uint8_t)* LOG_QUEUE = &getConfiguration()->usb.endpoints[LOG_ENDPOINT_INDEX].queue;
+MessageQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].sendQueue;
+MessageQueue* LOG_QUEUE = &getConfiguration()->usb.endpoints[LOG_ENDPOINT_INDEX].sendQueue;
 
 extern bool USB_PROCESSED;
 extern bool UART_PROCESSED;
 extern bool NETWORK_PROCESSED;
+extern unsigned long FAKE_TIME;
+
+/* Private: Queue telemetry until the queue or the pool is full.
+ */
+static void fillQueue(MessageQueue* queue) {
+    uint8_t message[32] = {128};
+    while(messagepool::messageFits(queue, sizeof(message))) {
+        int pooledMessage = messagepool::allocateMessage(message,
+                sizeof(message), MessageClass::SIMPLE);
+        if(pooledMessage == -1) {
+            break;
+        }
+        ck_assert(messagepool::enqueueMessage(queue, pooledMessage));
+        messagepool::releaseMessage(pooledMessage);
+    }
+}
 
 void setup() {
     getConfiguration()->pipeline.usb = &getConfiguration()->usb;
     getConfiguration()->pipeline.uart = NULL;
     getConfiguration()->pipeline.network = NULL;
+    // The tests don't fork, so start each one on a new pass of the main loop
+    openxc::pipeline::process(&getConfiguration()->pipeline);
     usb::initialize(&getConfiguration()->usb);
     uart::initialize(&getConfiguration()->uart);
     network::initialize(&getConfiguration()->network);
+    getConfiguration()->network.descriptor.maxBytesPerSecond = 0;
+    getConfiguration()->uart.descriptor.maxBytesPerSecond = 0;
+    getConfiguration()->network.descriptor.hasPayloadFormat = false;
+    getConfiguration()->usb.descriptor.hasPayloadFormat = false;
     getConfiguration()->usb.configured = true;
+    getConfiguration()->payloadFormat = PayloadFormat::JSON;
+    openxc::pipeline::clearSubscriptions(InterfaceType::USB);
+    openxc::pipeline::clearSubscriptions(InterfaceType::UART);
+    openxc::pipeline::clearSubscriptions(InterfaceType::NETWORK);
     USB_PROCESSED = false;
     UART_PROCESSED = false;
     NETWORK_PROCESSED = false;
@@ -37,10 +70,10 @@ START_TEST (test_log_to_usb)
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::LOG);
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, LOG_QUEUE)];
-    ck_assert(QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE));
-    ck_assert(!QUEUE_EMPTY(uint8_t, &getConfiguration()->usb.endpoints[LOG_ENDPOINT_INDEX].queue));
-    QUEUE_SNAPSHOT(uint8_t, &getConfiguration()->usb.endpoints[LOG_ENDPOINT_INDEX].queue, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(LOG_QUEUE)];
+    ck_assert(messagepool::queueEmpty(OUTPUT_QUEUE));
+    ck_assert(!messagepool::queueEmpty(LOG_QUEUE));
+    messagepool::peekBytes(LOG_QUEUE, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 }
 END_TEST
@@ -50,19 +83,33 @@ START_TEST (test_only_usb)
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE)];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE)];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 }
 END_TEST
 
+START_TEST (test_endpoint_metrics)
+{
+    EndpointMetrics before = {0};
+    openxc::pipeline::endpointMetrics(InterfaceType::USB, &before);
+
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+
+    EndpointMetrics after;
+    ck_assert(openxc::pipeline::endpointMetrics(InterfaceType::USB, &after));
+    ck_assert_int_eq(after.sent, before.sent + 1);
+    ck_assert_int_eq(after.bytesSent, before.bytesSent + 8);
+    ck_assert_int_eq(after.dropped, before.dropped);
+}
+END_TEST
+
 START_TEST (test_full_network)
 {
     getConfiguration()->pipeline.network = &getConfiguration()->network;
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) + 1; i++) {
-        QUEUE_PUSH(uint8_t, &getConfiguration()->pipeline.network->sendQueue, (uint8_t) 128);
-    }
-    fail_unless(QUEUE_FULL(uint8_t, &getConfiguration()->pipeline.network->sendQueue));
+    fillQueue(&getConfiguration()->pipeline.network->sendQueue);
+    fail_if(messagepool::messageFits(&getConfiguration()->pipeline.network->sendQueue, 8));
 
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
@@ -72,22 +119,408 @@ END_TEST
 START_TEST (test_full_uart)
 {
     getConfiguration()->pipeline.uart = &getConfiguration()->uart;
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) + 1; i++) {
-        QUEUE_PUSH(uint8_t, &getConfiguration()->pipeline.uart->sendQueue, (uint8_t) 128);
-    }
-    fail_unless(QUEUE_FULL(uint8_t, &getConfiguration()->pipeline.uart->sendQueue));
+    fillQueue(&getConfiguration()->pipeline.uart->sendQueue);
+    fail_if(messagepool::messageFits(&getConfiguration()->pipeline.uart->sendQueue, 8));
+
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+}
+END_TEST
+
+START_TEST (test_full_uart_doesnt_block_usb)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    fillQueue(&getConfiguration()->pipeline.uart->sendQueue);
+
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE)];
+    ck_assert_int_eq(sizeof(snapshot), 8);
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    ck_assert_str_eq((char*)snapshot, "message");
+}
+END_TEST
+
+START_TEST (test_endpoints_share_one_copy)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    getConfiguration()->pipeline.network = &getConfiguration()->network;
+    int availableBytes = messagepool::availableBytes();
+
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    ck_assert_int_eq(messagepool::availableBytes(), availableBytes - 8);
+
+    messagepool::discardBytes(OUTPUT_QUEUE, 8);
+    messagepool::discardBytes(&getConfiguration()->pipeline.uart->sendQueue, 8);
+    messagepool::initializeQueue(&getConfiguration()->pipeline.network->sendQueue);
+    // The message isn't freed until all endpoints have sent it
+    ck_assert_int_eq(messagepool::availableBytes(), availableBytes - 8);
+
+    messagepool::initializeQueue(OUTPUT_QUEUE);
+    messagepool::initializeQueue(&getConfiguration()->pipeline.uart->sendQueue);
+    ck_assert_int_eq(messagepool::availableBytes(), availableBytes);
+}
+END_TEST
+
+START_TEST (test_full_uart_drops_newest)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    fillQueue(&getConfiguration()->pipeline.uart->sendQueue);
+    int queued = messagepool::queuedBytes(&getConfiguration()->uart.sendQueue);
+    unsigned int dropped = droppedMessageCount(InterfaceType::UART,
+            MessageClass::CAN);
+
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::CAN);
+    ck_assert_int_eq(droppedMessageCount(InterfaceType::UART, MessageClass::CAN),
+            dropped + 1);
+    ck_assert_int_eq(messagepool::queuedBytes(&getConfiguration()->uart.sendQueue),
+            queued);
+    // UART was never processed, so a stalled UART can't hold up the loop
+    fail_if(UART_PROCESSED);
+}
+END_TEST
+
+START_TEST (test_full_network_drops_oldest)
+{
+    getConfiguration()->pipeline.network = &getConfiguration()->network;
+    MessageQueue* queue = &getConfiguration()->network.sendQueue;
+    fillQueue(queue);
+    unsigned int dropped = droppedMessageCount(InterfaceType::NETWORK,
+            MessageClass::SIMPLE);
+
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::CAN);
+    ck_assert_int_eq(droppedMessageCount(InterfaceType::NETWORK,
+                MessageClass::SIMPLE), dropped + 1);
+
+    uint8_t snapshot[messagepool::queuedBytes(queue)];
+    messagepool::peekBytes(queue, snapshot, sizeof(snapshot));
+    ck_assert_str_eq((char*)&snapshot[sizeof(snapshot) - 8], "message");
+    fail_if(NETWORK_PROCESSED);
+}
+END_TEST
+
+START_TEST (test_bounded_wait_processes_only_one_endpoint)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    getConfiguration()->pipeline.network = &getConfiguration()->network;
+    getConfiguration()->network.descriptor.backpressurePolicy =
+            BackpressurePolicy::BOUNDED_WAIT;
+    getConfiguration()->network.descriptor.backpressureWaitUs = 1000;
+    fillQueue(&getConfiguration()->network.sendQueue);
+    unsigned int dropped = droppedMessageCount(InterfaceType::NETWORK,
+            MessageClass::SIMPLE);
+
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    // The network never drains, so the message is dropped after the wait
+    fail_unless(NETWORK_PROCESSED);
+    ck_assert_int_eq(droppedMessageCount(InterfaceType::NETWORK,
+                MessageClass::SIMPLE), dropped + 1);
+    fail_if(USB_PROCESSED);
+    fail_if(UART_PROCESSED);
+}
+END_TEST
+
+START_TEST (test_bounded_wait_once_per_pass)
+{
+    getConfiguration()->pipeline.network = &getConfiguration()->network;
+    getConfiguration()->network.descriptor.backpressurePolicy =
+            BackpressurePolicy::BOUNDED_WAIT;
+    getConfiguration()->network.descriptor.backpressureWaitUs = 1000;
+    fillQueue(&getConfiguration()->network.sendQueue);
+    unsigned int dropped = droppedMessageCount(InterfaceType::NETWORK,
+            MessageClass::SIMPLE);
+
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    fail_unless(NETWORK_PROCESSED);
+
+    // The wait ran out, so the rest of the pass drops without waiting
+    NETWORK_PROCESSED = false;
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    fail_if(NETWORK_PROCESSED);
+    ck_assert_int_eq(droppedMessageCount(InterfaceType::NETWORK,
+                MessageClass::SIMPLE), dropped + 2);
+
+    openxc::pipeline::process(&getConfiguration()->pipeline);
+    NETWORK_PROCESSED = false;
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    fail_unless(NETWORK_PROCESSED);
+}
+END_TEST
+
+START_TEST (test_full_usb_waits)
+{
+    fillQueue(OUTPUT_QUEUE);
 
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    fail_unless(USB_PROCESSED);
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE)];
+    ck_assert_int_eq(sizeof(snapshot), 8);
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    ck_assert_str_eq((char*)snapshot, "message");
+}
+END_TEST
+
+START_TEST (test_command_response_skips_telemetry)
+{
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
+    const char* response = "reply";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)response, 6,
+            MessageClass::COMMAND_RESPONSE);
+
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE)];
+    ck_assert_int_eq(sizeof(snapshot), 14);
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    ck_assert_str_eq((char*)snapshot, "reply");
+    ck_assert_str_eq((char*)&snapshot[6], "message");
+}
+END_TEST
+
+START_TEST (test_full_network_still_sends_diagnostic_response)
+{
+    getConfiguration()->pipeline.network = &getConfiguration()->network;
+    MessageQueue* queue = &getConfiguration()->network.sendQueue;
+    fillQueue(queue);
+    unsigned int dropped = droppedMessageCount(InterfaceType::NETWORK,
+            MessageClass::SIMPLE);
+
+    const char* response = "reply";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)response, 6,
+            MessageClass::DIAGNOSTIC);
+    ck_assert_int_eq(droppedMessageCount(InterfaceType::NETWORK,
+                MessageClass::SIMPLE), dropped);
+
+    uint8_t snapshot[6];
+    messagepool::peekBytes(queue, snapshot, sizeof(snapshot));
+    ck_assert_str_eq((char*)snapshot, "reply");
+}
+END_TEST
+
+START_TEST (test_full_usb_and_uart_still_send_command_response)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    MessageQueue* uartQueue = &getConfiguration()->uart.sendQueue;
+    fillQueue(OUTPUT_QUEUE);
+    fillQueue(uartQueue);
+    // Telemetry has taken all of the pool it's allowed
+    uint8_t telemetry[8] = {0};
+    ck_assert_int_eq(messagepool::allocateMessage(telemetry,
+                sizeof(telemetry), MessageClass::SIMPLE), -1);
+
+    const char* response = "reply";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)response, 6,
+            MessageClass::COMMAND_RESPONSE);
+
+    uint8_t snapshot[6];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    ck_assert_str_eq((char*)snapshot, "reply");
+    messagepool::peekBytes(uartQueue, snapshot, sizeof(snapshot));
+    ck_assert_str_eq((char*)snapshot, "reply");
+}
+END_TEST
+
+static openxc_VehicleMessage simpleMessage() {
+    openxc_VehicleMessage message = openxc_VehicleMessage();
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_SIMPLE;
+    message.has_simple_message = true;
+    message.simple_message.has_name = true;
+    strcpy(message.simple_message.name, "foo");
+    message.simple_message.has_value = true;
+    message.simple_message.value.has_type = true;
+    message.simple_message.value.type = openxc_DynamicField_Type_NUM;
+    message.simple_message.value.numeric_value = 42;
+    return message;
+}
+
+START_TEST (test_publish_without_subscriptions)
+{
+    openxc_VehicleMessage message = simpleMessage();
+    openxc::pipeline::publishSignal(&message, 3, &getConfiguration()->pipeline);
+    ck_assert(!messagepool::queueEmpty(OUTPUT_QUEUE));
+}
+END_TEST
+
+START_TEST (test_publish_unsubscribed_signal)
+{
+    ck_assert(openxc::pipeline::subscribeToSignal(InterfaceType::USB, 2));
+    openxc_VehicleMessage message = simpleMessage();
+    openxc::pipeline::publishSignal(&message, 3, &getConfiguration()->pipeline);
+    ck_assert(messagepool::queueEmpty(OUTPUT_QUEUE));
+
+    openxc::pipeline::publishSignal(&message, 2, &getConfiguration()->pipeline);
+    ck_assert(!messagepool::queueEmpty(OUTPUT_QUEUE));
+}
+END_TEST
+
+START_TEST (test_publish_to_subscribed_interface_only)
+{
+    getConfiguration()->pipeline.network = &getConfiguration()->network;
+    ck_assert(openxc::pipeline::subscribeToSignal(InterfaceType::NETWORK, 2));
+    openxc_VehicleMessage message = simpleMessage();
+    openxc::pipeline::publishSignal(&message, 3, &getConfiguration()->pipeline);
+    ck_assert(!messagepool::queueEmpty(OUTPUT_QUEUE));
+    ck_assert(messagepool::queueEmpty(
+                &getConfiguration()->network.sendQueue));
+}
+END_TEST
+
+START_TEST (test_unsubscribe_receives_everything)
+{
+    ck_assert(openxc::pipeline::subscribeToSignal(InterfaceType::USB, 2));
+    ck_assert(openxc::pipeline::unsubscribeFromSignal(InterfaceType::USB, 2));
+    ck_assert(!openxc::pipeline::unsubscribeFromSignal(InterfaceType::USB, 2));
+    openxc_VehicleMessage message = simpleMessage();
+    openxc::pipeline::publishSignal(&message, 3, &getConfiguration()->pipeline);
+    ck_assert(!messagepool::queueEmpty(OUTPUT_QUEUE));
+}
+END_TEST
+
+START_TEST (test_publish_unsubscribed_can_message)
+{
+    ck_assert(openxc::pipeline::subscribeToCanMessage(InterfaceType::USB, 1,
+                0x42));
+    openxc_VehicleMessage message = openxc_VehicleMessage();
+    message.has_type = true;
+    message.type = openxc_VehicleMessage_Type_CAN;
+    message.has_can_message = true;
+    message.can_message.has_bus = true;
+    message.can_message.bus = 1;
+    message.can_message.has_id = true;
+    message.can_message.id = 0x43;
+    message.can_message.has_data = true;
+    message.can_message.data.size = 1;
+    openxc::pipeline::publish(&message, &getConfiguration()->pipeline);
+    ck_assert(messagepool::queueEmpty(OUTPUT_QUEUE));
+
+    message.can_message.id = 0x42;
+    openxc::pipeline::publish(&message, &getConfiguration()->pipeline);
+    ck_assert(!messagepool::queueEmpty(OUTPUT_QUEUE));
+}
+END_TEST
+
+START_TEST (test_signal_rate_limit)
+{
+    ck_assert(openxc::pipeline::setSignalRateLimit(InterfaceType::USB, 2, 1));
+    openxc_VehicleMessage message = simpleMessage();
+    openxc::pipeline::publishSignal(&message, 2, &getConfiguration()->pipeline);
+    ck_assert(!messagepool::queueEmpty(OUTPUT_QUEUE));
+    unsigned int queued = messagepool::queuedBytes(OUTPUT_QUEUE);
+
+    openxc::pipeline::publishSignal(&message, 2, &getConfiguration()->pipeline);
+    ck_assert_int_eq(messagepool::queuedBytes(OUTPUT_QUEUE), queued);
+
+    // Other signals aren't limited
+    openxc::pipeline::publishSignal(&message, 3, &getConfiguration()->pipeline);
+    ck_assert(messagepool::queuedBytes(OUTPUT_QUEUE) > queued);
+    queued = messagepool::queuedBytes(OUTPUT_QUEUE);
+
+    FAKE_TIME += 1000;
+    openxc::pipeline::publishSignal(&message, 2, &getConfiguration()->pipeline);
+    ck_assert(messagepool::queuedBytes(OUTPUT_QUEUE) > queued);
+}
+END_TEST
+
+START_TEST (test_byte_rate_limit)
+{
+    getConfiguration()->pipeline.network = &getConfiguration()->network;
+    getConfiguration()->network.descriptor.maxBytesPerSecond = 10;
+    MessageQueue* queue = &getConfiguration()->network.sendQueue;
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8,
+            MessageClass::SIMPLE);
+    ck_assert_int_eq(messagepool::queuedBytes(queue), 8);
+
+    unsigned int dropped = droppedMessageCount(InterfaceType::NETWORK,
+            MessageClass::SIMPLE);
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8,
+            MessageClass::SIMPLE);
+    ck_assert_int_eq(messagepool::queuedBytes(queue), 8);
+    ck_assert_int_eq(droppedMessageCount(InterfaceType::NETWORK,
+                MessageClass::SIMPLE), dropped + 1);
+    // USB has no limit
+    ck_assert_int_eq(messagepool::queuedBytes(OUTPUT_QUEUE), 16);
+
+    // Replies aren't limited
+    const char* response = "reply";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)response, 6,
+            MessageClass::COMMAND_RESPONSE);
+    ck_assert_int_eq(messagepool::queuedBytes(queue), 14);
+
+    FAKE_TIME += 1000;
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8,
+            MessageClass::SIMPLE);
+    ck_assert_int_eq(messagepool::queuedBytes(queue), 22);
+}
+END_TEST
+
+START_TEST (test_dropped_message_keeps_bytes)
+{
+    getConfiguration()->pipeline.uart = &getConfiguration()->uart;
+    getConfiguration()->uart.descriptor.maxBytesPerSecond = 10;
+    fillQueue(&getConfiguration()->uart.sendQueue);
+    const char* message = "message";
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8,
+            MessageClass::SIMPLE);
+
+    // The full queue dropped the message, so the bytes are still available
+    uart::initialize(&getConfiguration()->uart);
+    getConfiguration()->uart.descriptor.maxBytesPerSecond = 10;
+    sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8,
+            MessageClass::SIMPLE);
+    ck_assert_int_eq(messagepool::queuedBytes(
+                &getConfiguration()->uart.sendQueue), 8);
+}
+END_TEST
+
+START_TEST (test_rate_limit_without_subscription)
+{
+    ck_assert(openxc::pipeline::setSignalRateLimit(InterfaceType::USB, 2, 1));
+    openxc_VehicleMessage message = simpleMessage();
+    strcpy(message.simple_message.name, "brake_pedal_status");
+    openxc::pipeline::publish(&message, &getConfiguration()->pipeline);
+    unsigned int queued = messagepool::queuedBytes(OUTPUT_QUEUE);
+    ck_assert(queued > 0);
+
+    openxc::pipeline::publish(&message, &getConfiguration()->pipeline);
+    ck_assert_int_eq(messagepool::queuedBytes(OUTPUT_QUEUE), queued);
+}
+END_TEST
+
+START_TEST (test_publish_in_each_interface_format)
+{
+    getConfiguration()->pipeline.network = &getConfiguration()->network;
+    getConfiguration()->network.descriptor.hasPayloadFormat = true;
+    getConfiguration()->network.descriptor.payloadFormat =
+            PayloadFormat::PROTOBUF;
+    openxc_VehicleMessage message = simpleMessage();
+    openxc::pipeline::publish(&message, &getConfiguration()->pipeline);
+
+    MessageQueue* networkQueue = &getConfiguration()->network.sendQueue;
+    ck_assert(!messagepool::queueEmpty(OUTPUT_QUEUE));
+    ck_assert(!messagepool::queueEmpty(networkQueue));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE)];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    ck_assert_int_eq(snapshot[0], '{');
+    uint8_t networkSnapshot[messagepool::queuedBytes(networkQueue)];
+    messagepool::peekBytes(networkQueue, networkSnapshot,
+            sizeof(networkSnapshot));
+    ck_assert(networkSnapshot[0] != '{');
+    ck_assert(sizeof(networkSnapshot) < sizeof(snapshot));
 }
 END_TEST
 
 START_TEST (test_full_usb)
 {
-    for(int i = 0; i < QUEUE_MAX_LENGTH(uint8_t) + 1; i++) {
-        QUEUE_PUSH(uint8_t, OUTPUT_QUEUE, (uint8_t) 128);
-    }
-    fail_unless(QUEUE_FULL(uint8_t, OUTPUT_QUEUE));
+    fillQueue(OUTPUT_QUEUE);
+    fail_if(messagepool::messageFits(OUTPUT_QUEUE, 8));
 
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
@@ -100,11 +533,11 @@ START_TEST (test_with_uart)
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE)];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE)];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 
-    QUEUE_SNAPSHOT(uint8_t, &getConfiguration()->pipeline.uart->sendQueue, snapshot, sizeof(snapshot));
+    messagepool::peekBytes(&getConfiguration()->pipeline.uart->sendQueue, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 }
 END_TEST
@@ -116,14 +549,14 @@ START_TEST (test_with_uart_and_network)
     const char* message = "message";
     sendMessage(&getConfiguration()->pipeline, (uint8_t*)message, 8, MessageClass::SIMPLE);
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE)];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE)];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 
-    QUEUE_SNAPSHOT(uint8_t, &getConfiguration()->pipeline.uart->sendQueue, snapshot, sizeof(snapshot));
+    messagepool::peekBytes(&getConfiguration()->pipeline.uart->sendQueue, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 
-    QUEUE_SNAPSHOT(uint8_t, &getConfiguration()->pipeline.network->sendQueue, snapshot, sizeof(snapshot));
+    messagepool::peekBytes(&getConfiguration()->pipeline.network->sendQueue, snapshot, sizeof(snapshot));
     ck_assert_str_eq((char*)snapshot, "message");
 }
 END_TEST
@@ -163,15 +596,36 @@ Suite* pipelineSuite(void) {
     TCase *tc_core = tcase_create("core");
     tcase_add_checked_fixture(tc_core, setup, NULL);
     tcase_add_test(tc_core, test_only_usb);
+    tcase_add_test(tc_core, test_endpoint_metrics);
     tcase_add_test(tc_core, test_with_uart);
     tcase_add_test(tc_core, test_with_uart_and_network);
     tcase_add_test(tc_core, test_full_usb);
     tcase_add_test(tc_core, test_full_uart);
     tcase_add_test(tc_core, test_full_network);
+    tcase_add_test(tc_core, test_full_uart_doesnt_block_usb);
+    tcase_add_test(tc_core, test_endpoints_share_one_copy);
+    tcase_add_test(tc_core, test_full_uart_drops_newest);
+    tcase_add_test(tc_core, test_full_network_drops_oldest);
+    tcase_add_test(tc_core, test_bounded_wait_processes_only_one_endpoint);
+    tcase_add_test(tc_core, test_bounded_wait_once_per_pass);
+    tcase_add_test(tc_core, test_full_usb_waits);
+    tcase_add_test(tc_core, test_command_response_skips_telemetry);
+    tcase_add_test(tc_core, test_full_network_still_sends_diagnostic_response);
+    tcase_add_test(tc_core, test_full_usb_and_uart_still_send_command_response);
     tcase_add_test(tc_core, test_process_all);
     tcase_add_test(tc_core, test_process_usb_and_uart);
     tcase_add_test(tc_core, test_process_usb);
     tcase_add_test(tc_core, test_log_to_usb);
+    tcase_add_test(tc_core, test_publish_without_subscriptions);
+    tcase_add_test(tc_core, test_publish_unsubscribed_signal);
+    tcase_add_test(tc_core, test_publish_to_subscribed_interface_only);
+    tcase_add_test(tc_core, test_unsubscribe_receives_everything);
+    tcase_add_test(tc_core, test_publish_unsubscribed_can_message);
+    tcase_add_test(tc_core, test_signal_rate_limit);
+    tcase_add_test(tc_core, test_byte_rate_limit);
+    tcase_add_test(tc_core, test_dropped_message_keeps_bytes);
+    tcase_add_test(tc_core, test_rate_limit_without_subscription);
+    tcase_add_test(tc_core, test_publish_in_each_interface_format);
     suite_add_tcase(s, tc_core);
 
     return s;
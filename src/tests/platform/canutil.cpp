@@ -1,13 +1,28 @@
 #include "canutil_spy.h"
 
 static bool _acceptanceFiltersUpdated = false;
+static int _acceptanceFilterTableUpdates = 0;
+static bool _failNextAcceptanceFilterTableUpdate = false;
 
 bool openxc::can::spy::acceptanceFiltersUpdated() {
     return _acceptanceFiltersUpdated;
 }
 
+int openxc::can::spy::acceptanceFilterTableUpdates() {
+    return _acceptanceFilterTableUpdates;
+}
+
+void openxc::can::spy::failNextAcceptanceFilterTableUpdate() {
+    _failNextAcceptanceFilterTableUpdate = true;
+}
+
 bool openxc::can::updateAcceptanceFilterTable(CanBus* buses, const int busCount) {
     _acceptanceFiltersUpdated = true;
+    ++_acceptanceFilterTableUpdates;
+    if(_failNextAcceptanceFilterTableUpdate) {
+        _failNextAcceptanceFilterTableUpdate = false;
+        return false;
+    }
     return true;
 }
 
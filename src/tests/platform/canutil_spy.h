@@ -8,6 +8,8 @@ namespace can {
 namespace spy {
 
 bool acceptanceFiltersUpdated();
+int acceptanceFilterTableUpdates();
+void failNextAcceptanceFilterTableUpdate();
 
 } // spy
 } // can
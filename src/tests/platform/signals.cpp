@@ -188,6 +188,15 @@ CanCommand COMMANDS[][MAX_COMMAND_COUNT] = {
     },
 };
 
+#ifdef __TABLE_DRIVEN_DECODING__
+const openxc::can::read::MessageDecoder* openxc::signals::getMessageDecoders() {
+    return NULL;
+}
+
+int openxc::signals::getMessageDecoderCount() {
+    return 0;
+}
+#else
 void openxc::signals::decodeCanMessage(Pipeline* pipeline, CanBus* bus, CanMessage* message) {
     switch(getConfiguration()->messageSetIndex) {
     case 0: // message set: tests
@@ -206,6 +215,7 @@ void openxc::signals::decodeCanMessage(Pipeline* pipeline, CanBus* bus, CanMessa
         break;
     }
 }
+#endif
 
 
 CanCommand* openxc::signals::getCommands() {
@@ -8,4 +8,8 @@ unsigned long openxc::util::time::systemTimeMs() {
     return FAKE_TIME;
 }
 
+unsigned long openxc::util::time::systemTimeUs() {
+    return FAKE_TIME * 1000;
+}
+
 void openxc::util::time::initialize() { }
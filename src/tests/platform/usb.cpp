@@ -5,6 +5,8 @@
 #include <stdarg.h>
 
 using openxc::util::bytebuffer::IncomingMessageCallback;
+using openxc::util::messagepool::queuedBytes;
+using openxc::util::messagepool::dequeueBytes;
 
 bool USB_PROCESSED = false;
 uint8_t LAST_CONTROL_COMMAND_PAYLOAD[256];
@@ -17,10 +19,9 @@ void openxc::interface::usb::processSendQueue(UsbDevice* usbDevice) {
         UsbEndpoint* endpoint = &usbDevice->endpoints[i];
         if(endpoint->direction == UsbEndpointDirection::USB_ENDPOINT_DIRECTION_IN) {
             printf("USB endpoint %d buffer:\n", i);
-            uint8_t snapshot[QUEUE_LENGTH(uint8_t, &endpoint->queue) + 1];
-            QUEUE_SNAPSHOT(uint8_t, &endpoint->queue, snapshot, sizeof(snapshot));
+            uint8_t snapshot[queuedBytes(&endpoint->sendQueue) + 1];
+            dequeueBytes(&endpoint->sendQueue, snapshot, sizeof(snapshot));
             SENT_BYTES += sizeof(snapshot);
-            QUEUE_INIT(uint8_t, &endpoint->queue);
             for(size_t i = 0; i < sizeof(snapshot) - 1; i++) {
                 if(snapshot[i] == 0) {
                     printf("\n");
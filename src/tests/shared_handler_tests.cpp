@@ -6,6 +6,7 @@
 #include "signals.h"
 
 namespace usb = openxc::interface::usb;
+namespace messagepool = openxc::util::messagepool;
 
 using openxc::can::write::encodeState;
 using openxc::can::write::encodeNumber;
@@ -17,15 +18,16 @@ using openxc::signals::handlers::doorStatusDecoder;
 using openxc::signals::handlers::handleFuelFlow;
 using openxc::signals::handlers::handleInverted;
 using openxc::pipeline::Pipeline;
+using openxc::util::messagepool::MessageQueue;
 using openxc::signals::getSignalCount;
 using openxc::signals::getSignals;
 using openxc::signals::getCanBuses;
 using openxc::config::getConfiguration;
 
-QUEUE_TYPE(uint8_t)* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].queue;
+MessageQueue* OUTPUT_QUEUE = &getConfiguration()->usb.endpoints[IN_ENDPOINT_INDEX].sendQueue;
 
 bool queueEmpty() {
-    return QUEUE_EMPTY(uint8_t, OUTPUT_QUEUE);
+    return messagepool::queueEmpty(OUTPUT_QUEUE);
 }
 
 void setup() {
@@ -85,8 +87,8 @@ START_TEST (test_button_event_handler_correct_types)
             &getConfiguration()->pipeline);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     fail_if(strstr((char*)snapshot, "event") == NULL);
     fail_if(strstr((char*)snapshot, "value") == NULL);
@@ -122,8 +124,8 @@ START_TEST (test_tire_pressure_as_decoder)
     openxc::can::read::decodeSignal(signal, &message, getSignals(), getSignalCount(), &send);
     fail_if(queueEmpty());
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     fail_if(strstr((char*)snapshot, "front_left") == NULL);
 }
@@ -139,8 +141,8 @@ START_TEST (test_tire_pressure_handler)
     fail_if(queueEmpty());
     ck_assert_str_eq(decodedTireId.string_value, "front_left");
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     fail_if(strstr((char*)snapshot, "front_left") == NULL);
 }
@@ -179,8 +181,8 @@ START_TEST (test_door_handler)
     fail_if(queueEmpty());
     ck_assert_str_eq(decodedDoorId.string_value, "driver");
 
-    uint8_t snapshot[QUEUE_LENGTH(uint8_t, OUTPUT_QUEUE) + 1];
-    QUEUE_SNAPSHOT(uint8_t, OUTPUT_QUEUE, snapshot, sizeof(snapshot));
+    uint8_t snapshot[messagepool::queuedBytes(OUTPUT_QUEUE) + 1];
+    messagepool::peekBytes(OUTPUT_QUEUE, snapshot, sizeof(snapshot));
     snapshot[sizeof(snapshot) - 1] = NULL;
     fail_if(strstr((char*)snapshot, "driver") == NULL);
 }
@@ -5,6 +5,7 @@
 
 using openxc::util::statistics::Statistic;
 using openxc::util::statistics::DeltaStatistic;
+using openxc::util::statistics::Histogram;
 
 namespace statistics = openxc::util::statistics;
 
@@ -93,6 +94,76 @@ START_TEST (test_delta_stat_exponential_average)
 }
 END_TEST
 
+START_TEST (test_histogram_buckets)
+{
+    Histogram histogram;
+    statistics::initialize(&histogram);
+    statistics::record(&histogram, 0);
+    statistics::record(&histogram, HISTOGRAM_FIRST_BUCKET_US - 1);
+    statistics::record(&histogram, HISTOGRAM_FIRST_BUCKET_US);
+    statistics::record(&histogram, HISTOGRAM_FIRST_BUCKET_US * 3);
+    ck_assert_int_eq(histogram.count, 4);
+    ck_assert_int_eq(histogram.buckets[0], 2);
+    ck_assert_int_eq(histogram.buckets[1], 1);
+    ck_assert_int_eq(histogram.buckets[2], 1);
+    ck_assert_int_eq(histogram.max, HISTOGRAM_FIRST_BUCKET_US * 3);
+}
+END_TEST
+
+START_TEST (test_histogram_overflow_bucket)
+{
+    Histogram histogram;
+    statistics::initialize(&histogram);
+    statistics::record(&histogram, 0xffffffff);
+    ck_assert_int_eq(histogram.buckets[HISTOGRAM_BUCKET_COUNT - 1], 1);
+    ck_assert_int_eq(statistics::bucketLimitUs(HISTOGRAM_BUCKET_COUNT - 1), 0);
+    ck_assert_int_eq(statistics::bucketLimitUs(1),
+            HISTOGRAM_FIRST_BUCKET_US * 2);
+}
+END_TEST
+
+START_TEST (test_histogram_format)
+{
+    Histogram histogram;
+    statistics::initialize(&histogram);
+    char buffer[128];
+    statistics::formatBuckets(&histogram, buffer, sizeof(buffer));
+    ck_assert_str_eq(buffer, "0");
+
+    statistics::record(&histogram, 0);
+    statistics::record(&histogram, HISTOGRAM_FIRST_BUCKET_US);
+    statistics::record(&histogram, HISTOGRAM_FIRST_BUCKET_US * 4);
+    statistics::formatBuckets(&histogram, buffer, sizeof(buffer));
+    ck_assert_str_eq(buffer, "1,1,0,1");
+
+    char small[4];
+    int written = statistics::formatBuckets(&histogram, small, sizeof(small));
+    ck_assert_int_eq(written, 3);
+    ck_assert_str_eq(small, "1,1");
+}
+END_TEST
+
+START_TEST (test_histogram_percentile)
+{
+    Histogram histogram;
+    statistics::initialize(&histogram);
+    ck_assert_int_eq(statistics::percentileUs(&histogram, 99), 0);
+
+    for(int i = 0; i < 98; i++) {
+        statistics::record(&histogram, 10);
+    }
+    statistics::record(&histogram, HISTOGRAM_FIRST_BUCKET_US * 3);
+    statistics::record(&histogram, HISTOGRAM_FIRST_BUCKET_US * 5);
+    ck_assert_int_eq(statistics::percentileUs(&histogram, 50),
+            HISTOGRAM_FIRST_BUCKET_US);
+    ck_assert_int_eq(statistics::percentileUs(&histogram, 99),
+            HISTOGRAM_FIRST_BUCKET_US * 4);
+    // The bound of the last sample's bucket is capped at the largest sample
+    ck_assert_int_eq(statistics::percentileUs(&histogram, 100),
+            HISTOGRAM_FIRST_BUCKET_US * 5);
+}
+END_TEST
+
 Suite* suite(void) {
     Suite* s = suite_create("statistics");
     TCase *tc_core = tcase_create("core");
@@ -103,6 +174,10 @@ Suite* suite(void) {
     tcase_add_test(tc_core, test_delta_stat_min_max);
     tcase_add_test(tc_core, test_delta_stat_exponential_average);
     tcase_add_test(tc_core, test_average_starts_at_first_value);
+    tcase_add_test(tc_core, test_histogram_buckets);
+    tcase_add_test(tc_core, test_histogram_overflow_bucket);
+    tcase_add_test(tc_core, test_histogram_format);
+    tcase_add_test(tc_core, test_histogram_percentile);
     suite_add_tcase(s, tc_core);
 
     return s;
@@ -8,6 +8,12 @@ TEST_OBJDIR = build/$(TEST_DIR)
 
 TEST_SRC=$(wildcard $(TEST_DIR)/*_tests.cpp)
 TESTS=$(patsubst %.cpp,$(TEST_OBJDIR)/%.bin,$(TEST_SRC))
+
+# Benchmarks are built with optimizations and without coverage, so they get
+# their own build directory
+BENCHMARK_OBJDIR = build/benchmarks
+BENCHMARK_SRC=$(wildcard $(TEST_DIR)/benchmarks/*_benchmark.cpp)
+BENCHMARKS=$(patsubst %.cpp,$(BENCHMARK_OBJDIR)/%.bin,$(BENCHMARK_SRC))
 TEST_LIBS = -lcheck -lrt -lpthread -lsubunit
 
 NON_TESTABLE_SRCS = signals.cpp main.cpp hardware_tests_main.cpp
@@ -19,6 +25,7 @@ TEST_CPP_SRCS := $(filter-out $(NON_TESTABLE_SRCS),$(TEST_CPP_SRCS))
 
 TEST_OBJ_FILES = $(TEST_C_SRCS:.c=.o) $(TEST_CPP_SRCS:.cpp=.o)
 TEST_OBJS = $(patsubst %,$(TEST_OBJDIR)/%,$(TEST_OBJ_FILES))
+BENCHMARK_OBJS = $(patsubst %,$(BENCHMARK_OBJDIR)/%,$(TEST_OBJ_FILES))
 
 GENERATOR = openxc-generate-firmware-code -s ../examples
 EXAMPLE_CONFIG_DIR = ../examples
@@ -117,6 +124,18 @@ unit_tests: $(TESTS)
 	@export SHELLOPTS
 	@sh tests/runtests.sh $(TEST_OBJDIR)/$(TEST_DIR)
 
+benchmarks: LD = $(TEST_LD)
+benchmarks: CC = $(TEST_CC)
+benchmarks: CXX = $(TEST_CXX)
+benchmarks: CPPFLAGS = -I/usr/local -c -Wall -Werror -O2
+benchmarks: CFLAGS = $(CC_SUPRESSED_ERRORS) $(CFLAGS_STD)
+benchmarks: CXXFLAGS =  $(CXX_SUPRESSED_ERRORS) $(CXXFLAGS_STD)
+benchmarks: LDFLAGS = -lm
+benchmarks: LDLIBS = -lrt -lpthread
+benchmarks: INCLUDE_PATHS += -I./tests/platform/ -I./tests/benchmarks/
+benchmarks: $(BENCHMARKS)
+	@for benchmark in $(BENCHMARKS); do ./$$benchmark || exit 1; done
+
 $(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, default_compile_test, DEBUG=0, code_generation_test))
 $(eval $(call MSD_PLATFORMS_TEST_TEMPLATE, msd_default_compile_test, DEBUG=0 MSD_ENABLE=1, code_generation_test))
 $(eval $(call ALL_PLATFORMS_TEST_TEMPLATE, diag_compile_test, DEBUG=0, diagnostic_code_generation_test))
@@ -200,5 +219,17 @@ $(TEST_OBJDIR)/%.bin: $(TEST_OBJDIR)/%.o $(TEST_OBJS)
 	@mkdir -p $(dir $@)
 	$(LD) $(LDFLAGS) $(CC_SYMBOLS) $(CXXFLAGS) $(INCLUDE_PATHS) -o $@ $^ $(LDLIBS)
 
+$(BENCHMARK_OBJDIR)/%.o: %.cpp .firmware_options
+	@mkdir -p $(dir $@)
+	$(CXX) $(CPPFLAGS) $(CC_SYMBOLS) $(CXXFLAGS) $(INCLUDE_PATHS) -o $@ $<
+
+$(BENCHMARK_OBJDIR)/%.o: %.c .firmware_options
+	@mkdir -p $(dir $@)
+	$(CC) $(CPPFLAGS) $(CC_SYMBOLS) $(CFLAGS) $(INCLUDE_PATHS) -o $@ $<
+
+$(BENCHMARK_OBJDIR)/%.bin: $(BENCHMARK_OBJDIR)/%.o $(BENCHMARK_OBJS)
+	@mkdir -p $(dir $@)
+	$(LD) $(LDFLAGS) $(CC_SYMBOLS) $(CXXFLAGS) $(INCLUDE_PATHS) -o $@ $^ $(LDLIBS)
+
 cppclean:
 	cppclean $(INCLUDE_PATHS) --exclude libs --exclude tests .  | grep -v "declared but not defined" | grep -v static
@@ -6,6 +6,7 @@
 using openxc::util::time::systemTimeMs;
 using openxc::util::time::FrequencyClock;
 using openxc::util::time::tick;
+using openxc::util::time::setFrequency;
 
 void setup() {
 }
@@ -101,6 +102,35 @@ START_TEST (test_nonconditional_tick)
 }
 END_TEST
 
+START_TEST (test_set_frequency_recalculates_period)
+{
+    FrequencyClock clock;
+    initializeClock(&clock);
+    clock.timeFunction = timeMock;
+    clock.frequency = 1;
+    ck_assert(conditionalTick(&clock));
+
+    setFrequency(&clock, 2);
+    fakeTime += 500;
+    ck_assert(conditionalTick(&clock));
+}
+END_TEST
+
+START_TEST (test_fractional_period_rounds_up)
+{
+    FrequencyClock clock;
+    initializeClock(&clock);
+    clock.timeFunction = timeMock;
+    setFrequency(&clock, 3);
+    ck_assert(conditionalTick(&clock));
+
+    fakeTime += 333;
+    ck_assert(!conditionalTick(&clock));
+    fakeTime += 1;
+    ck_assert(conditionalTick(&clock));
+}
+END_TEST
+
 Suite* suite(void) {
     Suite* s = suite_create("timer");
     TCase *tc_core = tcase_create("core");
@@ -111,6 +141,8 @@ Suite* suite(void) {
     tcase_add_test(tc_core, test_first_tick_always_true);
     tcase_add_test(tc_core, test_staggered_not_true_at_start);
     tcase_add_test(tc_core, test_nonconditional_tick);
+    tcase_add_test(tc_core, test_set_frequency_recalculates_period);
+    tcase_add_test(tc_core, test_fractional_period_rounds_up);
     suite_add_tcase(s, tc_core);
 
     return s;
@@ -33,6 +33,8 @@ static bool canQueueEmpty(int bus) {
 void setup() {
     initializeVehicleInterface();
     fail_unless(canQueueEmpty(0));
+    getCanBuses()[0].receiveBatchSize = 0;
+    getCanBuses()[0].receiveBatchBudgetUs = 0;
 }
 
 CanMessage message = {
@@ -89,6 +91,90 @@ START_TEST (test_update_data_lights_suspend)
 }
 END_TEST
 
+START_TEST (test_receive_drains_queue)
+{
+    CanBus* bus = &getCanBuses()[0];
+    for(int i = 0; i < 3; i++) {
+        QUEUE_PUSH(CanMessage, &bus->receiveQueue, message);
+    }
+    receiveCan(&getConfiguration()->pipeline, bus);
+    fail_unless(QUEUE_EMPTY(CanMessage, &bus->receiveQueue));
+}
+END_TEST
+
+START_TEST (test_receive_batch_size_limit)
+{
+    CanBus* bus = &getCanBuses()[0];
+    bus->receiveBatchSize = 2;
+    for(int i = 0; i < 3; i++) {
+        QUEUE_PUSH(CanMessage, &bus->receiveQueue, message);
+    }
+    receiveCan(&getConfiguration()->pipeline, bus);
+    ck_assert_int_eq(QUEUE_LENGTH(CanMessage, &bus->receiveQueue), 1);
+
+    receiveCan(&getConfiguration()->pipeline, bus);
+    fail_unless(QUEUE_EMPTY(CanMessage, &bus->receiveQueue));
+}
+END_TEST
+
+START_TEST (test_receive_batch_stats)
+{
+    getConfiguration()->calculateMetrics = true;
+    CanBus* bus = &getCanBuses()[0];
+    for(int i = 0; i < 3; i++) {
+        QUEUE_PUSH(CanMessage, &bus->receiveQueue, message);
+    }
+    receiveCan(&getConfiguration()->pipeline, bus);
+    ck_assert_int_eq(openxc::util::statistics::maximum(
+                &bus->receiveBatchStats), 3);
+    getConfiguration()->calculateMetrics = false;
+}
+END_TEST
+
+START_TEST (test_receive_latency)
+{
+    getConfiguration()->calculateMetrics = true;
+    CanBus* bus = &getCanBuses()[0];
+    openxc::util::statistics::initialize(&bus->receiveQueueLatency);
+    openxc::util::statistics::initialize(&bus->processLatency);
+
+    // A stamp of 0 is still a real time, e.g. just after boot
+    CanMessage stamped = message;
+    stamped.timestamped = true;
+    stamped.receivedUs = 0;
+    QUEUE_PUSH(CanMessage, &bus->receiveQueue, stamped);
+    QUEUE_PUSH(CanMessage, &bus->receiveQueue, message);
+    FAKE_TIME += 2;
+    unsigned long now = FAKE_TIME * 1000;
+    receiveCan(&getConfiguration()->pipeline, bus);
+
+    // Only the message stamped by the receive interrupt is timed
+    ck_assert_int_eq(bus->receiveQueueLatency.count, 1);
+    ck_assert_int_eq(bus->receiveQueueLatency.max, now);
+    ck_assert_int_eq(bus->processLatency.count, 1);
+    ck_assert_int_eq(getConfiguration()->pipeline.originUs, 0);
+    getConfiguration()->calculateMetrics = false;
+}
+END_TEST
+
+START_TEST (test_receive_latency_without_metrics)
+{
+    getConfiguration()->calculateMetrics = false;
+    CanBus* bus = &getCanBuses()[0];
+    openxc::util::statistics::initialize(&bus->receiveQueueLatency);
+    openxc::util::statistics::initialize(&bus->processLatency);
+
+    CanMessage stamped = message;
+    stamped.timestamped = true;
+    stamped.receivedUs = FAKE_TIME * 1000;
+    QUEUE_PUSH(CanMessage, &bus->receiveQueue, stamped);
+    receiveCan(&getConfiguration()->pipeline, bus);
+
+    ck_assert_int_eq(bus->receiveQueueLatency.count, 0);
+    ck_assert_int_eq(bus->processLatency.count, 0);
+}
+END_TEST
+
 START_TEST (test_loop)
 {
     firmwareLoop();
@@ -102,6 +188,11 @@ Suite* suite(void) {
     tcase_add_test(tc_core, test_update_data_lights_can_active);
     tcase_add_test(tc_core, test_update_data_lights_can_inactive);
     tcase_add_test(tc_core, test_update_data_lights_suspend);
+    tcase_add_test(tc_core, test_receive_drains_queue);
+    tcase_add_test(tc_core, test_receive_batch_size_limit);
+    tcase_add_test(tc_core, test_receive_batch_stats);
+    tcase_add_test(tc_core, test_receive_latency);
+    tcase_add_test(tc_core, test_receive_latency_without_metrics);
 
     tcase_add_test(tc_core, test_loop);
 
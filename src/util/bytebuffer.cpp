@@ -1,11 +1,17 @@
+#include <string.h>
 #include "bytebuffer.h"
 #include "strutil.h"
 #include "util/log.h"
 
 QUEUE_DEFINE(uint8_t)
 
+// The number of slots in a byte queue's ring - emqueue keeps one more than
+// QUEUE_MAX_LENGTH so a full queue can be told apart from an empty one.
+#define QUEUE_SLOTS (int)sizeof(((QUEUE_TYPE(uint8_t)*)NULL)->elements)
+
 using openxc::util::log::debug;
 using openxc::util::bytebuffer::IncomingMessageCallback;
+using openxc::util::bytebuffer::ByteSpan;
 
 bool openxc::util::bytebuffer::processQueue(QUEUE_TYPE(uint8_t)* queue,
         IncomingMessageCallback callback) {
@@ -15,7 +21,7 @@ bool openxc::util::bytebuffer::processQueue(QUEUE_TYPE(uint8_t)* queue,
     }
 
     uint8_t snapshot[length];
-    QUEUE_SNAPSHOT(uint8_t, queue, snapshot, length);
+    peekBytes(queue, snapshot, length);
     if(callback == NULL) {
         debug("Callback is NULL (%p) -- unable to handle queue at %p",
                 callback, queue);
@@ -23,9 +29,7 @@ bool openxc::util::bytebuffer::processQueue(QUEUE_TYPE(uint8_t)* queue,
     }
 
     size_t parsedLength = callback(snapshot, length);
-    for(size_t i = 0; i < parsedLength; i++) {
-        QUEUE_POP(uint8_t, queue);
-    }
+    discardBytes(queue, parsedLength);
 
     if(QUEUE_FULL(uint8_t, queue)) {
         debug("Incoming write is too long - dumping queue");
@@ -41,11 +45,75 @@ bool openxc::util::bytebuffer::messageFits(QUEUE_TYPE(uint8_t)* queue, uint8_t*
 
 bool openxc::util::bytebuffer::conditionalEnqueue(QUEUE_TYPE(uint8_t)* queue, uint8_t* message,
         int messageSize) {
-    if(messageFits(queue, message, messageSize)) {
-        for(int i = 0; i < messageSize; i++) {
-            QUEUE_PUSH(uint8_t, queue, (uint8_t)message[i]);
+    return messageFits(queue, message, messageSize) &&
+            enqueueBytes(queue, message, messageSize);
+}
+
+bool openxc::util::bytebuffer::enqueueBytes(QUEUE_TYPE(uint8_t)* queue,
+        const uint8_t* data, int length) {
+    if(queue == NULL || length < 0 ||
+            QUEUE_AVAILABLE(uint8_t, queue) < length) {
+        return false;
+    }
+
+    int firstLength = QUEUE_SLOTS - queue->head;
+    if(firstLength > length) {
+        firstLength = length;
+    }
+    memcpy(&queue->elements[queue->head], data, firstLength);
+    memcpy(queue->elements, &data[firstLength], length - firstLength);
+    queue->head = (queue->head + length) % QUEUE_SLOTS;
+    return true;
+}
+
+int openxc::util::bytebuffer::readableSpans(QUEUE_TYPE(uint8_t)* queue,
+        ByteSpan spans[2]) {
+    int spanCount = 0;
+    if(queue->head >= queue->tail) {
+        if(queue->head > queue->tail) {
+            spans[spanCount++] = {&queue->elements[queue->tail],
+                    queue->head - queue->tail};
+        }
+    } else {
+        spans[spanCount++] = {&queue->elements[queue->tail],
+                QUEUE_SLOTS - queue->tail};
+        if(queue->head > 0) {
+            spans[spanCount++] = {queue->elements, queue->head};
         }
-        return true;
     }
-    return false;
+    return spanCount;
+}
+
+int openxc::util::bytebuffer::peekBytes(QUEUE_TYPE(uint8_t)* queue,
+        uint8_t* buffer, int maxLength) {
+    ByteSpan spans[2];
+    int spanCount = readableSpans(queue, spans);
+    int copied = 0;
+    for(int i = 0; i < spanCount && copied < maxLength; i++) {
+        int length = spans[i].length;
+        if(length > maxLength - copied) {
+            length = maxLength - copied;
+        }
+        memcpy(&buffer[copied], spans[i].data, length);
+        copied += length;
+    }
+    return copied;
+}
+
+void openxc::util::bytebuffer::discardBytes(QUEUE_TYPE(uint8_t)* queue,
+        int length) {
+    int queued = QUEUE_LENGTH(uint8_t, queue);
+    if(length > queued) {
+        length = queued;
+    }
+    if(length > 0) {
+        queue->tail = (queue->tail + length) % QUEUE_SLOTS;
+    }
+}
+
+int openxc::util::bytebuffer::dequeueBytes(QUEUE_TYPE(uint8_t)* queue,
+        uint8_t* buffer, int maxLength) {
+    int length = peekBytes(queue, buffer, maxLength);
+    discardBytes(queue, length);
+    return length;
 }
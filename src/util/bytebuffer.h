@@ -21,6 +21,16 @@ namespace bytebuffer {
  */
 typedef size_t (*IncomingMessageCallback)(uint8_t* buffer, size_t length);
 
+/* Public: A contiguous region of the bytes stored in a byte queue.
+ *
+ * data - A pointer to the first byte of the region, inside the queue.
+ * length - The number of bytes in the region.
+ */
+typedef struct {
+    uint8_t* data;
+    int length;
+} ByteSpan;
+
 /* Public: Search for a complete message in the queue, remove it and pass it to
  * the callback. If no message is found, reset the queue back to empty if it's
  * full.
@@ -56,6 +66,62 @@ bool conditionalEnqueue(QUEUE_TYPE(uint8_t)* queue, uint8_t* message,
  */
 bool messageFits(QUEUE_TYPE(uint8_t)* queue, uint8_t* message, int messageSize);
 
+/* Public: Add a block of bytes to the queue if there is room for all of them,
+ * copying them in with at most two memcpys instead of pushing each byte.
+ *
+ * queue - The queue to add the bytes.
+ * data - The bytes to add.
+ * length - The number of bytes to add.
+ *
+ * Returns true if all of the bytes were added, false if none were because
+ * there wasn't room or the queue is NULL.
+ */
+bool enqueueBytes(QUEUE_TYPE(uint8_t)* queue, const uint8_t* data, int length);
+
+/* Public: Find the contiguous regions of the bytes waiting in the queue
+ * without removing them, so they can be written out directly. There are two
+ * when the bytes wrap around the end of the queue's storage.
+ *
+ * Remove the bytes with discardBytes once they've been used - the spans are
+ * only valid until then.
+ *
+ * queue - The queue to read.
+ * spans - An output array for the regions, oldest bytes first.
+ *
+ * Returns the number of regions written to the array, from 0 to 2.
+ */
+int readableSpans(QUEUE_TYPE(uint8_t)* queue, ByteSpan spans[2]);
+
+/* Public: Copy bytes from the front of the queue without removing them.
+ *
+ * queue - The queue to read.
+ * buffer - The buffer to copy the bytes into.
+ * maxLength - The maximum number of bytes to copy.
+ *
+ * Returns the number of bytes copied.
+ */
+int peekBytes(QUEUE_TYPE(uint8_t)* queue, uint8_t* buffer, int maxLength);
+
+/* Public: Remove bytes from the front of the queue, e.g. once those returned
+ * by readableSpans or peekBytes have been sent.
+ *
+ * queue - The queue to remove the bytes from.
+ * length - The number of bytes to remove. If there are fewer in the queue, it
+ *      is emptied.
+ */
+void discardBytes(QUEUE_TYPE(uint8_t)* queue, int length);
+
+/* Public: Move bytes from the front of the queue into a buffer - the same as
+ * peekBytes followed by discardBytes.
+ *
+ * queue - The queue to read.
+ * buffer - The buffer to copy the bytes into.
+ * maxLength - The maximum number of bytes to move.
+ *
+ * Returns the number of bytes moved.
+ */
+int dequeueBytes(QUEUE_TYPE(uint8_t)* queue, uint8_t* buffer, int maxLength);
+
 } // namespace bytebuffer
 } // namespace util
 } // namespace openxc
@@ -0,0 +1,45 @@
+#include "util/coalesce.h"
+#include "util/timer.h"
+#include "config.h"
+
+using openxc::util::time::uptimeMs;
+
+void openxc::util::coalesce::initialize(Coalescer* coalescer, int unitSize,
+        unsigned long maxLatencyMs) {
+    coalescer->unitSize = unitSize;
+    coalescer->maxLatencyMs = maxLatencyMs;
+    coalescer->waiting = false;
+    coalescer->waitingSince = 0;
+}
+
+int openxc::util::coalesce::coalescedLength(Coalescer* coalescer,
+        int queuedBytes, int maxLength) {
+    int available = MIN(queuedBytes, maxLength);
+    if(available <= 0) {
+        coalescer->waiting = false;
+        return 0;
+    } else if(coalescer->maxLatencyMs == 0 || coalescer->unitSize <= 0) {
+        return available;
+    }
+
+    int length = available - available % coalescer->unitSize;
+    if(length > 0) {
+        // The remainder keeps waiting from when it started, if it already was
+        if(queuedBytes == length) {
+            coalescer->waiting = false;
+        } else if(!coalescer->waiting) {
+            coalescer->waiting = true;
+            coalescer->waitingSince = uptimeMs();
+        }
+        return length;
+    }
+
+    if(!coalescer->waiting) {
+        coalescer->waiting = true;
+        coalescer->waitingSince = uptimeMs();
+    } else if(uptimeMs() - coalescer->waitingSince >= coalescer->maxLatencyMs) {
+        coalescer->waiting = false;
+        return available;
+    }
+    return 0;
+}
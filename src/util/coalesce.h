@@ -0,0 +1,53 @@
+#ifndef __COALESCE_H__
+#define __COALESCE_H__
+
+namespace openxc {
+namespace util {
+namespace coalesce {
+
+/* Public: Decides when to send queued bytes so they fill whole transport
+ * units (e.g. USB packets or BLE notifications), without holding a short
+ * message back for too long.
+ *
+ * unitSize - The size of one transport unit in bytes.
+ * maxLatencyMs - The longest time to hold back less than a full unit waiting
+ *      for more bytes, or 0 to always send right away.
+ * waiting - (private) True if part of a unit has been held back.
+ * waitingSince - (private) The uptime in milliseconds the bytes held back
+ *      started waiting.
+ */
+typedef struct {
+    int unitSize;
+    unsigned long maxLatencyMs;
+    bool waiting;
+    unsigned long waitingSince;
+} Coalescer;
+
+/* Public: Initialize a Coalescer with nothing waiting.
+ *
+ * coalescer - The coalescer to initialize.
+ * unitSize - The size of one transport unit in bytes, greater than 0.
+ * maxLatencyMs - The longest time to hold back a partly filled unit.
+ */
+void initialize(Coalescer* coalescer, int unitSize,
+        unsigned long maxLatencyMs);
+
+/* Public: Return how many of the queued bytes to send now.
+ *
+ * If at least one full unit is queued, this is as many whole units as fit in
+ * maxLength, and any remainder waits. Otherwise, the bytes are held back until
+ * they fill a unit or have waited maxLatencyMs, when they're all sent.
+ *
+ * coalescer - The coalescer for the queue.
+ * queuedBytes - The number of bytes waiting to be sent.
+ * maxLength - The most bytes the caller can send at once.
+ *
+ * Returns the number of bytes to send, possibly 0.
+ */
+int coalescedLength(Coalescer* coalescer, int queuedBytes, int maxLength);
+
+} // namespace coalesce
+} // namespace util
+} // namespace openxc
+
+#endif // __COALESCE_H__
@@ -0,0 +1,474 @@
+#include <string.h>
+#include "util/messagepool.h"
+#include "util/timer.h"
+
+#define NO_MESSAGE 0xff
+
+using openxc::util::bytebuffer::ByteSpan;
+using openxc::util::messagepool::MessageQueue;
+using openxc::util::messagepool::MessageLane;
+using openxc::util::messagepool::MessageLaneType;
+using openxc::util::messagepool::NORMAL_LANE;
+using openxc::util::messagepool::PRIORITY_LANE;
+
+namespace statistics = openxc::util::statistics;
+
+/* Private: The details of a message stored in the pool - its bytes are kept
+ * separately, in one block of messageData.
+ *
+ * offset - The position of the message's bytes in messageData.
+ * length - The length of the message.
+ * tag - A byte stored with the message by its publisher.
+ * refCount - The number of references held to the message, by queues and its
+ *      publisher.
+ * next - The message with the next block in messageData if this is in
+ *      use, otherwise the next free message - NO_MESSAGE at the end of either.
+ * originUs - When the message's data was first seen, or 0 if unknown.
+ */
+typedef struct {
+    uint16_t offset;
+    uint16_t length;
+    uint8_t tag;
+    uint8_t refCount;
+    uint8_t next;
+    unsigned long originUs;
+} PooledMessage;
+
+static uint8_t messageData[MESSAGE_POOL_SIZE];
+static PooledMessage messages[MESSAGE_POOL_MAX_MESSAGES];
+// The first message in use, with the rest linked in order of their offset
+static uint8_t usedMessages;
+static uint8_t freeMessages;
+static int freeMessageCount;
+static int freeByteCount;
+static bool poolInitialized;
+
+static MessageQueue* queues[MESSAGE_POOL_MAX_QUEUES];
+static int queueCount;
+
+static void initializePool() {
+    if(poolInitialized) {
+        return;
+    }
+
+    for(int i = 0; i < MESSAGE_POOL_MAX_MESSAGES; i++) {
+        messages[i].next = i + 1 < MESSAGE_POOL_MAX_MESSAGES ?
+                i + 1 : NO_MESSAGE;
+    }
+    freeMessages = 0;
+    freeMessageCount = MESSAGE_POOL_MAX_MESSAGES;
+    usedMessages = NO_MESSAGE;
+    freeByteCount = MESSAGE_POOL_SIZE;
+    poolInitialized = true;
+}
+
+/* Private: Find the first gap in messageData long enough for a message, that
+ * ends before a limit.
+ *
+ * previous - Set to the message the gap follows, or NO_MESSAGE if it's at the
+ *      start of messageData.
+ *
+ * Returns the offset of the gap, or -1 if there isn't one.
+ */
+static int findGap(int length, int limit, uint8_t* previous) {
+    int end = 0;
+    *previous = NO_MESSAGE;
+    for(uint8_t message = usedMessages; message != NO_MESSAGE;
+            message = messages[message].next) {
+        if(end + length > limit) {
+            return -1;
+        } else if(messages[message].offset - end >= length) {
+            return end;
+        }
+        end = messages[message].offset + messages[message].length;
+        *previous = message;
+    }
+    return end + length <= limit ? end : -1;
+}
+
+/* Private: Find space for a message, leaving some bytes at the end of the pool
+ * and some messages free.
+ *
+ * Returns the offset for the message's bytes, or -1 if it doesn't fit.
+ */
+static int findSpace(int length, int reservedBytes, int reservedMessages,
+        uint8_t* previous) {
+    if(freeMessageCount <= reservedMessages) {
+        return -1;
+    }
+    return findGap(length, MESSAGE_POOL_SIZE - reservedBytes, previous);
+}
+
+static int nextIndex(int index) {
+    return (index + 1) % (MESSAGE_QUEUE_MAX_LENGTH + 1);
+}
+
+static void registerQueue(MessageQueue* queue) {
+    if(!queue->registered && queueCount < MESSAGE_POOL_MAX_QUEUES) {
+        queues[queueCount++] = queue;
+        queue->registered = true;
+    }
+}
+
+static void resetLane(MessageLane* lane) {
+    lane->head = lane->tail = lane->released = 0;
+}
+
+/* Private: Release the messages a queue's reader has finished with. Only call
+ * this from the main loop, never from an interrupt handler.
+ */
+static void releaseReadMessages(MessageQueue* queue) {
+    for(int i = 0; i < MESSAGE_LANE_COUNT; i++) {
+        MessageLane* lane = &queue->lanes[i];
+        int tail = lane->tail;
+        while(lane->released != tail) {
+            openxc::util::messagepool::releaseMessage(
+                    lane->messages[lane->released]);
+            lane->released = nextIndex(lane->released);
+        }
+    }
+}
+
+/* Private: Return the number of pool bytes held by the messages in a lane.
+ */
+static int heldBytes(MessageLane* lane) {
+    int count = 0;
+    for(int i = lane->released; i != lane->head; i = nextIndex(i)) {
+        count += messages[lane->messages[i]].length;
+    }
+    return count;
+}
+
+static bool laneFits(MessageQueue* queue, MessageLaneType laneType,
+        int maxBytes, int messageSize) {
+    if(queue == NULL) {
+        return false;
+    }
+
+    releaseReadMessages(queue);
+    MessageLane* lane = &queue->lanes[laneType];
+    return nextIndex(lane->head) != lane->released &&
+            heldBytes(lane) + messageSize <= maxBytes;
+}
+
+static bool enqueueInLane(MessageQueue* queue, MessageLaneType laneType,
+        int maxBytes, int message) {
+    if(message < 0 ||
+            !laneFits(queue, laneType, maxBytes, messages[message].length)) {
+        return false;
+    }
+
+    registerQueue(queue);
+    MessageLane* lane = &queue->lanes[laneType];
+    ++messages[message].refCount;
+    lane->messages[lane->head] = message;
+    lane->head = nextIndex(lane->head);
+    return true;
+}
+
+/* Private: A position in the unread bytes of a queue.
+ *
+ * tails - The index of the next message to read in each lane.
+ * lane - The lane of the message being read, if offset is not 0.
+ * offset - The number of bytes of that message already read.
+ */
+typedef struct {
+    int tails[MESSAGE_LANE_COUNT];
+    int lane;
+    int offset;
+} ReadPosition;
+
+static ReadPosition readPosition(MessageQueue* queue) {
+    ReadPosition position;
+    for(int i = 0; i < MESSAGE_LANE_COUNT; i++) {
+        position.tails[i] = queue->lanes[i].tail;
+    }
+    position.lane = queue->readLane;
+    position.offset = queue->readOffset;
+    return position;
+}
+
+/* Private: Find the message to read next from a position - the one already
+ * being read, otherwise the oldest in the priority lane, otherwise the oldest
+ * in the normal lane.
+ *
+ * Returns false if there are no more messages.
+ */
+static bool currentMessage(MessageQueue* queue, ReadPosition* position) {
+    if(position->offset > 0) {
+        return true;
+    }
+
+    if(position->tails[PRIORITY_LANE] !=
+            queue->lanes[PRIORITY_LANE].head) {
+        position->lane = PRIORITY_LANE;
+        return true;
+    } else if(position->tails[NORMAL_LANE] != queue->lanes[NORMAL_LANE].head) {
+        position->lane = NORMAL_LANE;
+        return true;
+    }
+    return false;
+}
+
+static PooledMessage* messageAt(MessageQueue* queue,
+        ReadPosition* position) {
+    return &messages[queue->lanes[position->lane].messages[
+            position->tails[position->lane]]];
+}
+
+static void finishMessage(ReadPosition* position) {
+    position->tails[position->lane] = nextIndex(
+            position->tails[position->lane]);
+    position->offset = 0;
+}
+
+/* Private: Find the next contiguous region of unread bytes in a queue,
+ * starting from a position, and move the position past it.
+ *
+ * Returns true if a region was found, false if the position reached the end
+ * of the queue.
+ */
+static bool nextSpan(MessageQueue* queue, ReadPosition* position,
+        ByteSpan* span) {
+    while(currentMessage(queue, position)) {
+        PooledMessage* message = messageAt(queue, position);
+        if(position->offset < message->length) {
+            span->data = &messageData[message->offset + position->offset];
+            span->length = message->length - position->offset;
+            position->offset = message->length;
+            return true;
+        }
+        finishMessage(position);
+    }
+    return false;
+}
+
+/* Private: Copy a message into the pool, leaving some of it free for priority
+ * messages.
+ */
+static int allocate(const uint8_t* data, int length, uint8_t tag,
+        int reservedBytes, int reservedMessages) {
+    initializePool();
+    if(length < 0 || length > MESSAGE_QUEUE_MAX_BYTES) {
+        return -1;
+    }
+
+    uint8_t previous = NO_MESSAGE;
+    int offset = findSpace(length, reservedBytes, reservedMessages, &previous);
+    if(offset == -1) {
+        for(int i = 0; i < queueCount; i++) {
+            releaseReadMessages(queues[i]);
+        }
+        offset = findSpace(length, reservedBytes, reservedMessages,
+                &previous);
+        if(offset == -1) {
+            return -1;
+        }
+    }
+
+    int message = freeMessages;
+    freeMessages = messages[message].next;
+    if(previous == NO_MESSAGE) {
+        messages[message].next = usedMessages;
+        usedMessages = message;
+    } else {
+        messages[message].next = messages[previous].next;
+        messages[previous].next = message;
+    }
+    --freeMessageCount;
+    freeByteCount -= length;
+
+    memcpy(&messageData[offset], data, length);
+    messages[message].offset = offset;
+    messages[message].length = length;
+    messages[message].tag = tag;
+    messages[message].refCount = 1;
+    messages[message].originUs = 0;
+    return message;
+}
+
+int openxc::util::messagepool::allocateMessage(const uint8_t* data,
+        int length, uint8_t tag) {
+    return allocate(data, length, tag, MESSAGE_POOL_PRIORITY_BYTES,
+            MESSAGE_POOL_PRIORITY_MESSAGES);
+}
+
+int openxc::util::messagepool::allocatePriorityMessage(const uint8_t* data,
+        int length, uint8_t tag) {
+    return allocate(data, length, tag, 0, 0);
+}
+
+void openxc::util::messagepool::releaseMessage(int message) {
+    if(message < 0 || --messages[message].refCount > 0) {
+        return;
+    }
+
+    if(usedMessages == message) {
+        usedMessages = messages[message].next;
+    } else {
+        uint8_t previous = usedMessages;
+        while(messages[previous].next != message) {
+            previous = messages[previous].next;
+        }
+        messages[previous].next = messages[message].next;
+    }
+    messages[message].next = freeMessages;
+    freeMessages = message;
+    ++freeMessageCount;
+    freeByteCount += messages[message].length;
+}
+
+int openxc::util::messagepool::messageLength(int message) {
+    return messages[message].length;
+}
+
+int openxc::util::messagepool::messageTag(int message) {
+    return messages[message].tag;
+}
+
+void openxc::util::messagepool::setMessageOrigin(int message,
+        unsigned long originUs) {
+    if(message >= 0) {
+        messages[message].originUs = originUs;
+    }
+}
+
+unsigned long openxc::util::messagepool::messageOrigin(int message) {
+    return message >= 0 ? messages[message].originUs : 0;
+}
+
+int openxc::util::messagepool::availableBytes() {
+    initializePool();
+    return freeByteCount;
+}
+
+void openxc::util::messagepool::initializeQueue(MessageQueue* queue) {
+    initializePool();
+    for(int i = 0; i < MESSAGE_LANE_COUNT; i++) {
+        queue->lanes[i].tail = queue->lanes[i].head;
+    }
+    releaseReadMessages(queue);
+    for(int i = 0; i < MESSAGE_LANE_COUNT; i++) {
+        resetLane(&queue->lanes[i]);
+    }
+    queue->readLane = NORMAL_LANE;
+    queue->readOffset = 0;
+    statistics::initialize(&queue->latency);
+    registerQueue(queue);
+}
+
+bool openxc::util::messagepool::messageFits(MessageQueue* queue,
+        int messageSize) {
+    return laneFits(queue, NORMAL_LANE, MESSAGE_QUEUE_MAX_BYTES, messageSize);
+}
+
+bool openxc::util::messagepool::enqueueMessage(MessageQueue* queue,
+        int message) {
+    return enqueueInLane(queue, NORMAL_LANE, MESSAGE_QUEUE_MAX_BYTES, message);
+}
+
+bool openxc::util::messagepool::priorityMessageFits(MessageQueue* queue,
+        int messageSize) {
+    return laneFits(queue, PRIORITY_LANE, MESSAGE_QUEUE_PRIORITY_BYTES,
+            messageSize);
+}
+
+bool openxc::util::messagepool::enqueuePriorityMessage(MessageQueue* queue,
+        int message) {
+    return enqueueInLane(queue, PRIORITY_LANE, MESSAGE_QUEUE_PRIORITY_BYTES,
+            message);
+}
+
+int openxc::util::messagepool::dropOldestMessage(MessageQueue* queue) {
+    if(queue == NULL) {
+        return -1;
+    }
+
+    MessageLane* lane = &queue->lanes[NORMAL_LANE];
+    if(lane->tail == lane->head ||
+            (queue->readOffset > 0 && queue->readLane == NORMAL_LANE)) {
+        return -1;
+    }
+
+    int tag = messages[lane->messages[lane->tail]].tag;
+    lane->tail = nextIndex(lane->tail);
+    releaseReadMessages(queue);
+    return tag;
+}
+
+int openxc::util::messagepool::queuedBytes(MessageQueue* queue) {
+    int length = -queue->readOffset;
+    for(int i = 0; i < MESSAGE_LANE_COUNT; i++) {
+        MessageLane* lane = &queue->lanes[i];
+        for(int j = lane->tail; j != lane->head; j = nextIndex(j)) {
+            length += messages[lane->messages[j]].length;
+        }
+    }
+    return length;
+}
+
+bool openxc::util::messagepool::queueEmpty(MessageQueue* queue) {
+    return queuedBytes(queue) == 0;
+}
+
+int openxc::util::messagepool::readableSpans(MessageQueue* queue,
+        ByteSpan spans[2]) {
+    ReadPosition position = readPosition(queue);
+    int spanCount = 0;
+    while(spanCount < 2 && nextSpan(queue, &position, &spans[spanCount])) {
+        ++spanCount;
+    }
+    return spanCount;
+}
+
+int openxc::util::messagepool::peekBytes(MessageQueue* queue, uint8_t* buffer,
+        int maxLength) {
+    ReadPosition position = readPosition(queue);
+    int copied = 0;
+    ByteSpan span;
+    while(copied < maxLength && nextSpan(queue, &position, &span)) {
+        int length = span.length;
+        if(length > maxLength - copied) {
+            length = maxLength - copied;
+        }
+        memcpy(&buffer[copied], span.data, length);
+        copied += length;
+    }
+    return copied;
+}
+
+void openxc::util::messagepool::discardBytes(MessageQueue* queue, int length) {
+    ReadPosition position = readPosition(queue);
+    unsigned long now = 0;
+    while(currentMessage(queue, &position)) {
+        PooledMessage* message = messageAt(queue, &position);
+        int remaining = message->length - position.offset;
+        if(length < remaining) {
+            position.offset += length;
+            break;
+        }
+        length -= remaining;
+        if(message->originUs != 0) {
+            if(now == 0) {
+                now = openxc::util::time::systemTimeUs();
+            }
+            statistics::record(&queue->latency, now - message->originUs);
+        }
+        finishMessage(&position);
+    }
+
+    // Only the reader's own state is written back, so this is safe to call
+    // from an interrupt handler
+    for(int i = 0; i < MESSAGE_LANE_COUNT; i++) {
+        queue->lanes[i].tail = position.tails[i];
+    }
+    queue->readLane = position.lane;
+    queue->readOffset = position.offset;
+}
+
+int openxc::util::messagepool::dequeueBytes(MessageQueue* queue,
+        uint8_t* buffer, int maxLength) {
+    int length = peekBytes(queue, buffer, maxLength);
+    discardBytes(queue, length);
+    return length;
+}
@@ -0,0 +1,289 @@
+#ifndef _MESSAGEPOOL_H_
+#define _MESSAGEPOOL_H_
+
+#include <stdint.h>
+#include "util/bytebuffer.h"
+#include "util/statistics.h"
+
+// The number of bytes in the pool shared by all of the send queues. Each
+// message is stored in one contiguous block of exactly its length. On the
+// LPC17xx this still lets one interface queue the 384 bytes it could before the
+// pool, and the PIC32 parts have twice the RAM, so they get more buffering.
+#ifndef MESSAGE_POOL_SIZE
+#ifdef __PIC32__
+#define MESSAGE_POOL_SIZE 2048
+#else
+#define MESSAGE_POOL_SIZE 576
+#endif // __PIC32__
+#endif
+
+#if MESSAGE_POOL_SIZE > 0xffff
+#error "MESSAGE_POOL_SIZE must fit in a uint16_t"
+#endif
+
+// The most messages the pool can hold at once, whatever their length.
+#ifndef MESSAGE_POOL_MAX_MESSAGES
+#define MESSAGE_POOL_MAX_MESSAGES (MESSAGE_POOL_SIZE / 24)
+#endif
+
+#if MESSAGE_POOL_MAX_MESSAGES > 255
+#error "MESSAGE_POOL_MAX_MESSAGES must fit in a uint8_t"
+#endif
+
+// The most bytes a single send queue can hold, so one stalled interface always
+// leaves a third of the pool for the others.
+#define MESSAGE_QUEUE_MAX_BYTES (MESSAGE_POOL_SIZE * 2 / 3)
+
+// The most bytes a send queue's priority lane can hold, on top of
+// MESSAGE_QUEUE_MAX_BYTES - enough for a few command responses.
+#ifndef MESSAGE_QUEUE_PRIORITY_BYTES
+#define MESSAGE_QUEUE_PRIORITY_BYTES (MESSAGE_POOL_SIZE / 6)
+#endif
+
+// The space at the end of the pool only priority messages may use (see
+// allocatePriorityMessage), so a pool full of telemetry never holds up a
+// command response - one priority lane's worth of bytes, and a few messages.
+#define MESSAGE_POOL_PRIORITY_BYTES MESSAGE_QUEUE_PRIORITY_BYTES
+#define MESSAGE_POOL_PRIORITY_MESSAGES (MESSAGE_POOL_MAX_MESSAGES / 8)
+
+// The most messages each lane of a send queue can hold.
+#define MESSAGE_QUEUE_MAX_LENGTH (MESSAGE_POOL_MAX_MESSAGES / 2)
+
+// The most send queues that can share the pool.
+#define MESSAGE_POOL_MAX_QUEUES 8
+
+namespace openxc {
+namespace util {
+namespace messagepool {
+
+typedef enum {
+    NORMAL_LANE,
+    PRIORITY_LANE,
+} MessageLaneType;
+
+#define MESSAGE_LANE_COUNT 2
+
+/* Public: A ring of references to messages in the shared message pool.
+ *
+ * messages - The references to the queued messages.
+ * head - The next free index in messages, moved only by the main loop.
+ * tail - The index of the oldest message not yet completely read.
+ * released - The index of the oldest message not yet released to the pool.
+ *      Messages between released and tail have been read, but the queue still
+ *      holds a reference to them.
+ */
+typedef struct {
+    uint8_t messages[MESSAGE_QUEUE_MAX_LENGTH + 1];
+    uint8_t head;
+    uint8_t tail;
+    uint8_t released;
+} MessageLane;
+
+/* Public: A queue of references to messages in the shared message pool,
+ * waiting to be sent out over one interface.
+ *
+ * The main loop adds messages with enqueueMessage and the interface's driver
+ * reads them back as bytes with the same span functions as a byte queue. The
+ * driver may read from an interrupt handler - it only ever moves the tails,
+ * readLane and readOffset, and the messages it has finished with are released
+ * back to the pool later from the main loop.
+ *
+ * Messages in the priority lane are read before those in the normal lane, but
+ * a message is never interrupted once its first byte has been read.
+ *
+ * lanes - The normal and priority lanes, indexed by MessageLaneType.
+ * readLane - The lane of the message being read, if readOffset is not 0.
+ * readOffset - The number of bytes of the message being read already read.
+ * registered - True if the pool knows to release messages from this queue.
+ * latency - The time (in us) from each message's origin (see
+ *      setMessageOrigin) until its last byte was read from this queue.
+ */
+typedef struct {
+    MessageLane lanes[MESSAGE_LANE_COUNT];
+    uint8_t readLane;
+    uint16_t readOffset;
+    bool registered;
+    openxc::util::statistics::Histogram latency;
+} MessageQueue;
+
+/* Public: Copy a message into the shared pool, so it can be added to any
+ * number of send queues without copying it again.
+ *
+ * The caller holds one reference to the new message, and must give it up with
+ * releaseMessage once it has been added to the queues - the message is freed
+ * when the last queue has sent it.
+ *
+ * If the pool is short of space, messages that have already been sent are
+ * released from every queue before giving up.
+ *
+ * data - The bytes of the message.
+ * length - The length of the message, up to MESSAGE_QUEUE_MAX_BYTES.
+ * tag - A byte to store with the message, e.g. its type, returned by
+ *      messageTag and dropOldestMessage.
+ *
+ * Returns a reference to the message in the pool, or -1 if it didn't fit.
+ */
+int allocateMessage(const uint8_t* data, int length, uint8_t tag);
+
+/* Public: Copy a message into the shared pool like allocateMessage, but let it
+ * use the space reserved for replies the host is waiting for,
+ * MESSAGE_POOL_PRIORITY_BYTES and MESSAGE_POOL_PRIORITY_MESSAGES. Other
+ * messages can never take that space, however many queues they fill.
+ *
+ * Returns a reference to the message in the pool, or -1 if it didn't fit.
+ */
+int allocatePriorityMessage(const uint8_t* data, int length, uint8_t tag);
+
+/* Public: Give up a reference to a message in the pool, freeing its space if
+ * it was the last.
+ *
+ * message - A reference returned by allocateMessage. Ignored if -1.
+ */
+void releaseMessage(int message);
+
+/* Public: Return the length of a message in the pool, in bytes.
+ */
+int messageLength(int message);
+
+/* Public: Return the tag stored with a message in the pool.
+ */
+int messageTag(int message);
+
+/* Public: Record when the data in a message was first seen, e.g. when the CAN
+ * message it was decoded from was received. Each queue holding the message
+ * counts the time from this origin until the message is read out in its
+ * latency histogram.
+ *
+ * message - A reference returned by allocateMessage.
+ * originUs - The origin time in microseconds, or 0 to not track the message.
+ */
+void setMessageOrigin(int message, unsigned long originUs);
+
+/* Public: Return the origin time stored with a message in the pool, or 0 if
+ * it has none.
+ */
+unsigned long messageOrigin(int message);
+
+/* Public: Return the number of bytes in the pool not holding a message. They
+ * may be split between several gaps, so a message this long won't always fit.
+ */
+int availableBytes();
+
+/* Public: Reset a queue to empty, releasing any messages it holds.
+ */
+void initializeQueue(MessageQueue* queue);
+
+/* Public: Check if a message of the given length will fit in the queue's
+ * normal lane.
+ *
+ * queue - The queue to add the message.
+ * messageSize - The length of the message.
+ *
+ * Returns true if the message will fit. Returns false otherwise, or if queue
+ * is NULL.
+ */
+bool messageFits(MessageQueue* queue, int messageSize);
+
+/* Public: Add a reference to a message in the pool to the end of a queue's
+ * normal lane, if there is room.
+ *
+ * queue - The queue to add the message.
+ * message - A reference returned by allocateMessage.
+ *
+ * Returns true if the message was added. Returns false if it didn't fit, or if
+ * queue is NULL or message is -1.
+ */
+bool enqueueMessage(MessageQueue* queue, int message);
+
+/* Public: Check if a message of the given length will fit in the queue's
+ * priority lane.
+ *
+ * Returns true if the message will fit. Returns false otherwise, or if queue
+ * is NULL.
+ */
+bool priorityMessageFits(MessageQueue* queue, int messageSize);
+
+/* Public: Add a reference to a message in the pool to the end of a queue's
+ * priority lane, so it's sent before any messages in the normal lane that
+ * haven't been started.
+ *
+ * The priority lane has its own space, MESSAGE_QUEUE_PRIORITY_BYTES, so a
+ * normal lane full of telemetry never holds up a command response.
+ *
+ * Returns true if the message was added. Returns false if it didn't fit, or if
+ * queue is NULL or message is -1.
+ */
+bool enqueuePriorityMessage(MessageQueue* queue, int message);
+
+/* Public: Remove the oldest message from a queue's normal lane to make room
+ * for newer ones, unless its reader has already started sending it.
+ *
+ * This moves the queue's read position, so only call it from the same context
+ * as the queue's reader - never for a queue read from an interrupt handler.
+ *
+ * queue - The queue to remove the message from.
+ *
+ * Returns the tag of the removed message, or -1 if the queue is empty or the
+ * oldest message is partly sent.
+ */
+int dropOldestMessage(MessageQueue* queue);
+
+/* Public: Return the number of bytes waiting to be read from the queue.
+ */
+int queuedBytes(MessageQueue* queue);
+
+/* Public: Return true if there are no messages waiting to be read from the
+ * queue.
+ */
+bool queueEmpty(MessageQueue* queue);
+
+/* Public: Find the contiguous regions of the bytes waiting in the queue
+ * without removing them, so they can be written out directly.
+ *
+ * Remove the bytes with discardBytes once they've been used - the spans are
+ * only valid until then.
+ *
+ * queue - The queue to read.
+ * spans - An output array for the regions, oldest bytes first.
+ *
+ * Returns the number of regions written to the array, from 0 to 2.
+ */
+int readableSpans(MessageQueue* queue,
+        openxc::util::bytebuffer::ByteSpan spans[2]);
+
+/* Public: Copy bytes from the front of the queue without removing them.
+ *
+ * queue - The queue to read.
+ * buffer - The buffer to copy the bytes into.
+ * maxLength - The maximum number of bytes to copy.
+ *
+ * Returns the number of bytes copied.
+ */
+int peekBytes(MessageQueue* queue, uint8_t* buffer, int maxLength);
+
+/* Public: Remove bytes from the front of the queue, e.g. once those returned
+ * by readableSpans or peekBytes have been sent. Each message removed completely
+ * is counted in the queue's latency histogram, if it has an origin time.
+ *
+ * queue - The queue to remove the bytes from.
+ * length - The number of bytes to remove. If there are fewer in the queue, it
+ *      is emptied.
+ */
+void discardBytes(MessageQueue* queue, int length);
+
+/* Public: Move bytes from the front of the queue into a buffer - the same as
+ * peekBytes followed by discardBytes.
+ *
+ * queue - The queue to read.
+ * buffer - The buffer to copy the bytes into.
+ * maxLength - The maximum number of bytes to move.
+ *
+ * Returns the number of bytes moved.
+ */
+int dequeueBytes(MessageQueue* queue, uint8_t* buffer, int maxLength);
+
+} // namespace messagepool
+} // namespace util
+} // namespace openxc
+
+#endif // _MESSAGEPOOL_H_
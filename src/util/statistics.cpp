@@ -2,6 +2,7 @@
 
 #include <limits.h>
 #include <stddef.h>
+#include <stdio.h>
 
 #include "config.h"
 
@@ -58,3 +59,71 @@ int openxc::util::statistics::maximum(const Statistic* stat) {
 int openxc::util::statistics::maximum(const DeltaStatistic* stat) {
     return stat->statistic.max;
 }
+
+void openxc::util::statistics::initialize(Histogram* histogram) {
+    for(int i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+        histogram->buckets[i] = 0;
+    }
+    histogram->count = 0;
+    histogram->max = 0;
+}
+
+void openxc::util::statistics::record(Histogram* histogram,
+        unsigned long latencyUs) {
+    int bucket = 0;
+    unsigned long limit = HISTOGRAM_FIRST_BUCKET_US;
+    while(bucket < HISTOGRAM_BUCKET_COUNT - 1 && latencyUs >= limit) {
+        limit <<= 1;
+        ++bucket;
+    }
+    ++histogram->buckets[bucket];
+    ++histogram->count;
+    histogram->max = MAX(histogram->max, latencyUs);
+}
+
+unsigned long openxc::util::statistics::bucketLimitUs(int bucket) {
+    if(bucket < 0 || bucket >= HISTOGRAM_BUCKET_COUNT - 1) {
+        return 0;
+    }
+    return (unsigned long)HISTOGRAM_FIRST_BUCKET_US << bucket;
+}
+
+unsigned long openxc::util::statistics::percentileUs(
+        const Histogram* histogram, int percent) {
+    // The number of samples at or below the percentile, rounded up
+    unsigned long rank = ((unsigned long long)histogram->count * percent + 99)
+            / 100;
+    unsigned long seen = 0;
+    for(int i = 0; i < HISTOGRAM_BUCKET_COUNT && rank > 0; i++) {
+        seen += histogram->buckets[i];
+        if(seen >= rank) {
+            unsigned long limit = bucketLimitUs(i);
+            return limit == 0 ? histogram->max : MIN(limit, histogram->max);
+        }
+    }
+    return histogram->max;
+}
+
+int openxc::util::statistics::formatBuckets(const Histogram* histogram,
+        char* buffer, size_t length) {
+    if(length == 0) {
+        return 0;
+    }
+
+    int bucketCount = HISTOGRAM_BUCKET_COUNT;
+    while(bucketCount > 1 && histogram->buckets[bucketCount - 1] == 0) {
+        --bucketCount;
+    }
+
+    size_t written = 0;
+    buffer[0] = '\0';
+    for(int i = 0; i < bucketCount && written < length; i++) {
+        int result = snprintf(buffer + written, length - written, "%s%u",
+                i > 0 ? "," : "", histogram->buckets[i]);
+        if(result < 0) {
+            break;
+        }
+        written += result;
+    }
+    return MIN(written, length - 1);
+}
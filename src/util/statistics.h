@@ -1,6 +1,8 @@
 #ifndef _STATISTICS_H_
 #define _STATISTICS_H_
 
+#include <stddef.h>
+
 namespace openxc {
 namespace util {
 namespace statistics {
@@ -26,6 +28,30 @@ typedef struct {
     Statistic statistic;
 } DeltaStatistic;
 
+#ifndef HISTOGRAM_BUCKET_COUNT
+#define HISTOGRAM_BUCKET_COUNT 12
+#endif
+
+#ifndef HISTOGRAM_FIRST_BUCKET_US
+#define HISTOGRAM_FIRST_BUCKET_US 128
+#endif
+
+/* Public: A fixed-bucket histogram of latencies in microseconds.
+ *
+ * Bucket 0 counts samples below HISTOGRAM_FIRST_BUCKET_US, and each following
+ * bucket doubles that bound. The last bucket counts everything that didn't
+ * fit in the others, so no sample is ever lost.
+ *
+ * buckets - the number of samples seen in each bucket.
+ * count - the total number of samples recorded.
+ * max - the largest sample recorded.
+ */
+typedef struct {
+    unsigned int buckets[HISTOGRAM_BUCKET_COUNT];
+    unsigned int count;
+    unsigned long max;
+} Histogram;
+
 /* Public: Initialize a new Statistic.
  *
  * stat - the Statistic to initialize.
@@ -55,6 +81,44 @@ int maximum(const Statistic* stat);
 
 int maximum(const DeltaStatistic* stat);
 
+/* Public: Reset all buckets of a Histogram to zero.
+ *
+ * histogram - the Histogram to initialize.
+ */
+void initialize(Histogram* histogram);
+
+/* Public: Count one latency sample in the matching bucket. This is cheap
+ * enough to call from the main loop for every message.
+ *
+ * histogram - the Histogram to update.
+ * latencyUs - the observed latency in microseconds.
+ */
+void record(Histogram* histogram, unsigned long latencyUs);
+
+/* Public: Return the exclusive upper bound in microseconds of a bucket, or 0
+ * for the last (unbounded) bucket.
+ */
+unsigned long bucketLimitUs(int bucket);
+
+/* Public: Estimate a percentile of the recorded latencies with integer math,
+ * as the upper bound of the bucket the percentile falls in - never more than
+ * the largest sample recorded.
+ *
+ * histogram - the Histogram to summarize.
+ * percent - the percentile to estimate, from 1 to 100.
+ *
+ * Returns the estimate in microseconds, or 0 if there are no samples.
+ */
+unsigned long percentileUs(const Histogram* histogram, int percent);
+
+/* Public: Write the bucket counts of a Histogram as a comma separated list,
+ * e.g. "3,10,0,1", truncated to fit the buffer. Empty buckets after the last
+ * one with a sample are left out.
+ *
+ * Returns the number of characters written, not including the NULL terminator.
+ */
+int formatBuckets(const Histogram* histogram, char* buffer, size_t length);
+
 
 } // namespace statistics
 } // namespace util
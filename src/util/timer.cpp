@@ -20,6 +20,27 @@ static float frequencyToPeriod(float frequency) {
     return 1 / frequency * MS_PER_SECOND;
 }
 
+/* Private: Return the clock's period in whole milliseconds, calculating it if
+ * the frequency was set without setFrequency.
+ *
+ * Time is only ever measured in whole milliseconds, so rounding the period up
+ * doesn't change when the clock ticks.
+ */
+static unsigned long periodMs(openxc::util::time::FrequencyClock* clock) {
+    if(!clock->periodCached) {
+        clock->periodMs = 0;
+        if(clock->frequency > 0) {
+            float period = frequencyToPeriod(clock->frequency);
+            clock->periodMs = (unsigned long) period;
+            if(clock->periodMs < period) {
+                ++clock->periodMs;
+            }
+        }
+        clock->periodCached = true;
+    }
+    return clock->periodMs;
+}
+
 bool openxc::util::time::conditionalTick(FrequencyClock* clock) {
     return conditionalTick(clock, false);
 }
@@ -35,22 +56,28 @@ static openxc::util::time::TimeFunction getTimeFunction(
        openxc::util::time::systemTimeMs;
 }
 
-bool openxc::util::time::elapsed(FrequencyClock* clock, bool stagger) {
-    if(clock == NULL) {
+/* Private: Determine if the clock's tick timer has elapsed at the given time,
+ * like elapsed(FrequencyClock*, bool).
+ */
+static bool elapsedAt(openxc::util::time::FrequencyClock* clock, bool stagger,
+        unsigned long now) {
+    unsigned long period = periodMs(clock);
+    if(!started(clock)) {
+        if(stagger && period > 0) {
+            clock->lastTick = now - (rand() % period);
+            return false;
+        }
+        // Make sure it ticks the the first call to conditionalTick(...)
         return true;
     }
+    return now - clock->lastTick >= period;
+}
 
-    float period = frequencyToPeriod(clock->frequency);
-    float elapsedTime = 0;
-    if(!started(clock) && stagger) {
-        clock->lastTick = getTimeFunction(clock)() - (rand() % int(period));
-    } else {
-        // Make sure it ticks the the first call to conditionalTick(...)
-        elapsedTime = !started(clock) ? period :
-                getTimeFunction(clock)() - clock->lastTick;
+bool openxc::util::time::elapsed(FrequencyClock* clock, bool stagger) {
+    if(clock == NULL) {
+        return true;
     }
-
-    return clock->frequency == 0 || elapsedTime >= period;
+    return elapsedAt(clock, stagger, getTimeFunction(clock)());
 }
 
 void openxc::util::time::tick(FrequencyClock* clock) {
@@ -58,16 +85,30 @@ void openxc::util::time::tick(FrequencyClock* clock) {
 }
 
 bool openxc::util::time::conditionalTick(FrequencyClock* clock, bool stagger) {
-    bool tick = elapsed(clock, stagger);
+    if(clock == NULL) {
+        return true;
+    }
+
+    unsigned long now = getTimeFunction(clock)();
+    bool tick = elapsedAt(clock, stagger, now);
     if(tick) {
-        clock->lastTick = getTimeFunction(clock)();
+        clock->lastTick = now;
     }
 
     return tick;
 }
 
+void openxc::util::time::setFrequency(FrequencyClock* clock, float frequency) {
+    clock->frequency = frequency;
+    clock->periodCached = false;
+    periodMs(clock);
+}
+
 void openxc::util::time::initializeClock(FrequencyClock* clock) {
     clock->lastTick = 0;
     clock->frequency = 0;
     clock->timeFunction = systemTimeMs;
+    // The frequency is often set directly after this, so calculate the period
+    // on first use instead.
+    clock->periodCached = false;
 }
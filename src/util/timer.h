@@ -9,14 +9,21 @@ typedef unsigned long (*TimeFunction)();
 
 /* Public: A frequency counting clock.
  *
- * frequency - the clock freuquency in Hz.
+ * frequency - the clock freuquency in Hz. Once the clock has been used, change
+ *      this with setFrequency so the cached period is recalculated.
  * lastTime - the last time (in milliseconds since startup) that the clock
  *      ticked.
+ * periodMs - (private) the period of the clock in whole milliseconds, rounded
+ *      up, or 0 if the frequency is 0.
+ * periodCached - (private) true if periodMs has been calculated from the
+ *      current frequency.
  */
 typedef struct {
     float frequency;
     unsigned long lastTick;
     TimeFunction timeFunction;
+    unsigned long periodMs;
+    bool periodCached;
 } FrequencyClock;
 
 /* Public: Initialize a FrequencyClock structure back to a fresh start - never
@@ -26,6 +33,14 @@ typedef struct {
  */
 void initializeClock(FrequencyClock* clock);
 
+/* Public: Change the frequency of a clock and recalculate its period, so
+ * checking if the clock should tick doesn't need any floating point math.
+ *
+ * clock - The clock to change.
+ * frequency - The new frequency in Hz, or 0 to tick every time.
+ */
+void setFrequency(FrequencyClock* clock, float frequency);
+
 /* Public: Determine if the clock should tick, according to its frequency and
  * last tick time, and tick it if it needs it!
  *
@@ -68,6 +83,14 @@ void delayMs(unsigned long delayInMs);
  */
 unsigned long systemTimeMs();
 
+/* Public: Return the current system time in microseconds.
+ *
+ * This wraps around after roughly 71 minutes on a 32-bit platform, so it's
+ * only useful for measuring short intervals, e.g. a time budget for a single
+ * pass of the main loop.
+ */
+unsigned long systemTimeUs();
+
 /* Public: Perform any one-time initialization required to use system times,
  * including those for system time and the delayMs function.
  */
@@ -20,6 +20,7 @@
 #include "config.h"
 #include "commands/commands.h"
 #include "platform/pic32/nvm.h"
+#include "metrics.h"
 
 #ifdef RTC_SUPPORT
 #include "platform/pic32/rtc.h"
@@ -35,6 +36,7 @@ namespace lights = openxc::lights;
 namespace can = openxc::can;
 namespace platform = openxc::platform;
 namespace time = openxc::util::time;
+namespace statistics = openxc::util::statistics;
 namespace signals = openxc::signals;
 namespace diagnostics = openxc::diagnostics;
 namespace power = openxc::power;
@@ -44,6 +46,7 @@ namespace config = openxc::config;
 namespace telit = openxc::telitHE910;
 namespace server_task = openxc::server_task;
 namespace nvm = openxc::nvm;
+namespace metrics = openxc::metrics;
 
 using openxc::util::log::debug;
 using openxc::signals::getCanBuses;
@@ -167,24 +170,144 @@ void initializeAllCan() {
     }
 }
 
+#ifdef __TABLE_DRIVEN_DECODING__
+static can::read::MessageDecoder MESSAGE_DECODERS[MAX_MESSAGE_DECODERS];
+static int MESSAGE_DECODER_COUNT;
+static CanSignal* DECODER_SIGNALS;
+static int DECODER_SIGNAL_COUNT;
+
+/* Private: Translate every signal of a received CAN message by scanning the
+ * whole signals array, for message sets too big for the decoder table.
+ */
+static void translateMessageSignals(Pipeline* pipeline, CanBus* bus,
+        CanMessage* message) {
+    CanSignal* signals = getSignals();
+    int signalCount = getSignalCount();
+    for(int i = 0; i < signalCount; i++) {
+        CanMessageDefinition* definition = signals[i].message;
+        if(definition != NULL && definition->bus != NULL &&
+                definition->bus->address == bus->address &&
+                definition->id == message->id &&
+                definition->format == message->format) {
+            can::read::translateSignal(&signals[i], message, signals,
+                    signalCount, pipeline);
+        }
+    }
+}
+
+/* Private: Decode a received CAN message with the decoder table generated for
+ * the active message set, which also calls any custom message handlers.
+ *
+ * If the signals were generated without a table, one is built from the active
+ * message set's signals instead and rebuilt whenever the set changes. The
+ * generated decodeCanMessage is never used, so the linker can leave its
+ * switches out of the firmware.
+ */
+static void decodeCanMessage(Pipeline* pipeline, CanBus* bus,
+        CanMessage* message) {
+    int generatedCount = signals::getMessageDecoderCount();
+    if(generatedCount != -1) {
+        can::read::dispatchMessage(signals::getMessageDecoders(),
+                generatedCount, bus, message, getSignals(), getSignalCount(),
+                pipeline);
+        return;
+    }
+
+    if(getSignals() != DECODER_SIGNALS ||
+            getSignalCount() != DECODER_SIGNAL_COUNT) {
+        DECODER_SIGNALS = getSignals();
+        DECODER_SIGNAL_COUNT = getSignalCount();
+        MESSAGE_DECODER_COUNT = can::read::buildMessageDecoders(
+                DECODER_SIGNALS, DECODER_SIGNAL_COUNT, MESSAGE_DECODERS,
+                MAX_MESSAGE_DECODERS);
+        if(MESSAGE_DECODER_COUNT == -1) {
+            debug("Too many CAN messages for the decoder table, "
+                    "set MAX_MESSAGE_DECODERS");
+        }
+    }
+
+    if(MESSAGE_DECODER_COUNT == -1) {
+        translateMessageSignals(pipeline, bus, message);
+    } else {
+        can::read::dispatchMessage(MESSAGE_DECODERS, MESSAGE_DECODER_COUNT,
+                bus, message, DECODER_SIGNALS, DECODER_SIGNAL_COUNT,
+                pipeline);
+    }
+}
+#endif
+
+/* Private: Decode a single received CAN message, pass it through if enabled for
+ * the bus and hand it to the diagnostics manager.
+ */
+static void processCanMessage(Pipeline* pipeline, CanBus* bus,
+        CanMessage* message) {
+    // Most messages repeat the same payload, so track which bits changed to
+    // let the signal decoders skip the ones that didn't.
+    CanMessageDefinition* definition = can::lookupMessageDefinition(bus,
+            message->id, message->format, getMessages(), getMessageCount());
+    if(definition != NULL) {
+        can::read::trackMessageChanges(definition, message);
+    }
+#ifdef __TABLE_DRIVEN_DECODING__
+    decodeCanMessage(pipeline, bus, message);
+#else
+    signals::decodeCanMessage(pipeline, bus, message);
+#endif
+    if(bus->passthroughCanMessages) {
+        openxc::can::read::passthroughMessage(bus, message, getMessages(),
+                getMessageCount(), pipeline);
+    }
+
+    bus->lastMessageReceived = time::systemTimeMs();
+    ++bus->messagesReceived;
+
+    diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager,
+            bus, message, pipeline);
+}
+
 /*
- * Check to see if a packet has been received. If so, read the packet and print
- * the packet payload to the uart monitor.
+ * Check to see if any packets have been received. If so, read and decode them
+ * in a batch, up to the bus's receiveBatchSize or until its
+ * receiveBatchBudgetUs is used up - whichever comes first.
+ *
+ * The batch is capped at the queue's capacity even when the bus has no limit
+ * configured, so a bus flooding the ISR can't starve the rest of the loop.
  */
 void receiveCan(Pipeline* pipeline, CanBus* bus) {
-    if(!QUEUE_EMPTY(CanMessage, &bus->receiveQueue)) {
-        CanMessage message = QUEUE_POP(CanMessage, &bus->receiveQueue);
-        signals::decodeCanMessage(pipeline, bus, &message);
-        if(bus->passthroughCanMessages) {
-            openxc::can::read::passthroughMessage(bus, &message, getMessages(),
-                    getMessageCount(), pipeline);
+    int batchLimit = bus->receiveBatchSize > 0 ?
+            bus->receiveBatchSize : QUEUE_MAX_LENGTH(CanMessage);
+    unsigned long batchStartUs = bus->receiveBatchBudgetUs > 0 ?
+            time::systemTimeUs() : 0;
+
+    int received = 0;
+    while(received < batchLimit &&
+            !QUEUE_EMPTY(CanMessage, &bus->receiveQueue)) {
+        if(received > 0 && bus->receiveBatchBudgetUs > 0 &&
+                time::systemTimeUs() - batchStartUs >=
+                    bus->receiveBatchBudgetUs) {
+            break;
         }
 
-        bus->lastMessageReceived = time::systemTimeMs();
-        ++bus->messagesReceived;
+        CanMessage message = QUEUE_POP(CanMessage, &bus->receiveQueue);
+        if(!message.timestamped || !getConfiguration()->calculateMetrics) {
+            processCanMessage(pipeline, bus, &message);
+        } else {
+            // Time each stage, and tag everything published for this message
+            // with when it was received so the send queues can time the rest
+            unsigned long dequeuedUs = time::systemTimeUs();
+            statistics::record(&bus->receiveQueueLatency,
+                    dequeuedUs - message.receivedUs);
+            openxc::pipeline::setOrigin(pipeline, message.receivedUs);
+            processCanMessage(pipeline, bus, &message);
+            openxc::pipeline::setOrigin(pipeline, 0);
+            statistics::record(&bus->processLatency,
+                    time::systemTimeUs() - dequeuedUs);
+        }
+        ++received;
+    }
 
-        diagnostics::receiveCanMessage(&getConfiguration()->diagnosticsManager,
-                bus, &message, pipeline);
+    if(received > 0 && getConfiguration()->calculateMetrics) {
+        statistics::update(&bus->receiveBatchStats, received);
     }
 }
 
@@ -251,19 +374,21 @@ void initializeVehicleInterface() {
 }
 
 void firmwareLoop() {
+    unsigned long passStartUs = time::systemTimeUs();
     if(getConfiguration()->runLevel != RunLevel::ALL_IO &&
             getConfiguration()->desiredRunLevel == RunLevel::ALL_IO) {
         initializeIO();
     }
+
+    // Diagnostic requests and commands can add and remove acceptance filters
+    // many times in one pass, so only rewrite the AF table once at the end.
+    can::beginAcceptanceFilterUpdate();
     for(int i = 0; i < getCanBusCount(); i++) {
-        // In normal operation, if no output interface is enabled/attached (e.g.
-        // no USB or Bluetooth, the loop will stall here. Deep down in
-        // receiveCan when it tries to append messages to the queue it will
-        // reach a point where it tries to flush the (full) queue. Since nothing
-        // is attached, that will just keep timing out. Just be aware that if
-        // you need to modify the firmware to not use any interfaces, you'll
-        // have to change that or enable the flush functionality to write to
-        // your desired output interface.
+        // If an output interface's send queue is full when receiveCan adds a
+        // message, its backpressure policy decides what to drop. Only an
+        // interface with the BOUNDED_WAIT policy (USB by default) can slow the
+        // loop down here, and by no more than its backpressureWaitUs in each
+        // pass.
         CanBus* bus = &(getCanBuses()[i]);
         receiveCan(&getConfiguration()->pipeline, bus);
         diagnostics::sendRequests(&getConfiguration()->diagnosticsManager, bus);
@@ -291,6 +416,10 @@ void firmwareLoop() {
         network::read(&getConfiguration()->network,
                 network::handleIncomingMessage);
     }
+    if(!can::commitAcceptanceFilterUpdate(getCanBuses(), getCanBusCount())) {
+        debug("Unable to update AF table - filters added this pass were "
+                "removed");
+    }
 
     for(int i = 0; i < getCanBusCount(); i++) {
         can::write::flushOutgoingCanMessageQueue(&getCanBuses()[i]);
@@ -327,4 +456,5 @@ void firmwareLoop() {
     rtc_task();
     #endif
     openxc::pipeline::process(&getConfiguration()->pipeline);
+    metrics::recordLoopPass(time::systemTimeUs() - passStartUs);
 }